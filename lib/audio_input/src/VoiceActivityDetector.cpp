@@ -0,0 +1,80 @@
+#include <math.h>
+#include "VoiceActivityDetector.h"
+
+VoiceActivityDetector::VoiceActivityDetector()
+{
+  // until we've heard a gap we only know the floor
+  for (int i = 0; i < VAD_NOISE_WINDOWS; i++)
+  {
+    m_window_energy[i] = VAD_MIN_NOISE_ENERGY;
+  }
+}
+
+void VoiceActivityDetector::reset()
+{
+  m_hangover = VAD_HANGOVER_BLOCKS;
+}
+
+bool VoiceActivityDetector::is_speech(const int16_t *samples, int count)
+{
+  if (count <= 0)
+  {
+    return m_hangover > 0;
+  }
+  uint64_t sum_squares = 0;
+  int zero_crossings = 0;
+  for (int i = 0; i < count; i++)
+  {
+    sum_squares += (int32_t)samples[i] * samples[i];
+    if (i > 0 && ((samples[i] ^ samples[i - 1]) < 0))
+    {
+      zero_crossings++;
+    }
+  }
+  uint32_t energy = sum_squares / count;
+  // zero crossings per 128 samples so the threshold doesn't depend on the block size
+  zero_crossings = zero_crossings * 128 / count;
+
+  bool speech = energy > (uint64_t)VAD_ENERGY_RATIO * m_noise_energy ||
+                (energy > (uint64_t)VAD_FRICATIVE_ENERGY_RATIO * m_noise_energy && zero_crossings > VAD_FRICATIVE_ZERO_CROSSINGS);
+  // speech stops often enough that the quietest block of the last second or so is the background, even
+  // if it has just got louder - loud blocks only raise it once a whole window has gone by without a quiet one
+  if (m_window_blocks == VAD_NOISE_WINDOW_BLOCKS)
+  {
+    m_window = (m_window + 1) % VAD_NOISE_WINDOWS;
+    m_window_energy[m_window] = energy;
+    m_window_blocks = 0;
+  }
+  else if (energy < m_window_energy[m_window])
+  {
+    m_window_energy[m_window] = energy;
+  }
+  m_window_blocks++;
+  m_noise_energy = UINT32_MAX;
+  for (int i = 0; i < VAD_NOISE_WINDOWS; i++)
+  {
+    if (m_window_energy[i] < m_noise_energy)
+    {
+      m_noise_energy = m_window_energy[i];
+    }
+  }
+  if (m_noise_energy < VAD_MIN_NOISE_ENERGY)
+  {
+    m_noise_energy = VAD_MIN_NOISE_ENERGY;
+  }
+  if (speech)
+  {
+    m_hangover = VAD_HANGOVER_BLOCKS;
+  }
+  else if (m_hangover > 0)
+  {
+    m_hangover--;
+  }
+  return m_hangover > 0;
+}
+
+uint16_t VoiceActivityDetector::noise_level()
+{
+  float level = sqrtf(m_noise_energy);
+  return level > UINT16_MAX ? UINT16_MAX : (uint16_t)level;
+}
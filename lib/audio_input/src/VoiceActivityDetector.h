@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// how much louder than the background noise a block needs to be to count as speech
+#define VAD_ENERGY_RATIO 4
+// quieter blocks can still be speech if they look like a fricative (lots of zero crossings)
+#define VAD_FRICATIVE_ENERGY_RATIO 2
+#define VAD_FRICATIVE_ZERO_CROSSINGS 30
+// keep sending for this many blocks after the last speech so we don't clip the ends of words
+#define VAD_HANGOVER_BLOCKS 30
+// the background noise estimate never drops below this (mean square)
+#define VAD_MIN_NOISE_ENERGY 10000
+// the background noise is the quietest block in the last 12 windows of 16 blocks - about 1.5 seconds of 128
+// sample blocks, long enough that there's always a gap between words in there
+#define VAD_NOISE_WINDOW_BLOCKS 16
+#define VAD_NOISE_WINDOWS 12
+
+/**
+ * @brief Energy and zero crossing voice activity detector with hangover
+ *
+ * Works on blocks of samples straight from the sampler and tracks the background
+ * noise level as the quietest recent block, which also sets the comfort noise level.
+ */
+class VoiceActivityDetector
+{
+private:
+  // background noise estimate - mean square of a block
+  uint32_t m_noise_energy = VAD_MIN_NOISE_ENERGY;
+  // quietest block in each of the recent windows
+  uint32_t m_window_energy[VAD_NOISE_WINDOWS];
+  int m_window = 0;
+  int m_window_blocks = 0;
+  // blocks of hangover left
+  int m_hangover = 0;
+
+public:
+  VoiceActivityDetector();
+  // start a new transmission - everything is treated as speech until the hangover runs out
+  void reset();
+  // returns true if this block should be sent
+  bool is_speech(const int16_t *samples, int count);
+  // RMS level of the background noise
+  uint16_t noise_level();
+};
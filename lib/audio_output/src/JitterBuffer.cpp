@@ -0,0 +1,392 @@
+#include <Arduino.h>
+#include "JitterBuffer.h"
+#include "OutputBuffer.h"
+
+// a sequence number this far behind means the sender has restarted rather than a late frame
+const int RESYNC_DISTANCE = 100;
+
+JitterBuffer::JitterBuffer(OutputBuffer *output_buffer, int sample_rate, int max_depth)
+    : m_output_buffer(output_buffer), m_sample_rate(sample_rate), m_max_depth(max_depth)
+{
+  for (int i = 0; i < JITTER_BUFFER_SLOTS; i++)
+  {
+    m_slots[i].used = false;
+    m_slots[i].samples = (int16_t *)malloc(sizeof(int16_t) * JITTER_BUFFER_MAX_FRAME_SAMPLES);
+  }
+  m_recovered_samples = (int16_t *)malloc(sizeof(int16_t) * JITTER_BUFFER_MAX_FRAME_SAMPLES);
+}
+
+JitterBuffer::~JitterBuffer()
+{
+  for (int i = 0; i < JITTER_BUFFER_SLOTS; i++)
+  {
+    free(m_slots[i].samples);
+  }
+  free(m_recovered_samples);
+}
+
+void JitterBuffer::reset(uint16_t sequence)
+{
+  for (int i = 0; i < JITTER_BUFFER_SLOTS; i++)
+  {
+    m_slots[i].used = false;
+  }
+  m_started = true;
+  m_next_sequence = sequence;
+  m_history = 0;
+  m_recovered_history = 0;
+  m_have_arrival = false;
+  m_have_timestamp = false;
+  m_missing = 0;
+  m_waiting_since_us = micros();
+  m_end_sequence = sequence;
+  m_protected_sequence = sequence;
+  m_ending = false;
+}
+
+void JitterBuffer::clear()
+{
+  for (int i = 0; i < JITTER_BUFFER_SLOTS; i++)
+  {
+    m_slots[i].used = false;
+  }
+  m_started = false;
+  m_have_arrival = false;
+  m_jitter_q4 = 0;
+  m_fec_group_size = 0;
+  m_ending = false;
+}
+
+void JitterBuffer::update_jitter(uint32_t timestamp, int count)
+{
+  uint32_t now = micros();
+  if (m_have_arrival)
+  {
+    // difference between how far apart the frames arrived and how far apart they were sent
+    int32_t arrival_delta = (int32_t)(((uint64_t)(now - m_last_arrival_us) * m_sample_rate) / 1000000);
+    int32_t d = arrival_delta - (int32_t)(timestamp - m_last_timestamp);
+    if (d < 0)
+    {
+      d = -d;
+    }
+    // don't let a single outlier blow the estimate up to the maximum depth
+    if (d > m_max_depth)
+    {
+      d = m_max_depth;
+    }
+    m_jitter_q4 += d - (m_jitter_q4 >> 4);
+  }
+  m_have_arrival = true;
+  m_last_arrival_us = now;
+  m_last_timestamp = timestamp;
+
+  // keep a frame plus enough headroom to ride out the jitter we've seen
+  int target = count + JITTER_BUFFER_DEPTH_FACTOR * jitter();
+  if (target > m_max_depth)
+  {
+    target = m_max_depth;
+  }
+  m_output_buffer->set_target_depth(target);
+}
+
+void JitterBuffer::release(uint32_t timestamp, const int16_t *samples, int count)
+{
+  // fill in for any frames we gave up on just before this one so it plays when it should
+  if (m_missing > 0 && m_have_timestamp)
+  {
+    // the timestamps also jump over any silence the sender skipped so fill no more than the missing frames
+    int32_t gap = (int32_t)(timestamp - m_next_timestamp);
+    if (gap > m_missing * m_frame_size)
+    {
+      gap = m_missing * m_frame_size;
+    }
+    if (gap > m_max_depth)
+    {
+      gap = m_max_depth;
+    }
+    if (gap > 0)
+    {
+      m_output_buffer->add_gap(gap);
+    }
+  }
+  m_missing = 0;
+  m_output_buffer->add_samples(samples, count);
+  m_have_timestamp = true;
+  m_next_timestamp = timestamp + count;
+  m_history = (m_history << 1) | 1;
+  m_recovered_history <<= 1;
+  m_next_sequence++;
+  m_waiting_since_us = micros();
+}
+
+void JitterBuffer::skip()
+{
+  // see if the frame can be rebuilt before we give up on it - only now so we never rebuild a frame that's just late
+  if (m_recovery)
+  {
+    uint32_t timestamp;
+    int count = m_recovery->recover_frame(m_recovery_id, m_next_sequence, timestamp, m_recovered_samples);
+    if (count >= 0)
+    {
+      release(timestamp, m_recovered_samples, count);
+      m_recovered_history |= 1;
+      m_recovered++;
+      return;
+    }
+  }
+  m_lost++;
+  m_missing++;
+  m_history <<= 1;
+  m_recovered_history <<= 1;
+  m_next_sequence++;
+  m_waiting_since_us = micros();
+}
+
+void JitterBuffer::hold(uint16_t sequence, uint32_t timestamp, const int16_t *samples, int count)
+{
+  Slot &slot = m_slots[sequence % JITTER_BUFFER_SLOTS];
+  slot.used = true;
+  slot.sequence = sequence;
+  slot.timestamp = timestamp;
+  slot.count = count;
+  memcpy(slot.samples, samples, sizeof(int16_t) * count);
+}
+
+void JitterBuffer::update_end(uint16_t end_sequence)
+{
+  if ((int16_t)(end_sequence - m_end_sequence) > 0)
+  {
+    m_end_sequence = end_sequence;
+  }
+}
+
+int32_t JitterBuffer::give_up_depth()
+{
+  // once we hold more audio behind a gap than the target depth the output would run dry waiting
+  // for it - unless the rest of its parity group is still arriving and we can rebuild it
+  int32_t give_up = m_output_buffer->target_depth();
+  bool parity_received = (int16_t)(m_protected_sequence - m_next_sequence) > 0;
+  if (!parity_received && m_fec_group_size * m_frame_size > give_up)
+  {
+    give_up = m_fec_group_size * m_frame_size;
+  }
+  return give_up;
+}
+
+void JitterBuffer::release_in_order()
+{
+  while (true)
+  {
+    Slot &slot = m_slots[m_next_sequence % JITTER_BUFFER_SLOTS];
+    if (!slot.used || slot.sequence != m_next_sequence)
+    {
+      return;
+    }
+    slot.used = false;
+    release(slot.timestamp, slot.samples, slot.count);
+  }
+}
+
+void JitterBuffer::skip_missing()
+{
+  // skip over everything up to the next frame we are holding
+  for (int i = 0; i < JITTER_BUFFER_SLOTS; i++)
+  {
+    Slot &slot = m_slots[m_next_sequence % JITTER_BUFFER_SLOTS];
+    if (slot.used && slot.sequence == m_next_sequence)
+    {
+      return;
+    }
+    skip();
+  }
+}
+
+void JitterBuffer::finish()
+{
+  // play out everything we're holding and give up on anything we know was sent that hasn't turned up
+  while (true)
+  {
+    release_in_order();
+    if ((int16_t)(m_end_sequence - m_next_sequence) <= 0)
+    {
+      break;
+    }
+    skip();
+  }
+  m_ending = false;
+}
+
+void JitterBuffer::finish_if_complete()
+{
+  // with parity on hold the end of the transmission until the last group's parity has arrived -
+  // the sender sends it straight after the last frame so poll gives up if it's lost
+  if (m_ending && (m_fec_group_size == 0 || (int16_t)(m_protected_sequence - m_end_sequence) >= 0 ||
+                   (int16_t)(m_end_sequence - m_next_sequence) <= 0))
+  {
+    finish();
+  }
+}
+
+void JitterBuffer::parity_received(uint16_t first_sequence, int count)
+{
+  uint16_t end_sequence = first_sequence + count;
+  int16_t distance = (int16_t)(end_sequence - m_next_sequence);
+  if (!m_started || distance < -RESYNC_DISTANCE || distance > RESYNC_DISTANCE)
+  {
+    return;
+  }
+  if ((int16_t)(end_sequence - m_protected_sequence) > 0)
+  {
+    m_protected_sequence = end_sequence;
+  }
+  // the parity tells us about frames even if none of them have arrived
+  update_end(end_sequence);
+  finish_if_complete();
+}
+
+void JitterBuffer::poll()
+{
+  if (!m_started || (int16_t)(m_end_sequence - m_next_sequence) <= 0)
+  {
+    return;
+  }
+  // add_frame gives up on gaps with frames held behind them as more arrive - this is for when nothing else is coming
+  for (int i = 0; i < JITTER_BUFFER_SLOTS && !m_ending; i++)
+  {
+    if (m_slots[i].used)
+    {
+      return;
+    }
+  }
+  // we've waited as long for the next frame as we would with later frames held so it isn't coming
+  uint32_t give_up_us = (uint64_t)give_up_depth() * 1000000 / m_sample_rate;
+  if (micros() - m_waiting_since_us >= give_up_us)
+  {
+    finish();
+  }
+}
+
+void JitterBuffer::add_frame(uint16_t sequence, uint32_t timestamp, const int16_t *samples, int count, bool first, bool last)
+{
+  if (count <= 0)
+  {
+    // an empty last frame just tells us the transmission is over - it's held like any other so
+    // the frames before it can still be rebuilt from the parity that follows
+    int16_t distance = (int16_t)(sequence - m_next_sequence);
+    if (last && m_started && distance >= 0)
+    {
+      if (distance < JITTER_BUFFER_SLOTS)
+      {
+        hold(sequence, timestamp, samples, 0);
+        update_end(sequence + 1);
+        release_in_order();
+        m_ending = true;
+        finish_if_complete();
+      }
+      else
+      {
+        finish();
+      }
+    }
+    return;
+  }
+  if (count > JITTER_BUFFER_MAX_FRAME_SAMPLES)
+  {
+    count = JITTER_BUFFER_MAX_FRAME_SAMPLES;
+  }
+  int16_t distance = (int16_t)(sequence - m_next_sequence);
+  if (m_started && distance < 0 && -distance <= 32 && (m_history & (1u << (-distance - 1))))
+  {
+    uint32_t bit = 1u << (-distance - 1);
+    if (m_recovered_history & bit)
+    {
+      // we played a rebuilt copy because this one was late - so it wasn't really lost
+      m_recovered_history &= ~bit;
+      m_recovered--;
+      m_late++;
+      return;
+    }
+    // we've already played this one
+    m_duplicate++;
+    return;
+  }
+  if (!m_started || first || distance < -RESYNC_DISTANCE || distance > RESYNC_DISTANCE)
+  {
+    // new transmission - play out anything left over from the previous one and start again
+    if (m_started)
+    {
+      finish();
+    }
+    reset(sequence);
+    distance = 0;
+  }
+  if (distance < 0)
+  {
+    // we've already given up on this frame - it arrived too late to be played
+    m_late++;
+    return;
+  }
+  Slot &slot = m_slots[sequence % JITTER_BUFFER_SLOTS];
+  if (distance < JITTER_BUFFER_SLOTS && slot.used && slot.sequence == sequence)
+  {
+    m_duplicate++;
+    return;
+  }
+  m_received++;
+  m_frame_size = count;
+  update_jitter(timestamp, count);
+  update_end(sequence + 1);
+  // too far ahead to hold - give up on the frames we were waiting for
+  while (distance >= JITTER_BUFFER_SLOTS)
+  {
+    release_in_order();
+    skip_missing();
+    distance = (int16_t)(sequence - m_next_sequence);
+  }
+  if (distance == 0)
+  {
+    // in order - this is the common case so pass it straight through
+    release(timestamp, samples, count);
+  }
+  else
+  {
+    hold(sequence, timestamp, samples, count);
+  }
+  release_in_order();
+
+  // still waiting on a missing frame - give up on it once we're holding too much audio behind the gap
+  int32_t give_up = give_up_depth();
+  while (true)
+  {
+    bool holding = false;
+    uint32_t start = 0;
+    uint32_t end = 0;
+    for (int i = 0; i < JITTER_BUFFER_SLOTS; i++)
+    {
+      Slot &held = m_slots[i];
+      if (held.used)
+      {
+        if (!holding || (int32_t)(held.timestamp - start) < 0)
+        {
+          start = held.timestamp;
+        }
+        if (!holding || (int32_t)(held.timestamp + held.count - end) > 0)
+        {
+          end = held.timestamp + held.count;
+        }
+        holding = true;
+      }
+    }
+    if (!holding || (int32_t)(end - start) <= give_up)
+    {
+      break;
+    }
+    skip_missing();
+    release_in_order();
+  }
+  if (last)
+  {
+    m_ending = true;
+  }
+  finish_if_complete();
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+
+class OutputBuffer;
+
+// how many out of order frames can be held while waiting for a missing one
+#define JITTER_BUFFER_SLOTS 8
+// largest frame (in samples) that can be held in a slot
+#define JITTER_BUFFER_MAX_FRAME_SAMPLES 512
+// how many multiples of the measured jitter to keep buffered on top of a frame
+#define JITTER_BUFFER_DEPTH_FACTOR 3
+
+/**
+ * @brief Rebuilds frames the jitter buffer is about to give up on - from a parity frame for example
+ */
+class FrameRecovery
+{
+public:
+  // rebuild the frame with this sequence number for the jitter buffer set up with this id
+  // returns the number of samples or -1 if it can't be rebuilt
+  virtual int recover_frame(int id, uint16_t sequence, uint32_t &timestamp, int16_t *samples) = 0;
+};
+
+/**
+ * @brief Reorders incoming frames by sequence number before they reach the output buffer
+ * and sizes the output buffer's target depth from the measured inter-arrival jitter.
+ *
+ * Only ever called from the receive side so it needs no locking of its own.
+ */
+class JitterBuffer
+{
+private:
+  struct Slot
+  {
+    bool used;
+    uint16_t sequence;
+    uint32_t timestamp;
+    int count;
+    int16_t *samples;
+  };
+  Slot m_slots[JITTER_BUFFER_SLOTS];
+  OutputBuffer *m_output_buffer;
+  int m_sample_rate;
+  int m_max_depth;
+
+  // the next frame we expect to hand to the output buffer
+  bool m_started = false;
+  uint16_t m_next_sequence = 0;
+  // bit n set means frame (m_next_sequence - 1 - n) was received
+  uint32_t m_history = 0;
+  // and the same for the frames that were rebuilt rather than received
+  uint32_t m_recovered_history = 0;
+  // where the next frame's audio should start and how many frames we've given up on since the last one
+  bool m_have_timestamp = false;
+  uint32_t m_next_timestamp = 0;
+  int m_missing = 0;
+  // when we started waiting for m_next_sequence
+  uint32_t m_waiting_since_us = 0;
+  // one past the newest frame we know was sent - from the frames and parity we've had
+  uint16_t m_end_sequence = 0;
+  // one past the newest frame covered by a parity frame
+  uint16_t m_protected_sequence = 0;
+  // we've had the last frame of the transmission and are waiting to play out the rest
+  bool m_ending = false;
+
+  // last chance to rebuild a frame before we give up on it
+  FrameRecovery *m_recovery = NULL;
+  int m_recovery_id = 0;
+  int16_t *m_recovered_samples;
+
+  // RFC 3550 style inter-arrival jitter estimate in samples (Q4 fixed point)
+  bool m_have_arrival = false;
+  uint32_t m_last_arrival_us = 0;
+  uint32_t m_last_timestamp = 0;
+  int32_t m_jitter_q4 = 0;
+
+  // if the sender protects groups of frames with parity we need to hold on long
+  // enough for the parity frame to arrive before giving up on a missing frame
+  int m_fec_group_size = 0;
+  int m_frame_size = 0;
+
+  // statistics
+  uint32_t m_received = 0;
+  uint32_t m_late = 0;
+  uint32_t m_lost = 0;
+  uint32_t m_duplicate = 0;
+  uint32_t m_recovered = 0;
+
+  void reset(uint16_t sequence);
+  void update_jitter(uint32_t timestamp, int count);
+  void release(uint32_t timestamp, const int16_t *samples, int count);
+  void skip();
+  void hold(uint16_t sequence, uint32_t timestamp, const int16_t *samples, int count);
+  void update_end(uint16_t end_sequence);
+  int32_t give_up_depth();
+  void release_in_order();
+  void skip_missing();
+  void finish();
+  void finish_if_complete();
+
+public:
+  JitterBuffer(OutputBuffer *output_buffer, int sample_rate, int max_depth);
+  ~JitterBuffer();
+  // add a decoded frame - first is set on the first frame of a transmission, last on the final one
+  void add_frame(uint16_t sequence, uint32_t timestamp, const int16_t *samples, int count, bool first, bool last);
+  // forget any held frames and wait for a new stream to start
+  void clear();
+  // the sender is sending a parity frame after every group_size frames
+  void set_fec_group_size(int group_size) { m_fec_group_size = group_size; }
+  // ask recovery for a missing frame before giving up on it - id tells it which jitter buffer is asking
+  void set_recovery(FrameRecovery *recovery, int id)
+  {
+    m_recovery = recovery;
+    m_recovery_id = id;
+  }
+  // a parity frame protecting count frames from first_sequence has arrived
+  void parity_received(uint16_t first_sequence, int count);
+  // give up on frames we've waited too long for even though nothing has arrived after them - call this regularly
+  void poll();
+  // current jitter estimate in samples
+  int jitter() { return m_jitter_q4 >> 4; }
+  uint32_t received() { return m_received; }
+  uint32_t late() { return m_late; }
+  uint32_t lost() { return m_lost; }
+  uint32_t duplicate() { return m_duplicate; }
+  // lost frames that were rebuilt in time to be played
+  uint32_t recovered() { return m_recovered; }
+};
@@ -3,6 +3,11 @@
 #include <freertos/FreeRTOS.h>
 #include <driver/i2s.h>
 
+// speaker DMA buffering - everything queued here is playback latency but the playback loop has to
+// come round with the next block before the last buffer runs out. Three 128 frame buffers is 24ms
+#define OUTPUT_DMA_BUFFER_COUNT 3
+#define OUTPUT_DMA_BUFFER_LENGTH 128
+
 /**
  * Base Class for both the DAC and I2S output
  **/
@@ -1,113 +1,276 @@
 #pragma once
 
 #include <Arduino.h>
-#include <freertos/FreeRTOS.h>
+#include <atomic>
+#include "JitterBuffer.h"
+#include "PacketLossConcealer.h"
+
+// made up audio for lost frames is written in blocks of this many samples
+#define OUTPUT_BUFFER_GAP_BLOCK 128
 
 /**
- * @brief Circular buffer for 8 bit unsigned PCM samples
- * 
+ * @brief Lock free circular buffer for 16 bit PCM samples decoded by the transport
+ *
+ * There is exactly one producer (the transport receive task calling add_frame/add_samples)
+ * and one consumer (the playback loop calling remove_samples) so neither side ever has to
+ * wait for the other. Each side only ever changes its own state - throwing buffered samples
+ * away is asked for with a flag and done by the consumer the next time it reads.
  */
 class OutputBuffer
 {
 private:
-  // how many samples should we buffer before outputting data?
-  int m_number_samples_to_buffer;
-  // where are we reading from
-  int m_read_head;
-  // where are we writing to
-  int m_write_head;
-  // keep track of how many samples we have
-  int m_available_samples;
-  // the total size of the buffer
-  int m_buffer_size;
+  // how many samples should we buffer before outputting data? - set by the jitter buffer
+  std::atomic<int> m_number_samples_to_buffer;
+  // the most we will ever buffer before outputting data
+  int m_max_samples_to_buffer;
+  // total samples ever read - only written by the consumer
+  std::atomic<uint32_t> m_read_position;
+  // total samples ever written - only written by the producer
+  std::atomic<uint32_t> m_write_position;
+  // the total size of the buffer - always a power of two
+  uint32_t m_buffer_size;
+  uint32_t m_buffer_mask;
   // are we currently buffering samples?
   bool m_buffering;
   // the sample buffer
-  uint8_t *m_buffer;
-  // thread safety
-  SemaphoreHandle_t m_semaphore;
+  int16_t *m_buffer;
+  // puts frames back in order before they reach the buffer
+  JitterBuffer *m_jitter_buffer;
+  // fills in the gaps when we run out of samples - consumer side
+  PacketLossConcealer m_concealer;
+  // fills in frames the jitter buffer has given up on - producer side
+  PacketLossConcealer m_gap_concealer;
+  uint32_t m_gap_samples = 0;
+  // samples the consumer has made up since it ran dry - a lost frame that's given up on later
+  // has already been covered by these so they don't get filled in twice
+  std::atomic<uint32_t> m_concealed_ahead;
+  // the consumer should throw away everything before m_discard_position and start buffering again
+  std::atomic<bool> m_discard;
+  std::atomic<uint32_t> m_discard_position;
+  // background noise level of the sender while they are silent - 0 when they aren't
+  std::atomic<uint16_t> m_comfort_noise;
+  uint32_t m_underruns = 0;
 
 public:
-  OutputBuffer(int number_samples_to_buffer) : m_number_samples_to_buffer(number_samples_to_buffer)
+  OutputBuffer(int max_samples_to_buffer, int sample_rate) : m_number_samples_to_buffer(max_samples_to_buffer), m_max_samples_to_buffer(max_samples_to_buffer), m_concealed_ahead(0), m_discard(false), m_discard_position(0), m_comfort_noise(0)
   {
-    // create a semaphore and make it available for locking
-    m_semaphore = xSemaphoreCreateBinary();
-    xSemaphoreGive(m_semaphore);
     // set reading and writing to the beginning of the buffer
-    m_read_head = 0;
-    m_write_head = 0;
-    m_available_samples = 0;
+    m_read_position = 0;
+    m_write_position = 0;
     // we'll start off buffering data as we have no samples yet
     m_buffering = true;
     // make sufficient space for the bufferring and incoming data
-    m_buffer_size = 3 * number_samples_to_buffer;
-    m_buffer = (uint8_t *)malloc(m_buffer_size);
-    memset(m_buffer, 0, m_buffer_size);
+    m_buffer_size = 1;
+    while (m_buffer_size < (uint32_t)(2 * max_samples_to_buffer))
+    {
+      m_buffer_size <<= 1;
+    }
+    m_buffer_mask = m_buffer_size - 1;
+    m_buffer = (int16_t *)malloc(sizeof(int16_t) * m_buffer_size);
     if (!m_buffer)
     {
       Serial.println("Failed to allocate buffer");
     }
+    else
+    {
+      memset(m_buffer, 0, sizeof(int16_t) * m_buffer_size);
+    }
+    m_jitter_buffer = new JitterBuffer(this, sample_rate, max_samples_to_buffer);
+  }
+
+  ~OutputBuffer()
+  {
+    delete m_jitter_buffer;
+    free(m_buffer);
   }
 
-  // we're adding samples that are 8 bit as they are coming from the transport
-  void add_samples(const uint8_t *samples, int count)
+  // add a decoded frame from the transport - it will be reordered by the jitter buffer
+  void add_frame(uint16_t sequence, uint32_t timestamp, const int16_t *samples, int count, bool first, bool last)
   {
-    xSemaphoreTake(m_semaphore, portMAX_DELAY);
+    m_jitter_buffer->add_frame(sequence, timestamp, samples, count, first, last);
+  }
+
+  JitterBuffer *jitter_buffer() { return m_jitter_buffer; }
+
+  // how many samples to wait for before starting playback
+  void set_target_depth(int number_samples_to_buffer)
+  {
+    m_number_samples_to_buffer = number_samples_to_buffer < m_max_samples_to_buffer ? number_samples_to_buffer : m_max_samples_to_buffer;
+  }
+
+  int target_depth() { return m_number_samples_to_buffer; }
+
+  // the sender has stopped sending while they are silent - this is the RMS level of their background noise
+  void set_comfort_noise(uint16_t noise_level)
+  {
+    m_gap_concealer.set_comfort_noise(noise_level);
+    // same scaling as the samples
+    m_comfort_noise = noise_level >> 3;
+  }
+
+private:
+  // copy samples into the buffer - producer side only
+  void write_samples(const int16_t *samples, int count)
+  {
+    uint32_t write_position = m_write_position.load(std::memory_order_relaxed);
+    uint32_t read_position = m_read_position.load(std::memory_order_acquire);
     // check if there is still room in the buffer
-    if (m_available_samples + count <= m_buffer_size)
+    if (write_position - read_position + count > m_buffer_size)
     {
-      // copy the samples into the buffer wrapping around as needed
-      for (int i = 0; i < count; i++)
-      {
-        m_buffer[m_write_head] = samples[i];
-        m_write_head = (m_write_head + 1) % m_buffer_size;
-      }
-      m_available_samples += count;
+      return;
+    }
+    // copy the samples into the buffer in at most two pieces if we wrap around
+    uint32_t start = write_position & m_buffer_mask;
+    uint32_t first_part = m_buffer_size - start < (uint32_t)count ? m_buffer_size - start : count;
+    for (uint32_t i = 0; i < first_part; i++)
+    {
+      // scale down to the same output level the old 8 bit PCM path produced
+      m_buffer[start + i] = samples[i] >> 3;
+    }
+    for (uint32_t i = first_part; i < (uint32_t)count; i++)
+    {
+      m_buffer[i - first_part] = samples[i] >> 3;
+    }
+    // publish the samples to the consumer
+    m_write_position.store(write_position + count, std::memory_order_release);
+  }
+
+  // ask the consumer to throw away everything written before position - safe from any task
+  void discard(uint32_t position)
+  {
+    // never move it backwards if someone else has asked for more to go
+    uint32_t current = m_discard_position.load(std::memory_order_relaxed);
+    while (((int32_t)(position - current) > 0 || !m_discard.load(std::memory_order_relaxed)) &&
+           !m_discard_position.compare_exchange_weak(current, position, std::memory_order_relaxed))
+    {
+    }
+    m_discard.store(true, std::memory_order_release);
+  }
+
+public:
+  // we're adding samples that are already in order and decoded - producer side only
+  void add_samples(const int16_t *samples, int count)
+  {
+    if (m_gap_concealer.active() && count > 0)
+    {
+      // cross fade out of the made up audio we put in for a lost frame
+      int16_t blended[PLC_BLEND_SAMPLES];
+      int blend = count < PLC_BLEND_SAMPLES ? count : PLC_BLEND_SAMPLES;
+      memcpy(blended, samples, sizeof(int16_t) * blend);
+      m_gap_concealer.resume(blended, blend);
+      m_gap_concealer.push(blended, blend);
+      write_samples(blended, blend);
+      samples += blend;
+      count -= blend;
     }
-    xSemaphoreGive(m_semaphore);
+    m_gap_concealer.push(samples, count);
+    write_samples(samples, count);
+    // real audio has caught up with the consumer so anything it made up was for a late frame, not a lost one
+    m_concealed_ahead.store(0, std::memory_order_relaxed);
   }
 
-  // convert the samples to 16 bit as they are going to the output
+  // the jitter buffer has given up on count samples in the middle of the stream - put made up
+  // audio in their place so playback carries on without running dry - producer side only
+  void add_gap(int count)
+  {
+    int16_t samples[OUTPUT_BUFFER_GAP_BLOCK];
+    m_gap_samples += count;
+    // if playback has already run dry waiting for these it's been playing made up audio in their place
+    uint32_t covered = m_concealed_ahead.load(std::memory_order_relaxed);
+    covered = covered < (uint32_t)count ? covered : count;
+    m_concealed_ahead.fetch_sub(covered, std::memory_order_relaxed);
+    count -= covered;
+    while (count > 0)
+    {
+      int block = count < OUTPUT_BUFFER_GAP_BLOCK ? count : OUTPUT_BUFFER_GAP_BLOCK;
+      m_gap_concealer.conceal(samples, block);
+      write_samples(samples, block);
+      count -= block;
+    }
+  }
+
+  // pull samples out of the buffer as they are going to the output - consumer side only
   void remove_samples(int16_t *samples, int count)
   {
-    xSemaphoreTake(m_semaphore, portMAX_DELAY);
-    for (int i = 0; i < count; i++)
+    if (m_discard.exchange(false, std::memory_order_acquire))
     {
-      samples[i] = 0;
-      // if we have no samples and we aren't already buffering then we need to start buffering
-      if (m_available_samples == 0 && !m_buffering)
+      // skip over what we've been asked to throw away - we may already be past it if we were reading at the time
+      uint32_t read_position = m_read_position.load(std::memory_order_relaxed);
+      uint32_t discard_position = m_discard_position.load(std::memory_order_relaxed);
+      if ((int32_t)(discard_position - read_position) > 0)
       {
-        Serial.println("Buffering");
-        m_buffering = true;
-        samples[i] = 0;
+        m_read_position.store(discard_position, std::memory_order_release);
       }
-      // are we buffering?
-      if (m_buffering && m_available_samples < m_number_samples_to_buffer)
+      m_buffering = true;
+      m_concealer.reset();
+    }
+    uint32_t read_position = m_read_position.load(std::memory_order_relaxed);
+    uint32_t available_samples = m_write_position.load(std::memory_order_acquire) - read_position;
+    // running dry while the sender is silent is expected so it doesn't count as an underrun
+    uint16_t comfort_noise = m_comfort_noise.load(std::memory_order_relaxed);
+    m_concealer.set_comfort_noise(comfort_noise);
+    // if we have no samples and we aren't already buffering then we need to start buffering
+    if (available_samples == 0 && !m_buffering)
+    {
+      m_buffering = true;
+      if (!comfort_noise)
       {
-        // just return 0 as we don't have enough samples yet
-        samples[i] = 0;
+        m_underruns++;
       }
-      else
+    }
+    // we've buffered enough samples so no need to buffer anymore
+    if (m_buffering && available_samples >= (uint32_t)m_number_samples_to_buffer.load())
+    {
+      m_buffering = false;
+    }
+    if (m_buffering)
+    {
+      // cover the gap by repeating what we last played, this fades out to silence (or comfort noise) on long gaps
+      m_concealer.conceal(samples, count);
+      m_concealed_ahead.fetch_add(count, std::memory_order_relaxed);
+      return;
+    }
+    // send back the samples we've got and move the read position forward
+    uint32_t to_copy = (uint32_t)count < available_samples ? count : available_samples;
+    uint32_t start = read_position & m_buffer_mask;
+    uint32_t first_part = m_buffer_size - start < to_copy ? m_buffer_size - start : to_copy;
+    memcpy(samples, m_buffer + start, sizeof(int16_t) * first_part);
+    memcpy(samples + first_part, m_buffer, sizeof(int16_t) * (to_copy - first_part));
+    m_read_position.store(read_position + to_copy, std::memory_order_release);
+    m_concealer.resume(samples, to_copy);
+    m_concealer.push(samples, to_copy);
+    if (to_copy < (uint32_t)count)
+    {
+      // we've run out part way through - conceal the rest and start buffering again
+      m_buffering = true;
+      if (!comfort_noise)
       {
-        // we've buffered enough samples so no need to buffer anymore
-        m_buffering = false;
-        // just send back the samples we've got and move the read head forward
-        int16_t sample = m_buffer[m_read_head];
-        samples[i] = (sample - 128) << 5;
-        m_read_head = (m_read_head + 1) % m_buffer_size;
-        m_available_samples--;
+        m_underruns++;
       }
+      m_concealer.conceal(samples + to_copy, count - to_copy);
+      m_concealed_ahead.fetch_add(count - to_copy, std::memory_order_relaxed);
     }
-    xSemaphoreGive(m_semaphore);
   }
 
+  // number of times we've run out of samples
+  uint32_t underruns() { return m_underruns; }
+  // number of samples made up for frames that never arrived
+  uint32_t gap_samples() { return m_gap_samples; }
+
+  // start again from scratch for a new stream - producer side only, the consumer drops what's left of the old one
+  void reset()
+  {
+    m_jitter_buffer->clear();
+    m_number_samples_to_buffer = m_max_samples_to_buffer;
+    m_comfort_noise = 0;
+    m_gap_concealer.reset();
+    m_concealed_ahead = 0;
+    discard(m_write_position.load(std::memory_order_relaxed));
+  }
+
+  // throw away all the samples in the buffer - safe from any task, the consumer does it the next time it reads
   void flush()
   {
-    // flush all samples in the outputbuffer
-    xSemaphoreTake(m_semaphore, portMAX_DELAY);
-    m_read_head = 0;
-    m_write_head = 0;
-    m_available_samples = 0;
-    xSemaphoreGive(m_semaphore);
+    discard(m_write_position.load(std::memory_order_acquire));
   }
 };
@@ -0,0 +1,136 @@
+#include <string.h>
+#include "PacketLossConcealer.h"
+
+PacketLossConcealer::PacketLossConcealer()
+{
+  reset();
+}
+
+void PacketLossConcealer::reset()
+{
+  memset(m_history, 0, sizeof(m_history));
+  m_active = false;
+  m_phase = 0;
+  m_concealed = 0;
+  m_comfort_noise = 0;
+}
+
+void PacketLossConcealer::push(const int16_t *samples, int count)
+{
+  if (count >= PLC_HISTORY_SIZE)
+  {
+    memcpy(m_history, samples + count - PLC_HISTORY_SIZE, sizeof(m_history));
+    return;
+  }
+  // shift the history down and add the new samples at the end
+  memmove(m_history, m_history + count, sizeof(int16_t) * (PLC_HISTORY_SIZE - count));
+  memcpy(m_history + PLC_HISTORY_SIZE - count, samples, sizeof(int16_t) * count);
+}
+
+float PacketLossConcealer::pitch_score(int lag, int step)
+{
+  // autocorrelation of the last pitch period's worth of samples against the ones lag samples earlier
+  const int16_t *end = m_history + PLC_HISTORY_SIZE;
+  float correlation = 0;
+  float energy = 0;
+  for (int n = -PLC_MAX_PITCH; n < 0; n += step)
+  {
+    float lagged = end[n - lag];
+    correlation += end[n] * lagged;
+    energy += lagged * lagged;
+  }
+  return correlation > 0 && energy > 0 ? correlation * correlation / energy : 0;
+}
+
+int PacketLossConcealer::find_pitch()
+{
+  // a coarse search over every other lag looking at every 4th sample, then the lags either side
+  // of the best one at every other sample - about a quarter of the work of searching every lag
+  int best_lag = PLC_MAX_PITCH;
+  float best_score = 0;
+  for (int lag = PLC_MIN_PITCH; lag <= PLC_MAX_PITCH; lag += 2)
+  {
+    float score = pitch_score(lag, 4);
+    if (score > best_score)
+    {
+      best_score = score;
+      best_lag = lag;
+    }
+  }
+  int coarse_lag = best_lag;
+  best_score = 0;
+  for (int lag = coarse_lag - 1; lag <= coarse_lag + 1; lag++)
+  {
+    if (lag < PLC_MIN_PITCH || lag > PLC_MAX_PITCH)
+    {
+      continue;
+    }
+    float score = pitch_score(lag, 2);
+    if (score > best_score)
+    {
+      best_score = score;
+      best_lag = lag;
+    }
+  }
+  return best_lag;
+}
+
+int16_t PacketLossConcealer::next_noise()
+{
+  if (!m_comfort_noise)
+  {
+    return 0;
+  }
+  // white noise from a simple LCG - uniform noise needs a peak of sqrt(3) times the RMS level
+  m_noise_seed = m_noise_seed * 1664525 + 1013904223;
+  int32_t noise = (int16_t)(m_noise_seed >> 16);
+  return noise * m_comfort_noise * 7 / 4 / 32768;
+}
+
+int16_t PacketLossConcealer::next_sample()
+{
+  if (m_concealed >= PLC_FADE_SAMPLES)
+  {
+    return next_noise();
+  }
+  int32_t sample = m_history[PLC_HISTORY_SIZE - m_pitch + m_phase];
+  sample = (sample * (PLC_FADE_SAMPLES - m_concealed) + next_noise() * m_concealed) / PLC_FADE_SAMPLES;
+  m_phase++;
+  if (m_phase == m_pitch)
+  {
+    m_phase = 0;
+  }
+  m_concealed++;
+  return sample;
+}
+
+void PacketLossConcealer::conceal(int16_t *samples, int count)
+{
+  if (!m_active)
+  {
+    // start of a gap - work out what to repeat
+    m_active = true;
+    m_pitch = find_pitch();
+    m_phase = 0;
+    m_concealed = 0;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    samples[i] = next_sample();
+  }
+}
+
+void PacketLossConcealer::resume(int16_t *samples, int count)
+{
+  if (!m_active)
+  {
+    return;
+  }
+  m_active = false;
+  int blend = count < PLC_BLEND_SAMPLES ? count : PLC_BLEND_SAMPLES;
+  for (int i = 0; i < blend; i++)
+  {
+    int32_t synthetic = next_sample();
+    samples[i] = (samples[i] * i + synthetic * (blend - i)) / blend;
+  }
+}
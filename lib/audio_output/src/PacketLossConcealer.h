@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+// pitch search range - 50Hz to 400Hz at 16kHz
+#define PLC_MIN_PITCH 40
+#define PLC_MAX_PITCH 320
+// we need two of the longest pitch periods to search for the pitch
+#define PLC_HISTORY_SIZE (2 * PLC_MAX_PITCH)
+// fade the repeated waveform out to silence over 60ms
+#define PLC_FADE_SAMPLES 960
+// cross fade from the concealment back into real audio over 4ms
+#define PLC_BLEND_SAMPLES 64
+
+/**
+ * @brief Fills gaps in playback by repeating the last pitch period of the
+ * audio we played, fading it out so a long gap ends in silence or comfort noise
+ *
+ */
+class PacketLossConcealer
+{
+private:
+  // the most recent samples that were played - oldest first
+  int16_t m_history[PLC_HISTORY_SIZE];
+  // are we in the middle of a gap?
+  bool m_active = false;
+  int m_pitch = PLC_MAX_PITCH;
+  // position within the repeated pitch period
+  int m_phase = 0;
+  // how many samples we've made up in this gap
+  int m_concealed = 0;
+  // level of the noise to fade into instead of silence
+  uint16_t m_comfort_noise = 0;
+  uint32_t m_noise_seed = 1;
+
+  float pitch_score(int lag, int step);
+  int find_pitch();
+  int16_t next_sample();
+  int16_t next_noise();
+
+public:
+  PacketLossConcealer();
+  void reset();
+  // RMS level of the noise to play once the repeated audio has faded out - 0 for silence
+  void set_comfort_noise(uint16_t noise_level) { m_comfort_noise = noise_level; }
+  // remember samples that were played so we can repeat them
+  void push(const int16_t *samples, int count);
+  // make up samples to cover a gap
+  void conceal(int16_t *samples, int count);
+  // real audio is back - cross fade into it from the concealment
+  void resume(int16_t *samples, int count);
+  // are we in the middle of a gap?
+  bool active() { return m_active; }
+};
@@ -0,0 +1,121 @@
+#include <Arduino.h>
+#include "StreamMixer.h"
+#include "OutputBuffer.h"
+
+StreamMixer::StreamMixer(int max_samples_to_buffer, int sample_rate)
+{
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    m_streams[i].active = false;
+    m_streams[i].last_seen = 0;
+    memset(m_streams[i].address, 0, MIXER_ADDRESS_SIZE);
+    m_streams[i].output_buffer = new OutputBuffer(max_samples_to_buffer, sample_rate);
+  }
+  m_stream_samples = (int16_t *)malloc(sizeof(int16_t) * MIXER_BLOCK_SIZE);
+  m_mix = (int32_t *)malloc(sizeof(int32_t) * MIXER_BLOCK_SIZE);
+}
+
+StreamMixer::~StreamMixer()
+{
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    delete m_streams[i].output_buffer;
+  }
+  free(m_stream_samples);
+  free(m_mix);
+}
+
+int StreamMixer::claim_stream(const uint8_t *address, bool &is_new)
+{
+  is_new = false;
+  int free_stream = -1;
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    Stream &stream = m_streams[i];
+    if (stream.active.load(std::memory_order_acquire))
+    {
+      if (memcmp(stream.address, address, MIXER_ADDRESS_SIZE) == 0)
+      {
+        stream.last_seen = millis();
+        return i;
+      }
+    }
+    else if (free_stream == -1)
+    {
+      free_stream = i;
+    }
+  }
+  if (free_stream == -1)
+  {
+    m_rejected++;
+    return -1;
+  }
+  // the consumer ignores inactive streams so it's safe to set this one up
+  Stream &stream = m_streams[free_stream];
+  memcpy(stream.address, address, MIXER_ADDRESS_SIZE);
+  stream.output_buffer->reset();
+  stream.last_seen = millis();
+  stream.active.store(true, std::memory_order_release);
+  is_new = true;
+  return free_stream;
+}
+
+int StreamMixer::latest_stream()
+{
+  int latest = -1;
+  uint32_t now = millis();
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    if (m_streams[i].active.load(std::memory_order_acquire) &&
+        (latest < 0 || now - m_streams[i].last_seen < now - m_streams[latest].last_seen))
+    {
+      latest = i;
+    }
+  }
+  return latest;
+}
+
+void StreamMixer::remove_samples(int16_t *samples, int count)
+{
+  uint32_t now = millis();
+  while (count > 0)
+  {
+    int block = count < MIXER_BLOCK_SIZE ? count : MIXER_BLOCK_SIZE;
+    memset(m_mix, 0, sizeof(int32_t) * block);
+    for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+    {
+      Stream &stream = m_streams[i];
+      if (!stream.active.load(std::memory_order_acquire))
+      {
+        continue;
+      }
+      if ((int32_t)(now - stream.last_seen) > MIXER_STREAM_TIMEOUT_MS)
+      {
+        // nothing from this sender for a while - free the stream up for someone else
+        stream.active.store(false, std::memory_order_release);
+        continue;
+      }
+      stream.output_buffer->remove_samples(m_stream_samples, block);
+      for (int j = 0; j < block; j++)
+      {
+        m_mix[j] += m_stream_samples[j];
+      }
+    }
+    // saturate rather than wrap around if the mix gets too loud
+    for (int j = 0; j < block; j++)
+    {
+      int32_t sample = m_mix[j];
+      samples[j] = sample > INT16_MAX ? INT16_MAX : (sample < INT16_MIN ? INT16_MIN : sample);
+    }
+    samples += block;
+    count -= block;
+  }
+}
+
+void StreamMixer::flush()
+{
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    m_streams[i].output_buffer->flush();
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+class OutputBuffer;
+
+// how many people can be talking at the same time
+#define MIXER_MAX_STREAMS 4
+// MAC address or an IPv4 address padded with zeros
+#define MIXER_ADDRESS_SIZE 6
+// forget about a sender once we've not heard from them for this long
+#define MIXER_STREAM_TIMEOUT_MS 2000
+// largest number of samples we mix in one go
+#define MIXER_BLOCK_SIZE 128
+
+/**
+ * @brief Keeps a separate output buffer for each sender and mixes them together for playback
+ *
+ * Streams are claimed by the transport receive task (the producer) and mixed and
+ * evicted by the playback loop (the consumer).
+ */
+class StreamMixer
+{
+private:
+  struct Stream
+  {
+    // set by the producer once the stream is ready, cleared by the consumer when it's evicted
+    std::atomic<bool> active;
+    std::atomic<uint32_t> last_seen;
+    uint8_t address[MIXER_ADDRESS_SIZE];
+    OutputBuffer *output_buffer;
+  };
+  Stream m_streams[MIXER_MAX_STREAMS];
+  int16_t *m_stream_samples;
+  int32_t *m_mix;
+  uint32_t m_rejected = 0;
+
+public:
+  StreamMixer(int max_samples_to_buffer, int sample_rate);
+  ~StreamMixer();
+  // find or create the stream for a sender - producer side only
+  // returns -1 if all the streams are busy, is_new is set if the stream has just been created
+  int claim_stream(const uint8_t *address, bool &is_new);
+  OutputBuffer *output_buffer(int index) { return m_streams[index].output_buffer; }
+  const uint8_t *address(int index) { return m_streams[index].address; }
+  bool is_active(int index) { return m_streams[index].active; }
+  // when we last had a packet from the sender - in millis()
+  uint32_t last_seen(int index) { return m_streams[index].last_seen; }
+  // the active stream we've heard from most recently - -1 if nobody is talking
+  int latest_stream();
+  // senders we had to ignore because all the streams were busy
+  uint32_t rejected() { return m_rejected; }
+  // mix all the active streams together - consumer side only
+  void remove_samples(int16_t *samples, int count);
+  // throw away anything buffered - safe from any task, it happens the next time the streams are mixed
+  void flush();
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+// the parts of the Arduino core the libraries use, for host builds
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_idf_version.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "IPAddress.h"
+#include "WString.h"
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+
+using std::max;
+using std::min;
+
+// newlib has these but older glibcs don't
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// pins belong to the device the calling thread is running on
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char *text) { return write(text); }
+  size_t print(const String &text) { return write((const uint8_t *)text.c_str(), text.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value) { return printf("%d", value); }
+  size_t print(unsigned int value) { return printf("%u", value); }
+  size_t print(long value) { return printf("%ld", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+  size_t print(const IPAddress &address) { return printf("%u.%u.%u.%u", address[0], address[1], address[2], address[3]); }
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  size_t println() { return write("\n"); }
+  virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual size_t readBytes(char *buffer, size_t length)
+  {
+    size_t count = 0;
+    int c;
+    while (count < length && (c = read()) >= 0)
+    {
+      buffer[count++] = c;
+    }
+    return count;
+  }
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+};
+
+// writes to stdout - when there's more than one device each line starts with the device's name
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) {}
+  void end() {}
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+  // there's no rebooting a device on the host - the whole process stops
+  void restart();
+};
+
+extern EspClass ESP;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <functional>
+#include "Arduino.h"
+#include "NativeDevice.h"
+
+/**
+ * @brief A packet from another device on the in-process network
+ */
+class AsyncUDPPacket
+{
+private:
+  const uint8_t *m_data;
+  size_t m_length;
+  IPAddress m_remote_ip;
+  uint16_t m_remote_port;
+
+public:
+  AsyncUDPPacket(const uint8_t *data, size_t length, IPAddress remote_ip, uint16_t remote_port)
+      : m_data(data), m_length(length), m_remote_ip(remote_ip), m_remote_port(remote_port) {}
+  uint8_t *data() { return (uint8_t *)m_data; }
+  size_t length() { return m_length; }
+  IPAddress remoteIP() { return m_remote_ip; }
+  uint16_t remotePort() { return m_remote_port; }
+};
+
+typedef std::function<void(AsyncUDPPacket &packet)> AuPacketHandlerFunction;
+
+/**
+ * @brief UDP on a shared in-process network - a broadcast reaches every other device
+ * listening on the same port
+ */
+class AsyncUDP
+{
+private:
+  NativeDevice *m_device = NULL;
+  NativeDevice::UdpSocket *m_socket = NULL;
+
+public:
+  ~AsyncUDP();
+  bool listen(uint16_t port);
+  void onPacket(AuPacketHandlerFunction handler);
+  size_t broadcast(uint8_t *data, size_t len);
+  size_t broadcastTo(uint8_t *data, size_t len, uint16_t port);
+  void close();
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "Arduino.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+  enum SeekMode
+  {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+  };
+
+  /**
+   * @brief A file on the host - copies share the same open file like they do on the ESP32
+   */
+  class File : public Stream
+  {
+  private:
+    std::shared_ptr<FILE> m_file;
+    std::string m_name;
+
+  public:
+    File() {}
+    File(FILE *file, const char *name);
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buffer, size_t size);
+    void flush() override;
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    const char *name() const { return m_name.c_str(); }
+    operator bool() const { return m_file != nullptr; }
+  };
+
+  /**
+   * @brief A directory on the host standing in for a filesystem - paths are looked up
+   * through the current device
+   */
+  class FS
+  {
+  protected:
+    std::string real_path(const char *path);
+
+  public:
+    virtual ~FS() {}
+    File open(const char *path, const char *mode = FILE_READ);
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *path_from, const char *path_to);
+    bool mkdir(const char *path);
+    bool rmdir(const char *path);
+  };
+}
+
+using fs::File;
+using fs::FS;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define HTTPCLIENT_DEFAULT_TCP_TIMEOUT 5000
+// bodies are sent and received through a buffer of this size
+#define HTTP_TCP_BUFFER_SIZE 1460
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_ENCODING (-9)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+typedef enum
+{
+  HTTP_CODE_OK = 200,
+  HTTP_CODE_NO_CONTENT = 204,
+  HTTP_CODE_BAD_REQUEST = 400,
+  HTTP_CODE_UNAUTHORIZED = 401,
+  HTTP_CODE_FORBIDDEN = 403,
+  HTTP_CODE_NOT_FOUND = 404,
+  HTTP_CODE_REQUEST_TIMEOUT = 408,
+  HTTP_CODE_PAYLOAD_TOO_LARGE = 413,
+  HTTP_CODE_TOO_MANY_REQUESTS = 429,
+  HTTP_CODE_INTERNAL_SERVER_ERROR = 500,
+  HTTP_CODE_SERVICE_UNAVAILABLE = 503
+} t_http_codes;
+
+/**
+ * @brief The ESP32 HTTPClient for host builds - HTTP/1.1 over a client the caller owns
+ *
+ * Behaves like the ESP32 one where it matters to us - a connection that's already open is
+ * reused, bodies go out through a fixed size buffer with a Content-Length, responses can be
+ * chunked, and end() only throws away what has already arrived of a response nobody read.
+ */
+class HTTPClient
+{
+private:
+  WiFiClient *m_client = NULL;
+  String m_host;
+  uint16_t m_port = 80;
+  String m_uri;
+  String m_headers;
+  bool m_reuse = true;
+  bool m_can_reuse = false;
+  uint16_t m_timeout = HTTPCLIENT_DEFAULT_TCP_TIMEOUT;
+  // what the response said about its body - -1 if it didn't give a length
+  int m_size = -1;
+  bool m_chunked = false;
+  int m_return_code = 0;
+
+  bool connect();
+  void disconnect(bool preserve_client);
+  bool send_header(const char *type, size_t size);
+  int handle_header_response();
+  int read_byte();
+  bool read_line(String &line);
+  int write_block(Stream *stream, int length);
+  int return_error(int error);
+
+public:
+  bool begin(WiFiClient &client, const String &url);
+  void end();
+  void setReuse(bool reuse) { m_reuse = reuse; }
+  void setTimeout(uint16_t timeout) { m_timeout = timeout; }
+  bool connected() { return m_client && m_client->connected(); }
+  void addHeader(const String &name, const String &value);
+
+  int GET();
+  int POST(const String &payload) { return POST((const uint8_t *)payload.c_str(), payload.length()); }
+  int POST(const uint8_t *payload, size_t size) { return sendRequest("POST", payload, size); }
+  int sendRequest(const char *type, const String &payload) { return sendRequest(type, (const uint8_t *)payload.c_str(), payload.length()); }
+  int sendRequest(const char *type, const uint8_t *payload = NULL, size_t size = 0);
+  int sendRequest(const char *type, Stream *stream, size_t size = 0);
+
+  int getSize() { return m_size; }
+  String getString();
+  int writeToStream(Stream *stream);
+  static String errorToString(int error);
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+class IPAddress
+{
+private:
+  uint8_t m_address[4];
+
+public:
+  IPAddress() : m_address{0, 0, 0, 0} {}
+  IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth) : m_address{first, second, third, fourth} {}
+  // most significant byte first - 10.0.0.1 is 0x0a000001
+  explicit IPAddress(uint32_t address)
+      : m_address{(uint8_t)(address >> 24), (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address} {}
+  uint8_t operator[](int index) const { return m_address[index]; }
+  uint8_t &operator[](int index) { return m_address[index]; }
+  bool operator==(const IPAddress &other) const
+  {
+    return m_address[0] == other[0] && m_address[1] == other[1] && m_address[2] == other[2] && m_address[3] == other[3];
+  }
+};
@@ -0,0 +1,167 @@
+#include <stdarg.h>
+#include <thread>
+#include <chrono>
+#include "Arduino.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "NativeDevice.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+  size_t length = strlen(src);
+  if (size > 0)
+  {
+    size_t copy = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, copy);
+    dst[copy] = 0;
+  }
+  return length;
+}
+#endif
+
+unsigned long millis()
+{
+  return native_micros() / 1000;
+}
+
+unsigned long micros()
+{
+  return native_micros();
+}
+
+void delay(uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  NativeDevice::current()->set_pin(pin, value);
+}
+
+int digitalRead(uint8_t pin)
+{
+  return NativeDevice::current()->pin(pin);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t written = 0;
+  while (written < size && write(buffer[written]))
+  {
+    written++;
+  }
+  return written;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0)
+  {
+    return 0;
+  }
+  if (length < (int)sizeof(buffer))
+  {
+    return write((const uint8_t *)buffer, length);
+  }
+  // too long for the stack
+  char *text = (char *)malloc(length + 1);
+  va_start(args, format);
+  vsnprintf(text, length + 1, format, args);
+  va_end(args);
+  size_t written = write((const uint8_t *)text, length);
+  free(text);
+  return written;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  // the host program's own output isn't labelled
+  NativeDevice *device = NativeDevice::selected();
+  bool label = device && NativeDevice::devices().size() > 1;
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> guard(mutex);
+  for (size_t i = 0; i < size; i++)
+  {
+    if (label && device->line_start())
+    {
+      fprintf(stdout, "[%s] ", device->name());
+    }
+    fputc(buffer[i], stdout);
+    if (device)
+    {
+      device->line_start() = buffer[i] == '\n';
+    }
+  }
+  return size;
+}
+
+void HardwareSerial::flush()
+{
+  fflush(stdout);
+}
+
+void native_log(char level, const char *tag, const char *format, ...)
+{
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  Serial.printf("%c (%lu) %s: %s\n", level, millis(), tag, buffer);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_ESPNOW_NOT_INIT:
+    return "ESP_ERR_ESPNOW_NOT_INIT";
+  case ESP_ERR_ESPNOW_ARG:
+    return "ESP_ERR_ESPNOW_ARG";
+  case ESP_ERR_ESPNOW_NOT_FOUND:
+    return "ESP_ERR_ESPNOW_NOT_FOUND";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+void EspClass::restart()
+{
+  Serial.println("Restarting - stopping the host build");
+  Serial.flush();
+  exit(1);
+}
+
+const char *esp_get_idf_version()
+{
+  return "v3.3.5-native";
+}
@@ -0,0 +1,156 @@
+#include <chrono>
+#include <thread>
+#include <string.h>
+#include "NativeDevice.h"
+
+static std::vector<NativeDevice *> s_devices;
+static int s_next_index = 0;
+static thread_local NativeDevice *t_current = NULL;
+static const auto s_start = std::chrono::steady_clock::now();
+// set once the program takes over the clock
+static std::atomic<bool> s_clock_set(false);
+static std::atomic<uint64_t> s_clock_us(0);
+
+std::mutex &NativeDevice::lock()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+NativeDevice::NativeDevice(const char *name) : m_name(name)
+{
+  std::lock_guard<std::mutex> guard(lock());
+  m_index = s_next_index++;
+  // locally administered addresses so they can't clash with anything real
+  const uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, (uint8_t)(m_index + 1)};
+  memcpy(m_mac, mac, sizeof(m_mac));
+  m_sd_root = std::string("sd/") + name;
+  for (int i = 0; i < NATIVE_GPIO_COUNT; i++)
+  {
+    m_pins[i] = 0;
+  }
+  s_devices.push_back(this);
+}
+
+NativeDevice::~NativeDevice()
+{
+  for (int i = 0; i < NATIVE_I2S_PORT_COUNT; i++)
+  {
+    finish_i2s(i);
+  }
+  std::lock_guard<std::mutex> guard(lock());
+  for (size_t i = 0; i < s_devices.size(); i++)
+  {
+    if (s_devices[i] == this)
+    {
+      s_devices.erase(s_devices.begin() + i);
+      break;
+    }
+  }
+  if (t_current == this)
+  {
+    t_current = NULL;
+  }
+}
+
+void NativeDevice::select()
+{
+  t_current = this;
+}
+
+void NativeDevice::deselect()
+{
+  t_current = NULL;
+}
+
+NativeDevice *NativeDevice::selected()
+{
+  return t_current;
+}
+
+NativeDevice *NativeDevice::current()
+{
+  if (!t_current)
+  {
+    // programs that only need one device don't have to make one
+    static NativeDevice *default_device = new NativeDevice("esp32");
+    t_current = default_device;
+  }
+  return t_current;
+}
+
+std::vector<NativeDevice *> NativeDevice::devices()
+{
+  std::lock_guard<std::mutex> guard(lock());
+  return s_devices;
+}
+
+const std::vector<NativeDevice *> &NativeDevice::devices_locked()
+{
+  return s_devices;
+}
+
+uint32_t NativeDevice::ip()
+{
+  return (10u << 24) | (m_index + 1);
+}
+
+void NativeDevice::set_pin(int pin, int value)
+{
+  if (pin >= 0 && pin < NATIVE_GPIO_COUNT)
+  {
+    m_pins[pin] = value;
+  }
+}
+
+int NativeDevice::pin(int pin)
+{
+  return pin >= 0 && pin < NATIVE_GPIO_COUNT ? m_pins[pin].load() : 0;
+}
+
+void NativeDevice::set_i2s_input(int port, const char *path)
+{
+  m_i2s[port].input_path = path;
+  m_i2s[port].input_changed = true;
+}
+
+void NativeDevice::set_i2s_output(int port, const char *path)
+{
+  m_i2s[port].output_path = path;
+}
+
+void NativeDevice::set_sd_root(const char *path)
+{
+  m_sd_root = path;
+}
+
+std::string NativeDevice::sd_path(const char *path)
+{
+  return m_sd_root + (path[0] == '/' ? "" : "/") + path;
+}
+
+uint64_t native_micros()
+{
+  if (s_clock_set)
+  {
+    return s_clock_us;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_start).count();
+}
+
+void native_set_clock(uint64_t us)
+{
+  s_clock_us = us;
+  s_clock_set = true;
+}
+
+void native_start_thread(std::function<void()> function)
+{
+  NativeDevice *device = NativeDevice::current();
+  std::thread([device, function]()
+              {
+                device->select();
+                function();
+              })
+      .detach();
+}
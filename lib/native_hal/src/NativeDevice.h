@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// pins on an ESP32
+#define NATIVE_GPIO_COUNT 40
+// the ESP32 has two I2S peripherals
+#define NATIVE_I2S_PORT_COUNT 2
+// the biggest packet ESP-NOW will send
+#define NATIVE_ESP_NOW_MAX_DATA_LEN 250
+
+typedef void (*native_esp_now_recv_cb_t)(const uint8_t *mac_addr, const uint8_t *data, int data_len);
+
+/**
+ * @brief One simulated ESP32 in a host build
+ *
+ * Each device has its own pins, I2S ports, SD card directory and radio address. Code runs
+ * "on" a device by calling select() from its thread - FreeRTOS tasks started from there
+ * belong to the same device, so several devices can share one process and talk to each
+ * other over the in-process ESP-NOW and UDP broadcast bus.
+ *
+ * I2S input is read from a 16 bit mono WAV or raw PCM file as if it was the sound around
+ * the device, scaled so the samplers read back the samples in the file. I2S output is
+ * written to a WAV file in real time - gaps where nothing was written are silence, the same
+ * as the speaker would play. Both run at the configured sample rate so the rest of the
+ * code sees the same timing as it would on the hardware.
+ */
+class NativeDevice
+{
+public:
+  struct I2SPort
+  {
+    std::string input_path;
+    std::string output_path;
+    FILE *input = NULL;
+    FILE *output = NULL;
+    // how the driver is set up at the moment
+    bool installed = false;
+    bool adc = false;
+    int mode = 0;
+    int sample_rate = 0;
+    int bytes_per_sample = 2;
+    int channels = 1;
+    int dma_buf_count = 0;
+    int dma_buf_len = 0;
+    // input and output each run in real time from when they were first started
+    uint64_t input_origin_us = 0;
+    uint64_t output_origin_us = 0;
+    uint64_t frames_read = 0;
+    uint64_t frames_written = 0;
+    // the output file's format is fixed when it's created
+    int output_sample_rate = 0;
+    int output_frame_size = 0;
+    int output_channels = 0;
+    // samples the reader was too slow to pick up before the DMA buffers overflowed
+    std::atomic<uint64_t> frames_dropped{0};
+    std::atomic<bool> input_finished{false};
+    // a new input file has been set since this one was opened
+    std::atomic<bool> input_changed{false};
+  };
+  // a slow SD card - every write takes write_us plus us_per_kb for each KB written, and every stall_every
+  // writes the card stops for stall_us while it erases. The counters show how the card was used
+  struct SdCard
+  {
+    uint32_t write_us = 0;
+    uint32_t us_per_kb = 0;
+    int stall_every = 0;
+    uint32_t stall_us = 0;
+    std::atomic<uint32_t> writes{0};
+    // writes that start part way into a sector so the card has to read it back first
+    std::atomic<uint32_t> unaligned_writes{0};
+    // times a file got longer and the filesystem had to find it more space
+    std::atomic<uint32_t> extends{0};
+  };
+  struct UdpSocket
+  {
+    uint16_t port;
+    std::function<void(const uint8_t *address, const uint8_t *data, size_t length, uint16_t remote_port)> handler;
+  };
+
+private:
+  std::string m_name;
+  int m_index;
+  uint8_t m_mac[6];
+  std::string m_sd_root;
+  SdCard m_sd_card;
+  std::atomic<int> m_pins[NATIVE_GPIO_COUNT];
+  I2SPort m_i2s[NATIVE_I2S_PORT_COUNT];
+  // serial output from each device starts with its name when there's more than one
+  bool m_line_start = true;
+
+  // radio
+  int m_wifi_channel = 1;
+  native_esp_now_recv_cb_t m_esp_now_callback = NULL;
+  std::vector<UdpSocket *> m_udp_sockets;
+
+public:
+  NativeDevice(const char *name);
+  ~NativeDevice();
+  // run the calling thread on this device
+  void select();
+  // hand the calling thread back to the host program
+  static void deselect();
+  // the device the calling thread is running on - there's always a default one
+  static NativeDevice *current();
+  // the same but NULL if the thread hasn't picked one
+  static NativeDevice *selected();
+  static std::vector<NativeDevice *> devices();
+  // the same for when lock() is already held
+  static const std::vector<NativeDevice *> &devices_locked();
+  // serialises access to the radio and the devices' state
+  static std::mutex &lock();
+
+  const char *name() { return m_name.c_str(); }
+  const uint8_t *mac() { return m_mac; }
+  // 10.0.0.x where x follows the order the devices were created in
+  uint32_t ip();
+
+  // things the host program does to the device
+  void set_pin(int pin, int value);
+  int pin(int pin);
+  // a new input while the device is running plays from its start the next time the port is started
+  void set_i2s_input(int port, const char *path);
+  void set_i2s_output(int port, const char *path);
+  // the input file has run out - the port reads silence from then on
+  bool i2s_input_finished(int port) { return m_i2s[port].input_finished; }
+  uint64_t i2s_input_dropped(int port) { return m_i2s[port].frames_dropped; }
+  // the SD card is this directory - "sd/<name>" if it isn't set
+  void set_sd_root(const char *path);
+  std::string sd_path(const char *path);
+  SdCard &sd_card() { return m_sd_card; }
+
+  // used by the HAL
+  I2SPort &i2s_port(int port) { return m_i2s[port]; }
+  // patch the output file's header and close the port's files
+  void finish_i2s(int port);
+  bool &line_start() { return m_line_start; }
+  int &wifi_channel() { return m_wifi_channel; }
+  native_esp_now_recv_cb_t &esp_now_callback() { return m_esp_now_callback; }
+  std::vector<UdpSocket *> &udp_sockets() { return m_udp_sockets; }
+};
+
+// microseconds since the program started - the same clock on every device
+uint64_t native_micros();
+// stop the clock and set it by hand from now on - for simulations that have to give the same
+// results every run. Only millis() and micros() follow it, anything that sleeps still uses real time
+void native_set_clock(uint64_t us);
+// start a thread running on the current device
+void native_start_thread(std::function<void()> function);
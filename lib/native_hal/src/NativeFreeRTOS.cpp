@@ -0,0 +1,160 @@
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "NativeDevice.h"
+
+struct NativeTask
+{
+  std::string name;
+};
+
+struct NativeQueue
+{
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::vector<uint8_t> items;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head = 0;
+  UBaseType_t count = 0;
+};
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+  NativeTask *task = new NativeTask{name};
+  native_start_thread([function, parameters]()
+                      { function(parameters); });
+  if (created_task)
+  {
+    *created_task = task;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+  return xTaskCreate(function, name, stack_depth, parameters, priority, created_task);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount()
+{
+  return native_micros() / 1000 / portTICK_PERIOD_MS;
+}
+
+void native_task_yield()
+{
+  std::this_thread::yield();
+}
+
+// wait on the condition until it's true or the ticks run out
+template <typename Predicate>
+static bool wait(std::condition_variable &condition, std::unique_lock<std::mutex> &lock, TickType_t ticks, Predicate predicate)
+{
+  if (ticks == portMAX_DELAY)
+  {
+    condition.wait(lock, predicate);
+    return true;
+  }
+  // like FreeRTOS don't give up the CPU if we aren't going to wait - a timed wait that has already
+  // timed out can still take milliseconds to come back
+  if (ticks == 0)
+  {
+    return predicate();
+  }
+  return condition.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), predicate);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  NativeQueue *queue = new NativeQueue();
+  queue->length = length;
+  queue->item_size = item_size;
+  queue->items.resize(length * item_size);
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait(queue->not_full, lock, ticks, [queue]()
+            { return queue->count < queue->length; }))
+  {
+    return errQUEUE_FULL;
+  }
+  UBaseType_t tail = (queue->head + queue->count) % queue->length;
+  if (queue->item_size > 0)
+  {
+    memcpy(queue->items.data() + tail * queue->item_size, item, queue->item_size);
+  }
+  queue->count++;
+  queue->not_empty.notify_one();
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait(queue->not_empty, lock, ticks, [queue]()
+            { return queue->count > 0; }))
+  {
+    return errQUEUE_EMPTY;
+  }
+  if (queue->item_size > 0)
+  {
+    memcpy(buffer, queue->items.data() + queue->head * queue->item_size, queue->item_size);
+  }
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  queue->not_full.notify_one();
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+  // starts empty so the first take waits for a give
+  return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  SemaphoreHandle_t semaphore = xQueueCreate(1, 0);
+  xSemaphoreGive(semaphore);
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+  SemaphoreHandle_t semaphore = xQueueCreate(max_count, 0);
+  for (UBaseType_t i = 0; i < initial_count; i++)
+  {
+    xSemaphoreGive(semaphore);
+  }
+  return semaphore;
+}
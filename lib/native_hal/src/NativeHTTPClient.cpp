@@ -0,0 +1,406 @@
+#include "HTTPClient.h"
+
+// gathers a response body into a String
+class StringStream : public Stream
+{
+private:
+  String &m_string;
+
+public:
+  StringStream(String &string) : m_string(string) {}
+  size_t write(uint8_t c) override
+  {
+    m_string += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    m_string.concat((const char *)buffer, size);
+    return size;
+  }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+
+bool HTTPClient::begin(WiFiClient &client, const String &url)
+{
+  m_client = &client;
+  m_headers = "";
+  m_size = -1;
+  m_chunked = false;
+  m_return_code = 0;
+  int start = url.indexOf("://");
+  String scheme = start < 0 ? "http" : url.substring(0, start);
+  start = start < 0 ? 0 : start + 3;
+  int end = url.indexOf('/', start);
+  m_host = end < 0 ? url.substring(start) : url.substring(start, end);
+  m_uri = end < 0 ? "/" : url.substring(end);
+  m_port = scheme == "https" ? 443 : 80;
+  int colon = m_host.indexOf(':');
+  if (colon >= 0)
+  {
+    m_port = m_host.substring(colon + 1).toInt();
+    m_host = m_host.substring(0, colon);
+  }
+  return true;
+}
+
+void HTTPClient::end()
+{
+  disconnect(false);
+}
+
+void HTTPClient::disconnect(bool preserve_client)
+{
+  if (connected())
+  {
+    // only what has already arrived - anything still on its way is left for the next response
+    uint8_t buffer[64];
+    while (m_client->available() > 0 && m_client->read(buffer, sizeof(buffer)) > 0)
+    {
+    }
+    if (!m_reuse || !m_can_reuse)
+    {
+      m_client->stop();
+    }
+  }
+  if (!preserve_client)
+  {
+    m_headers = "";
+  }
+}
+
+bool HTTPClient::connect()
+{
+  if (connected())
+  {
+    // the same as the ESP32 - throw away anything left over from the last response
+    while (m_client->available() > 0)
+    {
+      m_client->read();
+    }
+    return true;
+  }
+  return m_client && m_client->connect(m_host.c_str(), m_port);
+}
+
+void HTTPClient::addHeader(const String &name, const String &value)
+{
+  m_headers += name + ": " + value + "\r\n";
+}
+
+bool HTTPClient::send_header(const char *type, size_t size)
+{
+  String header = String(type) + " " + m_uri + " HTTP/1.1\r\n"
+                  "Host: " + m_host;
+  if (m_port != 80 && m_port != 443)
+  {
+    header += ":" + String(m_port);
+  }
+  header += "\r\nUser-Agent: ESP32HTTPClient\r\n"
+            "Connection: ";
+  header += m_reuse ? "keep-alive" : "close";
+  header += "\r\nAccept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n";
+  if (size > 0)
+  {
+    header += "Content-Length: " + String((unsigned long)size) + "\r\n";
+  }
+  header += m_headers + "\r\n";
+  return m_client->write((const uint8_t *)header.c_str(), header.length()) == header.length();
+}
+
+int HTTPClient::return_error(int error)
+{
+  if (error < 0 && connected())
+  {
+    m_client->stop();
+  }
+  return error;
+}
+
+int HTTPClient::GET()
+{
+  return sendRequest("GET");
+}
+
+int HTTPClient::sendRequest(const char *type, const uint8_t *payload, size_t size)
+{
+  if (!connect())
+  {
+    return return_error(HTTPC_ERROR_CONNECTION_REFUSED);
+  }
+  if (!send_header(type, payload ? size : 0))
+  {
+    return return_error(HTTPC_ERROR_SEND_HEADER_FAILED);
+  }
+  if (payload && size > 0 && m_client->write(payload, size) != size)
+  {
+    return return_error(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+  }
+  return return_error(handle_header_response());
+}
+
+int HTTPClient::sendRequest(const char *type, Stream *stream, size_t size)
+{
+  if (!stream)
+  {
+    return return_error(HTTPC_ERROR_NO_STREAM);
+  }
+  if (!connect())
+  {
+    return return_error(HTTPC_ERROR_CONNECTION_REFUSED);
+  }
+  if (!send_header(type, size))
+  {
+    return return_error(HTTPC_ERROR_SEND_HEADER_FAILED);
+  }
+  uint8_t *buffer = (uint8_t *)malloc(HTTP_TCP_BUFFER_SIZE);
+  if (!buffer)
+  {
+    return return_error(HTTPC_ERROR_TOO_LESS_RAM);
+  }
+  size_t remaining = size;
+  int error = 0;
+  while (remaining > 0)
+  {
+    int available = stream->available();
+    if (available < 0)
+    {
+      error = HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+      break;
+    }
+    if (available == 0)
+    {
+      delay(1);
+      continue;
+    }
+    size_t wanted = std::min<size_t>(std::min<size_t>(available, HTTP_TCP_BUFFER_SIZE), remaining);
+    size_t read = stream->readBytes((char *)buffer, wanted);
+    if (read == 0 || m_client->write(buffer, read) != read)
+    {
+      error = HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+      break;
+    }
+    remaining -= read;
+  }
+  free(buffer);
+  if (error < 0)
+  {
+    return return_error(error);
+  }
+  return return_error(handle_header_response());
+}
+
+int HTTPClient::read_byte()
+{
+  unsigned long start = millis();
+  while (m_client->available() <= 0)
+  {
+    if (!m_client->connected() || millis() - start > m_timeout)
+    {
+      return -1;
+    }
+    delay(1);
+  }
+  return m_client->read();
+}
+
+bool HTTPClient::read_line(String &line)
+{
+  line = "";
+  int c;
+  while ((c = read_byte()) >= 0)
+  {
+    if (c == '\n')
+    {
+      line.trim();
+      return true;
+    }
+    line += (char)c;
+  }
+  return false;
+}
+
+int HTTPClient::handle_header_response()
+{
+  m_size = -1;
+  m_chunked = false;
+  m_can_reuse = m_reuse;
+  m_return_code = 0;
+  String line;
+  if (!read_line(line))
+  {
+    return connected() ? HTTPC_ERROR_READ_TIMEOUT : HTTPC_ERROR_CONNECTION_LOST;
+  }
+  if (!line.startsWith("HTTP/1."))
+  {
+    return HTTPC_ERROR_NO_HTTP_SERVER;
+  }
+  int space = line.indexOf(' ');
+  m_return_code = line.substring(space + 1).toInt();
+  while (read_line(line))
+  {
+    if (line.length() == 0)
+    {
+      return m_return_code > 0 ? m_return_code : HTTPC_ERROR_NO_HTTP_SERVER;
+    }
+    int colon = line.indexOf(':');
+    String name = line.substring(0, colon);
+    String value = line.substring(colon + 1);
+    name.toLowerCase();
+    value.trim();
+    value.toLowerCase();
+    if (name == "content-length")
+    {
+      m_size = value.toInt();
+    }
+    else if (name == "transfer-encoding")
+    {
+      m_chunked = value == "chunked";
+    }
+    else if (name == "connection" && value.indexOf("close") >= 0 && value.indexOf("keep-alive") < 0)
+    {
+      m_can_reuse = false;
+    }
+  }
+  return connected() ? HTTPC_ERROR_READ_TIMEOUT : HTTPC_ERROR_CONNECTION_LOST;
+}
+
+int HTTPClient::write_block(Stream *stream, int length)
+{
+  uint8_t *buffer = (uint8_t *)malloc(HTTP_TCP_BUFFER_SIZE);
+  if (!buffer)
+  {
+    return HTTPC_ERROR_TOO_LESS_RAM;
+  }
+  int total = 0;
+  int result = 0;
+  // a length of -1 runs until the server closes the connection
+  while (length < 0 || total < length)
+  {
+    int c = read_byte();
+    if (c < 0)
+    {
+      result = length < 0 && !m_client->connected() ? 0 : HTTPC_ERROR_READ_TIMEOUT;
+      break;
+    }
+    buffer[0] = c;
+    int count = 1;
+    int wanted = HTTP_TCP_BUFFER_SIZE;
+    if (length >= 0 && length - total < wanted)
+    {
+      wanted = length - total;
+    }
+    int available = std::min(m_client->available(), wanted - 1);
+    if (available > 0)
+    {
+      int read = m_client->read(buffer + 1, available);
+      count += read > 0 ? read : 0;
+    }
+    if ((int)stream->write(buffer, count) != count)
+    {
+      result = HTTPC_ERROR_STREAM_WRITE;
+      break;
+    }
+    total += count;
+  }
+  free(buffer);
+  return result < 0 ? result : total;
+}
+
+int HTTPClient::writeToStream(Stream *stream)
+{
+  if (!stream)
+  {
+    return return_error(HTTPC_ERROR_NO_STREAM);
+  }
+  if (!connected())
+  {
+    return return_error(HTTPC_ERROR_NOT_CONNECTED);
+  }
+  int total = 0;
+  if (!m_chunked)
+  {
+    total = write_block(stream, m_size);
+    if (total < 0)
+    {
+      return return_error(total);
+    }
+  }
+  else
+  {
+    String line;
+    while (true)
+    {
+      if (!read_line(line))
+      {
+        return return_error(HTTPC_ERROR_READ_TIMEOUT);
+      }
+      int length = strtol(line.c_str(), NULL, 16);
+      if (length == 0)
+      {
+        // skip any trailers up to the blank line
+        while (read_line(line) && line.length() > 0)
+        {
+        }
+        break;
+      }
+      int written = write_block(stream, length);
+      if (written < 0)
+      {
+        return return_error(written);
+      }
+      total += written;
+      if (!read_line(line))
+      {
+        return return_error(HTTPC_ERROR_READ_TIMEOUT);
+      }
+    }
+  }
+  disconnect(true);
+  return total;
+}
+
+String HTTPClient::getString()
+{
+  String result;
+  if (m_size > 0)
+  {
+    result.reserve(m_size);
+  }
+  StringStream stream(result);
+  writeToStream(&stream);
+  return result;
+}
+
+String HTTPClient::errorToString(int error)
+{
+  switch (error)
+  {
+  case HTTPC_ERROR_CONNECTION_REFUSED:
+    return "connection refused";
+  case HTTPC_ERROR_SEND_HEADER_FAILED:
+    return "send header failed";
+  case HTTPC_ERROR_SEND_PAYLOAD_FAILED:
+    return "send payload failed";
+  case HTTPC_ERROR_NOT_CONNECTED:
+    return "not connected";
+  case HTTPC_ERROR_CONNECTION_LOST:
+    return "connection lost";
+  case HTTPC_ERROR_NO_STREAM:
+    return "no stream";
+  case HTTPC_ERROR_NO_HTTP_SERVER:
+    return "no HTTP server";
+  case HTTPC_ERROR_TOO_LESS_RAM:
+    return "too less ram";
+  case HTTPC_ERROR_ENCODING:
+    return "Transfer-Encoding not supported";
+  case HTTPC_ERROR_STREAM_WRITE:
+    return "Stream write error";
+  case HTTPC_ERROR_READ_TIMEOUT:
+    return "read Timeout";
+  default:
+    return String();
+  }
+}
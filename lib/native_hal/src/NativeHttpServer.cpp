@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <chrono>
+#include "NativeHttpServer.h"
+#include "WiFiClient.h"
+
+NativeHttpServer::NativeHttpServer(Handler handler)
+    : m_handler(handler), m_running(true), m_connections(0), m_requests(0), m_handshake_ms(0),
+      m_bytes_per_second(0), m_keep_bodies(true)
+{
+  m_listener = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  bind(m_listener, (struct sockaddr *)&address, sizeof(address));
+  socklen_t length = sizeof(address);
+  getsockname(m_listener, (struct sockaddr *)&address, &length);
+  m_port = ntohs(address.sin_port);
+  listen(m_listener, 8);
+  m_accept_thread = std::thread(&NativeHttpServer::accept_loop, this);
+}
+
+NativeHttpServer::~NativeHttpServer()
+{
+  m_running = false;
+  shutdown(m_listener, SHUT_RDWR);
+  close(m_listener);
+  m_accept_thread.join();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int socket : m_sockets)
+    {
+      shutdown(socket, SHUT_RDWR);
+    }
+  }
+  for (std::thread &thread : m_threads)
+  {
+    thread.join();
+  }
+}
+
+void NativeHttpServer::route(const char *host)
+{
+  native_route_host(host, m_port);
+}
+
+std::vector<NativeHttpServer::Request> NativeHttpServer::received()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_received;
+}
+
+void NativeHttpServer::accept_loop()
+{
+  while (m_running)
+  {
+    int socket = accept(m_listener, NULL, NULL);
+    if (socket < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    int on = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    m_connections++;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sockets.push_back(socket);
+    m_threads.push_back(std::thread(&NativeHttpServer::serve, this, socket));
+  }
+}
+
+bool NativeHttpServer::read_more(int socket, std::string &buffer)
+{
+  char data[4096];
+  size_t wanted = sizeof(data);
+  uint32_t rate = m_bytes_per_second;
+  if (rate > 0)
+  {
+    // a slow link - take a little at a time and wait for as long as it would have taken to arrive
+    wanted = std::max<size_t>(1, std::min<size_t>(wanted, rate / 100));
+    std::this_thread::sleep_for(std::chrono::microseconds(1000000ull * wanted / rate));
+  }
+  ssize_t count = recv(socket, data, wanted, 0);
+  if (count <= 0)
+  {
+    return false;
+  }
+  buffer.append(data, count);
+  return true;
+}
+
+bool NativeHttpServer::read_body(int socket, std::string &buffer, Request &request, size_t length)
+{
+  while (length > 0)
+  {
+    if (buffer.empty() && !read_more(socket, buffer))
+    {
+      return false;
+    }
+    size_t count = std::min(length, buffer.size());
+    if (m_keep_bodies)
+    {
+      request.body.append(buffer, 0, count);
+    }
+    buffer.erase(0, count);
+    request.body_size += count;
+    length -= count;
+    if (m_on_body)
+    {
+      m_on_body(request, request.body_size);
+    }
+  }
+  return true;
+}
+
+// take a line off the front of the buffer
+static bool take_line(std::string &buffer, std::string &line)
+{
+  size_t end = buffer.find("\r\n");
+  if (end == std::string::npos)
+  {
+    return false;
+  }
+  line = buffer.substr(0, end);
+  buffer.erase(0, end + 2);
+  return true;
+}
+
+bool NativeHttpServer::read_request(int socket, std::string &buffer, Request &request)
+{
+  std::string line;
+  while (!take_line(buffer, line))
+  {
+    if (!read_more(socket, buffer))
+    {
+      return false;
+    }
+  }
+  size_t space = line.find(' ');
+  request.method = line.substr(0, space);
+  request.path = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+  while (true)
+  {
+    while (!take_line(buffer, line))
+    {
+      if (!read_more(socket, buffer))
+      {
+        return false;
+      }
+    }
+    if (line.empty())
+    {
+      break;
+    }
+    size_t colon = line.find(':');
+    std::string name = line.substr(0, colon);
+    for (char &c : name)
+    {
+      c = tolower(c);
+    }
+    size_t value = line.find_first_not_of(' ', colon + 1);
+    request.headers[name] = value == std::string::npos ? "" : line.substr(value);
+  }
+  if (request.headers.count("transfer-encoding") && request.headers["transfer-encoding"] == "chunked")
+  {
+    request.chunked = true;
+    while (true)
+    {
+      while (!take_line(buffer, line))
+      {
+        if (!read_more(socket, buffer))
+        {
+          return false;
+        }
+      }
+      size_t length = strtoul(line.c_str(), NULL, 16);
+      if (length == 0)
+      {
+        // no trailers - just the blank line
+        while (!take_line(buffer, line))
+        {
+          if (!read_more(socket, buffer))
+          {
+            return false;
+          }
+        }
+        return true;
+      }
+      if (!read_body(socket, buffer, request, length))
+      {
+        return false;
+      }
+      while (!take_line(buffer, line))
+      {
+        if (!read_more(socket, buffer))
+        {
+          return false;
+        }
+      }
+    }
+  }
+  if (request.headers.count("content-length"))
+  {
+    return read_body(socket, buffer, request, strtoul(request.headers["content-length"].c_str(), NULL, 10));
+  }
+  return true;
+}
+
+static bool send_all(int socket, const std::string &data)
+{
+  size_t sent = 0;
+  while (sent < data.size())
+  {
+    ssize_t count = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (count <= 0)
+    {
+      return false;
+    }
+    sent += count;
+  }
+  return true;
+}
+
+void NativeHttpServer::send_response(int socket, const Response &response)
+{
+  if (response.delay_ms > 0)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(response.delay_ms));
+  }
+  std::string head = "HTTP/1.1 " + std::to_string(response.status) + (response.status == 200 ? " OK" : " Error") + "\r\n";
+  head += "Content-Type: " + response.content_type + "\r\n";
+  head += response.close ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+  std::string body = response.body;
+  if (response.cut_short)
+  {
+    body = body.substr(0, body.size() / 2);
+  }
+  if (response.chunk_size > 0)
+  {
+    head += "Transfer-Encoding: chunked\r\n\r\n";
+    if (!send_all(socket, head))
+    {
+      return;
+    }
+    for (size_t position = 0; position < body.size(); position += response.chunk_size)
+    {
+      std::string chunk = body.substr(position, response.chunk_size);
+      char size[16];
+      snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+      if (!send_all(socket, size + chunk + "\r\n"))
+      {
+        return;
+      }
+    }
+    if (!response.cut_short)
+    {
+      send_all(socket, "0\r\n\r\n");
+    }
+    return;
+  }
+  head += "Content-Length: " + std::to_string(response.body.size()) + "\r\n\r\n";
+  send_all(socket, head + body);
+}
+
+void NativeHttpServer::serve(int socket)
+{
+  if (m_handshake_ms > 0)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(m_handshake_ms));
+  }
+  std::string buffer;
+  while (m_running)
+  {
+    Request request;
+    if (!read_request(socket, buffer, request))
+    {
+      break;
+    }
+    Response response = m_handler(request);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_received.push_back(request);
+    }
+    m_requests++;
+    send_response(socket, response);
+    if (response.close || response.cut_short)
+    {
+      break;
+    }
+  }
+  shutdown(socket, SHUT_RDWR);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t i = 0; i < m_sockets.size(); i++)
+  {
+    if (m_sockets[i] == socket)
+    {
+      m_sockets.erase(m_sockets.begin() + i);
+      break;
+    }
+  }
+  close(socket);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A local HTTP/1.1 server standing in for Telegram and Gemini in host tests
+ *
+ * Listens on a free port on this machine and answers each request with whatever the handler
+ * returns. Keeps connections alive between requests, takes request bodies with a
+ * Content-Length or chunked, and can be made to behave like a slow server on the far end of
+ * a TLS connection - a delay before the first byte of each new connection and a limit on how
+ * fast it reads.
+ */
+class NativeHttpServer
+{
+public:
+  struct Request
+  {
+    std::string method;
+    std::string path;
+    // names are lower case
+    std::map<std::string, std::string> headers;
+    // empty if bodies aren't being kept
+    std::string body;
+    size_t body_size = 0;
+    bool chunked = false;
+  };
+
+  struct Response
+  {
+    int status = 200;
+    std::string content_type = "application/json";
+    std::string body;
+    // send the body as chunks of this size rather than with a Content-Length
+    size_t chunk_size = 0;
+    // close the connection after this response
+    bool close = false;
+    // stop part way through the body and close the connection
+    bool cut_short = false;
+    // how long to think before answering
+    uint32_t delay_ms = 0;
+  };
+
+  typedef std::function<Response(const Request &)> Handler;
+  // called as each piece of a request body arrives with the total so far
+  typedef std::function<void(const Request &, size_t received)> BodyCallback;
+
+private:
+  Handler m_handler;
+  BodyCallback m_on_body;
+  int m_listener = -1;
+  uint16_t m_port = 0;
+  std::thread m_accept_thread;
+  std::mutex m_mutex;
+  std::vector<std::thread> m_threads;
+  std::vector<int> m_sockets;
+  std::atomic<bool> m_running;
+  std::atomic<int> m_connections;
+  std::atomic<int> m_requests;
+  std::atomic<uint32_t> m_handshake_ms;
+  std::atomic<uint32_t> m_bytes_per_second;
+  std::atomic<bool> m_keep_bodies;
+  std::vector<Request> m_received;
+
+  void accept_loop();
+  void serve(int socket);
+  bool read_request(int socket, std::string &buffer, Request &request);
+  bool read_body(int socket, std::string &buffer, Request &request, size_t length);
+  bool read_more(int socket, std::string &buffer);
+  void send_response(int socket, const Response &response);
+
+public:
+  NativeHttpServer(Handler handler);
+  ~NativeHttpServer();
+  uint16_t port() { return m_port; }
+  // send the client's connections to host here instead
+  void route(const char *host);
+  void set_on_body(BodyCallback on_body) { m_on_body = on_body; }
+  // a TLS handshake stand-in - every new connection waits this long before anything is read
+  void set_handshake_ms(uint32_t ms) { m_handshake_ms = ms; }
+  // read request bodies no faster than this - 0 for as fast as they come
+  void set_bytes_per_second(uint32_t bytes_per_second) { m_bytes_per_second = bytes_per_second; }
+  // keep the body of every request - turn off for big uploads
+  void set_keep_bodies(bool keep) { m_keep_bodies = keep; }
+  // connections accepted and requests answered so far
+  int connections() { return m_connections; }
+  int requests() { return m_requests; }
+  // every request answered so far
+  std::vector<Request> received();
+};
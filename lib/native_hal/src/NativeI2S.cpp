@@ -0,0 +1,349 @@
+#include <chrono>
+#include <thread>
+#include <string.h>
+#include "driver/i2s.h"
+#include "Arduino.h"
+#include "NativeDevice.h"
+
+static NativeDevice::I2SPort *get_port(i2s_port_t i2s_num)
+{
+  if (i2s_num < 0 || i2s_num >= NATIVE_I2S_PORT_COUNT)
+  {
+    return NULL;
+  }
+  return &NativeDevice::current()->i2s_port(i2s_num);
+}
+
+// frames of audio that pass through the port between its origin and now
+static uint64_t elapsed_frames(uint64_t origin_us, int sample_rate)
+{
+  return (native_micros() - origin_us) * sample_rate / 1000000;
+}
+
+static void sleep_until_frame(uint64_t origin_us, int sample_rate, uint64_t frame)
+{
+  uint64_t due_us = origin_us + frame * 1000000 / sample_rate;
+  uint64_t now = native_micros();
+  if (due_us > now)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(due_us - now));
+  }
+}
+
+static void write_wav_header(FILE *file, int sample_rate, int channels, int frame_size, uint32_t data_size)
+{
+  uint8_t header[44];
+  uint32_t values[] = {data_size + 36, 16, (uint32_t)sample_rate, (uint32_t)(sample_rate * frame_size), data_size};
+  memcpy(header, "RIFF", 4);
+  memcpy(header + 4, &values[0], 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  memcpy(header + 16, &values[1], 4);
+  uint16_t format[] = {1, (uint16_t)channels};
+  memcpy(header + 20, format, 4);
+  memcpy(header + 24, &values[2], 8);
+  uint16_t alignment[] = {(uint16_t)frame_size, (uint16_t)(frame_size / channels * 8)};
+  memcpy(header + 32, alignment, 4);
+  memcpy(header + 36, "data", 4);
+  memcpy(header + 40, &values[4], 4);
+  long position = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  fwrite(header, 1, sizeof(header), file);
+  fseek(file, position < (long)sizeof(header) ? (long)sizeof(header) : position, SEEK_SET);
+  fflush(file);
+}
+
+// skip to the samples if the file is a WAV - anything else is taken to be raw samples
+static void skip_wav_header(FILE *file, const char *path)
+{
+  uint8_t header[12];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+  {
+    fseek(file, 0, SEEK_SET);
+    return;
+  }
+  uint8_t chunk[8];
+  while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk))
+  {
+    uint32_t size;
+    memcpy(&size, chunk + 4, 4);
+    if (memcmp(chunk, "data", 4) == 0)
+    {
+      return;
+    }
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+    {
+      uint16_t format[8];
+      fread(format, 1, 16, file);
+      if (format[1] != 1 || format[7] != 16)
+      {
+        Serial.printf("%s should be 16 bit mono - reading it as if it was\n", path);
+      }
+      size -= 16;
+    }
+    fseek(file, size + (size & 1), SEEK_CUR);
+  }
+}
+
+// what the hardware would give us for a sample in the input file - the inverse of what the samplers do
+static void put_input_sample(uint8_t *dest, const NativeDevice::I2SPort &port, int16_t sample)
+{
+  if (port.adc)
+  {
+    // 12 bit ADC reading centred on 2048
+    int code = 2048 - sample / 15;
+    uint16_t value = code < 0 ? 0 : (code > 4095 ? 4095 : code);
+    memcpy(dest, &value, 2);
+  }
+  else if (port.bytes_per_sample == 4)
+  {
+    int32_t value = (int32_t)sample * (1 << 11);
+    memcpy(dest, &value, 4);
+  }
+  else if (port.bytes_per_sample == 2)
+  {
+    memcpy(dest, &sample, 2);
+  }
+  else
+  {
+    *dest = (uint8_t)(sample >> 8);
+  }
+}
+
+esp_err_t i2s_driver_install(i2s_port_t i2s_num, const i2s_config_t *i2s_config, int queue_size, void *i2s_queue)
+{
+  NativeDevice::I2SPort *port = get_port(i2s_num);
+  if (!port || !i2s_config || i2s_config->sample_rate <= 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (port->installed)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  port->installed = true;
+  port->mode = i2s_config->mode;
+  port->adc = i2s_config->mode & I2S_MODE_ADC_BUILT_IN;
+  port->sample_rate = i2s_config->sample_rate;
+  // 24 bit samples take up 32 bits
+  port->bytes_per_sample = i2s_config->bits_per_sample == I2S_BITS_PER_SAMPLE_24BIT ? 4 : i2s_config->bits_per_sample / 8;
+  port->channels = i2s_config->channel_format < I2S_CHANNEL_FMT_ONLY_RIGHT ? 2 : 1;
+  port->dma_buf_count = i2s_config->dma_buf_count;
+  port->dma_buf_len = i2s_config->dma_buf_len;
+  uint64_t now = native_micros();
+  if (port->mode & I2S_MODE_RX)
+  {
+    if (port->input_changed.exchange(false) && port->input)
+    {
+      fclose(port->input);
+      port->input = NULL;
+      port->input_finished = false;
+    }
+    if (!port->input && !port->input_path.empty())
+    {
+      port->input = fopen(port->input_path.c_str(), "rb");
+      if (!port->input)
+      {
+        Serial.printf("Failed to open I2S input %s\n", port->input_path.c_str());
+      }
+      else
+      {
+        skip_wav_header(port->input, port->input_path.c_str());
+      }
+      port->input_origin_us = now;
+      port->frames_read = 0;
+    }
+    else if (port->input)
+    {
+      // the sound carried on while the input was off
+      uint64_t missed = elapsed_frames(port->input_origin_us, port->sample_rate) - port->frames_read;
+      fseek(port->input, missed * sizeof(int16_t), SEEK_CUR);
+      port->frames_read += missed;
+    }
+  }
+  if ((port->mode & I2S_MODE_TX) && !port->output && !port->output_path.empty())
+  {
+    port->output = fopen(port->output_path.c_str(), "wb");
+    if (!port->output)
+    {
+      Serial.printf("Failed to create I2S output %s\n", port->output_path.c_str());
+    }
+    port->output_origin_us = now;
+    port->frames_written = 0;
+    port->output_sample_rate = port->sample_rate;
+    port->output_channels = port->channels;
+    port->output_frame_size = port->bytes_per_sample * port->channels;
+    if (port->output)
+    {
+      write_wav_header(port->output, port->output_sample_rate, port->output_channels, port->output_frame_size, 0);
+    }
+  }
+  else if ((port->mode & I2S_MODE_TX) && port->output_origin_us == 0)
+  {
+    port->output_origin_us = now;
+  }
+  return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t i2s_num)
+{
+  NativeDevice::I2SPort *port = get_port(i2s_num);
+  if (!port || !port->installed)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  port->installed = false;
+  if (port->output)
+  {
+    // keep the file valid while the port is off
+    write_wav_header(port->output, port->output_sample_rate, port->output_channels, port->output_frame_size,
+                     port->frames_written * port->output_frame_size);
+  }
+  return ESP_OK;
+}
+
+void NativeDevice::finish_i2s(int i2s_num)
+{
+  I2SPort &port = m_i2s[i2s_num];
+  if (port.output)
+  {
+    write_wav_header(port.output, port.output_sample_rate, port.output_channels, port.output_frame_size,
+                     port.frames_written * port.output_frame_size);
+    fclose(port.output);
+    port.output = NULL;
+  }
+  if (port.input)
+  {
+    fclose(port.input);
+    port.input = NULL;
+  }
+}
+
+esp_err_t i2s_read(i2s_port_t i2s_num, void *dest, size_t size, size_t *bytes_read, TickType_t ticks_to_wait)
+{
+  NativeDevice::I2SPort *port = get_port(i2s_num);
+  *bytes_read = 0;
+  if (!port || !port->installed || !(port->mode & I2S_MODE_RX))
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  int frame_size = port->bytes_per_sample * port->channels;
+  uint64_t frames = size / frame_size;
+  // the DMA hands samples over a buffer at a time
+  uint64_t wanted = port->frames_read + frames;
+  uint64_t buffers = (wanted + port->dma_buf_len - 1) / port->dma_buf_len;
+  sleep_until_frame(port->input_origin_us, port->sample_rate, buffers * port->dma_buf_len);
+  uint64_t captured = elapsed_frames(port->input_origin_us, port->sample_rate) / port->dma_buf_len * port->dma_buf_len;
+  uint64_t capacity = (uint64_t)port->dma_buf_count * port->dma_buf_len;
+  if (captured > port->frames_read + capacity)
+  {
+    // we weren't reading fast enough so the oldest samples have been overwritten
+    uint64_t dropped = captured - port->frames_read - capacity;
+    if (port->input)
+    {
+      fseek(port->input, dropped * sizeof(int16_t), SEEK_CUR);
+    }
+    port->frames_read += dropped;
+    port->frames_dropped += dropped;
+  }
+  uint8_t *output = (uint8_t *)dest;
+  for (uint64_t i = 0; i < frames; i++)
+  {
+    int16_t sample = 0;
+    if (!port->input || fread(&sample, sizeof(sample), 1, port->input) != 1)
+    {
+      // nothing left to say
+      sample = 0;
+      port->input_finished = true;
+    }
+    for (int channel = 0; channel < port->channels; channel++)
+    {
+      put_input_sample(output, *port, sample);
+      output += port->bytes_per_sample;
+    }
+  }
+  port->frames_read += frames;
+  *bytes_read = frames * frame_size;
+  return ESP_OK;
+}
+
+esp_err_t i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, TickType_t ticks_to_wait)
+{
+  NativeDevice::I2SPort *port = get_port(i2s_num);
+  *bytes_written = 0;
+  if (!port || !port->installed || !(port->mode & I2S_MODE_TX))
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  int frame_size = port->bytes_per_sample * port->channels;
+  uint64_t frames = size / frame_size;
+  uint64_t played = elapsed_frames(port->output_origin_us, port->sample_rate);
+  if (port->frames_written < played)
+  {
+    // the DMA buffers ran dry (or the output was off) and the speaker played silence
+    if (port->output && frame_size == port->output_frame_size)
+    {
+      static const uint8_t silence[1024] = {0};
+      uint64_t remaining = (played - port->frames_written) * frame_size;
+      while (remaining > 0)
+      {
+        size_t length = remaining < sizeof(silence) ? remaining : sizeof(silence);
+        fwrite(silence, 1, length, port->output);
+        remaining -= length;
+      }
+    }
+    port->frames_written = played;
+  }
+  // wait for room in the DMA buffers
+  uint64_t capacity = (uint64_t)port->dma_buf_count * port->dma_buf_len;
+  if (port->frames_written + frames > capacity)
+  {
+    sleep_until_frame(port->output_origin_us, port->sample_rate, port->frames_written + frames - capacity);
+  }
+  if (port->output && frame_size == port->output_frame_size)
+  {
+    fwrite(src, frame_size, frames, port->output);
+  }
+  port->frames_written += frames;
+  *bytes_written = frames * frame_size;
+  return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t i2s_num, const i2s_pin_config_t *pin)
+{
+  return get_port(i2s_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_start(i2s_port_t i2s_num)
+{
+  return get_port(i2s_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_stop(i2s_port_t i2s_num)
+{
+  return get_port(i2s_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t i2s_num)
+{
+  return get_port(i2s_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_set_adc_mode(adc_unit_t adc_unit, adc1_channel_t adc_channel)
+{
+  return ESP_OK;
+}
+
+esp_err_t i2s_adc_enable(i2s_port_t i2s_num)
+{
+  return get_port(i2s_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_adc_disable(i2s_port_t i2s_num)
+{
+  return get_port(i2s_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_set_dac_mode(i2s_dac_mode_t dac_mode)
+{
+  return ESP_OK;
+}
@@ -0,0 +1,198 @@
+#include <string.h>
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "WiFi.h"
+#include "AsyncUDP.h"
+#include "NativeDevice.h"
+
+WiFiClass WiFi;
+
+IPAddress WiFiClass::localIP()
+{
+  return IPAddress(NativeDevice::current()->ip());
+}
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac)
+{
+  memcpy(mac, NativeDevice::current()->mac(), 6);
+  return mac;
+}
+
+String WiFiClass::macAddress()
+{
+  const uint8_t *mac = NativeDevice::current()->mac();
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return String(text);
+}
+
+esp_err_t esp_wifi_set_promiscuous(bool en)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second)
+{
+  if (primary < 1 || primary > 14)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  std::lock_guard<std::mutex> guard(NativeDevice::lock());
+  NativeDevice::current()->wifi_channel() = primary;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_init()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_deinit()
+{
+  std::lock_guard<std::mutex> guard(NativeDevice::lock());
+  NativeDevice::current()->esp_now_callback() = NULL;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+  std::lock_guard<std::mutex> guard(NativeDevice::lock());
+  NativeDevice::current()->esp_now_callback() = cb;
+  return ESP_OK;
+}
+
+// everyone gets the same packet so there's no point keeping track of peers
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer)
+{
+  return peer ? ESP_OK : ESP_ERR_ESPNOW_ARG;
+}
+
+bool esp_now_is_peer_exist(const uint8_t *peer_addr)
+{
+  return false;
+}
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len)
+{
+  if (!data || len == 0 || len > ESP_NOW_MAX_DATA_LEN)
+  {
+    return ESP_ERR_ESPNOW_ARG;
+  }
+  NativeDevice *sender = NativeDevice::current();
+  // find who can hear us then deliver without holding the lock
+  std::vector<std::pair<NativeDevice *, esp_now_recv_cb_t>> receivers;
+  {
+    std::lock_guard<std::mutex> guard(NativeDevice::lock());
+    for (NativeDevice *device : NativeDevice::devices_locked())
+    {
+      if (device != sender && device->esp_now_callback() && device->wifi_channel() == sender->wifi_channel())
+      {
+        receivers.push_back(std::make_pair(device, device->esp_now_callback()));
+      }
+    }
+  }
+  for (auto &receiver : receivers)
+  {
+    // the callback runs on the receiving device as it would in its WiFi task
+    receiver.first->select();
+    receiver.second(sender->mac(), data, len);
+  }
+  sender->select();
+  return ESP_OK;
+}
+
+AsyncUDP::~AsyncUDP()
+{
+  close();
+}
+
+bool AsyncUDP::listen(uint16_t port)
+{
+  close();
+  std::lock_guard<std::mutex> guard(NativeDevice::lock());
+  m_device = NativeDevice::current();
+  for (NativeDevice::UdpSocket *socket : m_device->udp_sockets())
+  {
+    if (socket->port == port)
+    {
+      // already in use
+      m_device = NULL;
+      return false;
+    }
+  }
+  m_socket = new NativeDevice::UdpSocket();
+  m_socket->port = port;
+  m_device->udp_sockets().push_back(m_socket);
+  return true;
+}
+
+void AsyncUDP::onPacket(AuPacketHandlerFunction handler)
+{
+  std::lock_guard<std::mutex> guard(NativeDevice::lock());
+  if (m_socket)
+  {
+    m_socket->handler = [handler](const uint8_t *address, const uint8_t *data, size_t length, uint16_t remote_port)
+    {
+      AsyncUDPPacket packet(data, length, IPAddress(address[0], address[1], address[2], address[3]), remote_port);
+      handler(packet);
+    };
+  }
+}
+
+size_t AsyncUDP::broadcast(uint8_t *data, size_t len)
+{
+  return m_socket ? broadcastTo(data, len, m_socket->port) : 0;
+}
+
+size_t AsyncUDP::broadcastTo(uint8_t *data, size_t len, uint16_t port)
+{
+  NativeDevice *sender = NativeDevice::current();
+  uint32_t ip = sender->ip();
+  const uint8_t address[4] = {(uint8_t)(ip >> 24), (uint8_t)(ip >> 16), (uint8_t)(ip >> 8), (uint8_t)ip};
+  uint16_t local_port = m_socket ? m_socket->port : port;
+  std::vector<std::pair<NativeDevice *, NativeDevice::UdpSocket>> receivers;
+  {
+    std::lock_guard<std::mutex> guard(NativeDevice::lock());
+    for (NativeDevice *device : NativeDevice::devices_locked())
+    {
+      if (device == sender)
+      {
+        continue;
+      }
+      for (NativeDevice::UdpSocket *socket : device->udp_sockets())
+      {
+        if (socket->port == port && socket->handler)
+        {
+          receivers.push_back(std::make_pair(device, *socket));
+        }
+      }
+    }
+  }
+  for (auto &receiver : receivers)
+  {
+    receiver.first->select();
+    receiver.second.handler(address, data, len, local_port);
+  }
+  sender->select();
+  return len;
+}
+
+void AsyncUDP::close()
+{
+  std::lock_guard<std::mutex> guard(NativeDevice::lock());
+  if (m_socket)
+  {
+    std::vector<NativeDevice::UdpSocket *> &sockets = m_device->udp_sockets();
+    for (size_t i = 0; i < sockets.size(); i++)
+    {
+      if (sockets[i] == m_socket)
+      {
+        sockets.erase(sockets.begin() + i);
+        break;
+      }
+    }
+    delete m_socket;
+    m_socket = NULL;
+    m_device = NULL;
+  }
+}
@@ -0,0 +1,200 @@
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include "SD.h"
+#include "NativeDevice.h"
+
+SDFS SD;
+SPIClass SPI;
+
+namespace fs
+{
+  File::File(FILE *file, const char *name) : m_file(file, fclose), m_name(name)
+  {
+  }
+
+  // sectors on the card
+  static const size_t SECTOR_SIZE = 512;
+
+  size_t File::write(const uint8_t *buffer, size_t size)
+  {
+    if (!m_file)
+    {
+      return 0;
+    }
+    NativeDevice::SdCard &card = NativeDevice::current()->sd_card();
+    size_t position = this->position();
+    uint32_t writes = ++card.writes;
+    if (position % SECTOR_SIZE != 0 && position < this->size())
+    {
+      card.unaligned_writes++;
+    }
+    if (position + size > this->size())
+    {
+      card.extends++;
+    }
+    uint64_t delay_us = card.write_us + (uint64_t)card.us_per_kb * size / 1024;
+    if (card.stall_every > 0 && writes % card.stall_every == 0)
+    {
+      delay_us += card.stall_us;
+    }
+    if (delay_us > 0)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+    }
+    return fwrite(buffer, 1, size, m_file.get());
+  }
+
+  int File::available()
+  {
+    if (!m_file)
+    {
+      return 0;
+    }
+    size_t remaining = size() - position();
+    return remaining > 0x7fffffff ? 0x7fffffff : remaining;
+  }
+
+  int File::read()
+  {
+    return m_file ? fgetc(m_file.get()) : -1;
+  }
+
+  int File::peek()
+  {
+    if (!m_file)
+    {
+      return -1;
+    }
+    int c = fgetc(m_file.get());
+    if (c != EOF)
+    {
+      ungetc(c, m_file.get());
+    }
+    return c;
+  }
+
+  size_t File::read(uint8_t *buffer, size_t size)
+  {
+    return m_file ? fread(buffer, 1, size, m_file.get()) : 0;
+  }
+
+  void File::flush()
+  {
+    if (m_file)
+    {
+      fflush(m_file.get());
+    }
+  }
+
+  bool File::seek(uint32_t pos, SeekMode mode)
+  {
+    if (!m_file || fseek(m_file.get(), pos, mode == SeekSet ? SEEK_SET : (mode == SeekCur ? SEEK_CUR : SEEK_END)) != 0)
+    {
+      return false;
+    }
+    // like FatFs, seeking past the end of a file that's open for writing makes it that long
+    size_t position = this->position();
+    if (position > size() && ftruncate(fileno(m_file.get()), position) == 0)
+    {
+      NativeDevice::current()->sd_card().extends++;
+    }
+    return true;
+  }
+
+  size_t File::position() const
+  {
+    return m_file ? ftell(m_file.get()) : 0;
+  }
+
+  size_t File::size() const
+  {
+    if (!m_file)
+    {
+      return 0;
+    }
+    fflush(m_file.get());
+    struct stat info;
+    return fstat(fileno(m_file.get()), &info) == 0 ? info.st_size : 0;
+  }
+
+  void File::close()
+  {
+    m_file.reset();
+  }
+
+  std::string FS::real_path(const char *path)
+  {
+    return NativeDevice::current()->sd_path(path);
+  }
+
+  File FS::open(const char *path, const char *mode)
+  {
+    std::string real = real_path(path);
+    struct stat info;
+    if (stat(real.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+    {
+      // directories can't be read as files
+      return File();
+    }
+    FILE *file = fopen(real.c_str(), mode);
+    return file ? File(file, path) : File();
+  }
+
+  bool FS::exists(const char *path)
+  {
+    struct stat info;
+    return stat(real_path(path).c_str(), &info) == 0;
+  }
+
+  bool FS::remove(const char *path)
+  {
+    return unlink(real_path(path).c_str()) == 0;
+  }
+
+  bool FS::rename(const char *path_from, const char *path_to)
+  {
+    return ::rename(real_path(path_from).c_str(), real_path(path_to).c_str()) == 0;
+  }
+
+  bool FS::mkdir(const char *path)
+  {
+    return ::mkdir(real_path(path).c_str(), 0755) == 0 || errno == EEXIST;
+  }
+
+  bool FS::rmdir(const char *path)
+  {
+    return ::rmdir(real_path(path).c_str()) == 0;
+  }
+}
+
+bool SDFS::begin(uint8_t ssPin)
+{
+  // make each directory on the way to the card
+  std::string root = real_path("/");
+  for (size_t i = 1; i <= root.size(); i++)
+  {
+    if (i == root.size() || root[i] == '/')
+    {
+      std::string directory = root.substr(0, i);
+      if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+      {
+        Serial.printf("Failed to create %s\n", directory.c_str());
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// the recorder gives back the end of a file with the C library's truncate on the card's VFS path -
+// that goes to the device's directory the same as it would go to the card on the ESP32
+extern "C" int truncate(const char *path, off_t length)
+{
+  const size_t mount_length = strlen(NATIVE_SD_MOUNT_POINT);
+  std::string real = strncmp(path, NATIVE_SD_MOUNT_POINT "/", mount_length + 1) == 0 ? NativeDevice::current()->sd_path(path + mount_length) : path;
+  return syscall(SYS_truncate, real.c_str(), length);
+}
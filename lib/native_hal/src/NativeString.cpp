@@ -0,0 +1,151 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "WString.h"
+
+std::string String::number(long long value, unsigned char base)
+{
+  if (value < 0 && base == 10)
+  {
+    return "-" + number((unsigned long long)-value, base);
+  }
+  return number((unsigned long long)value, base);
+}
+
+std::string String::number(unsigned long long value, unsigned char base)
+{
+  if (base < 2 || base > 36)
+  {
+    base = 10;
+  }
+  char digits[65];
+  int position = sizeof(digits) - 1;
+  digits[position] = 0;
+  do
+  {
+    int digit = value % base;
+    digits[--position] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= base;
+  } while (value > 0);
+  return std::string(digits + position);
+}
+
+String::String(float value, unsigned int decimal_places) : String((double)value, decimal_places)
+{
+}
+
+String::String(double value, unsigned int decimal_places)
+{
+  char text[64];
+  snprintf(text, sizeof(text), "%.*f", decimal_places, value);
+  m_text = text;
+}
+
+bool String::equalsIgnoreCase(const String &other) const
+{
+  if (m_text.length() != other.m_text.length())
+  {
+    return false;
+  }
+  for (size_t i = 0; i < m_text.length(); i++)
+  {
+    if (tolower((unsigned char)m_text[i]) != tolower((unsigned char)other.m_text[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+  size_t found = m_text.find(c, from);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+int String::indexOf(const String &text, unsigned int from) const
+{
+  size_t found = m_text.find(text.m_text, from);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+int String::lastIndexOf(char c) const
+{
+  size_t found = m_text.rfind(c);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+int String::lastIndexOf(const String &text) const
+{
+  size_t found = m_text.rfind(text.m_text);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+  // like the Arduino core the ends can be either way round
+  if (from > to)
+  {
+    std::swap(from, to);
+  }
+  String result;
+  if (from < m_text.length())
+  {
+    result.m_text = m_text.substr(from, std::min<size_t>(to, m_text.length()) - from);
+  }
+  return result;
+}
+
+void String::replace(const String &find, const String &replace)
+{
+  if (find.m_text.empty())
+  {
+    return;
+  }
+  size_t position = 0;
+  while ((position = m_text.find(find.m_text, position)) != std::string::npos)
+  {
+    m_text.replace(position, find.m_text.length(), replace.m_text);
+    position += replace.m_text.length();
+  }
+}
+
+void String::remove(unsigned int index, unsigned int count)
+{
+  if (index < m_text.length())
+  {
+    m_text.erase(index, count);
+  }
+}
+
+void String::toLowerCase()
+{
+  for (char &c : m_text)
+  {
+    c = tolower((unsigned char)c);
+  }
+}
+
+void String::toUpperCase()
+{
+  for (char &c : m_text)
+  {
+    c = toupper((unsigned char)c);
+  }
+}
+
+void String::trim()
+{
+  size_t start = 0;
+  while (start < m_text.length() && isspace((unsigned char)m_text[start]))
+  {
+    start++;
+  }
+  size_t end = m_text.length();
+  while (end > start && isspace((unsigned char)m_text[end - 1]))
+  {
+    end--;
+  }
+  m_text = m_text.substr(start, end - start);
+}
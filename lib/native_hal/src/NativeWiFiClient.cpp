@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include "WiFiClient.h"
+
+static std::mutex routes_mutex;
+static std::map<std::string, uint16_t> routes;
+
+void native_route_host(const char *host, uint16_t port)
+{
+  std::lock_guard<std::mutex> lock(routes_mutex);
+  routes[host] = port;
+}
+
+void native_clear_routes()
+{
+  std::lock_guard<std::mutex> lock(routes_mutex);
+  routes.clear();
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+  stop();
+  std::string address = host;
+  {
+    std::lock_guard<std::mutex> lock(routes_mutex);
+    auto route = routes.find(host);
+    if (route != routes.end())
+    {
+      address = "127.0.0.1";
+      port = route->second;
+    }
+  }
+  struct addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *result;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(address.c_str(), service, &hints, &result) != 0)
+  {
+    return 0;
+  }
+  m_socket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (m_socket >= 0 && ::connect(m_socket, result->ai_addr, result->ai_addrlen) != 0)
+  {
+    close(m_socket);
+    m_socket = -1;
+  }
+  freeaddrinfo(result);
+  if (m_socket < 0)
+  {
+    return 0;
+  }
+  int on = 1;
+  setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return 1;
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+  size_t written = 0;
+  while (m_socket >= 0 && written < size)
+  {
+    ssize_t sent = send(m_socket, buffer + written, size - written, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (sent <= 0)
+    {
+      stop();
+      break;
+    }
+    written += sent;
+  }
+  return written;
+}
+
+int WiFiClient::available()
+{
+  int count = 0;
+  if (m_socket < 0 || ioctl(m_socket, FIONREAD, &count) != 0)
+  {
+    return 0;
+  }
+  return count;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+  if (m_socket < 0)
+  {
+    return -1;
+  }
+  ssize_t count = recv(m_socket, buffer, size, MSG_DONTWAIT);
+  return count > 0 ? count : -1;
+}
+
+int WiFiClient::peek()
+{
+  uint8_t c;
+  if (m_socket < 0 || recv(m_socket, &c, 1, MSG_DONTWAIT | MSG_PEEK) != 1)
+  {
+    return -1;
+  }
+  return c;
+}
+
+void WiFiClient::stop()
+{
+  if (m_socket >= 0)
+  {
+    close(m_socket);
+    m_socket = -1;
+  }
+}
+
+uint8_t WiFiClient::connected()
+{
+  if (m_socket < 0)
+  {
+    return 0;
+  }
+  // still connected while there is something left to read even if the other end has closed
+  uint8_t c;
+  ssize_t count = recv(m_socket, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+  if (count > 0 || (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)))
+  {
+    return 1;
+  }
+  stop();
+  return 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "FS.h"
+#include "SPI.h"
+
+typedef enum
+{
+  CARD_NONE,
+  CARD_MMC,
+  CARD_SD,
+  CARD_SDHC,
+  CARD_UNKNOWN
+} sdcard_type_t;
+
+// where the ESP-IDF VFS puts the card for the C library - paths under it are the device's too
+#define NATIVE_SD_MOUNT_POINT "/sd"
+
+/**
+ * @brief The SD card is a directory on the host, one per device - see NativeDevice::set_sd_root
+ */
+class SDFS : public fs::FS
+{
+public:
+  // makes the directory if it isn't there
+  bool begin(uint8_t ssPin = 5);
+  bool begin(uint8_t ssPin, SPIClass &spi, uint32_t frequency = 4000000) { return begin(ssPin); }
+  void end() {}
+  sdcard_type_t cardType() { return CARD_SDHC; }
+};
+
+extern SDFS SD;
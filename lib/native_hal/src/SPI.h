@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#define VSPI 3
+#define HSPI 2
+
+/**
+ * @brief The SD card on the host is a directory so there's no bus to set up
+ */
+class SPIClass
+{
+public:
+  SPIClass(uint8_t spi_bus = HSPI) {}
+  void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+  void end() {}
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "WString.h"
+#include "WiFiClient.h"
+
+/**
+ * @brief The application sends to Telegram with its own requests and only keeps the bot to say
+ * it's been set up - this is enough of it for that
+ */
+class UniversalTelegramBot
+{
+private:
+  String m_token;
+  Client &m_client;
+
+public:
+  UniversalTelegramBot(const String &token, Client &client) : m_token(token), m_client(client) {}
+};
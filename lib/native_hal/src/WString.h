@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string>
+#include <type_traits>
+
+/**
+ * @brief The Arduino String for host builds - the same interface over a std::string so the
+ * text still lives on the heap like it does on the ESP32
+ */
+class String
+{
+private:
+  std::string m_text;
+
+  static std::string number(long long value, unsigned char base);
+  static std::string number(unsigned long long value, unsigned char base);
+
+public:
+  String() {}
+  String(const char *text) : m_text(text ? text : "") {}
+  String(const String &other) = default;
+  String(String &&other) = default;
+  explicit String(char c) : m_text(1, c) {}
+  explicit String(unsigned char value, unsigned char base = 10) : m_text(number((unsigned long long)value, base)) {}
+  explicit String(int value, unsigned char base = 10) : m_text(number((long long)value, base)) {}
+  explicit String(unsigned int value, unsigned char base = 10) : m_text(number((unsigned long long)value, base)) {}
+  explicit String(long value, unsigned char base = 10) : m_text(number((long long)value, base)) {}
+  explicit String(unsigned long value, unsigned char base = 10) : m_text(number((unsigned long long)value, base)) {}
+  explicit String(long long value, unsigned char base = 10) : m_text(number(value, base)) {}
+  explicit String(unsigned long long value, unsigned char base = 10) : m_text(number(value, base)) {}
+  explicit String(float value, unsigned int decimal_places = 2);
+  explicit String(double value, unsigned int decimal_places = 2);
+
+  String &operator=(const String &other) = default;
+  String &operator=(String &&other) = default;
+  String &operator=(const char *text)
+  {
+    m_text = text ? text : "";
+    return *this;
+  }
+
+  bool reserve(unsigned int size)
+  {
+    m_text.reserve(size);
+    return true;
+  }
+  unsigned int length() const { return m_text.length(); }
+  bool isEmpty() const { return m_text.empty(); }
+  const char *c_str() const { return m_text.c_str(); }
+
+  bool concat(const String &other)
+  {
+    m_text += other.m_text;
+    return true;
+  }
+  bool concat(const char *text)
+  {
+    m_text += text ? text : "";
+    return true;
+  }
+  bool concat(const char *text, unsigned int length)
+  {
+    m_text.append(text, length);
+    return true;
+  }
+  bool concat(char c)
+  {
+    m_text += c;
+    return true;
+  }
+  template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+  bool concat(T value) { return concat(String(value)); }
+  template <typename T>
+  String &operator+=(const T &value)
+  {
+    concat(value);
+    return *this;
+  }
+
+  bool equals(const String &other) const { return m_text == other.m_text; }
+  bool equals(const char *text) const { return m_text == (text ? text : ""); }
+  bool equalsIgnoreCase(const String &other) const;
+  bool operator==(const String &other) const { return equals(other); }
+  bool operator==(const char *text) const { return equals(text); }
+  bool operator!=(const String &other) const { return !equals(other); }
+  bool operator!=(const char *text) const { return !equals(text); }
+  bool operator<(const String &other) const { return m_text < other.m_text; }
+  bool startsWith(const String &prefix) const { return m_text.compare(0, prefix.m_text.length(), prefix.m_text) == 0; }
+  bool endsWith(const String &suffix) const
+  {
+    return m_text.length() >= suffix.m_text.length() &&
+           m_text.compare(m_text.length() - suffix.m_text.length(), suffix.m_text.length(), suffix.m_text) == 0;
+  }
+
+  char charAt(unsigned int index) const { return index < m_text.length() ? m_text[index] : 0; }
+  void setCharAt(unsigned int index, char c)
+  {
+    if (index < m_text.length())
+    {
+      m_text[index] = c;
+    }
+  }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char &operator[](unsigned int index) { return m_text[index]; }
+
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const String &text, unsigned int from = 0) const;
+  int lastIndexOf(char c) const;
+  int lastIndexOf(const String &text) const;
+  String substring(unsigned int from) const { return substring(from, m_text.length()); }
+  String substring(unsigned int from, unsigned int to) const;
+
+  void replace(const String &find, const String &replace);
+  void remove(unsigned int index) { remove(index, m_text.length()); }
+  void remove(unsigned int index, unsigned int count);
+  void toLowerCase();
+  void toUpperCase();
+  void trim();
+
+  long toInt() const { return atol(m_text.c_str()); }
+  float toFloat() const { return atof(m_text.c_str()); }
+  double toDouble() const { return atof(m_text.c_str()); }
+};
+
+inline String operator+(const String &lhs, const String &rhs)
+{
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+inline String operator+(const String &lhs, const char *rhs)
+{
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+inline String operator+(const char *lhs, const String &rhs)
+{
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+inline String operator+(const String &lhs, char rhs)
+{
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+inline String operator+(const String &lhs, T rhs)
+{
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+inline bool operator==(const char *lhs, const String &rhs) { return rhs == lhs; }
+inline bool operator!=(const char *lhs, const String &rhs) { return rhs != lhs; }
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Arduino.h"
+#include "esp_wifi.h"
+
+typedef enum
+{
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+} wifi_mode_t;
+
+typedef enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+/**
+ * @brief Just enough of the WiFi class for the radio - every device is always "connected"
+ * to the same network with the address 10.0.0.x
+ */
+class WiFiClass
+{
+public:
+  bool mode(wifi_mode_t mode) { return true; }
+  wl_status_t begin(const char *ssid, const char *passphrase = NULL) { return WL_CONNECTED; }
+  uint8_t waitForConnectResult() { return WL_CONNECTED; }
+  bool setSleep(bool enabled) { return true; }
+  bool disconnect(bool wifioff = false) { return true; }
+  wl_status_t status() { return WL_CONNECTED; }
+  IPAddress localIP();
+  uint8_t *macAddress(uint8_t *mac);
+  String macAddress();
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Arduino.h"
+
+/**
+ * @brief The Arduino network client interface
+ */
+class Client : public Stream
+{
+public:
+  virtual int connect(const char *host, uint16_t port) = 0;
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int read(uint8_t *buffer, size_t size) = 0;
+  virtual int peek() = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+};
+
+/**
+ * @brief A TCP connection on the host - blocking writes and non blocking reads like the
+ * ESP32's WiFiClient
+ */
+class WiFiClient : public Client
+{
+private:
+  int m_socket = -1;
+
+public:
+  WiFiClient() {}
+  ~WiFiClient() { stop(); }
+  WiFiClient(const WiFiClient &) = delete;
+  WiFiClient &operator=(const WiFiClient &) = delete;
+
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+};
+
+// connections to host go to port on this machine instead - lets tests stand in for real servers
+void native_route_host(const char *host, uint16_t port);
+// forget all the routes
+void native_clear_routes();
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "WiFiClient.h"
+
+/**
+ * @brief Stands in for the TLS client on the host - the connection is plain TCP, certificates
+ * are never checked
+ */
+class WiFiClientSecure : public WiFiClient
+{
+public:
+  void setInsecure() {}
+  void setCACert(const char *root_ca) {}
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum
+{
+  ADC_UNIT_1 = 1,
+  ADC_UNIT_2 = 2,
+} adc_unit_t;
+
+typedef enum
+{
+  ADC1_CHANNEL_0 = 0,
+  ADC1_CHANNEL_1,
+  ADC1_CHANNEL_2,
+  ADC1_CHANNEL_3,
+  ADC1_CHANNEL_4,
+  ADC1_CHANNEL_5,
+  ADC1_CHANNEL_6,
+  ADC1_CHANNEL_7,
+  ADC1_CHANNEL_MAX,
+} adc1_channel_t;
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_idf_version.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/adc.h"
+#include "driver/gpio.h"
+
+// the I2S driver from the IDF the boards are built with - see NativeDevice for where the samples go
+typedef enum
+{
+  I2S_NUM_0 = 0,
+  I2S_NUM_1 = 1,
+  I2S_NUM_MAX,
+} i2s_port_t;
+
+typedef enum
+{
+  I2S_BITS_PER_SAMPLE_8BIT = 8,
+  I2S_BITS_PER_SAMPLE_16BIT = 16,
+  I2S_BITS_PER_SAMPLE_24BIT = 24,
+  I2S_BITS_PER_SAMPLE_32BIT = 32,
+} i2s_bits_per_sample_t;
+
+typedef enum
+{
+  I2S_CHANNEL_FMT_RIGHT_LEFT = 0x00,
+  I2S_CHANNEL_FMT_ALL_RIGHT,
+  I2S_CHANNEL_FMT_ALL_LEFT,
+  I2S_CHANNEL_FMT_ONLY_RIGHT,
+  I2S_CHANNEL_FMT_ONLY_LEFT,
+} i2s_channel_fmt_t;
+
+typedef enum
+{
+  I2S_COMM_FORMAT_I2S = 0x01,
+  I2S_COMM_FORMAT_I2S_MSB = 0x02,
+  I2S_COMM_FORMAT_I2S_LSB = 0x04,
+  I2S_COMM_FORMAT_PCM = 0x08,
+  I2S_COMM_FORMAT_PCM_SHORT = 0x10,
+  I2S_COMM_FORMAT_PCM_LONG = 0x20,
+  // the names newer IDFs use
+  I2S_COMM_FORMAT_STAND_I2S = 0x01,
+  I2S_COMM_FORMAT_STAND_MSB = 0x03,
+  I2S_COMM_FORMAT_STAND_PCM_SHORT = 0x04,
+  I2S_COMM_FORMAT_STAND_PCM_LONG = 0x0C,
+} i2s_comm_format_t;
+
+typedef enum
+{
+  I2S_MODE_MASTER = 1,
+  I2S_MODE_SLAVE = 2,
+  I2S_MODE_TX = 4,
+  I2S_MODE_RX = 8,
+  I2S_MODE_DAC_BUILT_IN = 16,
+  I2S_MODE_ADC_BUILT_IN = 32,
+  I2S_MODE_PDM = 64,
+} i2s_mode_t;
+
+typedef enum
+{
+  I2S_DAC_CHANNEL_DISABLE = 0,
+  I2S_DAC_CHANNEL_RIGHT_EN = 1,
+  I2S_DAC_CHANNEL_LEFT_EN = 2,
+  I2S_DAC_CHANNEL_BOTH_EN = 0x3,
+  I2S_DAC_CHANNEL_MAX = 0x4,
+} i2s_dac_mode_t;
+
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+#define I2S_PIN_NO_CHANGE (-1)
+
+typedef struct
+{
+  i2s_mode_t mode;
+  int sample_rate;
+  i2s_bits_per_sample_t bits_per_sample;
+  i2s_channel_fmt_t channel_format;
+  i2s_comm_format_t communication_format;
+  int intr_alloc_flags;
+  int dma_buf_count;
+  int dma_buf_len;
+  bool use_apll;
+  bool tx_desc_auto_clear;
+  int fixed_mclk;
+} i2s_config_t;
+
+typedef struct
+{
+  int bck_io_num;
+  int ws_io_num;
+  int data_out_num;
+  int data_in_num;
+} i2s_pin_config_t;
+
+esp_err_t i2s_driver_install(i2s_port_t i2s_num, const i2s_config_t *i2s_config, int queue_size, void *i2s_queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t i2s_num);
+esp_err_t i2s_set_pin(i2s_port_t i2s_num, const i2s_pin_config_t *pin);
+esp_err_t i2s_start(i2s_port_t i2s_num);
+esp_err_t i2s_stop(i2s_port_t i2s_num);
+esp_err_t i2s_zero_dma_buffer(i2s_port_t i2s_num);
+// these wait for the samples to be played or captured at the sample rate
+esp_err_t i2s_read(i2s_port_t i2s_num, void *dest, size_t size, size_t *bytes_read, TickType_t ticks_to_wait);
+esp_err_t i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, TickType_t ticks_to_wait);
+esp_err_t i2s_set_adc_mode(adc_unit_t adc_unit, adc1_channel_t adc_channel);
+esp_err_t i2s_adc_enable(i2s_port_t i2s_num);
+esp_err_t i2s_adc_disable(i2s_port_t i2s_num);
+esp_err_t i2s_set_dac_mode(i2s_dac_mode_t dac_mode);
@@ -0,0 +1,10 @@
+#pragma once
+
+// errors, warnings and info go to the serial output - debug and verbose are compiled out
+void native_log(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) native_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) native_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) native_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)
+#define ESP_LOGV(tag, format, ...)
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef enum
+{
+  WIFI_SECOND_CHAN_NONE = 0,
+  WIFI_SECOND_CHAN_ABOVE,
+  WIFI_SECOND_CHAN_BELOW,
+} wifi_second_chan_t;
+
+typedef enum
+{
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+esp_err_t esp_wifi_set_promiscuous(bool en);
+// devices only hear ESP-NOW packets sent on their own channel
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct NativeQueue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+// these wait up to ticks for room or an item - 0 doesn't wait and portMAX_DELAY waits forever
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#define xQueueSendToBack(queue, item, ticks) xQueueSend(queue, item, ticks)
+#define xQueueSendFromISR(queue, item, woken) xQueueSend(queue, item, 0)
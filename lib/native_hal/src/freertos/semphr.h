@@ -0,0 +1,14 @@
+#pragma once
+
+#include "queue.h"
+
+// semaphores are queues of empty items, the same as in FreeRTOS
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+
+#define xSemaphoreTake(semaphore, ticks) xQueueReceive(semaphore, NULL, ticks)
+#define xSemaphoreGive(semaphore) xQueueSend(semaphore, NULL, 0)
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef struct NativeTask *TaskHandle_t;
+
+// each task is a thread on the device that created it - the stack size, priority and core are
+// ignored so the host's scheduler decides what runs when
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+void native_task_yield();
+
+#define taskYIELD() native_task_yield()
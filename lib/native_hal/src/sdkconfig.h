@@ -0,0 +1,5 @@
+#pragma once
+
+// the host build pretends to be an ESP32 so the ESP32 only parts of the libraries are built too
+#define CONFIG_IDF_TARGET_ESP32 1
+#define CONFIG_FREERTOS_HZ 1000
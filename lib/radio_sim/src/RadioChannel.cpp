@@ -0,0 +1,127 @@
+#include <math.h>
+#include <string.h>
+#include "RadioChannel.h"
+#include "SimTransport.h"
+
+RadioChannel::RadioChannel(const RadioChannelConfig &config) : m_config(config)
+{
+  // splitmix64 of the seed so nearby seeds give unrelated runs
+  uint64_t z = config.seed + 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  m_random = (z ^ (z >> 31)) | 1;
+  memset(m_link_bad, 0, sizeof(m_link_bad));
+}
+
+uint32_t RadioChannel::next_random()
+{
+  // xorshift64*
+  m_random ^= m_random >> 12;
+  m_random ^= m_random << 25;
+  m_random ^= m_random >> 27;
+  return (m_random * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+float RadioChannel::random_uniform()
+{
+  return (next_random() >> 8) * (1.0f / 16777216.0f);
+}
+
+bool RadioChannel::chance(float probability)
+{
+  return probability > 0 && random_uniform() < probability;
+}
+
+uint32_t RadioChannel::random_delay()
+{
+  if (m_config.jitter_us == 0)
+  {
+    return m_config.base_delay_us;
+  }
+  // mostly small with the occasional long one - like retries and busy network stacks
+  return m_config.base_delay_us + (uint32_t)(-logf(1.0f - random_uniform()) * m_config.jitter_us);
+}
+
+int RadioChannel::add_radio(SimTransport *radio)
+{
+  if (m_radio_count == RADIO_CHANNEL_MAX_RADIOS)
+  {
+    return -1;
+  }
+  m_radios[m_radio_count] = radio;
+  return m_radio_count++;
+}
+
+void RadioChannel::schedule(uint64_t time_us, int from, int to, const uint8_t *data, int length)
+{
+  Delivery delivery;
+  delivery.time_us = time_us;
+  delivery.order = m_order++;
+  delivery.from = from;
+  delivery.to = to;
+  delivery.data.assign(data, data + length);
+  m_deliveries.push(delivery);
+}
+
+void RadioChannel::transmit(int from, const uint8_t *data, int length)
+{
+  // wait for the channel to be free then back off for a random number of slots
+  uint64_t start_us = m_now_us > m_air_free_us ? m_now_us : m_air_free_us;
+  if (m_config.max_backoff_slots > 0)
+  {
+    start_us += (next_random() % (m_config.max_backoff_slots + 1)) * RADIO_CHANNEL_SLOT_US;
+  }
+  if (start_us - m_now_us > m_config.max_queue_delay_us)
+  {
+    m_congestion_drops++;
+    return;
+  }
+  uint32_t airtime_us = m_config.frame_overhead_us + (uint64_t)length * 8 * 1000000 / m_config.bitrate;
+  m_air_free_us = start_us + airtime_us;
+  m_airtime_us += airtime_us;
+  m_sent++;
+  // broadcasts aren't retried so each receiver either gets it or doesn't
+  for (int to = 0; to < m_radio_count; to++)
+  {
+    if (to == from)
+    {
+      continue;
+    }
+    bool &bad = m_link_bad[from][to];
+    bad = bad ? !chance(m_config.bad_to_good) : chance(m_config.good_to_bad);
+    if (chance(bad ? m_config.loss_bad : m_config.loss_good))
+    {
+      m_lost++;
+      continue;
+    }
+    uint64_t arrival_us = m_air_free_us + random_delay();
+    if (chance(m_config.reorder))
+    {
+      arrival_us += m_config.reorder_delay_us;
+      m_reordered++;
+    }
+    schedule(arrival_us, from, to, data, length);
+    if (chance(m_config.duplicate))
+    {
+      schedule(arrival_us + airtime_us + random_delay(), from, to, data, length);
+      m_duplicated++;
+    }
+  }
+}
+
+uint64_t RadioChannel::next_delivery()
+{
+  return m_deliveries.empty() ? UINT64_MAX : m_deliveries.top().time_us;
+}
+
+bool RadioChannel::deliver_next(uint64_t until_us)
+{
+  if (m_deliveries.empty() || m_deliveries.top().time_us > until_us)
+  {
+    return false;
+  }
+  Delivery delivery = m_deliveries.top();
+  m_deliveries.pop();
+  m_radios[delivery.to]->deliver(m_radios[delivery.from]->address(), delivery.data.data(), delivery.data.size());
+  return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <queue>
+#include <vector>
+
+// most radios that can share a channel
+#define RADIO_CHANNEL_MAX_RADIOS 16
+// an 802.11 slot - the unit of random backoff before each transmission
+#define RADIO_CHANNEL_SLOT_US 9
+
+class SimTransport;
+
+/**
+ * @brief How bad the channel is - everything is random but follows from the seed
+ */
+struct RadioChannelConfig
+{
+  uint32_t seed = 1;
+  // on-air rate and the fixed cost of each frame (preamble, MAC header and ACK-less gap)
+  uint32_t bitrate = 1000000;
+  uint32_t frame_overhead_us = 250;
+  // random backoff of 0 to this many slots before each frame
+  uint32_t max_backoff_slots = 15;
+  // frames that can't get on air within this long are dropped by the sender
+  uint32_t max_queue_delay_us = 50000;
+  // propagation and stack delay, plus an exponentially distributed extra with this mean
+  uint32_t base_delay_us = 2000;
+  uint32_t jitter_us = 0;
+  // Gilbert-Elliott burst loss per link - the chance of moving between the good and bad
+  // states at each frame and the chance of losing a frame in each state
+  float good_to_bad = 0;
+  float bad_to_good = 1;
+  float loss_good = 0;
+  float loss_bad = 0;
+  // chance of a frame being held back by reorder_delay_us so later ones overtake it
+  float reorder = 0;
+  uint32_t reorder_delay_us = 30000;
+  // chance of a frame arriving twice
+  float duplicate = 0;
+};
+
+/**
+ * @brief A shared radio channel for simulated transports
+ *
+ * Frames take turns on air so busy channels queue and drop them, then every other radio gets
+ * its own copy subject to burst loss, jitter, reordering and duplication. Nothing depends on
+ * the real time or the order threads run in - the caller moves the clock on with set_time and
+ * collects deliveries with deliver_next - so the same seed gives exactly the same run.
+ */
+class RadioChannel
+{
+private:
+  struct Delivery
+  {
+    uint64_t time_us;
+    // breaks ties so equal times always come out in the order they were scheduled
+    uint64_t order;
+    int from;
+    int to;
+    std::vector<uint8_t> data;
+    bool operator>(const Delivery &other) const
+    {
+      return time_us != other.time_us ? time_us > other.time_us : order > other.order;
+    }
+  };
+
+  RadioChannelConfig m_config;
+  uint64_t m_random;
+  uint64_t m_now_us = 0;
+  uint64_t m_air_free_us = 0;
+  uint64_t m_order = 0;
+  SimTransport *m_radios[RADIO_CHANNEL_MAX_RADIOS];
+  int m_radio_count = 0;
+  // Gilbert-Elliott state of each link - true while it's in the bad state
+  bool m_link_bad[RADIO_CHANNEL_MAX_RADIOS][RADIO_CHANNEL_MAX_RADIOS];
+  std::priority_queue<Delivery, std::vector<Delivery>, std::greater<Delivery>> m_deliveries;
+
+  // statistics
+  uint32_t m_sent = 0;
+  uint32_t m_congestion_drops = 0;
+  uint32_t m_lost = 0;
+  uint32_t m_reordered = 0;
+  uint32_t m_duplicated = 0;
+  uint64_t m_airtime_us = 0;
+
+  // our own generator so runs match whatever the standard library is
+  uint32_t next_random();
+  float random_uniform();
+  bool chance(float probability);
+  uint32_t random_delay();
+  void schedule(uint64_t time_us, int from, int to, const uint8_t *data, int length);
+
+public:
+  RadioChannel(const RadioChannelConfig &config);
+  // returns the radio's index or -1 if the channel is full
+  int add_radio(SimTransport *radio);
+  // everything sent from now on is sent at this time
+  void set_time(uint64_t now_us) { m_now_us = now_us; }
+  uint64_t time() { return m_now_us; }
+  // broadcast a frame from one radio to all the others
+  void transmit(int from, const uint8_t *data, int length);
+  // when the next frame arrives - UINT64_MAX if nothing is on its way
+  uint64_t next_delivery();
+  // hand over the next frame if it arrives by until_us
+  bool deliver_next(uint64_t until_us);
+
+  uint32_t sent() { return m_sent; }
+  uint32_t congestion_drops() { return m_congestion_drops; }
+  uint32_t lost() { return m_lost; }
+  uint32_t reordered() { return m_reordered; }
+  uint32_t duplicated() { return m_duplicated; }
+  // fraction of the time the channel has been busy
+  float utilisation() { return m_now_us ? (float)m_airtime_us / m_now_us : 0; }
+};
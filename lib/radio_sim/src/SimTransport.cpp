@@ -0,0 +1,28 @@
+#include <string.h>
+#include "SimTransport.h"
+#include "RadioChannel.h"
+
+SimTransport::SimTransport(StreamMixer *mixer, RadioChannel *channel, int max_packet_size, const uint8_t *address)
+    : Transport(mixer, max_packet_size), m_channel(channel)
+{
+  memcpy(m_address, address, PACKET_ADDRESS_SIZE);
+}
+
+bool SimTransport::begin()
+{
+  m_radio = m_channel->add_radio(this);
+  return m_radio >= 0;
+}
+
+void SimTransport::send(const uint8_t *data, int length)
+{
+  if (m_radio >= 0)
+  {
+    m_channel->transmit(m_radio, data, length);
+  }
+}
+
+void SimTransport::deliver(const uint8_t *address, const uint8_t *data, int length)
+{
+  receive_packet(address, data, length);
+}
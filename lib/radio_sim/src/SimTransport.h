@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Transport.h"
+
+class RadioChannel;
+
+/**
+ * @brief A transport whose radio is a RadioChannel - for running the protocol over a simulated
+ * bad channel on the host
+ *
+ * There's no receive task: the channel hands frames straight to receive_packet when the caller
+ * collects them, so the whole run happens on one thread and repeats exactly. The caller has to
+ * call poll as time moves on instead.
+ */
+class SimTransport final : public Transport
+{
+private:
+  RadioChannel *m_channel;
+  int m_radio = -1;
+  uint8_t m_address[PACKET_ADDRESS_SIZE];
+
+protected:
+  void send(const uint8_t *data, int length) override;
+
+public:
+  // max_packet_size is 250 to behave like ESP-NOW or 1436 for UDP
+  SimTransport(StreamMixer *mixer, RadioChannel *channel, int max_packet_size, const uint8_t *address);
+  // join the channel
+  bool begin() override;
+  const uint8_t *address() { return m_address; }
+  // a frame has arrived from the radio with this address
+  void deliver(const uint8_t *address, const uint8_t *data, int length);
+};
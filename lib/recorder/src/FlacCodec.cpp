@@ -0,0 +1,526 @@
+#include <string.h>
+#include <stdlib.h>
+#include "FlacCodec.h"
+
+// largest rice parameter we can code with a 4 bit parameter - 15 is the escape code
+const int FLAC_MAX_RICE_PARAMETER = 14;
+// split the residuals of a full block into this many partitions (as a power of 2) so the
+// rice parameter can follow changes in level within the block
+const int FLAC_MAX_PARTITION_ORDER = 4;
+
+/**
+ * @brief Writes bits most significant first into a byte buffer
+ *
+ */
+class BitWriter
+{
+private:
+  uint8_t *m_dst;
+  int m_length = 0;
+  uint64_t m_accumulator = 0;
+  int m_bits = 0;
+
+public:
+  BitWriter(uint8_t *dst) : m_dst(dst) {}
+  void write(uint32_t value, int count)
+  {
+    uint32_t mask = count < 32 ? (1u << count) - 1 : 0xffffffff;
+    m_accumulator = (m_accumulator << count) | (value & mask);
+    m_bits += count;
+    while (m_bits >= 8)
+    {
+      m_bits -= 8;
+      m_dst[m_length++] = m_accumulator >> m_bits;
+    }
+  }
+  // q zeros followed by a one
+  void write_unary(uint32_t q)
+  {
+    while (q >= 32)
+    {
+      write(0, 32);
+      q -= 32;
+    }
+    write(1, q + 1);
+  }
+  void align()
+  {
+    if (m_bits > 0)
+    {
+      write(0, 8 - m_bits);
+    }
+  }
+  int length() { return m_length; }
+};
+
+static uint8_t crc8(const uint8_t *data, int length)
+{
+  uint8_t crc = 0;
+  for (int i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static uint16_t crc16(const uint8_t *data, int length)
+{
+  uint16_t crc = 0;
+  for (int i = 0; i < length; i++)
+  {
+    crc ^= data[i] << 8;
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// residuals are folded so small negative numbers become small positive ones
+static inline uint32_t fold(int32_t residual)
+{
+  return ((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31);
+}
+
+static inline int32_t unfold(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// prediction from the previous samples for each order of fixed predictor
+static inline int32_t fixed_prediction(const int32_t *x, int order)
+{
+  switch (order)
+  {
+  case 1:
+    return x[-1];
+  case 2:
+    return 2 * x[-1] - x[-2];
+  case 3:
+    return 3 * x[-1] - 3 * x[-2] + x[-3];
+  case 4:
+    return 4 * x[-1] - 6 * x[-2] + 4 * x[-3] - x[-4];
+  default:
+    return 0;
+  }
+}
+
+void FlacEncoder::write_header(uint8_t *dst, int sample_rate, uint64_t total_samples, uint32_t min_frame_size, uint32_t max_frame_size)
+{
+  BitWriter writer(dst);
+  writer.write('f', 8);
+  writer.write('L', 8);
+  writer.write('a', 8);
+  writer.write('C', 8);
+  // last metadata block, type 0 (STREAMINFO), 34 bytes long
+  writer.write(1, 1);
+  writer.write(0, 7);
+  writer.write(34, 24);
+  // min and max block size - the last block can be shorter but that's allowed
+  writer.write(FLAC_BLOCK_SIZE, 16);
+  writer.write(FLAC_BLOCK_SIZE, 16);
+  writer.write(min_frame_size, 24);
+  writer.write(max_frame_size, 24);
+  // sample rate, 1 channel, 16 bits per sample, total samples
+  writer.write(sample_rate, 20);
+  writer.write(0, 3);
+  writer.write(15, 5);
+  writer.write(total_samples >> 32, 4);
+  writer.write(total_samples, 32);
+  // no MD5 signature
+  for (int i = 0; i < 4; i++)
+  {
+    writer.write(0, 32);
+  }
+}
+
+int FlacEncoder::choose_order(const int16_t *samples, int count)
+{
+  // pick the predictor with the smallest total residual - this is what the reference encoder does
+  int max_order = count > FLAC_MAX_FIXED_ORDER ? FLAC_MAX_FIXED_ORDER : count - 1;
+  uint64_t totals[FLAC_MAX_FIXED_ORDER + 1] = {0};
+  for (int i = FLAC_MAX_FIXED_ORDER; i < count; i++)
+  {
+    int32_t e0 = samples[i];
+    int32_t e1 = e0 - samples[i - 1];
+    int32_t e2 = e1 - (samples[i - 1] - samples[i - 2]);
+    int32_t e3 = e2 - (samples[i - 1] - 2 * samples[i - 2] + samples[i - 3]);
+    int32_t e4 = e3 - (samples[i - 1] - 3 * samples[i - 2] + 3 * samples[i - 3] - samples[i - 4]);
+    totals[0] += abs(e0);
+    totals[1] += abs(e1);
+    totals[2] += abs(e2);
+    totals[3] += abs(e3);
+    totals[4] += abs(e4);
+  }
+  int best = 0;
+  for (int order = 1; order <= max_order; order++)
+  {
+    if (totals[order] < totals[best])
+    {
+      best = order;
+    }
+  }
+  return best;
+}
+
+void FlacEncoder::compute_residuals(const int16_t *samples, int count, int order)
+{
+  for (int i = order; i < count; i++)
+  {
+    // work in 32 bits so the predictions can't overflow
+    int32_t x[FLAC_MAX_FIXED_ORDER];
+    for (int j = 0; j < order; j++)
+    {
+      x[j] = samples[i - order + j];
+    }
+    m_residuals[i - order] = samples[i] - fixed_prediction(x + order, order);
+  }
+}
+
+// pick the rice parameter that codes these residuals in the fewest bits
+static int choose_rice_parameter(const int32_t *residuals, int count, uint32_t &bits)
+{
+  uint64_t sum = 0;
+  for (int i = 0; i < count; i++)
+  {
+    sum += fold(residuals[i]);
+  }
+  // the best parameter is close to log2 of the mean
+  int estimate = 0;
+  while (estimate < FLAC_MAX_RICE_PARAMETER && ((uint64_t)count << (estimate + 1)) < sum)
+  {
+    estimate++;
+  }
+  int best = -1;
+  for (int k = estimate > 0 ? estimate - 1 : 0; k <= estimate + 1 && k <= FLAC_MAX_RICE_PARAMETER; k++)
+  {
+    uint64_t total = (uint64_t)count * (k + 1);
+    for (int i = 0; i < count; i++)
+    {
+      total += fold(residuals[i]) >> k;
+    }
+    if (best < 0 || total < bits)
+    {
+      best = k;
+      bits = total > UINT32_MAX ? UINT32_MAX : total;
+    }
+  }
+  return best;
+}
+
+int FlacEncoder::encode(const int16_t *samples, int count, uint8_t *dst)
+{
+  if (count <= 0)
+  {
+    return 0;
+  }
+  if (count > FLAC_BLOCK_SIZE)
+  {
+    count = FLAC_BLOCK_SIZE;
+  }
+  BitWriter writer(dst);
+  // frame header - fixed block size stream, sample rate from STREAMINFO, mono, 16 bit
+  writer.write(0xfff8, 16);
+  writer.write(0x7, 4);
+  writer.write(0x0, 4);
+  writer.write(0x0, 4);
+  writer.write(0x4, 3);
+  writer.write(0, 1);
+  // frame number as UTF-8
+  uint32_t number = m_frame_number++;
+  if (number < 0x80)
+  {
+    writer.write(number, 8);
+  }
+  else
+  {
+    int bytes = number < 0x800 ? 2 : number < 0x10000 ? 3 : number < 0x200000 ? 4 : number < 0x4000000 ? 5 : 6;
+    writer.write((0xff00 >> bytes) | (number >> (6 * (bytes - 1))), 8);
+    for (int i = bytes - 2; i >= 0; i--)
+    {
+      writer.write(0x80 | ((number >> (6 * i)) & 0x3f), 8);
+    }
+  }
+  writer.write(count - 1, 16);
+  writer.write(crc8(dst, writer.length()), 8);
+
+  int order = choose_order(samples, count);
+  compute_residuals(samples, count, order);
+  // use smaller partitions when the block divides up evenly
+  int partition_order = FLAC_MAX_PARTITION_ORDER;
+  while (partition_order > 0 && ((count & ((1 << partition_order) - 1)) || (count >> partition_order) <= order))
+  {
+    partition_order--;
+  }
+  int partitions = 1 << partition_order;
+  int partition_size = count >> partition_order;
+  int parameters[1 << FLAC_MAX_PARTITION_ORDER];
+  uint64_t residual_bits = 2 + 4;
+  const int32_t *residual = m_residuals;
+  for (int p = 0; p < partitions; p++)
+  {
+    // the warm up samples come out of the first partition
+    int length = p == 0 ? partition_size - order : partition_size;
+    uint32_t bits = 0;
+    parameters[p] = choose_rice_parameter(residual, length, bits);
+    residual_bits += 4 + bits;
+    residual += length;
+  }
+  if (16 * order + residual_bits >= 16 * (uint64_t)count)
+  {
+    // noise doesn't compress - just store the samples
+    writer.write(0x01 << 1, 8);
+    for (int i = 0; i < count; i++)
+    {
+      writer.write((uint16_t)samples[i], 16);
+    }
+  }
+  else
+  {
+    writer.write((0x08 | order) << 1, 8);
+    for (int i = 0; i < order; i++)
+    {
+      writer.write((uint16_t)samples[i], 16);
+    }
+    // rice coding with 4 bit parameters
+    writer.write(0, 2);
+    writer.write(partition_order, 4);
+    residual = m_residuals;
+    for (int p = 0; p < partitions; p++)
+    {
+      int length = p == 0 ? partition_size - order : partition_size;
+      int k = parameters[p];
+      writer.write(k, 4);
+      for (int i = 0; i < length; i++)
+      {
+        uint32_t value = fold(residual[i]);
+        writer.write_unary(value >> k);
+        writer.write(value, k);
+      }
+      residual += length;
+    }
+  }
+  writer.align();
+  uint16_t crc = crc16(dst, writer.length());
+  writer.write(crc, 16);
+  return writer.length();
+}
+
+FlacDecoder::FlacDecoder(fs::File &file) : m_file(file)
+{
+  m_frame = (uint8_t *)malloc(FLAC_MAX_FRAME_SIZE);
+  m_samples = (int16_t *)malloc(sizeof(int16_t) * FLAC_BLOCK_SIZE);
+}
+
+FlacDecoder::~FlacDecoder()
+{
+  free(m_frame);
+  free(m_samples);
+}
+
+bool FlacDecoder::begin()
+{
+  uint8_t header[FLAC_HEADER_SIZE];
+  if (!m_frame || !m_samples || m_file.read(header, FLAC_HEADER_SIZE) != FLAC_HEADER_SIZE || memcmp(header, "fLaC", 4) != 0)
+  {
+    return false;
+  }
+  // sample rate is the first 20 bits after the block and frame sizes
+  const uint8_t *info = header + 8;
+  m_sample_rate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+  m_total_samples = ((uint64_t)(info[13] & 0x0f) << 32) | ((uint32_t)info[14] << 24) | (info[15] << 16) | (info[16] << 8) | info[17];
+  m_frame_length = 0;
+  m_bit_position = 0;
+  m_sample_count = 0;
+  m_sample_position = 0;
+  m_samples_read = 0;
+  m_ended = false;
+  return true;
+}
+
+uint32_t FlacDecoder::read_bits(int count)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < count; i++)
+  {
+    int byte = m_bit_position >> 3;
+    if (byte >= m_frame_length)
+    {
+      // ran off the end of what we have - the caller will see the CRC fail
+      m_bit_position = m_frame_length * 8;
+      return 0;
+    }
+    value = (value << 1) | ((m_frame[byte] >> (7 - (m_bit_position & 7))) & 1);
+    m_bit_position++;
+  }
+  return value;
+}
+
+int32_t FlacDecoder::read_signed_bits(int count)
+{
+  // sign extend
+  return (int32_t)(read_bits(count) << (32 - count)) >> (32 - count);
+}
+
+uint32_t FlacDecoder::read_unary()
+{
+  uint32_t count = 0;
+  while (m_bit_position < m_frame_length * 8 && read_bits(1) == 0)
+  {
+    count++;
+  }
+  return count;
+}
+
+bool FlacDecoder::read_frame_bytes()
+{
+  // move what's left of the buffer down to the start and top it up from the file
+  int consumed = m_bit_position >> 3;
+  memmove(m_frame, m_frame + consumed, m_frame_length - consumed);
+  m_frame_length -= consumed;
+  m_bit_position = 0;
+  int read = m_file.read(m_frame + m_frame_length, FLAC_MAX_FRAME_SIZE - m_frame_length);
+  if (read > 0)
+  {
+    m_frame_length += read;
+  }
+  return m_frame_length > 0;
+}
+
+bool FlacDecoder::decode_frame()
+{
+  if (!read_frame_bytes() || read_bits(16) != 0xfff8)
+  {
+    return false;
+  }
+  int block_size_code = read_bits(4);
+  int sample_rate_code = read_bits(4);
+  int channels = read_bits(4);
+  int sample_size = read_bits(3);
+  read_bits(1);
+  if (channels != 0 || (sample_size != 0x4 && sample_size != 0) || sample_rate_code > 0xb)
+  {
+    return false;
+  }
+  // skip over the UTF-8 frame number - the leading ones of the first byte say how many bytes it takes
+  uint32_t first = read_bits(8);
+  for (uint32_t mask = 0x40; first & 0x80 && first & mask; mask >>= 1)
+  {
+    read_bits(8);
+  }
+  int count;
+  if (block_size_code == 0x6)
+  {
+    count = read_bits(8) + 1;
+  }
+  else if (block_size_code == 0x7)
+  {
+    count = read_bits(16) + 1;
+  }
+  else if (block_size_code >= 0x8)
+  {
+    count = 256 << (block_size_code - 8);
+  }
+  else
+  {
+    return false;
+  }
+  int header_length = m_bit_position >> 3;
+  if (count > FLAC_BLOCK_SIZE || read_bits(8) != crc8(m_frame, header_length))
+  {
+    return false;
+  }
+
+  int type = (read_bits(8) >> 1) & 0x3f;
+  if (type == 0x01)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      m_samples[i] = read_signed_bits(16);
+    }
+  }
+  else if ((type & 0x38) == 0x08 && (type & 0x07) <= FLAC_MAX_FIXED_ORDER)
+  {
+    int order = type & 0x07;
+    for (int i = 0; i < order; i++)
+    {
+      m_samples[i] = read_signed_bits(16);
+    }
+    if (read_bits(2) != 0)
+    {
+      return false;
+    }
+    int partition_order = read_bits(4);
+    int partition_size = count >> partition_order;
+    int i = order;
+    for (int p = 0; p < (1 << partition_order); p++)
+    {
+      int k = read_bits(4);
+      int end = (p + 1) * partition_size;
+      for (; i < end; i++)
+      {
+        uint32_t q = read_unary();
+        int32_t residual = unfold((q << k) | read_bits(k));
+        int32_t x[FLAC_MAX_FIXED_ORDER];
+        for (int j = 0; j < order; j++)
+        {
+          x[j] = m_samples[i - order + j];
+        }
+        m_samples[i] = residual + fixed_prediction(x + order, order);
+      }
+    }
+  }
+  else
+  {
+    return false;
+  }
+  // byte aligned CRC of the whole frame
+  m_bit_position = (m_bit_position + 7) & ~7;
+  int frame_length = m_bit_position >> 3;
+  if (frame_length + 2 > m_frame_length || read_bits(16) != crc16(m_frame, frame_length))
+  {
+    // a truncated recording ends part way through a frame
+    return false;
+  }
+  m_sample_count = count;
+  m_sample_position = 0;
+  return true;
+}
+
+int FlacDecoder::read(int16_t *samples, int count)
+{
+  int total = 0;
+  while (total < count)
+  {
+    if (m_sample_position == m_sample_count)
+    {
+      // stop at the first bad frame - it's either the end of the file or a truncated frame
+      if (m_ended || !decode_frame())
+      {
+        m_ended = true;
+        break;
+      }
+    }
+    int to_copy = m_sample_count - m_sample_position;
+    if (to_copy > count - total)
+    {
+      to_copy = count - total;
+    }
+    if (m_total_samples > 0 && m_samples_read + to_copy >= m_total_samples)
+    {
+      to_copy = m_total_samples - m_samples_read;
+      m_ended = true;
+      m_sample_count = m_sample_position + to_copy;
+    }
+    memcpy(samples + total, m_samples + m_sample_position, sizeof(int16_t) * to_copy);
+    m_sample_position += to_copy;
+    m_samples_read += to_copy;
+    total += to_copy;
+  }
+  return total;
+}
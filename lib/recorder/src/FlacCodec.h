@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <FS.h>
+
+// samples in each FLAC frame - a full recorder block of 16 bit samples
+#define FLAC_BLOCK_SIZE 4096
+// "fLaC" followed by a STREAMINFO metadata block
+#define FLAC_HEADER_SIZE 42
+// the biggest a frame can get - a verbatim block plus the frame header and footer
+#define FLAC_MAX_FRAME_SIZE (FLAC_BLOCK_SIZE * 2 + 32)
+// the fixed predictors go up to 4th order
+#define FLAC_MAX_FIXED_ORDER 4
+
+/**
+ * @brief Lossless encoder writing a subset of FLAC - 16 bit mono, fixed polynomial
+ * predictors and Rice coded residuals
+ *
+ * Each block is encoded on its own so the encoder keeps no state between frames
+ * apart from the frame number.
+ */
+class FlacEncoder
+{
+private:
+  uint32_t m_frame_number = 0;
+  int32_t m_residuals[FLAC_BLOCK_SIZE];
+
+  int choose_order(const int16_t *samples, int count);
+  void compute_residuals(const int16_t *samples, int count, int order);
+
+public:
+  void reset() { m_frame_number = 0; }
+  // write the stream header - min and max frame sizes can be 0 if they aren't known yet
+  static void write_header(uint8_t *dst, int sample_rate, uint64_t total_samples, uint32_t min_frame_size, uint32_t max_frame_size);
+  // encode up to FLAC_BLOCK_SIZE samples into a frame returning the number of bytes written
+  int encode(const int16_t *samples, int count, uint8_t *dst);
+};
+
+/**
+ * @brief Streaming decoder for the files written by FlacEncoder - reads a frame at a
+ * time from the file so only one block is ever held in memory
+ *
+ */
+class FlacDecoder
+{
+private:
+  fs::File &m_file;
+  // bit reader over the current frame
+  uint8_t *m_frame;
+  int m_frame_length = 0;
+  int m_bit_position = 0;
+  // decoded samples from the current frame that haven't been read yet
+  int16_t *m_samples;
+  int m_sample_count = 0;
+  int m_sample_position = 0;
+  bool m_ended = false;
+  int m_sample_rate = 0;
+  uint64_t m_total_samples = 0;
+  uint64_t m_samples_read = 0;
+
+  uint32_t read_bits(int count);
+  int32_t read_signed_bits(int count);
+  uint32_t read_unary();
+  bool read_frame_bytes();
+  bool decode_frame();
+
+public:
+  FlacDecoder(fs::File &file);
+  ~FlacDecoder();
+  // read the stream header - returns false if this isn't one of our files
+  bool begin();
+  int sample_rate() { return m_sample_rate; }
+  // total samples in the stream - 0 if the header was never brought up to date
+  uint64_t total_samples() { return m_total_samples; }
+  // read up to count samples returning how many we got - 0 at the end of the stream. Stops at the total
+  // if there is one, anything after that was left by a power failure
+  int read(int16_t *samples, int count);
+};
@@ -0,0 +1,372 @@
+#include <Arduino.h>
+#include "RecordingTrimmer.h"
+#include "FlacCodec.h"
+#include "VoiceActivityDetector.h"
+
+RecordingTrimmer::RecordingTrimmer(fs::FS &fs) : m_fs(fs)
+{
+}
+
+RecordingTrimmer::~RecordingTrimmer()
+{
+  close_input();
+  release();
+}
+
+bool RecordingTrimmer::open_input(const char *path)
+{
+  m_input = m_fs.open(path, FILE_READ);
+  if (!m_input)
+  {
+    return false;
+  }
+  // the recorder writes either so go by what's in the file rather than its name
+  uint8_t header[WAV_HEADER_SIZE];
+  if (m_input.read(header, 4) != 4)
+  {
+    return false;
+  }
+  m_lossless = memcmp(header, "fLaC", 4) == 0;
+  m_input.seek(0);
+  if (m_lossless)
+  {
+    m_decoder = new FlacDecoder(m_input);
+    if (!m_decoder->begin())
+    {
+      return false;
+    }
+    m_sample_rate = m_decoder->sample_rate();
+  }
+  else
+  {
+    if (m_input.read(header, WAV_HEADER_SIZE) != WAV_HEADER_SIZE || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+    {
+      return false;
+    }
+    m_sample_rate = header[24] | (header[25] << 8) | (header[26] << 16) | (header[27] << 24);
+    // only as far as the last checkpoint - a file cut off by a power failure can have anything after that
+    m_input_remaining = header[40] | (header[41] << 8) | (header[42] << 16) | ((uint32_t)header[43] << 24);
+  }
+  return m_sample_rate >= 1000;
+}
+
+int RecordingTrimmer::read_input(int16_t *samples, int count)
+{
+  if (m_lossless)
+  {
+    return m_decoder->read(samples, count);
+  }
+  // the samples follow the header
+  uint32_t length = count * sizeof(int16_t);
+  if (length > m_input_remaining)
+  {
+    length = m_input_remaining & ~1;
+  }
+  int read = m_input.read((uint8_t *)samples, length);
+  if (read <= 0)
+  {
+    return 0;
+  }
+  m_input_remaining -= read;
+  return read / sizeof(int16_t);
+}
+
+void RecordingTrimmer::close_input()
+{
+  delete m_decoder;
+  m_decoder = NULL;
+  if (m_input)
+  {
+    m_input.close();
+  }
+}
+
+uint32_t RecordingTrimmer::find_segments(bool split)
+{
+  VoiceActivityDetector vad;
+  uint32_t lead_in = m_sample_rate * TRIM_LEAD_IN_MS / 1000;
+  uint32_t split_pause = m_sample_rate * TRIM_SPLIT_PAUSE_MS / 1000;
+  uint32_t min_segment = m_sample_rate * (TRIM_MIN_SEGMENT_MS / 1000);
+  m_segment_count = 0;
+  bool in_speech = false;
+  uint32_t position = 0;
+  int count;
+  while ((count = read_input(m_samples, FLAC_BLOCK_SIZE)) > 0)
+  {
+    for (int i = 0; i < count; i += TRIM_VAD_BLOCK_SIZE)
+    {
+      int length = count - i < TRIM_VAD_BLOCK_SIZE ? count - i : TRIM_VAD_BLOCK_SIZE;
+      uint32_t start = position + i;
+      // this includes the detector's hangover so the ends of words are kept
+      if (!vad.is_speech(m_samples + i, length))
+      {
+        in_speech = false;
+        continue;
+      }
+      if (!in_speech)
+      {
+        in_speech = true;
+        // short pauses stay in, as do long ones until the part before them is long enough to split off
+        Segment *last = m_segment_count > 0 ? &m_segments[m_segment_count - 1] : NULL;
+        if (!last || (split && m_segment_count < TRIM_MAX_SEGMENTS &&
+                      start - last->end >= split_pause && last->end - last->start >= min_segment))
+        {
+          Segment &segment = m_segments[m_segment_count++];
+          segment.start = start > lead_in ? start - lead_in : 0;
+          if (last && segment.start < last->end)
+          {
+            segment.start = last->end;
+          }
+        }
+      }
+      m_segments[m_segment_count - 1].end = start + length;
+    }
+    position += count;
+  }
+  return position;
+}
+
+bool RecordingTrimmer::open_output(const char *path)
+{
+  m_output = m_fs.open(path, FILE_WRITE);
+  if (!m_output)
+  {
+    Serial.printf("Failed to create %s\n", path);
+    return false;
+  }
+  m_bytes_written = 0;
+  m_samples_written = 0;
+  m_block_length = 0;
+  m_min_frame_size = 0;
+  m_max_frame_size = 0;
+  m_write_failed = false;
+  if (m_lossless)
+  {
+    m_encoder->reset();
+  }
+  // leave room for the header - it's filled in once we know the sizes
+  uint8_t header[WAV_HEADER_SIZE] = {0};
+  int header_size = m_lossless ? FLAC_HEADER_SIZE : WAV_HEADER_SIZE;
+  if (m_output.write(header, header_size) != (size_t)header_size)
+  {
+    m_write_failed = true;
+  }
+  return true;
+}
+
+void RecordingTrimmer::write_output(const int16_t *samples, int count)
+{
+  m_samples_written += count;
+  if (!m_lossless)
+  {
+    size_t length = count * sizeof(int16_t);
+    if (m_output.write((const uint8_t *)samples, length) != length)
+    {
+      m_write_failed = true;
+    }
+    m_bytes_written += length;
+    return;
+  }
+  // every FLAC frame but the last is a whole block
+  while (count > 0)
+  {
+    int to_copy = FLAC_BLOCK_SIZE - m_block_length;
+    if (to_copy > count)
+    {
+      to_copy = count;
+    }
+    memcpy(m_block + m_block_length, samples, to_copy * sizeof(int16_t));
+    m_block_length += to_copy;
+    samples += to_copy;
+    count -= to_copy;
+    if (m_block_length == FLAC_BLOCK_SIZE)
+    {
+      encode_block();
+    }
+  }
+}
+
+void RecordingTrimmer::encode_block()
+{
+  if (m_block_length == 0)
+  {
+    return;
+  }
+  uint32_t length = m_encoder->encode(m_block, m_block_length, m_encoded);
+  if (m_min_frame_size == 0 || length < m_min_frame_size)
+  {
+    m_min_frame_size = length;
+  }
+  if (length > m_max_frame_size)
+  {
+    m_max_frame_size = length;
+  }
+  if (m_output.write(m_encoded, length) != length)
+  {
+    m_write_failed = true;
+  }
+  m_bytes_written += length;
+  m_block_length = 0;
+}
+
+bool RecordingTrimmer::close_output()
+{
+  uint8_t header[WAV_HEADER_SIZE];
+  int header_size;
+  if (m_lossless)
+  {
+    encode_block();
+    FlacEncoder::write_header(header, m_sample_rate, m_samples_written, m_min_frame_size, m_max_frame_size);
+    header_size = FLAC_HEADER_SIZE;
+  }
+  else
+  {
+    SdRecorder::make_wav_header(header, m_sample_rate, m_bytes_written);
+    header_size = WAV_HEADER_SIZE;
+  }
+  m_output.seek(0);
+  if (m_output.write(header, header_size) != (size_t)header_size)
+  {
+    m_write_failed = true;
+  }
+  m_output.close();
+  return !m_write_failed;
+}
+
+bool RecordingTrimmer::copy_segments(char paths[][SD_RECORDER_MAX_PATH])
+{
+  int segment = 0;
+  uint32_t position = 0;
+  bool ok = true;
+  int count;
+  while (ok && segment < m_segment_count && (count = read_input(m_samples, FLAC_BLOCK_SIZE)) > 0)
+  {
+    int i = 0;
+    while (i < count && segment < m_segment_count)
+    {
+      Segment &current = m_segments[segment];
+      uint32_t at = position + i;
+      if (at < current.start)
+      {
+        // skip the silence before this part
+        i += current.start - at < (uint32_t)(count - i) ? current.start - at : count - i;
+        continue;
+      }
+      if (!m_output && !(ok = open_output(paths[segment])))
+      {
+        break;
+      }
+      int length = current.end - at < (uint32_t)(count - i) ? current.end - at : count - i;
+      write_output(m_samples + i, length);
+      i += length;
+      if (position + i == current.end)
+      {
+        segment++;
+        if (!(ok = close_output()))
+        {
+          break;
+        }
+      }
+    }
+    position += count;
+  }
+  if (m_output)
+  {
+    // the file came up short the second time round
+    m_output.close();
+    ok = false;
+  }
+  return ok && segment == m_segment_count;
+}
+
+void RecordingTrimmer::release()
+{
+  free(m_samples);
+  m_samples = NULL;
+  free(m_block);
+  m_block = NULL;
+  free(m_encoded);
+  m_encoded = NULL;
+  delete m_encoder;
+  m_encoder = NULL;
+}
+
+int RecordingTrimmer::process(const char *path, bool split, char paths[][SD_RECORDER_MAX_PATH])
+{
+  // first find where the speech is
+  m_samples = (int16_t *)malloc(sizeof(int16_t) * FLAC_BLOCK_SIZE);
+  if (!m_samples || !open_input(path))
+  {
+    Serial.printf("Couldn't read %s to trim it\n", path);
+    close_input();
+    release();
+    return -1;
+  }
+  uint32_t total = find_segments(split);
+  close_input();
+  uint32_t kept = 0;
+  for (int i = 0; i < m_segment_count; i++)
+  {
+    kept += m_segments[i].end - m_segments[i].start;
+  }
+  if (m_segment_count == 0)
+  {
+    release();
+    return 0;
+  }
+  if (m_segment_count == 1 && total - kept < (uint32_t)m_sample_rate * TRIM_MIN_SAVING_MS / 1000)
+  {
+    release();
+    strcpy(paths[0], path);
+    return 1;
+  }
+
+  // a single part replaces the recording, more are numbered after it - audio_1.wav becomes audio_1_1.wav, audio_1_2.wav...
+  const char *extension = strrchr(path, '.');
+  int base_length = extension ? extension - path : strlen(path);
+  for (int i = 0; i < m_segment_count; i++)
+  {
+    int length = m_segment_count == 1 ? snprintf(paths[i], SD_RECORDER_MAX_PATH, "%s.tmp", path)
+                                      : snprintf(paths[i], SD_RECORDER_MAX_PATH, "%.*s_%d%s", base_length, path, i + 1, extension ? extension : "");
+    if (length >= SD_RECORDER_MAX_PATH)
+    {
+      release();
+      return -1;
+    }
+  }
+
+  // then copy it out
+  bool ok = open_input(path);
+  if (ok && m_lossless)
+  {
+    m_encoder = new FlacEncoder();
+    m_block = (int16_t *)malloc(sizeof(int16_t) * FLAC_BLOCK_SIZE);
+    m_encoded = (uint8_t *)malloc(FLAC_MAX_FRAME_SIZE);
+    ok = m_block && m_encoded;
+  }
+  ok = ok && copy_segments(paths);
+  close_input();
+  release();
+  if (!ok)
+  {
+    Serial.printf("Failed to trim %s\n", path);
+    for (int i = 0; i < m_segment_count; i++)
+    {
+      if (m_fs.exists(paths[i]))
+      {
+        m_fs.remove(paths[i]);
+      }
+    }
+    return -1;
+  }
+  // everything is safely written so the original can go
+  m_fs.remove(path);
+  if (m_segment_count == 1)
+  {
+    m_fs.rename(paths[0], path);
+    strcpy(paths[0], path);
+  }
+  Serial.printf("Trimmed %s from %u ms to %u ms in %d parts\n", path,
+                total / (m_sample_rate / 1000), kept / (m_sample_rate / 1000), m_segment_count);
+  return m_segment_count;
+}
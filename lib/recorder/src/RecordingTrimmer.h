@@ -0,0 +1,81 @@
+#pragma once
+
+#include <FS.h>
+#include "SdRecorder.h"
+
+// samples looked at by the voice activity detector at a time - the same as the capture loop
+#define TRIM_VAD_BLOCK_SIZE 128
+// audio kept before the first speech so we don't clip the start of the first word - the
+// detector's hangover already keeps a bit after the last speech
+#define TRIM_LEAD_IN_MS 200
+// a pause at least this long splits a recording once the part before it is long enough
+#define TRIM_SPLIT_PAUSE_MS 1500
+#define TRIM_MIN_SEGMENT_MS 10000
+// most files a recording gets split into - anything after the last split stays in the last one
+#define TRIM_MAX_SEGMENTS 8
+// don't bother rewriting the file to save less than this
+#define TRIM_MIN_SAVING_MS 500
+
+class FlacDecoder;
+class FlacEncoder;
+
+/**
+ * @brief Cuts the silence off the ends of a finished recording and splits it at long pauses
+ *
+ * Runs over the file twice, a block at a time - once to find where the speech is using the
+ * same voice activity detector as the transmitter and once to copy those parts to new files
+ * in the same format. Only the start and end of each part are held in memory.
+ */
+class RecordingTrimmer
+{
+private:
+  struct Segment
+  {
+    uint32_t start;
+    uint32_t end;
+  };
+
+  fs::FS &m_fs;
+  Segment m_segments[TRIM_MAX_SEGMENTS];
+  int m_segment_count = 0;
+
+  // reading side
+  fs::File m_input;
+  FlacDecoder *m_decoder = NULL;
+  bool m_lossless = false;
+  int m_sample_rate = 0;
+  // bytes of WAV samples left to read
+  uint32_t m_input_remaining = 0;
+  int16_t *m_samples = NULL;
+
+  // writing side
+  fs::File m_output;
+  FlacEncoder *m_encoder = NULL;
+  int16_t *m_block = NULL;
+  int m_block_length = 0;
+  uint8_t *m_encoded = NULL;
+  uint32_t m_bytes_written = 0;
+  uint32_t m_samples_written = 0;
+  uint32_t m_min_frame_size = 0;
+  uint32_t m_max_frame_size = 0;
+  bool m_write_failed = false;
+
+  bool open_input(const char *path);
+  int read_input(int16_t *samples, int count);
+  void close_input();
+  uint32_t find_segments(bool split);
+  bool open_output(const char *path);
+  void write_output(const int16_t *samples, int count);
+  void encode_block();
+  bool close_output();
+  bool copy_segments(char paths[][SD_RECORDER_MAX_PATH]);
+  void release();
+
+public:
+  RecordingTrimmer(fs::FS &fs);
+  ~RecordingTrimmer();
+  // trim the recording, splitting it at long pauses if split is set. Returns how many files the
+  // audio is now in with their paths in paths - just the original if it wasn't worth changing -
+  // 0 if it's all silence or -1 if it couldn't be trimmed and should be used as it is
+  int process(const char *path, bool split, char paths[][SD_RECORDER_MAX_PATH]);
+};
@@ -0,0 +1,390 @@
+#include <Arduino.h>
+#include <unistd.h>
+#include "SdRecorder.h"
+
+// queued instead of a block index to close the current file
+const uint8_t SD_RECORDER_CLOSE = 0xff;
+
+void sd_recorder_task(void *param)
+{
+  SdRecorder *recorder = reinterpret_cast<SdRecorder *>(param);
+  while (true)
+  {
+    uint8_t index;
+    if (xQueueReceive(recorder->m_full, &index, portMAX_DELAY) == pdTRUE)
+    {
+      if (index == SD_RECORDER_CLOSE)
+      {
+        recorder->close_file();
+        recorder->m_closed++;
+        xSemaphoreGive(recorder->m_finished);
+        continue;
+      }
+      SdRecorder::Block &block = recorder->m_blocks[index];
+      if (block.first)
+      {
+        recorder->open_file(block);
+      }
+      recorder->write_block(block);
+      xQueueSend(recorder->m_free, &index, 0);
+    }
+  }
+}
+
+SdRecorder::SdRecorder(fs::FS &fs, const char *mount_point) : m_closed(0), m_fs(fs), m_max_loss_ms(SD_RECORDER_MAX_LOSS_MS)
+{
+  strncpy(m_mount_point, mount_point, SD_RECORDER_MAX_PATH - 1);
+  m_mount_point[SD_RECORDER_MAX_PATH - 1] = 0;
+  m_free = xQueueCreate(SD_RECORDER_BLOCK_COUNT, sizeof(uint8_t));
+  // room for every block plus a few close requests
+  m_full = xQueueCreate(SD_RECORDER_BLOCK_COUNT + 4, sizeof(uint8_t));
+  m_finished = xSemaphoreCreateBinary();
+  for (uint8_t i = 0; i < SD_RECORDER_BLOCK_COUNT; i++)
+  {
+    m_blocks[i].data = (uint8_t *)malloc(SD_RECORDER_BLOCK_SIZE);
+    m_blocks[i].length = 0;
+    m_blocks[i].first = false;
+    if (!m_blocks[i].data)
+    {
+      Serial.println("Failed to allocate recorder block");
+      continue;
+    }
+    xQueueSend(m_free, &i, 0);
+  }
+}
+
+void SdRecorder::begin()
+{
+  // run below the application task that captures the audio - the card can wait, the audio can't
+  TaskHandle_t task_handle;
+  xTaskCreate(sd_recorder_task, "sd_recorder_task", 4096, this, 0, &task_handle);
+}
+
+bool SdRecorder::start(const char *path, int sample_rate, bool lossless)
+{
+  if (m_recording)
+  {
+    stop(false);
+  }
+  if (lossless && !m_encoder)
+  {
+    // nothing is using the encoder yet so it's safe to create it from this side
+    m_encoder = new FlacEncoder();
+    m_encoded = (uint8_t *)malloc(FLAC_MAX_FRAME_SIZE);
+    if (!m_encoded)
+    {
+      Serial.println("Failed to allocate FLAC frame buffer");
+      delete m_encoder;
+      m_encoder = NULL;
+    }
+  }
+  if ((lossless && !m_encoder) || strlen(path) >= SD_RECORDER_MAX_PATH)
+  {
+    return false;
+  }
+  strcpy(m_path, path);
+  m_sample_rate = sample_rate;
+  m_lossless = lossless;
+  m_dropped_bytes = 0;
+  m_pending_open = true;
+  m_recording = true;
+  next_block();
+  return true;
+}
+
+void SdRecorder::next_block()
+{
+  uint8_t index;
+  if (xQueueReceive(m_free, &index, 0) == pdTRUE)
+  {
+    Block &block = m_blocks[index];
+    m_current = index;
+    block.length = 0;
+    block.first = m_pending_open;
+    if (m_pending_open)
+    {
+      strcpy(block.path, m_path);
+      block.sample_rate = m_sample_rate;
+      block.lossless = m_lossless;
+      m_pending_open = false;
+    }
+  }
+  else
+  {
+    m_current = -1;
+  }
+}
+
+int SdRecorder::block_capacity(Block &block)
+{
+  // the header goes in front of the first block of a WAV file so the blocks after it start on a block boundary
+  return block.first && !block.lossless ? SD_RECORDER_BLOCK_SIZE - WAV_HEADER_SIZE : SD_RECORDER_BLOCK_SIZE;
+}
+
+void SdRecorder::write(const void *data, size_t length)
+{
+  if (!m_recording)
+  {
+    return;
+  }
+  const uint8_t *src = (const uint8_t *)data;
+  while (length > 0)
+  {
+    if (m_current < 0)
+    {
+      // the writer has fallen behind - see if it has given us a block back yet
+      next_block();
+      if (m_current < 0)
+      {
+        m_dropped_bytes += length;
+        return;
+      }
+    }
+    Block &block = m_blocks[m_current];
+    int capacity = block_capacity(block);
+    size_t to_copy = capacity - block.length;
+    if (to_copy > length)
+    {
+      to_copy = length;
+    }
+    memcpy(block.data + block.length, src, to_copy);
+    block.length += to_copy;
+    src += to_copy;
+    length -= to_copy;
+    if (block.length == capacity)
+    {
+      uint8_t index = m_current;
+      xQueueSend(m_full, &index, 0);
+      next_block();
+    }
+  }
+}
+
+void SdRecorder::open_file(Block &block)
+{
+  // the previous recording should already be closed but make sure
+  close_file();
+  m_file = m_fs.open(block.path, FILE_WRITE);
+  if (!m_file)
+  {
+    Serial.printf("Failed to create recording file %s\n", block.path);
+    return;
+  }
+  strcpy(m_file_path, block.path);
+  m_allocated = 0;
+  m_file_sample_rate = block.sample_rate;
+  m_file_lossless = block.lossless;
+  m_header_size = m_file_lossless ? FLAC_HEADER_SIZE : WAV_HEADER_SIZE;
+  if (m_file_lossless)
+  {
+    m_encoder->reset();
+  }
+  m_min_frame_size = 0;
+  m_max_frame_size = 0;
+  m_bytes_written = 0;
+  m_samples_written = 0;
+  m_checkpoint_samples = 0;
+  m_write_errors = 0;
+  // reserve space for the header - the sizes get filled in as we go
+  write_header();
+}
+
+void SdRecorder::close_file()
+{
+  if (!m_file)
+  {
+    return;
+  }
+  if (m_samples_written != m_checkpoint_samples)
+  {
+    checkpoint();
+  }
+  m_file.close();
+  // give back what's left of the last extent
+  uint32_t length = m_header_size + m_bytes_written;
+  if (m_allocated > length)
+  {
+    char path[2 * SD_RECORDER_MAX_PATH];
+    snprintf(path, sizeof(path), "%s%s", m_mount_point, m_file_path);
+    if (truncate(path, length) != 0)
+    {
+      Serial.printf("Failed to trim recording file %s\n", path);
+    }
+  }
+  if (m_write_errors > 0)
+  {
+    Serial.printf("%u writes to the recording failed\n", m_write_errors);
+  }
+}
+
+void SdRecorder::write_block(Block &block)
+{
+  if (!m_file)
+  {
+    return;
+  }
+  if (block.length > 0)
+  {
+    const uint8_t *data = block.data;
+    size_t length = block.length;
+    if (m_file_lossless)
+    {
+      // this is the slow part so it happens here rather than on the capture side
+      length = m_encoder->encode((const int16_t *)block.data, block.length / sizeof(int16_t), m_encoded);
+      data = m_encoded;
+      if (m_min_frame_size == 0 || length < m_min_frame_size)
+      {
+        m_min_frame_size = length;
+      }
+      if (length > m_max_frame_size)
+      {
+        m_max_frame_size = length;
+      }
+    }
+    // grow the file an extent at a time - seeking past the end allocates the space in one go
+    uint32_t end = m_header_size + m_bytes_written + length;
+    if (end > m_allocated)
+    {
+      while (m_allocated < end)
+      {
+        m_allocated += SD_RECORDER_EXTENT_SIZE;
+      }
+      m_file.seek(m_allocated);
+      m_file.seek(m_header_size + m_bytes_written);
+    }
+    size_t written = m_file.write(data, length);
+    m_bytes_written += written;
+    if (written != length)
+    {
+      m_write_errors++;
+    }
+    m_samples_written += block.length / sizeof(int16_t);
+  }
+  // a power cut would lose what's been written since the last checkpoint, the next block (which might
+  // already be full and waiting) and the one after it that's being filled - checkpoint before that's
+  // more than we're allowed to lose
+  uint32_t at_risk = m_samples_written - m_checkpoint_samples + 2 * SD_RECORDER_BLOCK_SIZE / sizeof(int16_t);
+  if ((uint64_t)at_risk * 1000 > (uint64_t)m_max_loss_ms * m_file_sample_rate)
+  {
+    checkpoint();
+  }
+}
+
+void SdRecorder::checkpoint()
+{
+  write_header();
+  m_file.seek(m_header_size + m_bytes_written);
+  m_file.flush();
+  m_checkpoint_samples = m_samples_written;
+}
+
+void SdRecorder::write_header()
+{
+  if (m_file_lossless)
+  {
+    FlacEncoder::write_header(m_header, m_file_sample_rate, m_samples_written, m_min_frame_size, m_max_frame_size);
+    m_file.seek(0);
+    if (m_file.write(m_header, FLAC_HEADER_SIZE) != FLAC_HEADER_SIZE)
+    {
+      m_write_errors++;
+    }
+  }
+  else
+  {
+    write_wav_header();
+  }
+}
+
+void SdRecorder::make_wav_header(uint8_t *header, int sample_rate, uint32_t data_size)
+{
+  uint32_t riff_size = data_size + WAV_HEADER_SIZE - 8;
+  uint32_t byte_rate = sample_rate * sizeof(int16_t);
+  // RIFF chunk descriptor
+  memcpy(header, "RIFF", 4);
+  header[4] = riff_size & 0xFF;
+  header[5] = (riff_size >> 8) & 0xFF;
+  header[6] = (riff_size >> 16) & 0xFF;
+  header[7] = (riff_size >> 24) & 0xFF;
+  memcpy(header + 8, "WAVE", 4);
+  // fmt sub-chunk - 16 byte PCM format, 1 channel, 16 bits per sample
+  memcpy(header + 12, "fmt ", 4);
+  header[16] = 16;
+  header[17] = 0;
+  header[18] = 0;
+  header[19] = 0;
+  header[20] = 1;
+  header[21] = 0;
+  header[22] = 1;
+  header[23] = 0;
+  header[24] = sample_rate & 0xFF;
+  header[25] = (sample_rate >> 8) & 0xFF;
+  header[26] = (sample_rate >> 16) & 0xFF;
+  header[27] = (sample_rate >> 24) & 0xFF;
+  header[28] = byte_rate & 0xFF;
+  header[29] = (byte_rate >> 8) & 0xFF;
+  header[30] = (byte_rate >> 16) & 0xFF;
+  header[31] = (byte_rate >> 24) & 0xFF;
+  header[32] = sizeof(int16_t);
+  header[33] = 0;
+  header[34] = 16;
+  header[35] = 0;
+  // data sub-chunk - the size is in bytes
+  memcpy(header + 36, "data", 4);
+  header[40] = data_size & 0xFF;
+  header[41] = (data_size >> 8) & 0xFF;
+  header[42] = (data_size >> 16) & 0xFF;
+  header[43] = (data_size >> 24) & 0xFF;
+}
+
+void SdRecorder::write_wav_header()
+{
+  // the data has to be a whole number of samples
+  make_wav_header(m_header, m_file_sample_rate, m_bytes_written & ~1);
+  m_file.seek(0);
+  if (m_file.write(m_header, WAV_HEADER_SIZE) != WAV_HEADER_SIZE)
+  {
+    m_write_errors++;
+  }
+}
+
+void SdRecorder::stop(bool wait)
+{
+  if (m_recording)
+  {
+    m_recording = false;
+    if (m_current >= 0)
+    {
+      // hand over whatever is left in the current block
+      uint8_t index = m_current;
+      m_current = -1;
+      if (m_blocks[index].length > 0 || m_blocks[index].first)
+      {
+        xQueueSend(m_full, &index, 0);
+      }
+      else
+      {
+        xQueueSend(m_free, &index, 0);
+      }
+    }
+    if (m_pending_open)
+    {
+      // we never got a block so there's nothing to open or close
+      m_pending_open = false;
+    }
+    else
+    {
+      // there's room in the queue for every block and a close for each, so this shouldn't ever wait - but if
+      // the close was lost the file would stay open
+      xQueueSend(m_full, &SD_RECORDER_CLOSE, portMAX_DELAY);
+      m_close_requests++;
+    }
+  }
+  if (wait)
+  {
+    // the writer closes the file once it has written everything queued before the close
+    while (m_closed != m_close_requests)
+    {
+      xSemaphoreTake(m_finished, portMAX_DELAY);
+    }
+  }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <atomic>
+#include "FlacCodec.h"
+
+// size of each block handed to the writer task - a multiple of the SD card's cluster size
+// so every write fills whole clusters. 8KB is 256ms of 16 bit audio at 16kHz and one FLAC frame
+#define SD_RECORDER_BLOCK_SIZE (FLAC_BLOCK_SIZE * 2)
+// one block being filled, one being written and one spare for when the card is slow
+#define SD_RECORDER_BLOCK_COUNT 3
+// recordings are 16 bit mono WAV or FLAC files
+#define WAV_HEADER_SIZE 44
+#define SD_RECORDER_MAX_PATH 64
+// the file is grown this much at a time so the card's allocation table isn't updated on every block - a
+// multiple of any cluster size an SD card is formatted with
+#define SD_RECORDER_EXTENT_SIZE (64 * 1024)
+// a power cut loses at most this much of a recording - what's still in memory and what's been written
+// since the header was last brought up to date
+#define SD_RECORDER_MAX_LOSS_MS 1000
+// where the SD library mounts the card - the recorder needs the real path to trim the end of the last extent
+#define SD_RECORDER_MOUNT_POINT "/sd"
+
+/**
+ * @brief Records to a file on the SD card that stays open for the whole recording.
+ *
+ * The capture side copies into a block in memory and hands full blocks to a writer task
+ * so it never waits for the card. If the card falls so far behind that there are no free
+ * blocks the data is dropped and counted rather than stalling the capture. Opening and
+ * closing the file also happen on the writer task so recordings can be started and
+ * stopped from the playback loop.
+ *
+ * The header is patched with the sizes so far and the file flushed often enough that
+ * a power failure loses no more than the loss budget, and what's left is a valid file.
+ *
+ * The first block of a WAV file is short by the size of the header so every write after
+ * it fills whole clusters, and the file is grown a whole extent at a time then trimmed
+ * to length when it is closed. A file cut off by a power failure keeps the rest of its
+ * last extent but the header still says where the audio ends.
+ *
+ * Lossless recordings are FLAC compressed by the writer task, one frame per block.
+ */
+class SdRecorder
+{
+private:
+  struct Block
+  {
+    uint8_t *data;
+    int length;
+    // the first block of a recording tells the writer which file to open
+    bool first;
+    char path[SD_RECORDER_MAX_PATH];
+    int sample_rate;
+    bool lossless;
+  };
+  Block m_blocks[SD_RECORDER_BLOCK_COUNT];
+  // indexes of blocks that are free to be filled
+  QueueHandle_t m_free;
+  // indexes of blocks waiting to be written or SD_RECORDER_CLOSE
+  QueueHandle_t m_full;
+  // given by the writer task each time it closes a file
+  SemaphoreHandle_t m_finished;
+  // how many recordings we've asked the writer to close and how many it has
+  uint32_t m_close_requests = 0;
+  std::atomic<uint32_t> m_closed;
+
+  fs::FS &m_fs;
+  char m_mount_point[SD_RECORDER_MAX_PATH];
+
+  // capture side state
+  // the block being filled by the capture side or -1 if we are waiting for one
+  int m_current = -1;
+  bool m_recording = false;
+  // the next block we get has to open this file
+  bool m_pending_open = false;
+  char m_path[SD_RECORDER_MAX_PATH];
+  int m_sample_rate = 0;
+  bool m_lossless = false;
+  uint32_t m_dropped_bytes = 0;
+  std::atomic<uint32_t> m_max_loss_ms;
+
+  // writer side state
+  fs::File m_file;
+  char m_file_path[SD_RECORDER_MAX_PATH];
+  // how long the file has been made so far - the end of the last extent
+  uint32_t m_allocated = 0;
+  bool m_file_lossless = false;
+  int m_file_sample_rate = 0;
+  int m_header_size = WAV_HEADER_SIZE;
+  uint8_t m_header[WAV_HEADER_SIZE];
+  // only allocated the first time we make a lossless recording
+  FlacEncoder *m_encoder = NULL;
+  uint8_t *m_encoded = NULL;
+  uint32_t m_min_frame_size = 0;
+  uint32_t m_max_frame_size = 0;
+  // bytes of audio data that have made it onto the card (not including the header)
+  uint32_t m_bytes_written = 0;
+  uint32_t m_samples_written = 0;
+  // samples the header covered when it was last brought up to date
+  uint32_t m_checkpoint_samples = 0;
+  uint32_t m_write_errors = 0;
+
+  void next_block();
+  // how much audio the block can hold
+  int block_capacity(Block &block);
+  void open_file(Block &block);
+  void close_file();
+  void write_block(Block &block);
+  // bring the header up to date and flush the file
+  void checkpoint();
+  void write_header();
+  void write_wav_header();
+
+public:
+  SdRecorder(fs::FS &fs, const char *mount_point = SD_RECORDER_MOUNT_POINT);
+  // start the writer task
+  void begin();
+  // how much of a recording a power cut may lose - lower costs more writes to the card
+  void set_max_loss(uint32_t ms) { m_max_loss_ms = ms; }
+  // record to a new WAV (or FLAC if lossless is set) file - anything already recording is stopped first.
+  // The file is opened by the writer task so this returns straight away
+  bool start(const char *path, int sample_rate, bool lossless = false);
+  // called from the capture side - copies the data and returns straight away
+  void write(const void *data, size_t length);
+  // write out whatever is left and close the file - if wait is set this waits for the writer task
+  // to finish so the file can be used straight away
+  void stop(bool wait = true);
+  bool is_recording() { return m_recording; }
+  // bytes of audio that have made it onto the last file - only valid once stop has waited
+  uint32_t bytes_written() { return m_bytes_written; }
+  uint32_t samples_written() { return m_samples_written; }
+  // bytes thrown away because the card couldn't keep up
+  uint32_t dropped_bytes() { return m_dropped_bytes; }
+  // fill in the header of a 16 bit mono WAV file with data_size bytes of samples
+  static void make_wav_header(uint8_t *header, int sample_rate, uint32_t data_size);
+
+  friend void sd_recorder_task(void *param);
+};
@@ -0,0 +1,108 @@
+#include <string.h>
+#include "AdpcmCodec.h"
+
+static const int16_t step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+static const int8_t index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8};
+
+// apply a 4 bit code to the predictor and step index - shared by the encoder and decoder
+static inline void apply_code(uint8_t code, int &predictor, int &step_index)
+{
+  int step = step_table[step_index];
+  int delta = step >> 3;
+  if (code & 4)
+    delta += step;
+  if (code & 2)
+    delta += step >> 1;
+  if (code & 1)
+    delta += step >> 2;
+  predictor += (code & 8) ? -delta : delta;
+  predictor = predictor > INT16_MAX ? INT16_MAX : (predictor < INT16_MIN ? INT16_MIN : predictor);
+  step_index += index_table[code];
+  step_index = step_index < 0 ? 0 : (step_index > 88 ? 88 : step_index);
+}
+
+void AdpcmEncoder::reset()
+{
+  m_predictor = 0;
+  m_step_index = 0;
+}
+
+void AdpcmEncoder::write_state(uint8_t *dst, uint8_t flags)
+{
+  memcpy(dst, &m_predictor, sizeof(int16_t));
+  dst[2] = m_step_index;
+  dst[3] = flags;
+}
+
+uint8_t AdpcmEncoder::encode(int16_t sample)
+{
+  int step = step_table[m_step_index];
+  int diff = sample - m_predictor;
+  uint8_t code = 0;
+  if (diff < 0)
+  {
+    code = 8;
+    diff = -diff;
+  }
+  if (diff >= step)
+  {
+    code |= 4;
+    diff -= step;
+  }
+  if (diff >= (step >> 1))
+  {
+    code |= 2;
+    diff -= step >> 1;
+  }
+  if (diff >= (step >> 2))
+  {
+    code |= 1;
+  }
+  // track exactly what the decoder will reconstruct
+  int predictor = m_predictor;
+  int step_index = m_step_index;
+  apply_code(code, predictor, step_index);
+  m_predictor = predictor;
+  m_step_index = step_index;
+  return code;
+}
+
+int AdpcmDecoder::decode(const uint8_t *data, int length, int16_t *samples, int max_samples)
+{
+  if (length <= ADPCM_STATE_SIZE)
+  {
+    return 0;
+  }
+  int16_t initial_predictor;
+  memcpy(&initial_predictor, data, sizeof(int16_t));
+  int predictor = initial_predictor;
+  int step_index = data[2] > 88 ? 88 : data[2];
+  uint8_t flags = data[3];
+
+  int count = (length - ADPCM_STATE_SIZE) * 2;
+  if (flags & ADPCM_FLAG_ODD_COUNT)
+  {
+    count--;
+  }
+  if (count > max_samples)
+  {
+    count = max_samples;
+  }
+  const uint8_t *codes = data + ADPCM_STATE_SIZE;
+  for (int i = 0; i < count; i++)
+  {
+    uint8_t code = (i & 1) ? (codes[i >> 1] >> 4) : (codes[i >> 1] & 0x0f);
+    apply_code(code, predictor, step_index);
+    samples[i] = predictor;
+  }
+  return count;
+}
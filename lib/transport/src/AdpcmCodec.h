@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+// every ADPCM packet starts with the encoder state so it can be decoded on its own:
+// int16 predictor, uint8 step index, uint8 flags
+const int ADPCM_STATE_SIZE = 4;
+// set in the flags byte when the last nibble of the packet is padding
+const uint8_t ADPCM_FLAG_ODD_COUNT = 0x01;
+
+/**
+ * @brief IMA ADPCM encoder - 16 bit PCM in, 4 bit codes out
+ *
+ */
+class AdpcmEncoder
+{
+private:
+  int16_t m_predictor = 0;
+  uint8_t m_step_index = 0;
+
+public:
+  void reset();
+  // write the current predictor state into the start of a packet
+  void write_state(uint8_t *dst, uint8_t flags = 0);
+  // encode a single sample returning the 4 bit code
+  uint8_t encode(int16_t sample);
+};
+
+/**
+ * @brief IMA ADPCM decoder - reads the predictor state from the packet so
+ * a lost packet never affects the ones that follow it
+ *
+ */
+class AdpcmDecoder
+{
+public:
+  // decode a packet (state + codes) returning the number of samples written
+  int decode(const uint8_t *data, int length, int16_t *samples, int max_samples);
+};
@@ -2,7 +2,6 @@
 #include <WiFi.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
-#include "OutputBuffer.h"
 #include "EspNowTransport.h"
 
 const int MAX_ESP_NOW_PACKET_SIZE = 250;
@@ -13,13 +12,8 @@ static EspNowTransport *instance = NULL;
 void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen)
 {
   // annoyingly we can't pass an param into this so we need to do a bit of hack to access the EspNowTransport instance
-  int header_size = instance->m_header_size;
-  
-  // first m_header_size bytes of m_buffer are the expected header
-  if ((dataLen > header_size) && (dataLen<=MAX_ESP_NOW_PACKET_SIZE) && (memcmp(data,instance->m_buffer,header_size) == 0)) 
-  {
-    instance->m_output_buffer->add_samples(data + header_size, dataLen - header_size);
-  }
+  // this runs in the WiFi task so just queue the packet up for the receive task
+  instance->queue_packet(macAddr, data, dataLen);
 }
 
 bool EspNowTransport::begin()
@@ -29,6 +23,8 @@ bool EspNowTransport::begin()
   esp_wifi_set_channel(m_wifi_channel, WIFI_SECOND_CHAN_NONE);
   esp_wifi_set_promiscuous(false);
   
+  start_receive_task();
+
   esp_err_t result = esp_now_init();
   if (result == ESP_OK)
   {
@@ -55,16 +51,15 @@ bool EspNowTransport::begin()
   return true;
 }
 
-EspNowTransport::EspNowTransport(OutputBuffer *output_buffer, uint8_t wifi_channel) : Transport(output_buffer, MAX_ESP_NOW_PACKET_SIZE)
+EspNowTransport::EspNowTransport(StreamMixer *mixer, uint8_t wifi_channel) : Transport(mixer, MAX_ESP_NOW_PACKET_SIZE)
 {
   instance = this;  
   m_wifi_channel = wifi_channel;
 }
 
-void EspNowTransport::send()
+void EspNowTransport::send(const uint8_t *data, int length)
 {
-
-  esp_err_t result = esp_now_send(broadcastAddress, m_buffer, m_index + m_header_size);
+  esp_err_t result = esp_now_send(broadcastAddress, data, length);
   if (result != ESP_OK)
   {
     Serial.printf("Failed to send: %s\n", esp_err_to_name(result));
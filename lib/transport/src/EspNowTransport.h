@@ -2,15 +2,15 @@
 
 #include "Transport.h"
 
-class OutputBuffer;
+class StreamMixer;
 
 class EspNowTransport: public Transport {
 private:
   uint8_t m_wifi_channel;
 protected:
-  void send();
+  void send(const uint8_t *data, int length);
 public:
-  EspNowTransport(OutputBuffer *output_buffer, uint8_t wifi_channel);
+  EspNowTransport(StreamMixer *mixer, uint8_t wifi_channel);
   virtual bool begin() override;
   friend void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen);
 };
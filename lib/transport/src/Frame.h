@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+// every packet has a frame header after the transport header:
+// uint8 type, uint8 flags, uint16 sequence number, uint32 timestamp (in samples)
+const int FRAME_HEADER_SIZE = 8;
+
+// ADPCM encoded audio
+const uint8_t FRAME_TYPE_AUDIO = 0x01;
+// XOR parity of a group of audio frames - the flags hold the number of frames in the group,
+// the sequence is the first frame in the group and the timestamp is the XOR of the frame lengths
+const uint8_t FRAME_TYPE_PARITY = 0x02;
+// sent instead of audio while the sender is silent - the payload is the uint16 RMS level of the
+// background noise. These don't use up a sequence number so they don't look like lost audio frames
+const uint8_t FRAME_TYPE_COMFORT_NOISE = 0x03;
+const int COMFORT_NOISE_PAYLOAD_SIZE = 2;
+
+// first frame of a transmission
+const uint8_t FRAME_FLAG_FIRST = 0x01;
+// last frame of a transmission
+const uint8_t FRAME_FLAG_LAST = 0x02;
@@ -0,0 +1,46 @@
+#include <Arduino.h>
+#include "PacketPool.h"
+
+PacketPool::PacketPool(int packet_size) : m_packet_size(packet_size)
+{
+  m_free = xQueueCreate(PACKET_POOL_SIZE, sizeof(uint8_t));
+  m_ready = xQueueCreate(PACKET_POOL_SIZE, sizeof(uint8_t));
+  for (uint8_t i = 0; i < PACKET_POOL_SIZE; i++)
+  {
+    m_packets[i].length = 0;
+    m_packets[i].data = (uint8_t *)malloc(m_packet_size);
+    xQueueSend(m_free, &i, 0);
+  }
+}
+
+bool PacketPool::push(const uint8_t *address, const uint8_t *data, int length)
+{
+  uint8_t index;
+  if (length <= 0 || length > m_packet_size || xQueueReceive(m_free, &index, 0) != pdTRUE)
+  {
+    m_dropped++;
+    return false;
+  }
+  Packet &packet = m_packets[index];
+  memcpy(packet.address, address, PACKET_ADDRESS_SIZE);
+  memcpy(packet.data, data, length);
+  packet.length = length;
+  xQueueSend(m_ready, &index, 0);
+  return true;
+}
+
+PacketPool::Packet *PacketPool::take(TickType_t ticks_to_wait)
+{
+  uint8_t index;
+  if (xQueueReceive(m_ready, &index, ticks_to_wait) != pdTRUE)
+  {
+    return NULL;
+  }
+  return &m_packets[index];
+}
+
+void PacketPool::release(Packet *packet)
+{
+  uint8_t index = packet - m_packets;
+  xQueueSend(m_free, &index, 0);
+}
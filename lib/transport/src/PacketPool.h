@@ -0,0 +1,46 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+// how many received packets can be waiting to be decoded
+#define PACKET_POOL_SIZE 16
+// MAC address or an IPv4 address padded with zeros
+#define PACKET_ADDRESS_SIZE 6
+
+/**
+ * @brief Fixed pool of packet buffers handed from the network stack to the receive task.
+ *
+ * push is all the network callbacks do - it copies the packet into a free buffer
+ * and queues it without ever blocking. If the pool is empty the packet is dropped.
+ */
+class PacketPool
+{
+public:
+  struct Packet
+  {
+    // who sent it
+    uint8_t address[PACKET_ADDRESS_SIZE];
+    int length;
+    uint8_t *data;
+  };
+
+private:
+  Packet m_packets[PACKET_POOL_SIZE];
+  int m_packet_size;
+  // indexes of packets that are free to be filled
+  QueueHandle_t m_free;
+  // indexes of packets waiting to be decoded
+  QueueHandle_t m_ready;
+  uint32_t m_dropped = 0;
+
+public:
+  PacketPool(int packet_size);
+  // called from the network stack - never blocks
+  bool push(const uint8_t *address, const uint8_t *data, int length);
+  // wait for the next packet - hand it back with release when done
+  Packet *take(TickType_t ticks_to_wait);
+  void release(Packet *packet);
+  // packets thrown away because the pool was full
+  uint32_t dropped() { return m_dropped; }
+};
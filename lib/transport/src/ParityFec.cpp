@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ParityFec.h"
+#include "Frame.h"
+
+ParityEncoder::ParityEncoder(int max_length) : m_max_length(max_length)
+{
+  m_parity = (uint8_t *)malloc(m_max_length);
+  memset(m_parity, 0, m_max_length);
+}
+
+ParityEncoder::~ParityEncoder()
+{
+  free(m_parity);
+}
+
+void ParityEncoder::set_group_size(int group_size)
+{
+  m_group_size = group_size < 0 ? 0 : (group_size > FEC_MAX_GROUP_SIZE ? FEC_MAX_GROUP_SIZE : group_size);
+}
+
+bool ParityEncoder::add_frame(uint16_t sequence, const uint8_t *frame, int length)
+{
+  if (m_group_size == 0 || length > m_max_length)
+  {
+    return false;
+  }
+  if (m_count == 0)
+  {
+    m_first_sequence = sequence;
+  }
+  for (int i = 0; i < length; i++)
+  {
+    m_parity[i] ^= frame[i];
+  }
+  m_length_xor ^= length;
+  if (length > m_parity_length)
+  {
+    m_parity_length = length;
+  }
+  m_count++;
+  return m_count == m_group_size;
+}
+
+int ParityEncoder::write_parity(uint8_t *dst)
+{
+  dst[0] = FRAME_TYPE_PARITY;
+  dst[1] = m_count;
+  memcpy(dst + 2, &m_first_sequence, sizeof(uint16_t));
+  memcpy(dst + 4, &m_length_xor, sizeof(uint32_t));
+  memcpy(dst + FRAME_HEADER_SIZE, m_parity, m_parity_length);
+  int length = FRAME_HEADER_SIZE + m_parity_length;
+  // start the next group
+  memset(m_parity, 0, m_parity_length);
+  m_parity_length = 0;
+  m_length_xor = 0;
+  m_count = 0;
+  return length;
+}
+
+ParityDecoder::ParityDecoder(int max_length) : m_max_length(max_length)
+{
+  for (int i = 0; i < FEC_HISTORY_SLOTS; i++)
+  {
+    m_slots[i].used = false;
+    m_slots[i].data = (uint8_t *)malloc(m_max_length);
+  }
+  // parity frames have their own header in front of the XOR of the frame headers and payloads
+  for (int i = 0; i < FEC_PARITY_SLOTS; i++)
+  {
+    m_parity[i].used = false;
+    m_parity[i].data = (uint8_t *)malloc(FRAME_HEADER_SIZE + m_max_length);
+  }
+  m_recovered = (uint8_t *)malloc(m_max_length);
+}
+
+ParityDecoder::~ParityDecoder()
+{
+  for (int i = 0; i < FEC_HISTORY_SLOTS; i++)
+  {
+    free(m_slots[i].data);
+  }
+  for (int i = 0; i < FEC_PARITY_SLOTS; i++)
+  {
+    free(m_parity[i].data);
+  }
+  free(m_recovered);
+}
+
+void ParityDecoder::clear()
+{
+  for (int i = 0; i < FEC_HISTORY_SLOTS; i++)
+  {
+    m_slots[i].used = false;
+  }
+  for (int i = 0; i < FEC_PARITY_SLOTS; i++)
+  {
+    m_parity[i].used = false;
+  }
+}
+
+void ParityDecoder::add_frame(uint16_t sequence, const uint8_t *frame, int length)
+{
+  if (length > m_max_length)
+  {
+    return;
+  }
+  Slot &slot = m_slots[sequence % FEC_HISTORY_SLOTS];
+  slot.used = true;
+  slot.sequence = sequence;
+  slot.length = length;
+  memcpy(slot.data, frame, length);
+}
+
+bool ParityDecoder::add_parity(const uint8_t *parity, int length)
+{
+  int count = parity[1];
+  if (count == 0 || count > FEC_MAX_GROUP_SIZE || length <= FRAME_HEADER_SIZE || length > FRAME_HEADER_SIZE + m_max_length)
+  {
+    return false;
+  }
+  // the oldest one goes - its group has been played or given up on by now
+  Slot &slot = m_parity[m_next_parity];
+  m_next_parity = (m_next_parity + 1) % FEC_PARITY_SLOTS;
+  slot.used = true;
+  memcpy(&slot.sequence, parity + 2, sizeof(uint16_t));
+  slot.length = length;
+  memcpy(slot.data, parity, length);
+  return true;
+}
+
+int ParityDecoder::recover(uint16_t sequence)
+{
+  for (int i = 0; i < FEC_PARITY_SLOTS; i++)
+  {
+    Slot &slot = m_parity[i];
+    if (slot.used && (uint16_t)(sequence - slot.sequence) < slot.data[1])
+    {
+      return rebuild(slot.data, slot.length, sequence);
+    }
+  }
+  return 0;
+}
+
+int ParityDecoder::rebuild(const uint8_t *parity, int length, uint16_t sequence)
+{
+  int count = parity[1];
+  uint16_t first_sequence;
+  uint32_t length_xor;
+  memcpy(&first_sequence, parity + 2, sizeof(uint16_t));
+  memcpy(&length_xor, parity + 4, sizeof(uint32_t));
+  // we can only rebuild a frame if it's the only one missing from the group
+  for (int i = 0; i < count; i++)
+  {
+    uint16_t group_sequence = first_sequence + i;
+    Slot &slot = m_slots[group_sequence % FEC_HISTORY_SLOTS];
+    bool missing = !slot.used || slot.sequence != group_sequence;
+    if (missing != (group_sequence == sequence))
+    {
+      return 0;
+    }
+  }
+  int parity_length = length - FRAME_HEADER_SIZE;
+  memcpy(m_recovered, parity + FRAME_HEADER_SIZE, parity_length);
+  for (int i = 0; i < count; i++)
+  {
+    uint16_t group_sequence = first_sequence + i;
+    if (group_sequence == sequence)
+    {
+      continue;
+    }
+    Slot &slot = m_slots[group_sequence % FEC_HISTORY_SLOTS];
+    length_xor ^= slot.length;
+    int to_xor = slot.length < parity_length ? slot.length : parity_length;
+    for (int j = 0; j < to_xor; j++)
+    {
+      m_recovered[j] ^= slot.data[j];
+    }
+  }
+  // whatever is left over from the XOR is the missing frame - check it is what we expected
+  uint16_t recovered_sequence;
+  memcpy(&recovered_sequence, m_recovered + 2, sizeof(uint16_t));
+  if ((int)length_xor > parity_length || (int)length_xor < FRAME_HEADER_SIZE || recovered_sequence != sequence)
+  {
+    return 0;
+  }
+  add_frame(recovered_sequence, m_recovered, length_xor);
+  return length_xor;
+}
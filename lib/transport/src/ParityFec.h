@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+// largest number of frames that can be protected by a single parity frame
+#define FEC_MAX_GROUP_SIZE 8
+// how many received frames we keep around to rebuild a missing one
+#define FEC_HISTORY_SLOTS (2 * FEC_MAX_GROUP_SIZE)
+// how many parity frames we keep until the frames they protect are given up on
+#define FEC_PARITY_SLOTS 2
+
+/**
+ * @brief Builds one XOR parity frame for every group of frames sent
+ *
+ */
+class ParityEncoder
+{
+private:
+  uint8_t *m_parity;
+  int m_max_length;
+  int m_group_size = 0;
+  int m_count = 0;
+  uint16_t m_first_sequence = 0;
+  uint32_t m_length_xor = 0;
+  int m_parity_length = 0;
+
+public:
+  ParityEncoder(int max_length);
+  ~ParityEncoder();
+  // 0 turns parity off
+  void set_group_size(int group_size);
+  bool is_enabled() { return m_group_size > 0; }
+  int group_size() { return m_group_size; }
+  bool has_frames() { return m_count > 0; }
+  // add a sent frame (frame header and payload) - returns true when the group is complete
+  bool add_frame(uint16_t sequence, const uint8_t *frame, int length);
+  // write out the parity frame for the current group and start a new one, returns the length
+  int write_parity(uint8_t *dst);
+};
+
+/**
+ * @brief Keeps the most recent frames and parity frames so a single missing frame in a group
+ * can be rebuilt once the jitter buffer gives up waiting for it
+ *
+ */
+class ParityDecoder
+{
+private:
+  struct Slot
+  {
+    bool used;
+    // the frame's sequence number or for parity the first frame in the group
+    uint16_t sequence;
+    int length;
+    uint8_t *data;
+  };
+  Slot m_slots[FEC_HISTORY_SLOTS];
+  Slot m_parity[FEC_PARITY_SLOTS];
+  int m_next_parity = 0;
+  int m_max_length;
+  uint8_t *m_recovered;
+
+  int rebuild(const uint8_t *parity, int length, uint16_t sequence);
+
+public:
+  ParityDecoder(int max_length);
+  ~ParityDecoder();
+  // remember a received frame (frame header and payload)
+  void add_frame(uint16_t sequence, const uint8_t *frame, int length);
+  // remember a received parity frame - returns false if it isn't a valid one
+  bool add_parity(const uint8_t *parity, int length);
+  // forget all the frames we've kept - used when the sender changes
+  void clear();
+  // try and rebuild a missing frame from the parity frames we've got - returns the recovered frame's length or 0
+  int recover(uint16_t sequence);
+  const uint8_t *recovered() { return m_recovered; }
+};
@@ -1,42 +1,378 @@
 #include "Arduino.h"
 #include "Transport.h"
+#include "OutputBuffer.h"
 
-Transport::Transport(OutputBuffer *output_buffer, size_t buffer_size)
+// while silent send a comfort noise frame every 200ms so receivers track the background level
+const int COMFORT_NOISE_INTERVAL = 3200;
+// how often the receive task checks for frames that are never coming when nothing is arriving
+const int RECEIVE_POLL_MS = 10;
+
+void transport_receive_task(void *param)
 {
-  m_output_buffer = output_buffer;
+  Transport *transport = reinterpret_cast<Transport *>(param);
+  while (true)
+  {
+    PacketPool::Packet *packet = transport->m_packet_pool->take(pdMS_TO_TICKS(RECEIVE_POLL_MS));
+    if (packet)
+    {
+      transport->receive_packet(packet->address, packet->data, packet->length);
+      transport->m_packet_pool->release(packet);
+    }
+    transport->poll();
+  }
+}
+
+Transport::Transport(StreamMixer *mixer, size_t buffer_size)
+{
+  m_mixer = mixer;
   m_buffer_size = buffer_size;
   m_buffer = (uint8_t *)malloc(m_buffer_size);
   m_index = 0;
   m_header_size = 0;
+  m_frame_size = JITTER_BUFFER_MAX_FRAME_SAMPLES;
+  m_decode_buffer = (int16_t *)malloc(sizeof(int16_t) * JITTER_BUFFER_MAX_FRAME_SAMPLES);
+  // parity frames can be as big as the biggest frame we send
+  int max_frame_length = FRAME_HEADER_SIZE + ADPCM_STATE_SIZE + JITTER_BUFFER_MAX_FRAME_SAMPLES / 2;
+  if (max_frame_length > m_buffer_size)
+  {
+    max_frame_length = m_buffer_size;
+  }
+  m_parity_encoder = new ParityEncoder(max_frame_length);
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    m_parity_decoders[i] = new ParityDecoder(max_frame_length);
+  }
+  m_parity_buffer = (uint8_t *)malloc(m_buffer_size);
+  m_packet_pool = new PacketPool(m_buffer_size);
+  update_samples_per_packet();
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    m_mixer->output_buffer(i)->jitter_buffer()->set_recovery(this, i);
+  }
+}
+
+void Transport::start_receive_task()
+{
+  TaskHandle_t task_handle;
+  xTaskCreate(transport_receive_task, "transport_receive_task", 4096, this, 2, &task_handle);
+}
+
+void Transport::queue_packet(const uint8_t *address, const uint8_t *data, int length)
+{
+  m_packet_pool->push(address, data, length);
+}
+
+uint32_t Transport::fec_recovered()
+{
+  uint32_t recovered = 0;
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    recovered += m_mixer->output_buffer(i)->jitter_buffer()->recovered();
+  }
+  return recovered;
+}
+
+void Transport::update_samples_per_packet()
+{
+  // each byte after the ADPCM state holds two samples
+  int payload_size = m_buffer_size - m_header_size - FRAME_HEADER_SIZE - ADPCM_STATE_SIZE;
+  // parity frames carry a whole frame after their own frame header so leave room for that
+  if (m_parity_encoder->is_enabled())
+  {
+    payload_size -= FRAME_HEADER_SIZE;
+  }
+  m_samples_per_packet = payload_size * 2;
+  // the receiver can't hold frames bigger than this
+  if (m_samples_per_packet > m_frame_size)
+  {
+    m_samples_per_packet = m_frame_size;
+  }
+}
+
+void Transport::set_frame_size(int frame_size)
+{
+  m_frame_size = frame_size < JITTER_BUFFER_MAX_FRAME_SAMPLES ? frame_size : JITTER_BUFFER_MAX_FRAME_SAMPLES;
+  update_samples_per_packet();
+}
+
+void Transport::set_fec_group_size(int group_size)
+{
+  m_parity_encoder->set_group_size(group_size);
+  update_samples_per_packet();
 }
 
 void Transport::add_sample(int16_t sample)
 {
-  m_buffer[m_index+m_header_size] = (sample + 32768) >> 8;
-  m_index++;
-  // have we reached a full packet?
-  if ((m_index+m_header_size) == m_buffer_size)
+  add_samples(&sample, 1);
+}
+
+void Transport::add_samples(const int16_t *samples, int count)
+{
+  m_silent = false;
+  while (count > 0)
   {
-    send();
-    m_index = 0;
+    uint8_t *payload = m_buffer + m_header_size + FRAME_HEADER_SIZE;
+    uint8_t *codes = payload + ADPCM_STATE_SIZE;
+    if (m_index == 0)
+    {
+      // the packet carries the predictor state so it can be decoded on its own
+      m_encoder.write_state(payload);
+    }
+    // encode as much as will fit in the current packet in one go
+    int to_encode = m_samples_per_packet - m_index;
+    if (to_encode > count)
+    {
+      to_encode = count;
+    }
+    const int16_t *end = samples + to_encode;
+    // finish off a half filled byte
+    if ((m_index & 1) && samples < end)
+    {
+      codes[m_index >> 1] |= m_encoder.encode(*samples++) << 4;
+      m_index++;
+    }
+    // two samples to a byte
+    uint8_t *code = codes + (m_index >> 1);
+    while (end - samples >= 2)
+    {
+      uint8_t low = m_encoder.encode(samples[0]);
+      uint8_t high = m_encoder.encode(samples[1]);
+      *code++ = low | (high << 4);
+      samples += 2;
+    }
+    m_index = (code - codes) * 2;
+    if (samples < end)
+    {
+      *code = m_encoder.encode(*samples++);
+      m_index++;
+    }
+    count -= to_encode;
+    // have we reached a full packet?
+    if (m_index == m_samples_per_packet)
+    {
+      send_packet(false);
+    }
   }
 }
 
+void Transport::send_packet(bool last)
+{
+  uint8_t *frame = m_buffer + m_header_size;
+  uint8_t *payload = frame + FRAME_HEADER_SIZE;
+  if (m_index == 0)
+  {
+    // an empty frame just marks the end of the transmission
+    m_encoder.write_state(payload);
+  }
+  if (m_index & 1)
+  {
+    payload[3] |= ADPCM_FLAG_ODD_COUNT;
+  }
+  frame[0] = FRAME_TYPE_AUDIO;
+  frame[1] = (m_first ? FRAME_FLAG_FIRST : 0) | (last ? FRAME_FLAG_LAST : 0);
+  memcpy(frame + 2, &m_sequence, sizeof(uint16_t));
+  memcpy(frame + 4, &m_timestamp, sizeof(uint32_t));
+  int length = m_header_size + FRAME_HEADER_SIZE + ADPCM_STATE_SIZE + (m_index + 1) / 2;
+  send(m_buffer, length);
+  if (m_parity_encoder->add_frame(m_sequence, frame, length - m_header_size))
+  {
+    send_parity();
+  }
+  m_sequence++;
+  m_timestamp += m_index;
+  m_first = false;
+  m_index = 0;
+}
+
+void Transport::add_silence(int count, uint16_t noise_level)
+{
+  // send the end of the last word straight away rather than waiting for the packet to fill
+  if (m_index > 0)
+  {
+    send_packet(false);
+  }
+  // and protect it now rather than when the next word fills the group
+  if (!m_silent && m_parity_encoder->has_frames())
+  {
+    send_parity();
+  }
+  if (!m_silent || m_samples_since_comfort_noise >= COMFORT_NOISE_INTERVAL)
+  {
+    send_comfort_noise(noise_level);
+    m_silent = true;
+    m_samples_since_comfort_noise = 0;
+  }
+  // the receiver uses the timestamps to know how long we were silent for
+  m_timestamp += count;
+  m_samples_since_comfort_noise += count;
+  m_suppressed_samples += count;
+}
+
+void Transport::send_comfort_noise(uint16_t noise_level)
+{
+  uint8_t *frame = m_buffer + m_header_size;
+  frame[0] = FRAME_TYPE_COMFORT_NOISE;
+  frame[1] = 0;
+  // the sequence number isn't used up - the next audio frame will carry the same one
+  memcpy(frame + 2, &m_sequence, sizeof(uint16_t));
+  memcpy(frame + 4, &m_timestamp, sizeof(uint32_t));
+  memcpy(frame + FRAME_HEADER_SIZE, &noise_level, sizeof(uint16_t));
+  int length = m_header_size + FRAME_HEADER_SIZE + COMFORT_NOISE_PAYLOAD_SIZE;
+  send(m_buffer, length);
+  m_comfort_noise_bytes += length;
+}
+
+int32_t Transport::dtx_saved_bytes()
+{
+  // two samples per byte plus the headers of every packet we would have sent
+  int packet_overhead = m_header_size + FRAME_HEADER_SIZE + ADPCM_STATE_SIZE;
+  uint32_t packets = (m_suppressed_samples + m_samples_per_packet - 1) / m_samples_per_packet;
+  uint32_t saved = m_suppressed_samples / 2 + packets * packet_overhead;
+  // and the parity frames that would have protected them - each one is a frame's worth behind its own header
+  if (m_parity_encoder->is_enabled())
+  {
+    saved += packets / m_parity_encoder->group_size() * (m_header_size + FRAME_HEADER_SIZE + FRAME_HEADER_SIZE + ADPCM_STATE_SIZE + m_samples_per_packet / 2);
+  }
+  return (int32_t)saved - (int32_t)m_comfort_noise_bytes;
+}
+
 void Transport::flush()
 {
-  if (m_index >0 )
+  // send whatever is left and let the receiver know the transmission is over
+  if (m_index > 0 || !m_first)
+  {
+    send_packet(true);
+  }
+  // protect whatever is left of the last group
+  if (m_parity_encoder->has_frames())
+  {
+    send_parity();
+  }
+  // start the next transmission from a clean predictor
+  m_encoder.reset();
+  m_first = true;
+  m_silent = false;
+}
+
+void Transport::send_parity()
+{
+  memcpy(m_parity_buffer, m_buffer, m_header_size);
+  int length = m_parity_encoder->write_parity(m_parity_buffer + m_header_size);
+  send(m_parity_buffer, m_header_size + length);
+}
+
+void Transport::receive_packet(const uint8_t *address, const uint8_t *data, int length)
+{
+  // first m_header_size bytes of m_buffer are the expected header
+  if ((length <= m_header_size + FRAME_HEADER_SIZE) || (length > m_buffer_size) || (memcmp(data, m_buffer, m_header_size) != 0))
+  {
+    return;
+  }
+  const uint8_t *frame = data + m_header_size;
+  int frame_length = length - m_header_size;
+  if (frame[0] != FRAME_TYPE_AUDIO && frame[0] != FRAME_TYPE_PARITY && frame[0] != FRAME_TYPE_COMFORT_NOISE)
+  {
+    return;
+  }
+  // find the stream for whoever sent this
+  bool is_new;
+  int stream = m_mixer->claim_stream(address, is_new);
+  if (stream < 0)
+  {
+    return;
+  }
+  ParityDecoder *parity_decoder = m_parity_decoders[stream];
+  if (is_new)
+  {
+    parity_decoder->clear();
+  }
+  OutputBuffer *output_buffer = m_mixer->output_buffer(stream);
+  if (frame[0] == FRAME_TYPE_AUDIO)
+  {
+    uint16_t sequence;
+    memcpy(&sequence, frame + 2, sizeof(uint16_t));
+    parity_decoder->add_frame(sequence, frame, frame_length);
+    receive_audio_frame(output_buffer, frame, frame_length);
+  }
+  else if (frame[0] == FRAME_TYPE_COMFORT_NOISE)
+  {
+    // the sender has gone quiet - fill the gap with noise at the level of their background
+    if (frame_length >= FRAME_HEADER_SIZE + COMFORT_NOISE_PAYLOAD_SIZE)
+    {
+      uint16_t noise_level;
+      memcpy(&noise_level, frame + FRAME_HEADER_SIZE, sizeof(uint16_t));
+      output_buffer->set_comfort_noise(noise_level);
+    }
+  }
+  else
+  {
+    // let the jitter buffer know to wait for parity before giving up on a lost frame
+    output_buffer->jitter_buffer()->set_fec_group_size(frame[1]);
+    // keep it for when the jitter buffer gives up on a frame - until then the frame might just be late
+    if (parity_decoder->add_parity(frame, frame_length))
+    {
+      uint16_t first_sequence;
+      memcpy(&first_sequence, frame + 2, sizeof(uint16_t));
+      output_buffer->jitter_buffer()->parity_received(first_sequence, frame[1]);
+    }
+  }
+}
+
+void Transport::receive_audio_frame(OutputBuffer *output_buffer, const uint8_t *frame, int length)
+{
+  if (length < FRAME_HEADER_SIZE + ADPCM_STATE_SIZE || frame[0] != FRAME_TYPE_AUDIO)
+  {
+    return;
+  }
+  uint8_t flags = frame[1];
+  uint16_t sequence;
+  uint32_t timestamp;
+  memcpy(&sequence, frame + 2, sizeof(uint16_t));
+  memcpy(&timestamp, frame + 4, sizeof(uint32_t));
+  int count = m_decoder.decode(frame + FRAME_HEADER_SIZE, length - FRAME_HEADER_SIZE, m_decode_buffer, JITTER_BUFFER_MAX_FRAME_SAMPLES);
+  if (flags & FRAME_FLAG_LAST)
+  {
+    // the transmission is over so the gap after it should be silent
+    output_buffer->set_comfort_noise(0);
+  }
+  output_buffer->add_frame(sequence, timestamp, m_decode_buffer, count, flags & FRAME_FLAG_FIRST, flags & FRAME_FLAG_LAST);
+}
+
+int Transport::recover_frame(int stream, uint16_t sequence, uint32_t &timestamp, int16_t *samples)
+{
+  // if exactly one frame of the group went missing we can rebuild it
+  int length = m_parity_decoders[stream]->recover(sequence);
+  const uint8_t *frame = m_parity_decoders[stream]->recovered();
+  if (length < FRAME_HEADER_SIZE + ADPCM_STATE_SIZE || frame[0] != FRAME_TYPE_AUDIO)
+  {
+    return -1;
+  }
+  memcpy(&timestamp, frame + 4, sizeof(uint32_t));
+  if (frame[1] & FRAME_FLAG_LAST)
+  {
+    m_mixer->output_buffer(stream)->set_comfort_noise(0);
+  }
+  return m_decoder.decode(frame + FRAME_HEADER_SIZE, length - FRAME_HEADER_SIZE, samples, JITTER_BUFFER_MAX_FRAME_SAMPLES);
+}
+
+void Transport::poll()
+{
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
   {
-    send();
-    m_index = 0;
+    if (m_mixer->is_active(i))
+    {
+      m_mixer->output_buffer(i)->jitter_buffer()->poll();
+    }
   }
 }
 
 int Transport::set_header(const int header_size, const uint8_t *header)
 {
-  if ((header_size<m_buffer_size) && (header))
+  if ((header_size < m_buffer_size - FRAME_HEADER_SIZE - ADPCM_STATE_SIZE) && (header))
   {
     m_header_size = header_size;
     memcpy(m_buffer, header, header_size);
+    update_samples_per_packet();
     return 0;
   }
   else
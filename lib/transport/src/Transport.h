@@ -1,26 +1,92 @@
 #pragma once
 #include <stdlib.h>
 #include <stdint.h>
+#include "AdpcmCodec.h"
+#include "Frame.h"
+#include "ParityFec.h"
+#include "PacketPool.h"
+#include "StreamMixer.h"
+#include "JitterBuffer.h"
 
-class OutputBuffer;
-
-class Transport
+class Transport : public FrameRecovery
 {
 protected:
   // audio buffer for samples we need to send
   uint8_t *m_buffer = NULL;
   int m_buffer_size = 0;
+  // number of samples encoded into the current packet
   int m_index = 0;
   int m_header_size;
+  // how many samples we put in a single packet
+  int m_samples_per_packet = 0;
+  int m_frame_size = 0;
+
+  // frame header state
+  uint16_t m_sequence = 0;
+  uint32_t m_timestamp = 0;
+  bool m_first = true;
+
+  // discontinuous transmission - while the sender is silent we only send the occasional comfort noise frame
+  bool m_silent = false;
+  int m_samples_since_comfort_noise = 0;
+  uint32_t m_suppressed_samples = 0;
+  uint32_t m_comfort_noise_bytes = 0;
+
+  // 4 bit IMA ADPCM - twice as many samples per packet as 8 bit PCM
+  AdpcmEncoder m_encoder;
+  AdpcmDecoder m_decoder;
+  // decoded samples from a received packet
+  int16_t *m_decode_buffer = NULL;
 
-  OutputBuffer *m_output_buffer = NULL;
+  // optional XOR parity so the receiver can rebuild a single lost frame in each group
+  ParityEncoder *m_parity_encoder = NULL;
+  uint8_t *m_parity_buffer = NULL;
+  // parity groups are per sender so each stream gets its own decoder
+  ParityDecoder *m_parity_decoders[MIXER_MAX_STREAMS];
 
-  virtual void send() = 0;
+  // received packets waiting for the receive task
+  PacketPool *m_packet_pool = NULL;
+
+  // each sender gets its own stream in the mixer
+  StreamMixer *m_mixer = NULL;
+
+  void update_samples_per_packet();
+  void send_packet(bool last);
+  void send_parity();
+  void send_comfort_noise(uint16_t noise_level);
+  // called from the network stack - copies the packet for the receive task and returns straight away
+  void queue_packet(const uint8_t *address, const uint8_t *data, int length);
+  // start the task that decodes queued packets - call this from begin
+  void start_receive_task();
+  // validate and decode a received packet and push it into the sender's stream
+  void receive_packet(const uint8_t *address, const uint8_t *data, int length);
+  void receive_audio_frame(OutputBuffer *output_buffer, const uint8_t *frame, int length);
+  virtual void send(const uint8_t *data, int length) = 0;
 
 public:
-  Transport(OutputBuffer *output_buffer, size_t buffer_size);
+  Transport(StreamMixer *mixer, size_t buffer_size);
   int set_header(const int header_size, const uint8_t *header);
+  // limit the number of samples in each packet - smaller packets mean lower latency
+  void set_frame_size(int frame_size);
+  // send a parity frame after every group_size frames - 0 turns this off
+  void set_fec_group_size(int group_size);
+  // rebuild a lost frame from the stream's parity once its jitter buffer gives up waiting for it
+  int recover_frame(int stream, uint16_t sequence, uint32_t &timestamp, int16_t *samples) override;
+  // let the jitter buffers give up on frames that are never coming - the receive task calls this
+  void poll();
+  // number of lost frames rebuilt from parity frames
+  uint32_t fec_recovered();
+  // number of received packets dropped because the receive task couldn't keep up
+  uint32_t receive_dropped() { return m_packet_pool->dropped(); }
   void add_sample(int16_t sample);
+  // add a block of samples - this will send as many packets as the block fills
+  void add_samples(const int16_t *samples, int count);
+  // the sender is silent - skip over count samples and let the receivers play comfort noise instead
+  void add_silence(int count, uint16_t noise_level);
+  // bytes we would have sent for the samples skipped by add_silence less the comfort noise frames we sent instead
+  int32_t dtx_saved_bytes();
   void flush();
   virtual bool begin() = 0;
+
+  friend void transport_receive_task(void *param);
 };
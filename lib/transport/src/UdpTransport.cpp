@@ -1,11 +1,10 @@
 #include <Arduino.h>
 #include <AsyncUDP.h>
 #include "UdpTransport.h"
-#include "OutputBuffer.h"
 
 const int MAX_UDP_SIZE = 1436;
 
-UdpTransport::UdpTransport(OutputBuffer *output_buffer) : Transport(output_buffer, MAX_UDP_SIZE)
+UdpTransport::UdpTransport(StreamMixer *mixer) : Transport(mixer, MAX_UDP_SIZE)
 {
 }
 
@@ -14,16 +13,16 @@ bool UdpTransport::begin()
 {
   udp = new AsyncUDP();
   last_packet = millis();
+  start_receive_task();
   if (udp->listen(8192))
   {
     udp->onPacket([this](AsyncUDPPacket packet)
                   {
-                    // our packets contain unsigned 8 bit PCM samples
-                    // so we can push them straight into the output buffer
-                    if ((packet.length() > this->m_header_size) && (packet.length() <= MAX_UDP_SIZE) && (memcmp(packet.data(), this->m_buffer, this->m_header_size) == 0)) 
-                    {
-                      this->m_output_buffer->add_samples(packet.data() + m_header_size, packet.length() - m_header_size);
-                    }
+                    // our packets contain ADPCM encoded samples - this runs in the
+                    // network task so just queue the packet up for the receive task
+                    IPAddress ip = packet.remoteIP();
+                    uint8_t address[PACKET_ADDRESS_SIZE] = {ip[0], ip[1], ip[2], ip[3], 0, 0};
+                    this->queue_packet(address, packet.data(), packet.length());
                   });
     return true;
   }
@@ -31,7 +30,7 @@ bool UdpTransport::begin()
   return false;
 }
 
-void UdpTransport::send()
+void UdpTransport::send(const uint8_t *data, int length)
 {
-  udp->broadcast(m_buffer, m_index);
+  udp->broadcast((uint8_t *)data, length);
 }
@@ -2,7 +2,7 @@
 
 #include "Transport.h"
 
-class OutputBuffer;
+class StreamMixer;
 class AsyncUDP;
 
 class UdpTransport : public Transport
@@ -11,9 +11,9 @@ private:
   AsyncUDP *udp;
 
 protected:
-  void send();
+  void send(const uint8_t *data, int length);
 
 public:
-  UdpTransport(OutputBuffer *output_buffer);
+  UdpTransport(StreamMixer *mixer);
   bool begin() override;
 };
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "Base64.h"
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64_encode_blocks(const uint8_t *src, size_t length, char *dst)
+{
+  const uint8_t *end = src + length - length % 3;
+  char *out = dst;
+  // no bounds checks or padding in here - just straight table lookups
+  while (src < end)
+  {
+    uint32_t triple = (src[0] << 16) | (src[1] << 8) | src[2];
+    out[0] = base64_chars[triple >> 18];
+    out[1] = base64_chars[(triple >> 12) & 0x3F];
+    out[2] = base64_chars[(triple >> 6) & 0x3F];
+    out[3] = base64_chars[triple & 0x3F];
+    src += 3;
+    out += 4;
+  }
+  return out - dst;
+}
+
+size_t base64_encode_tail(const uint8_t *src, size_t length, char *dst)
+{
+  if (length == 0)
+  {
+    return 0;
+  }
+  uint32_t triple = (src[0] << 16) | (length > 1 ? src[1] << 8 : 0);
+  dst[0] = base64_chars[triple >> 18];
+  dst[1] = base64_chars[(triple >> 12) & 0x3F];
+  dst[2] = length > 1 ? base64_chars[(triple >> 6) & 0x3F] : '=';
+  dst[3] = '=';
+  return 4;
+}
+
+size_t base64_encode(const uint8_t *src, size_t length, char *dst)
+{
+  size_t written = base64_encode_blocks(src, length, dst);
+  size_t tail = length % 3;
+  return written + base64_encode_tail(src + length - tail, tail, dst + written);
+}
+
+size_t Base64Encoder::update(const uint8_t *src, size_t length, char *dst)
+{
+  size_t written = 0;
+  // top up the group we started last time
+  while (m_carry_length > 0 && m_carry_length < 3 && length > 0)
+  {
+    m_carry[m_carry_length++] = *src++;
+    length--;
+  }
+  if (m_carry_length == 3)
+  {
+    written = base64_encode_blocks(m_carry, 3, dst);
+    m_carry_length = 0;
+  }
+  else if (m_carry_length > 0)
+  {
+    // still not a whole group - everything we were given is in the carry
+    return 0;
+  }
+  written += base64_encode_blocks(src, length, dst + written);
+  // keep whatever doesn't make up a whole group for next time
+  size_t left_over = length % 3;
+  for (size_t i = 0; i < left_over; i++)
+  {
+    m_carry[i] = src[length - left_over + i];
+  }
+  m_carry_length = left_over;
+  return written;
+}
+
+size_t Base64Encoder::finish(char *dst)
+{
+  size_t written = base64_encode_tail(m_carry, m_carry_length, dst);
+  m_carry_length = 0;
+  return written;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// number of characters needed to encode length bytes (with padding, without a terminator)
+inline size_t base64_encoded_length(size_t length) { return ((length + 2) / 3) * 4; }
+
+// encode the whole 3 byte groups at the start of src - returns the number of characters written
+// which is 4 for every 3 bytes. Any 1 or 2 bytes left over at the end are not touched
+size_t base64_encode_blocks(const uint8_t *src, size_t length, char *dst);
+// encode the last 1 or 2 bytes of the input with padding - returns the number of characters written (0 or 4)
+size_t base64_encode_tail(const uint8_t *src, size_t length, char *dst);
+// encode a whole buffer - dst needs room for base64_encoded_length(length) characters
+size_t base64_encode(const uint8_t *src, size_t length, char *dst);
+
+/**
+ * @brief Base64 encodes a stream of data that arrives in pieces of any size
+ *
+ * Up to 2 bytes that don't make up a whole group are carried over to the next call
+ * so the output is the same as encoding all the data in one go.
+ */
+class Base64Encoder
+{
+private:
+  // a part filled group waiting for the rest of its bytes
+  uint8_t m_carry[3];
+  size_t m_carry_length = 0;
+
+public:
+  void reset() { m_carry_length = 0; }
+  // the most characters update can write for length bytes of input
+  static size_t max_output(size_t length) { return ((length + 2) / 3) * 4; }
+  // encode the next piece of data returning the number of characters written
+  size_t update(const uint8_t *src, size_t length, char *dst);
+  // the data has all been seen - write out the padded final group if there is one
+  size_t finish(char *dst);
+};
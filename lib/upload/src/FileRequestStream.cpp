@@ -0,0 +1,160 @@
+#include "FileRequestStream.h"
+
+FileRequestStream::FileRequestStream(bool base64, const String &suffix)
+    : m_suffix(suffix), m_base64(base64)
+{
+  m_size = m_suffix.length();
+}
+
+FileRequestStream::FileRequestStream(const String &prefix, fs::File &file, bool base64, const String &suffix)
+    : FileRequestStream(base64, suffix)
+{
+  add_file(prefix, file);
+}
+
+bool FileRequestStream::add_file(const String &prefix, fs::File &file)
+{
+  if (m_file_count == FILE_REQUEST_MAX_FILES || m_position > 0)
+  {
+    return false;
+  }
+  size_t file_size = file.size();
+  m_size += prefix.length() + (m_base64 ? ((file_size + 2) / 3) * 4 : file_size);
+  m_prefixes[m_file_count] = prefix;
+  m_files[m_file_count] = &file;
+  m_file_ends[m_file_count] = m_size - m_suffix.length();
+  m_file_count++;
+  return true;
+}
+
+size_t FileRequestStream::fill_string(const String &string)
+{
+  size_t length = string.length() - m_part_offset;
+  if (length > FILE_REQUEST_CHUNK_SIZE)
+  {
+    length = FILE_REQUEST_CHUNK_SIZE;
+  }
+  memcpy(m_chunk, string.c_str() + m_part_offset, length);
+  m_part_offset += length;
+  return length;
+}
+
+size_t FileRequestStream::fill_file()
+{
+  fs::File &file = *m_files[m_file_index];
+  if (!m_base64)
+  {
+    int read = file.read(m_chunk, FILE_REQUEST_CHUNK_SIZE);
+    return read > 0 ? read : 0;
+  }
+  // leave room for the bytes the encoder might be carrying from last time
+  uint8_t raw[FILE_REQUEST_CHUNK_SIZE / 4 * 3 - 2];
+  while (true)
+  {
+    int read = file.read(raw, sizeof(raw));
+    if (read <= 0)
+    {
+      // pad out the final group - this returns 0 once there's nothing left
+      return m_encoder.finish((char *)m_chunk);
+    }
+    size_t written = m_encoder.update(raw, read, (char *)m_chunk);
+    // a short read might not have completed a group
+    if (written > 0)
+    {
+      return written;
+    }
+  }
+}
+
+bool FileRequestStream::fill()
+{
+  while (m_chunk_position == m_chunk_length)
+  {
+    m_chunk_position = 0;
+    switch (m_part)
+    {
+    case PART_PREFIX:
+      if (m_file_index == m_file_count)
+      {
+        // no files at all
+        m_part = PART_SUFFIX;
+        m_chunk_length = 0;
+        break;
+      }
+      m_chunk_length = fill_string(m_prefixes[m_file_index]);
+      if (m_part_offset == m_prefixes[m_file_index].length())
+      {
+        m_part = PART_FILE;
+        m_part_offset = 0;
+      }
+      break;
+    case PART_FILE:
+      m_chunk_length = fill_file();
+      if (m_chunk_length == 0)
+      {
+        // if the file came up short we can't send the Content-Length we promised
+        if (m_position != m_file_ends[m_file_index])
+        {
+          Serial.println("Failed to read the whole file for the request");
+          m_part = PART_ERROR;
+          return false;
+        }
+        m_file_index++;
+        m_part = m_file_index < m_file_count ? PART_PREFIX : PART_SUFFIX;
+        m_part_offset = 0;
+      }
+      break;
+    case PART_SUFFIX:
+      m_chunk_length = fill_string(m_suffix);
+      if (m_chunk_length == 0)
+      {
+        return false;
+      }
+      break;
+    default:
+      m_chunk_length = 0;
+      return false;
+    }
+  }
+  return true;
+}
+
+int FileRequestStream::available()
+{
+  // -1 tells HTTPClient to give up rather than wait for the rest of the body
+  if (m_part == PART_ERROR)
+  {
+    return -1;
+  }
+  size_t remaining = m_size - m_position;
+  return remaining > INT32_MAX ? INT32_MAX : remaining;
+}
+
+size_t FileRequestStream::readBytes(char *buffer, size_t length)
+{
+  size_t total = 0;
+  while (total < length && fill())
+  {
+    size_t to_copy = m_chunk_length - m_chunk_position;
+    if (to_copy > length - total)
+    {
+      to_copy = length - total;
+    }
+    memcpy(buffer + total, m_chunk + m_chunk_position, to_copy);
+    m_chunk_position += to_copy;
+    m_position += to_copy;
+    total += to_copy;
+  }
+  return total;
+}
+
+int FileRequestStream::read()
+{
+  char c;
+  return readBytes(&c, 1) == 1 ? (uint8_t)c : -1;
+}
+
+int FileRequestStream::peek()
+{
+  return fill() ? m_chunk[m_chunk_position] : -1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "Base64.h"
+
+// how much of the body we produce at a time - a multiple of 4 so base64 chunks line up
+#define FILE_REQUEST_CHUNK_SIZE 512
+// most files that can go in one body
+#define FILE_REQUEST_MAX_FILES 8
+
+/**
+ * @brief Request body made up of a prefix, the contents of a file and a suffix, read a
+ * chunk at a time so the file never has to fit in memory.
+ *
+ * The file can be sent as is (e.g. a multipart upload) or base64 encoded on the fly
+ * (e.g. inline data in a JSON request). The total size is known up front so it can be
+ * passed to HTTPClient::sendRequest as the Content-Length.
+ *
+ * More files can be added before the body is read - each one goes after the one before
+ * with its own prefix and the suffix comes after the last.
+ */
+class FileRequestStream : public Stream
+{
+private:
+  String m_prefixes[FILE_REQUEST_MAX_FILES];
+  fs::File *m_files[FILE_REQUEST_MAX_FILES];
+  // where each file's data should end in the body
+  size_t m_file_ends[FILE_REQUEST_MAX_FILES];
+  int m_file_count = 0;
+  int m_file_index = 0;
+  String m_suffix;
+  bool m_base64;
+  Base64Encoder m_encoder;
+  size_t m_size;
+  // how many bytes of the body have been handed out
+  size_t m_position = 0;
+  // which part of the body we are producing
+  enum
+  {
+    PART_PREFIX,
+    PART_FILE,
+    PART_SUFFIX,
+    PART_ERROR
+  } m_part = PART_PREFIX;
+  size_t m_part_offset = 0;
+  // the chunk currently being handed out
+  uint8_t m_chunk[FILE_REQUEST_CHUNK_SIZE];
+  size_t m_chunk_length = 0;
+  size_t m_chunk_position = 0;
+
+  bool fill();
+  size_t fill_string(const String &string);
+  size_t fill_file();
+
+public:
+  FileRequestStream(bool base64, const String &suffix);
+  FileRequestStream(const String &prefix, fs::File &file, bool base64, const String &suffix);
+  // add another file to the body - returns false if there are too many
+  bool add_file(const String &prefix, fs::File &file);
+  // total size of the body in bytes
+  size_t size() { return m_size; }
+  // true if the file couldn't be read - the body will be cut short
+  bool failed() { return m_part == PART_ERROR; }
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t readBytes(char *buffer, size_t length) override;
+  void flush() override {}
+  // this stream is read only
+  size_t write(uint8_t) override { return 0; }
+};
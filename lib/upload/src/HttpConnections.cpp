@@ -0,0 +1,298 @@
+#include "HttpConnections.h"
+
+#define HTTPS_PORT 443
+
+HttpConnection::HttpConnection()
+{
+  // we don't check certificates - the same as the Telegram bot
+  m_client.setInsecure();
+  // ask the server to keep the connection open after each response
+  m_http.setReuse(true);
+}
+
+void HttpConnection::set_host(const String &host)
+{
+  close();
+  m_host = host;
+}
+
+bool HttpConnection::connect()
+{
+  if (m_client.connected())
+  {
+    return true;
+  }
+  // the server has closed the connection or we've not made one yet - this is where the TLS handshake happens
+  m_client.stop();
+  unsigned long start = millis();
+  if (!m_client.connect(m_host.c_str(), HTTPS_PORT))
+  {
+    return false;
+  }
+  m_handshakes++;
+  m_handshake_ms += millis() - start;
+  return true;
+}
+
+bool HttpConnection::begin(const String &url)
+{
+  m_request_start = millis();
+  if (!connect())
+  {
+    return false;
+  }
+  // the client is already connected so HTTPClient sends straight down it
+  return m_http.begin(m_client, url);
+}
+
+void HttpConnection::end()
+{
+  // this reads anything left of the response so the connection is ready for the next request
+  m_http.end();
+  finish_request();
+}
+
+void HttpConnection::abort()
+{
+  m_client.stop();
+  finish_request();
+}
+
+void HttpConnection::finish_request()
+{
+  uint32_t elapsed = millis() - m_request_start;
+  m_requests++;
+  m_request_ms += elapsed;
+  if (elapsed > m_max_request_ms)
+  {
+    m_max_request_ms = elapsed;
+  }
+  m_last_used = millis();
+}
+
+bool HttpConnection::begin_chunked(const String &url, const char *content_type)
+{
+  m_request_start = millis();
+  if (!connect())
+  {
+    return false;
+  }
+  // everything after the host is the path
+  int start = url.indexOf("://");
+  start = url.indexOf('/', start < 0 ? 0 : start + 3);
+  String path = start < 0 ? "/" : url.substring(start);
+  String headers = "POST " + path + " HTTP/1.1\r\n"
+                   "Host: " + m_host + "\r\n"
+                   "Content-Type: " + content_type + "\r\n"
+                   "Transfer-Encoding: chunked\r\n"
+                   "Connection: keep-alive\r\n\r\n";
+  return m_client.write((const uint8_t *)headers.c_str(), headers.length()) == headers.length();
+}
+
+bool HttpConnection::write_chunk(const uint8_t *data, size_t length)
+{
+  // an empty chunk would end the body
+  if (length == 0)
+  {
+    return true;
+  }
+  char size[12];
+  int size_length = snprintf(size, sizeof(size), "%x\r\n", (unsigned int)length);
+  return m_client.write((const uint8_t *)size, size_length) == (size_t)size_length &&
+         m_client.write(data, length) == length &&
+         m_client.write((const uint8_t *)"\r\n", 2) == 2;
+}
+
+int HttpConnection::read_byte(unsigned long deadline)
+{
+  while (!m_client.available())
+  {
+    if (!m_client.connected() || (long)(millis() - deadline) > 0)
+    {
+      return -1;
+    }
+    delay(1);
+  }
+  return m_client.read();
+}
+
+bool HttpConnection::read_line(String &line, unsigned long deadline)
+{
+  line = "";
+  while (true)
+  {
+    int c = read_byte(deadline);
+    if (c < 0)
+    {
+      return false;
+    }
+    if (c == '\n')
+    {
+      line.trim();
+      return true;
+    }
+    // we only care about the start of long header lines
+    if (line.length() < 256)
+    {
+      line += (char)c;
+    }
+  }
+}
+
+bool HttpConnection::read_body(Stream *response, int length, unsigned long deadline)
+{
+  uint8_t buffer[128];
+  while (length > 0)
+  {
+    int c = read_byte(deadline);
+    if (c < 0)
+    {
+      return false;
+    }
+    // take whatever else has already arrived in one go
+    buffer[0] = c;
+    int count = 1;
+    int available = m_client.available();
+    int wanted = length < (int)sizeof(buffer) ? length : sizeof(buffer);
+    if (available > wanted - 1)
+    {
+      available = wanted - 1;
+    }
+    if (available > 0)
+    {
+      int read = m_client.read(buffer + 1, available);
+      count += read > 0 ? read : 0;
+    }
+    response->write(buffer, count);
+    length -= count;
+  }
+  return true;
+}
+
+int HttpConnection::end_chunked(Stream *response)
+{
+  unsigned long deadline = millis() + HTTP_RESPONSE_TIMEOUT_MS;
+  int status = -1;
+  int content_length = -1;
+  bool chunked = false;
+  bool keep_alive = true;
+  String line;
+  bool ok = m_client.write((const uint8_t *)"0\r\n\r\n", 5) == 5 && read_line(line, deadline);
+  if (ok)
+  {
+    // HTTP/1.1 200 OK
+    int space = line.indexOf(' ');
+    status = space < 0 ? -1 : line.substring(space + 1).toInt();
+    while ((ok = read_line(line, deadline)) && line.length() > 0)
+    {
+      line.toLowerCase();
+      if (line.startsWith("content-length:"))
+      {
+        content_length = line.substring(15).toInt();
+      }
+      else if (line.startsWith("transfer-encoding:") && line.indexOf("chunked") > 0)
+      {
+        chunked = true;
+      }
+      else if (line.startsWith("connection:") && line.indexOf("close") > 0)
+      {
+        keep_alive = false;
+      }
+    }
+  }
+  if (ok && chunked)
+  {
+    while ((ok = read_line(line, deadline)))
+    {
+      int length = strtol(line.c_str(), NULL, 16);
+      if (length == 0)
+      {
+        // skip any trailers up to the blank line
+        while ((ok = read_line(line, deadline)) && line.length() > 0)
+        {
+        }
+        break;
+      }
+      if (!(ok = read_body(response, length, deadline) && read_line(line, deadline)))
+      {
+        break;
+      }
+    }
+  }
+  else if (ok && content_length >= 0)
+  {
+    ok = read_body(response, content_length, deadline);
+  }
+  else if (ok)
+  {
+    // the body runs until the server closes the connection
+    int c;
+    while ((c = read_byte(deadline)) >= 0)
+    {
+      response->write((uint8_t)c);
+    }
+    keep_alive = false;
+  }
+  if (!ok || !keep_alive)
+  {
+    m_client.stop();
+  }
+  finish_request();
+  return ok ? status : -1;
+}
+
+void HttpConnection::close()
+{
+  m_client.stop();
+}
+
+HttpConnection &HttpConnectionManager::connection(const String &url)
+{
+  // the host is between the scheme and the path
+  int start = url.indexOf("://");
+  start = start < 0 ? 0 : start + 3;
+  int end = url.indexOf('/', start);
+  String host = end < 0 ? url.substring(start) : url.substring(start, end);
+
+  HttpConnection *oldest = &m_connections[0];
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    HttpConnection &connection = m_connections[i];
+    if (connection.host() == host)
+    {
+      return connection;
+    }
+    // prefer one that's never been used
+    if (oldest->host().length() > 0 &&
+        (connection.host().length() == 0 || (long)(connection.last_used() - oldest->last_used()) < 0))
+    {
+      oldest = &connection;
+    }
+  }
+  oldest->set_host(host);
+  return *oldest;
+}
+
+void HttpConnectionManager::close_idle()
+{
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    HttpConnection &connection = m_connections[i];
+    if (connection.is_open() && millis() - connection.last_used() > HTTP_IDLE_TIMEOUT_MS)
+    {
+      connection.close();
+    }
+  }
+}
+
+bool HttpConnectionManager::has_open()
+{
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+  {
+    if (m_connections[i].is_open())
+    {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+
+// how many hosts we keep connections open to - Telegram and Gemini
+#define HTTP_MAX_CONNECTIONS 2
+// close connections nobody has used for this long so they aren't holding on to TLS buffers
+#define HTTP_IDLE_TIMEOUT_MS 60000
+// how long to wait for the response to a chunked request
+#define HTTP_RESPONSE_TIMEOUT_MS 30000
+
+/**
+ * @brief A kept-alive HTTPS connection to one host
+ *
+ * The TLS connection and the HTTPClient outlive each request so the next request to the
+ * same host goes out on the open connection without another handshake.
+ *
+ * HTTPClient needs to know the size of the body up front so requests whose body is still
+ * being produced are sent with chunked transfer encoding by hand instead.
+ */
+class HttpConnection
+{
+private:
+  String m_host;
+  WiFiClientSecure m_client;
+  HTTPClient m_http;
+  unsigned long m_request_start = 0;
+  unsigned long m_last_used = 0;
+
+  // statistics
+  uint32_t m_requests = 0;
+  uint32_t m_handshakes = 0;
+  uint32_t m_handshake_ms = 0;
+  uint32_t m_request_ms = 0;
+  uint32_t m_max_request_ms = 0;
+
+  bool connect();
+  void finish_request();
+  int read_byte(unsigned long deadline);
+  bool read_line(String &line, unsigned long deadline);
+  bool read_body(Stream *response, int length, unsigned long deadline);
+
+public:
+  HttpConnection();
+  // point the connection at a different host - closes it if it's open
+  void set_host(const String &host);
+  const String &host() { return m_host; }
+  // start a request - false if we couldn't connect, otherwise add headers and send it with http() then call end()
+  bool begin(const String &url);
+  HTTPClient &http() { return m_http; }
+  // finish the request leaving the connection open if the server will let us - the response has to have been read
+  void end();
+  // give up on the request and close the connection so what's left of the response can't be taken for the next one
+  void abort();
+  // start a request with a body of unknown length - send it with write_chunk then call end_chunked()
+  bool begin_chunked(const String &url, const char *content_type);
+  bool write_chunk(const uint8_t *data, size_t length);
+  // finish the body and read the response into response - returns the status code or -1 on failure
+  int end_chunked(Stream *response);
+  void close();
+  bool is_open() { return m_client.connected(); }
+  unsigned long last_used() { return m_last_used; }
+  uint32_t requests() { return m_requests; }
+  uint32_t handshakes() { return m_handshakes; }
+  uint32_t average_handshake_ms() { return m_handshakes ? m_handshake_ms / m_handshakes : 0; }
+  uint32_t average_request_ms() { return m_requests ? m_request_ms / m_requests : 0; }
+  uint32_t max_request_ms() { return m_max_request_ms; }
+};
+
+/**
+ * @brief Hands out one kept-alive connection per host
+ *
+ * Only used from the upload task so it needs no locking.
+ */
+class HttpConnectionManager
+{
+private:
+  HttpConnection m_connections[HTTP_MAX_CONNECTIONS];
+
+public:
+  // the connection for the url's host - the least recently used one is taken over if there isn't one yet
+  HttpConnection &connection(const String &url);
+  // close the connections that haven't been used for a while
+  void close_idle();
+  bool has_open();
+  int count() { return HTTP_MAX_CONNECTIONS; }
+  HttpConnection &get(int index) { return m_connections[index]; }
+};
@@ -0,0 +1,355 @@
+#include "JsonTextExtractor.h"
+
+static bool is_whitespace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+JsonTextExtractor::JsonTextExtractor(const char *path)
+{
+  strlcpy(m_path, path, sizeof(m_path));
+  char *segment = m_path;
+  while (m_segment_count < JSON_TEXT_MAX_DEPTH)
+  {
+    m_segments[m_segment_count++] = segment;
+    char *dot = strchr(segment, '.');
+    if (!dot)
+    {
+      break;
+    }
+    *dot = 0;
+    segment = dot + 1;
+  }
+}
+
+bool JsonTextExtractor::segment_matches(int level, const char *key)
+{
+  if (level >= m_segment_count)
+  {
+    return false;
+  }
+  const char *segment = m_segments[level];
+  if (m_levels[level].is_array)
+  {
+    return strcmp(segment, "*") == 0 || atoi(segment) == m_levels[level].index;
+  }
+  return strcmp(segment, key) == 0;
+}
+
+bool JsonTextExtractor::value_matches()
+{
+  // the path to the value we're about to read matches the start of the path we want
+  if (m_depth == 0)
+  {
+    return true;
+  }
+  return m_levels[m_depth - 1].matches && segment_matches(m_depth - 1, m_key);
+}
+
+void JsonTextExtractor::end_value()
+{
+  m_state = STATE_AFTER_VALUE;
+}
+
+void JsonTextExtractor::flush_buffer()
+{
+  m_buffer[m_buffer_length] = 0;
+  m_text += m_buffer;
+  m_buffer_length = 0;
+}
+
+void JsonTextExtractor::add_char(char c)
+{
+  if (m_in_key)
+  {
+    // anything too long to fit can't be one of ours - leave it so it won't match
+    if (m_key_length < JSON_TEXT_MAX_KEY - 1)
+    {
+      m_key[m_key_length++] = c;
+      m_key[m_key_length] = 0;
+    }
+    else
+    {
+      m_key[0] = 0;
+    }
+  }
+  else if (m_capture && c != 0)
+  {
+    if (m_buffer_length == sizeof(m_buffer) - 1)
+    {
+      flush_buffer();
+    }
+    m_buffer[m_buffer_length++] = c;
+  }
+}
+
+void JsonTextExtractor::add_code_point(uint32_t code_point)
+{
+  // back to UTF-8
+  if (code_point < 0x80)
+  {
+    add_char(code_point);
+  }
+  else if (code_point < 0x800)
+  {
+    add_char(0xc0 | (code_point >> 6));
+    add_char(0x80 | (code_point & 0x3f));
+  }
+  else if (code_point < 0x10000)
+  {
+    add_char(0xe0 | (code_point >> 12));
+    add_char(0x80 | ((code_point >> 6) & 0x3f));
+    add_char(0x80 | (code_point & 0x3f));
+  }
+  else
+  {
+    add_char(0xf0 | (code_point >> 18));
+    add_char(0x80 | ((code_point >> 12) & 0x3f));
+    add_char(0x80 | ((code_point >> 6) & 0x3f));
+    add_char(0x80 | (code_point & 0x3f));
+  }
+}
+
+bool JsonTextExtractor::process(char c)
+{
+  switch (m_state)
+  {
+  case STATE_VALUE:
+  case STATE_VALUE_OR_END:
+    if (is_whitespace(c))
+    {
+      return true;
+    }
+    if (c == ']' && m_state == STATE_VALUE_OR_END)
+    {
+      // empty array
+      m_depth--;
+      end_value();
+      return true;
+    }
+    if (c == '{' || c == '[')
+    {
+      if (m_depth == JSON_TEXT_MAX_DEPTH)
+      {
+        return false;
+      }
+      bool matches = value_matches();
+      Level &level = m_levels[m_depth++];
+      level.is_array = c == '[';
+      level.matches = matches;
+      level.index = 0;
+      m_state = level.is_array ? STATE_VALUE_OR_END : STATE_KEY_OR_END;
+      return true;
+    }
+    if (c == '"')
+    {
+      m_in_key = false;
+      m_capture = m_depth == m_segment_count && value_matches();
+      m_high_surrogate = 0;
+      m_state = STATE_STRING;
+      return true;
+    }
+    if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n')
+    {
+      m_state = STATE_LITERAL;
+      return true;
+    }
+    return false;
+  case STATE_KEY_OR_END:
+  case STATE_KEY:
+    if (is_whitespace(c))
+    {
+      return true;
+    }
+    if (c == '}' && m_state == STATE_KEY_OR_END)
+    {
+      // empty object
+      m_depth--;
+      end_value();
+      return true;
+    }
+    if (c == '"')
+    {
+      m_in_key = true;
+      m_key_length = 0;
+      m_key[0] = 0;
+      m_high_surrogate = 0;
+      m_state = STATE_STRING;
+      return true;
+    }
+    return false;
+  case STATE_COLON:
+    if (is_whitespace(c))
+    {
+      return true;
+    }
+    if (c == ':')
+    {
+      m_state = STATE_VALUE;
+      return true;
+    }
+    return false;
+  case STATE_STRING:
+    if (c == '"')
+    {
+      if (m_in_key)
+      {
+        m_in_key = false;
+        m_state = STATE_COLON;
+      }
+      else
+      {
+        m_capture = false;
+        end_value();
+      }
+    }
+    else if (c == '\\')
+    {
+      m_state = STATE_ESCAPE;
+    }
+    else
+    {
+      // anything else including multibyte UTF-8 is copied as is
+      add_char(c);
+    }
+    return true;
+  case STATE_ESCAPE:
+    m_state = STATE_STRING;
+    switch (c)
+    {
+    case '"':
+    case '\\':
+    case '/':
+      add_char(c);
+      return true;
+    case 'b':
+      add_char('\b');
+      return true;
+    case 'f':
+      add_char('\f');
+      return true;
+    case 'n':
+      add_char('\n');
+      return true;
+    case 'r':
+      add_char('\r');
+      return true;
+    case 't':
+      add_char('\t');
+      return true;
+    case 'u':
+      m_unicode = 0;
+      m_unicode_digits = 0;
+      m_state = STATE_UNICODE;
+      return true;
+    }
+    return false;
+  case STATE_UNICODE:
+    if (c >= '0' && c <= '9')
+    {
+      m_unicode = (m_unicode << 4) | (c - '0');
+    }
+    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+    {
+      m_unicode = (m_unicode << 4) | ((c | 0x20) - 'a' + 10);
+    }
+    else
+    {
+      return false;
+    }
+    if (++m_unicode_digits == 4)
+    {
+      m_state = STATE_STRING;
+      if (m_unicode >= 0xd800 && m_unicode < 0xdc00)
+      {
+        // characters outside the basic plane come as a pair of escapes
+        m_high_surrogate = m_unicode;
+      }
+      else if (m_unicode >= 0xdc00 && m_unicode < 0xe000)
+      {
+        if (m_high_surrogate)
+        {
+          add_code_point(0x10000 + ((uint32_t)(m_high_surrogate - 0xd800) << 10) + (m_unicode - 0xdc00));
+        }
+        m_high_surrogate = 0;
+      }
+      else
+      {
+        add_code_point(m_unicode);
+      }
+    }
+    return true;
+  case STATE_LITERAL:
+    // numbers, true, false and null just run up to whatever comes after them
+    if (c == ',' || c == '}' || c == ']' || is_whitespace(c))
+    {
+      end_value();
+      return process(c);
+    }
+    return true;
+  case STATE_AFTER_VALUE:
+    if (is_whitespace(c))
+    {
+      return true;
+    }
+    if (m_depth == 0)
+    {
+      return false;
+    }
+    if (c == ',')
+    {
+      Level &level = m_levels[m_depth - 1];
+      if (level.is_array)
+      {
+        level.index++;
+        m_state = STATE_VALUE;
+      }
+      else
+      {
+        m_state = STATE_KEY;
+      }
+      return true;
+    }
+    if (c == (m_levels[m_depth - 1].is_array ? ']' : '}'))
+    {
+      m_depth--;
+      end_value();
+      return true;
+    }
+    return false;
+  case STATE_ERROR:
+    break;
+  }
+  return false;
+}
+
+size_t JsonTextExtractor::write(uint8_t c)
+{
+  if (m_state != STATE_ERROR && !process(c))
+  {
+    m_state = STATE_ERROR;
+  }
+  // always take everything so the rest of the response is read off the connection
+  return 1;
+}
+
+size_t JsonTextExtractor::write(const uint8_t *buffer, size_t size)
+{
+  for (size_t i = 0; i < size && m_state != STATE_ERROR; i++)
+  {
+    if (!process(buffer[i]))
+    {
+      m_state = STATE_ERROR;
+    }
+  }
+  return size;
+}
+
+const String &JsonTextExtractor::text()
+{
+  if (m_buffer_length > 0)
+  {
+    flush_buffer();
+  }
+  return m_text;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Arduino.h>
+
+// deepest nesting we can follow - Gemini responses are about 6 levels deep
+#define JSON_TEXT_MAX_DEPTH 16
+// longest key we need to compare against the path
+#define JSON_TEXT_MAX_KEY 32
+
+/**
+ * @brief Pulls the strings at one path out of a JSON document as it is written to it,
+ * without ever holding the document in memory
+ *
+ * The path is a list of keys and array indices separated by dots, where * matches any
+ * index - e.g. "candidates.0.content.parts.*.text". Every string found at the path is
+ * decoded and appended to text(), so its length is only limited by the heap.
+ *
+ * It's a write only Stream so it can be handed straight to HTTPClient::writeToStream,
+ * which also takes care of chunked responses.
+ */
+class JsonTextExtractor : public Stream
+{
+private:
+  // the path split into its segments
+  char m_path[64];
+  const char *m_segments[JSON_TEXT_MAX_DEPTH];
+  int m_segment_count = 0;
+
+  // the containers we're inside and whether the path to each one matches so far
+  struct Level
+  {
+    bool is_array;
+    bool matches;
+    uint16_t index;
+  };
+  Level m_levels[JSON_TEXT_MAX_DEPTH];
+  int m_depth = 0;
+
+  enum
+  {
+    STATE_VALUE,
+    STATE_VALUE_OR_END,
+    STATE_KEY_OR_END,
+    STATE_KEY,
+    STATE_COLON,
+    STATE_STRING,
+    STATE_ESCAPE,
+    STATE_UNICODE,
+    STATE_LITERAL,
+    STATE_AFTER_VALUE,
+    STATE_ERROR
+  } m_state = STATE_VALUE;
+  // the string being read is a key rather than a value
+  bool m_in_key = false;
+  // the string being read is one we want
+  bool m_capture = false;
+  char m_key[JSON_TEXT_MAX_KEY];
+  int m_key_length = 0;
+  // \u escapes - a high surrogate waits for its low half
+  uint16_t m_unicode = 0;
+  int m_unicode_digits = 0;
+  uint16_t m_high_surrogate = 0;
+
+  // decoded text is gathered here before being added to the string
+  char m_buffer[64];
+  int m_buffer_length = 0;
+  String m_text;
+
+  bool segment_matches(int level, const char *key);
+  bool value_matches();
+  void end_value();
+  void add_char(char c);
+  void add_code_point(uint32_t code_point);
+  void flush_buffer();
+  bool process(char c);
+
+public:
+  JsonTextExtractor(const char *path);
+  const String &text();
+  // the document wasn't valid JSON or was nested too deeply
+  bool failed() { return m_state == STATE_ERROR; }
+  // we've seen the whole document - false if the response was cut short
+  bool finished() { return m_depth == 0 && m_state == STATE_AFTER_VALUE; }
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  // this stream is write only
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+};
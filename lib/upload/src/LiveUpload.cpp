@@ -0,0 +1,135 @@
+#include "LiveUpload.h"
+#include "HttpConnections.h"
+#include "SdRecorder.h"
+
+#define LIVE_UPLOAD_BUFFER_MASK (LIVE_UPLOAD_BUFFER_SAMPLES - 1)
+
+LiveUpload::LiveUpload(int sample_rate) : m_state(LIVE_IDLE), m_read_position(0), m_write_position(0), m_sample_rate(sample_rate)
+{
+  m_buffer = (int16_t *)malloc(sizeof(int16_t) * LIVE_UPLOAD_BUFFER_SAMPLES);
+  if (!m_buffer)
+  {
+    Serial.println("Failed to allocate live upload buffer");
+  }
+}
+
+LiveUpload::~LiveUpload()
+{
+  free(m_buffer);
+}
+
+bool LiveUpload::start()
+{
+  if (!m_buffer || m_state != LIVE_IDLE)
+  {
+    return false;
+  }
+  // the upload task isn't touching the buffer while we're idle
+  m_read_position = 0;
+  m_write_position = 0;
+  m_state = LIVE_RECORDING;
+  return true;
+}
+
+void LiveUpload::write(const int16_t *samples, int count)
+{
+  if (m_state != LIVE_RECORDING)
+  {
+    return;
+  }
+  uint32_t write_position = m_write_position.load(std::memory_order_relaxed);
+  if (write_position + count - m_read_position.load(std::memory_order_acquire) > LIVE_UPLOAD_BUFFER_SAMPLES)
+  {
+    // the upload can't keep up - the recording will have to be sent afterwards
+    m_state = LIVE_ABANDONED;
+    return;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    m_buffer[(write_position + i) & LIVE_UPLOAD_BUFFER_MASK] = samples[i];
+  }
+  m_write_position.store(write_position + count, std::memory_order_release);
+}
+
+void LiveUpload::stop()
+{
+  int recording = LIVE_RECORDING;
+  m_stopped_at = millis();
+  if (!m_state.compare_exchange_strong(recording, LIVE_STOPPED) && recording == LIVE_ABANDONED)
+  {
+    if (m_read_position == 0)
+    {
+      Serial.printf("Live transcription abandoned - the upload task was busy for more than %d ms\n",
+                    LIVE_UPLOAD_BUFFER_SAMPLES * 1000 / m_sample_rate);
+    }
+    else
+    {
+      Serial.println("Live transcription abandoned - the upload fell too far behind");
+    }
+  }
+}
+
+int LiveUpload::send(HttpConnection &connection, const String &url, const String &prefix, const String &suffix, Stream *response)
+{
+  int16_t samples[LIVE_UPLOAD_CHUNK_SAMPLES];
+  // room for a chunk of samples and the bytes the encoder carried over from the last one
+  char chunk[(LIVE_UPLOAD_CHUNK_SAMPLES * sizeof(int16_t) + 2 + 2) / 3 * 4];
+  // we don't know how long the audio is going to be so the sizes are as big as they can go
+  uint8_t header[WAV_HEADER_SIZE];
+  SdRecorder::make_wav_header(header, m_sample_rate, UINT32_MAX - (WAV_HEADER_SIZE - 8));
+  m_encoder.reset();
+
+  bool ok = m_state != LIVE_ABANDONED &&
+            connection.begin_chunked(url, "application/json") &&
+            connection.write_chunk((const uint8_t *)prefix.c_str(), prefix.length()) &&
+            connection.write_chunk((const uint8_t *)chunk, m_encoder.update(header, sizeof(header), chunk));
+  while (ok)
+  {
+    uint32_t read_position = m_read_position.load(std::memory_order_relaxed);
+    uint32_t available = m_write_position.load(std::memory_order_acquire) - read_position;
+    if (available == 0)
+    {
+      int state = m_state;
+      if (state == LIVE_ABANDONED)
+      {
+        ok = false;
+      }
+      else if (state == LIVE_STOPPED)
+      {
+        // the last samples are written before the session is stopped so check again
+        if (m_write_position.load(std::memory_order_acquire) == read_position)
+        {
+          break;
+        }
+      }
+      else
+      {
+        delay(10);
+      }
+      continue;
+    }
+    int count = available < LIVE_UPLOAD_CHUNK_SAMPLES ? available : LIVE_UPLOAD_CHUNK_SAMPLES;
+    for (int i = 0; i < count; i++)
+    {
+      samples[i] = m_buffer[(read_position + i) & LIVE_UPLOAD_BUFFER_MASK];
+    }
+    m_read_position.store(read_position + count, std::memory_order_release);
+    ok = connection.write_chunk((const uint8_t *)chunk, m_encoder.update((const uint8_t *)samples, count * sizeof(int16_t), chunk));
+  }
+
+  int status = -1;
+  if (ok &&
+      connection.write_chunk((const uint8_t *)chunk, m_encoder.finish(chunk)) &&
+      connection.write_chunk((const uint8_t *)suffix.c_str(), suffix.length()))
+  {
+    status = connection.end_chunked(response);
+    m_latency_ms = millis() - m_stopped_at;
+  }
+  else
+  {
+    // the body is only half sent so the connection is no use for anything else
+    connection.close();
+  }
+  m_state = LIVE_IDLE;
+  return status;
+}
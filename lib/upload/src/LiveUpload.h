@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "Base64.h"
+
+class HttpConnection;
+
+// audio that can be waiting to be sent - a power of two, about a second at 16kHz
+#define LIVE_UPLOAD_BUFFER_SAMPLES 16384
+// samples sent in each chunk of the request body
+#define LIVE_UPLOAD_CHUNK_SAMPLES 384
+
+/**
+ * @brief Sends audio as the body of a request while it is still being recorded
+ *
+ * The audio task writes samples into a lock free buffer as they are captured and the upload
+ * task sends them as a chunked request body - prefix, base64 WAV, suffix - so when the button
+ * is released all that's left is to send the last few samples and wait for the answer.
+ *
+ * The WAV header is sent before we know how long the audio will be so it says the data runs
+ * to the end of the file. If the upload falls a buffer behind the session is abandoned and the
+ * recording has to be sent from the SD card afterwards instead.
+ */
+class LiveUpload
+{
+private:
+  enum
+  {
+    LIVE_IDLE,
+    LIVE_RECORDING,
+    LIVE_STOPPED,
+    LIVE_ABANDONED
+  };
+  std::atomic<int> m_state;
+  int16_t *m_buffer;
+  // total samples ever read and written - each only changed by one side
+  std::atomic<uint32_t> m_read_position;
+  std::atomic<uint32_t> m_write_position;
+  int m_sample_rate;
+  Base64Encoder m_encoder;
+  unsigned long m_stopped_at = 0;
+  uint32_t m_latency_ms = 0;
+
+public:
+  LiveUpload(int sample_rate);
+  ~LiveUpload();
+
+  // called from the audio task - start a session, returns false if the last one is still being sent
+  bool start();
+  // add captured samples - never waits for the upload
+  void write(const int16_t *samples, int count);
+  // the recording has finished - says so if the session had to be abandoned
+  void stop();
+  // the session never made it to the upload task
+  void cancel() { m_state = LIVE_IDLE; }
+
+  // called from the upload task - sends the session's audio as it arrives and reads the
+  // response into response, returning the status code or -1 if the session was abandoned
+  int send(HttpConnection &connection, const String &url, const String &prefix, const String &suffix, Stream *response);
+  // how long the response took to arrive after stop() for the last session that was sent
+  uint32_t latency_ms() { return m_latency_ms; }
+};
@@ -0,0 +1,405 @@
+#include "UploadJournal.h"
+
+// a record is a type, a state and a path
+#define UPLOAD_JOURNAL_MAX_LINE (UPLOAD_JOURNAL_MAX_PATH + 8)
+
+UploadJournal::UploadJournal(fs::FS &fs, const char *path) : m_fs(fs)
+{
+  strlcpy(m_path, path, sizeof(m_path));
+  snprintf(m_temp_path, sizeof(m_temp_path), "%s.tmp", path);
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+  {
+    m_entries[i].used = false;
+  }
+  m_lock = xSemaphoreCreateMutex();
+}
+
+UploadEntry *UploadJournal::find(const char *path)
+{
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+  {
+    if (m_entries[i].used && strcmp(m_entries[i].path, path) == 0)
+    {
+      return &m_entries[i];
+    }
+  }
+  return NULL;
+}
+
+UploadEntry *UploadJournal::allocate(const char *path)
+{
+  if (strlen(path) >= UPLOAD_JOURNAL_MAX_PATH)
+  {
+    return NULL;
+  }
+  UploadEntry *free_entry = NULL;
+  UploadEntry *failed_entry = NULL;
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+  {
+    UploadEntry &entry = m_entries[i];
+    if (!entry.used)
+    {
+      free_entry = &entry;
+      break;
+    }
+    if (!failed_entry && (entry.state & UPLOAD_FAILED))
+    {
+      failed_entry = &entry;
+    }
+  }
+  // a recording we've given up on makes way for a new one - its files stay on the card
+  if (!free_entry && failed_entry)
+  {
+    Serial.printf("Upload journal full - forgetting %s\n", failed_entry->path);
+    remove(failed_entry);
+    free_entry = failed_entry;
+  }
+  if (!free_entry)
+  {
+    return NULL;
+  }
+  free_entry->used = true;
+  strcpy(free_entry->path, path);
+  free_entry->state = 0;
+  free_entry->attempts = 0;
+  free_entry->retry_at = millis();
+  free_entry->added_at = free_entry->retry_at;
+  m_pending++;
+  return free_entry;
+}
+
+void UploadJournal::remove(UploadEntry *entry)
+{
+  append(m_file, 'D', entry);
+  if (entry->state & UPLOAD_FAILED)
+  {
+    m_failed--;
+  }
+  entry->used = false;
+  m_pending--;
+}
+
+void UploadJournal::apply(char *line)
+{
+  // "A <path>" adds a recording, "S <state> <path>" updates it and "D <path>" removes it
+  if (line[0] == 0 || line[1] != ' ')
+  {
+    return;
+  }
+  char *path = line + 2;
+  uint8_t state = 0;
+  if (line[0] == 'S')
+  {
+    state = strtoul(line + 2, &path, 16);
+    if (*path != ' ')
+    {
+      return;
+    }
+    path++;
+  }
+  UploadEntry *entry = find(path);
+  switch (line[0])
+  {
+  case 'A':
+    if (!entry)
+    {
+      allocate(path);
+    }
+    break;
+  case 'S':
+    if (entry)
+    {
+      entry->state = state;
+    }
+    break;
+  case 'D':
+    if (entry)
+    {
+      remove(entry);
+    }
+    break;
+  }
+}
+
+void UploadJournal::replay()
+{
+  fs::File file = m_fs.open(m_path, FILE_READ);
+  if (!file)
+  {
+    return;
+  }
+  char line[UPLOAD_JOURNAL_MAX_LINE];
+  int length = 0;
+  bool too_long = false;
+  uint8_t buffer[128];
+  int read;
+  while ((read = file.read(buffer, sizeof(buffer))) > 0)
+  {
+    for (int i = 0; i < read; i++)
+    {
+      if (buffer[i] == '\n')
+      {
+        line[length] = 0;
+        if (!too_long)
+        {
+          apply(line);
+        }
+        length = 0;
+        too_long = false;
+      }
+      else if (length < UPLOAD_JOURNAL_MAX_LINE - 1)
+      {
+        line[length++] = buffer[i];
+      }
+      else
+      {
+        too_long = true;
+      }
+    }
+  }
+  // anything left without a newline was cut short when we lost power
+  file.close();
+}
+
+void UploadJournal::rewrite()
+{
+  if (m_file)
+  {
+    m_file.close();
+  }
+  // write the pending entries to a new journal and swap it in - if we lose power before
+  // the rename begin() will pick up the new one
+  fs::File file = m_fs.open(m_temp_path, FILE_WRITE);
+  if (file)
+  {
+    for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+    {
+      if (m_entries[i].used)
+      {
+        append(file, 'A', &m_entries[i]);
+        if (m_entries[i].state)
+        {
+          append(file, 'S', &m_entries[i]);
+        }
+      }
+    }
+    file.close();
+    m_fs.remove(m_path);
+    m_fs.rename(m_temp_path, m_path);
+  }
+  m_file = m_fs.open(m_path, FILE_APPEND);
+  if (!m_file)
+  {
+    Serial.println("Failed to open the upload journal - uploads won't survive a reboot");
+  }
+}
+
+void UploadJournal::append(fs::File &file, char type, const UploadEntry *entry)
+{
+  if (!file)
+  {
+    return;
+  }
+  char line[UPLOAD_JOURNAL_MAX_LINE];
+  int length;
+  if (type == 'S')
+  {
+    length = snprintf(line, sizeof(line), "S %x %s\n", entry->state, entry->path);
+  }
+  else
+  {
+    length = snprintf(line, sizeof(line), "%c %s\n", type, entry->path);
+  }
+  file.write((const uint8_t *)line, length);
+  file.flush();
+}
+
+void UploadJournal::transcript_path(const UploadEntry *entry, char *path)
+{
+  snprintf(path, UPLOAD_JOURNAL_MAX_PATH + 4, "%s.txt", entry->path);
+}
+
+void UploadJournal::begin()
+{
+  xSemaphoreTake(m_lock, portMAX_DELAY);
+  if (!m_fs.exists(m_path) && m_fs.exists(m_temp_path))
+  {
+    m_fs.rename(m_temp_path, m_path);
+  }
+  replay();
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+  {
+    UploadEntry &entry = m_entries[i];
+    // we can still send a transcription after the recording has gone but nothing else
+    if (entry.used && !(entry.state & UPLOAD_TRANSCRIBED) && !m_fs.exists(entry.path))
+    {
+      Serial.printf("%s has been deleted - not uploading it\n", entry.path);
+      remove(&entry);
+    }
+    // the ones we'd given up on get another go
+    entry.state &= ~UPLOAD_FAILED;
+  }
+  m_failed = 0;
+  rewrite();
+  xSemaphoreGive(m_lock);
+  if (m_pending > 0)
+  {
+    Serial.printf("Resuming %d uploads\n", m_pending);
+  }
+}
+
+UploadEntry *UploadJournal::add(const char *path, uint8_t state)
+{
+  xSemaphoreTake(m_lock, portMAX_DELAY);
+  UploadEntry *entry = find(path);
+  if (!entry && (entry = allocate(path)))
+  {
+    append(m_file, 'A', entry);
+  }
+  if (entry && (entry->state | state) != entry->state)
+  {
+    entry->state |= state;
+    append(m_file, 'S', entry);
+  }
+  xSemaphoreGive(m_lock);
+  if (!entry)
+  {
+    Serial.printf("Upload journal full - not uploading %s\n", path);
+  }
+  return entry;
+}
+
+UploadEntry *UploadJournal::next(unsigned long *wait_ms)
+{
+  UploadEntry *next = NULL;
+  xSemaphoreTake(m_lock, portMAX_DELAY);
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+  {
+    UploadEntry &entry = m_entries[i];
+    if (entry.used && !(entry.state & UPLOAD_FAILED) && (!next || (long)(entry.retry_at - next->retry_at) < 0))
+    {
+      next = &entry;
+    }
+  }
+  xSemaphoreGive(m_lock);
+  if (next)
+  {
+    long wait = (long)(next->retry_at - millis());
+    *wait_ms = wait > 0 ? wait : 0;
+  }
+  return next;
+}
+
+int UploadJournal::collect(uint8_t state, UploadEntry **entries, int max)
+{
+  int count = 0;
+  xSemaphoreTake(m_lock, portMAX_DELAY);
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES && count < max; i++)
+  {
+    UploadEntry &entry = m_entries[i];
+    // recordings straight from the recorder have to be trimmed before anything else is done with them
+    if (entry.used && (entry.state & UPLOAD_TRIMMED) && !(entry.state & (state | UPLOAD_FAILED)) && entry.attempts == 0)
+    {
+      entries[count++] = &entry;
+    }
+  }
+  xSemaphoreGive(m_lock);
+  return count;
+}
+
+void UploadJournal::defer(UploadEntry *entry, unsigned long delay_ms)
+{
+  xSemaphoreTake(m_lock, portMAX_DELAY);
+  entry->retry_at = millis() + delay_ms;
+  xSemaphoreGive(m_lock);
+}
+
+void UploadJournal::mark(UploadEntry *entry, uint8_t state)
+{
+  xSemaphoreTake(m_lock, portMAX_DELAY);
+  entry->state |= state;
+  entry->attempts = 0;
+  append(m_file, 'S', entry);
+  xSemaphoreGive(m_lock);
+}
+
+bool UploadJournal::retry(UploadEntry *entry)
+{
+  entry->attempts++;
+  if (entry->attempts >= UPLOAD_MAX_ATTEMPTS)
+  {
+    // keep it and its transcription so it can be sent after the next reboot
+    Serial.printf("Giving up on uploading %s for now\n", entry->path);
+    xSemaphoreTake(m_lock, portMAX_DELAY);
+    entry->state |= UPLOAD_FAILED;
+    m_failed++;
+    append(m_file, 'S', entry);
+    xSemaphoreGive(m_lock);
+    return false;
+  }
+  unsigned long delay_ms = UPLOAD_RETRY_BASE_MS;
+  for (int i = 1; i < entry->attempts && delay_ms < UPLOAD_RETRY_MAX_MS; i++)
+  {
+    delay_ms *= 2;
+  }
+  if (delay_ms > UPLOAD_RETRY_MAX_MS)
+  {
+    delay_ms = UPLOAD_RETRY_MAX_MS;
+  }
+  entry->retry_at = millis() + delay_ms;
+  Serial.printf("Upload of %s failed - trying again in %lu seconds\n", entry->path, delay_ms / 1000);
+  return true;
+}
+
+void UploadJournal::complete(UploadEntry *entry)
+{
+  char path[UPLOAD_JOURNAL_MAX_PATH + 4];
+  transcript_path(entry, path);
+  if (m_fs.exists(path))
+  {
+    m_fs.remove(path);
+  }
+  xSemaphoreTake(m_lock, portMAX_DELAY);
+  remove(entry);
+  // nothing left to do so start the journal again rather than letting it grow forever
+  if (m_pending == m_failed)
+  {
+    rewrite();
+  }
+  xSemaphoreGive(m_lock);
+}
+
+bool UploadJournal::save_transcript(const UploadEntry *entry, const String &transcript)
+{
+  char path[UPLOAD_JOURNAL_MAX_PATH + 4];
+  transcript_path(entry, path);
+  fs::File file = m_fs.open(path, FILE_WRITE);
+  if (!file)
+  {
+    return false;
+  }
+  size_t written = file.write((const uint8_t *)transcript.c_str(), transcript.length());
+  file.close();
+  return written == transcript.length();
+}
+
+String UploadJournal::load_transcript(const UploadEntry *entry)
+{
+  char path[UPLOAD_JOURNAL_MAX_PATH + 4];
+  transcript_path(entry, path);
+  String transcript;
+  fs::File file = m_fs.open(path, FILE_READ);
+  if (!file)
+  {
+    return transcript;
+  }
+  char buffer[65];
+  int read;
+  while ((read = file.read((uint8_t *)buffer, sizeof(buffer) - 1)) > 0)
+  {
+    buffer[read] = 0;
+    transcript += buffer;
+  }
+  file.close();
+  return transcript;
+}
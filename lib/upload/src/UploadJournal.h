@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// most recordings that can be waiting to be uploaded at once
+#define UPLOAD_JOURNAL_MAX_ENTRIES 16
+#define UPLOAD_JOURNAL_MAX_PATH 64
+// wait this long before the first retry - it doubles after every failure up to the maximum
+#define UPLOAD_RETRY_BASE_MS 5000
+#define UPLOAD_RETRY_MAX_MS (30 * 60 * 1000)
+// give up on a recording after this many failures in a row - it stays in the journal and gets
+// another go after the next reboot
+#define UPLOAD_MAX_ATTEMPTS 12
+
+// what has been done with a recording so far
+#define UPLOAD_TELEGRAM_SENT 0x01
+#define UPLOAD_TRANSCRIBED 0x02
+#define UPLOAD_TRANSCRIPT_SENT 0x04
+// trimmed and split - recordings go in straight from the recorder without it
+#define UPLOAD_TRIMMED 0x08
+#define UPLOAD_COMPLETE (UPLOAD_TELEGRAM_SENT | UPLOAD_TRANSCRIBED | UPLOAD_TRANSCRIPT_SENT)
+// we've given up for now - kept along with its transcription until there's no room for it
+#define UPLOAD_FAILED 0x80
+
+struct UploadEntry
+{
+  bool used;
+  char path[UPLOAD_JOURNAL_MAX_PATH];
+  uint8_t state;
+  // failures since the last step that worked and when we can try again
+  uint8_t attempts;
+  unsigned long retry_at;
+  // when it was added or the journal was loaded
+  unsigned long added_at;
+};
+
+/**
+ * @brief Recordings waiting to be uploaded along with how far each one has got, kept in an
+ * append-only journal on the SD card so nothing is forgotten across failures or reboots
+ *
+ * Each change is a single short line appended to the journal. When the journal is opened
+ * it is replayed and rewritten with just the entries that are still pending. A line cut
+ * short by a power cut is ignored. Transcriptions that haven't been sent yet are kept in a
+ * file next to the recording. Retry counts aren't journalled so they start again after a reboot.
+ *
+ * add() can be called from any task so a recording is journalled the moment it's finished -
+ * everything else belongs to the upload task.
+ */
+class UploadJournal
+{
+private:
+  fs::FS &m_fs;
+  char m_path[UPLOAD_JOURNAL_MAX_PATH];
+  char m_temp_path[UPLOAD_JOURNAL_MAX_PATH];
+  fs::File m_file;
+  UploadEntry m_entries[UPLOAD_JOURNAL_MAX_ENTRIES];
+  int m_pending = 0;
+  int m_failed = 0;
+  // held while the entries are added to or removed from and while the journal is written
+  SemaphoreHandle_t m_lock;
+
+  UploadEntry *find(const char *path);
+  UploadEntry *allocate(const char *path);
+  void remove(UploadEntry *entry);
+  void apply(char *line);
+  void replay();
+  void rewrite();
+  void append(fs::File &file, char type, const UploadEntry *entry);
+  void transcript_path(const UploadEntry *entry, char *path);
+
+public:
+  UploadJournal(fs::FS &fs, const char *path);
+  // load the journal left by the last run
+  void begin();
+  // add a recording with the steps already done - returns NULL if the journal is full
+  UploadEntry *add(const char *path, uint8_t state = 0);
+  // the entry that is due to be retried first or NULL if there's nothing to do - wait_ms is
+  // set to how long until it is due. Entries we've given up on are skipped
+  UploadEntry *next(unsigned long *wait_ms);
+  // the trimmed entries that still need a step doing and aren't waiting to retry a failure
+  int collect(uint8_t state, UploadEntry **entries, int max);
+  // hold off on an entry for a while
+  void defer(UploadEntry *entry, unsigned long delay_ms);
+  // a step worked
+  void mark(UploadEntry *entry, uint8_t state);
+  // a step failed - returns false if we've given up on the recording for now
+  bool retry(UploadEntry *entry);
+  // everything has been done - forget about the recording
+  void complete(UploadEntry *entry);
+  // keep the transcription until it has been sent
+  bool save_transcript(const UploadEntry *entry, const String &transcript);
+  String load_transcript(const UploadEntry *entry);
+  // including the ones we've given up on
+  int pending() { return m_pending; }
+  int failed() { return m_failed; }
+};
@@ -4,16 +4,24 @@
 #include <SD.h>
 #include <UniversalTelegramBot.h>
 #include <WiFiClientSecure.h>
-#include <ArduinoJson.h>
 
 #include "Application.h"
 #include "I2SMEMSSampler.h"
 #include "ADCSampler.h"
+#include "VoiceActivityDetector.h"
 #include "I2SOutput.h"
 #include "DACOutput.h"
 #include "UdpTransport.h"
 #include "EspNowTransport.h"
 #include "OutputBuffer.h"
+#include "StreamMixer.h"
+#include "SdRecorder.h"
+#include "FileRequestStream.h"
+#include "UploadJournal.h"
+#include "HttpConnections.h"
+#include "JsonTextExtractor.h"
+#include "LiveUpload.h"
+#include "RecordingTrimmer.h"
 #include "config.h"
 
 #ifdef ARDUINO_TINYPICO
@@ -29,14 +37,45 @@ static void application_task(void *param)
   application->loop();
 }
 
+// what the upload task is asked to do with a recording
+struct UploadRequest
+{
+  // send it to Gemini while it's being recorded rather than once it's finished
+  bool live;
+  char path[SD_RECORDER_MAX_PATH];
+};
+
+static void upload_task(void *param)
+{
+  // delegate onto the application
+  Application *application = reinterpret_cast<Application *>(param);
+  application->uploadLoop();
+}
+
 Application::Application()
 {
-  m_output_buffer = new OutputBuffer(300 * 16);
+  // each sender gets a buffer of at most 200ms - the jitter buffer will pick a lower target when the link is good
+  m_mixer = new StreamMixer(200 * 16, SAMPLE_RATE);
 #ifdef USE_I2S_MIC_INPUT
   m_input = new I2SMEMSSampler(I2S_NUM_0, i2s_mic_pins, i2s_mic_Config,128);
 #else
   m_input = new ADCSampler(ADC_UNIT_1, ADC1_CHANNEL_7, i2s_adc_config);
 #endif
+  m_vad = new VoiceActivityDetector();
+  m_recorder = new SdRecorder(SD);
+  m_recorder->set_max_loss(RECORDING_MAX_LOSS_MS);
+  m_journal = new UploadJournal(SD, UPLOAD_JOURNAL_FILE);
+  m_connections = new HttpConnectionManager();
+#if defined(USE_LIVE_TRANSCRIPTION) && !RECORDING_LOSSLESS
+  m_live = new LiveUpload(WAV_SAMPLE_RATE);
+#else
+  m_live = NULL;
+#endif
+#ifdef USE_RECORDING_TRIMMING
+  m_trimmer = new RecordingTrimmer(SD);
+#else
+  m_trimmer = NULL;
+#endif
 
 #ifdef USE_I2S_SPEAKER_OUTPUT
   m_output = new I2SOutput(I2S_NUM_0, i2s_speaker_pins);
@@ -45,12 +84,14 @@ Application::Application()
 #endif
 
 #ifdef USE_ESP_NOW
-  m_transport = new EspNowTransport(m_output_buffer,ESP_NOW_WIFI_CHANNEL);
+  m_transport = new EspNowTransport(m_mixer,ESP_NOW_WIFI_CHANNEL);
 #else
-  m_transport = new UdpTransport(m_output_buffer);
+  m_transport = new UdpTransport(m_mixer);
 #endif
 
   m_transport->set_header(TRANSPORT_HEADER_SIZE,transport_header);
+  m_transport->set_frame_size(TRANSPORT_FRAME_SIZE);
+  m_transport->set_fec_group_size(TRANSPORT_FEC_GROUP_SIZE);
 
 #ifdef ARDUINO_TINYPICO
   m_indicator_led = new TinyPICOIndicatorLed();
@@ -124,7 +165,11 @@ void Application::begin()
   // start off with i2S output running
   m_output->start(SAMPLE_RATE);
   // flush all samples received during startup
-  m_output_buffer->flush();
+  m_mixer->flush();
+  // uploads run below the audio so they only get the CPU when it's waiting on I2S - TLS needs a big stack
+  m_upload_queue = xQueueCreate(UPLOAD_QUEUE_LENGTH, sizeof(UploadRequest));
+  TaskHandle_t upload_task_handle;
+  xTaskCreate(upload_task, "upload_task", 16384, this, 0, &upload_task_handle);
   // start the main task for the application
   TaskHandle_t task_handle;
   xTaskCreate(application_task, "application_task", 8192, this, 1, &task_handle);
@@ -138,12 +183,6 @@ void Application::loop()
   // continue forever
   while (true)
   {
-    // Check for new audio files to process
-    if (millis() - m_last_bot_check > m_bot_check_interval) {
-      checkAndProcessNewAudioFile();
-      m_last_bot_check = millis();
-    }
-
     // do we need to start transmitting?
     if (digitalRead(GPIO_TRANSMIT_BUTTON))
     {
@@ -153,28 +192,55 @@ void Application::loop()
       m_output->stop();
       // start the input to get samples from the microphone
       m_input->start();
+      m_vad->reset();
+      // keep the recording open for the whole transmission
+      if (m_sd_initialized && startRecording()) {
+        // and start transcribing it straight away if the upload task is free
+        if (m_live && m_live->start()) {
+          queueUpload(m_current_audio_file, true);
+        }
+      }
       // transmit for at least 1 second or while the button is pushed
       unsigned long start_time = millis();
+      resetLoopStall();
       while (millis() - start_time < 1000 || digitalRead(GPIO_TRANSMIT_BUTTON))
       {
         // read samples from the microphone
         int samples_read = m_input->read(samples, 128);
+        trackLoopStall();
         if (samples_read > 0) {
           // Save audio to SD card
           if (m_sd_initialized) {
             saveAudioToSD(samples, samples_read);
           }
+          if (m_live) {
+            m_live->write(samples, samples_read);
+          }
           
-          // Send audio through transport
-          for (int i = 0; i < samples_read; i++) {
-            m_transport->add_sample(samples[i]);
+#ifdef USE_VOICE_ACTIVITY_DETECTION
+          // only send audio while someone is talking - the receivers play comfort noise in between
+          if (!m_vad->is_speech(samples, samples_read))
+          {
+            m_transport->add_silence(samples_read, m_vad->noise_level());
+            continue;
           }
+#endif
+          // Send audio through transport
+          m_transport->add_samples(samples, samples_read);
         }
       }
+      // let the live transcription finish - only the last few samples still need sending
+      if (m_live) {
+        m_live->stop();
+      }
       // send all packets still in the transport buffer
       m_transport->flush();
+      // finish writing the recording now we're not capturing any more
+      stopRecording();
       // finished transmitting stop the input and start the output
       Serial.println("Finished transmitting");
+      Serial.printf("Longest audio loop stall %lu us\n", m_max_loop_stall_us);
+      Serial.printf("Discontinuous transmission has saved %d bytes\n", m_transport->dtx_saved_bytes());
       m_indicator_led->set_is_flashing(false, 0xff0000);
       m_input->stop();
       m_output->start(SAMPLE_RATE);
@@ -186,21 +252,58 @@ void Application::loop()
       digitalWrite(I2S_SPEAKER_SD_PIN, HIGH);
     }
     unsigned long start_time = millis();
+    resetLoopStall();
     while (millis() - start_time < 1000 || !digitalRead(GPIO_TRANSMIT_BUTTON))
     {
-      // read from the output buffer (which should be getting filled by the transport)
-      m_output_buffer->remove_samples(samples, 128);
+      // mix together everyone who is talking (the streams are filled by the transport)
+      m_mixer->remove_samples(samples, 128);
       // and send the samples to the speaker
       m_output->write(samples, 128);
+      trackLoopStall();
+      // archive what we heard - this never waits for the SD card
+      if (m_sd_initialized) {
+        recordReceivedAudio(samples, 128);
+      }
     }
+    stopRecordingReceived();
     if (I2S_SPEAKER_SD_PIN != -1)
     {
       digitalWrite(I2S_SPEAKER_SD_PIN, LOW);
     }
     Serial.println("Finished Receiving");
+    Serial.printf("Longest audio loop stall %lu us\n", m_max_loop_stall_us);
+    Serial.printf("Recovered %u frames, dropped %u packets, ignored %u senders\n",
+                  m_transport->fec_recovered(), m_transport->receive_dropped(), m_mixer->rejected());
+    for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+    {
+      if (m_mixer->is_active(i))
+      {
+        const uint8_t *address = m_mixer->address(i);
+        OutputBuffer *output_buffer = m_mixer->output_buffer(i);
+        JitterBuffer *jitter_buffer = output_buffer->jitter_buffer();
+        Serial.printf("%02x:%02x:%02x:%02x:%02x:%02x received %u frames, lost %u, late %u, duplicate %u, jitter %d samples, target depth %d samples, underruns %u\n",
+                      address[0], address[1], address[2], address[3], address[4], address[5],
+                      jitter_buffer->received(), jitter_buffer->lost(), jitter_buffer->late(), jitter_buffer->duplicate(),
+                      jitter_buffer->jitter(), output_buffer->target_depth(), output_buffer->underruns());
+      }
+    }
   }
 }
 
+void Application::resetLoopStall() {
+    m_last_block_us = micros();
+    m_max_loop_stall_us = 0;
+}
+
+void Application::trackLoopStall() {
+    // time between blocks - at 16kHz a 128 sample block should come round every 8ms
+    unsigned long now = micros();
+    if (now - m_last_block_us > m_max_loop_stall_us) {
+        m_max_loop_stall_us = now - m_last_block_us;
+    }
+    m_last_block_us = now;
+}
+
 bool Application::initSDCard() {
     SPIClass spiSD(VSPI);
     spiSD.begin(SD_SCK_PIN, SD_MISO_PIN, SD_MOSI_PIN, SD_CS_PIN);
@@ -216,6 +319,7 @@ bool Application::initSDCard() {
     }
 
     createAudioDirectory();
+    m_recorder->begin();
     return true;
 }
 
@@ -230,92 +334,90 @@ void Application::createAudioDirectory() {
 }
 
 String Application::getTimestampFilename() {
-    return String(AUDIO_FOLDER) + "/audio_" + String(millis()) + ".wav";
-}
-
-void Application::writeWAVHeader(File* file, size_t length) {
-    unsigned char header[44];
-    unsigned long fileSize = length * sizeof(int16_t) + 36;
-
-    // RIFF chunk descriptor
-    header[0] = 'R'; header[1] = 'I'; header[2] = 'F'; header[3] = 'F';
-    header[4] = (fileSize & 0xFF);
-    header[5] = ((fileSize >> 8) & 0xFF);
-    header[6] = ((fileSize >> 16) & 0xFF);
-    header[7] = ((fileSize >> 24) & 0xFF);
-    header[8] = 'W'; header[9] = 'A'; header[10] = 'V'; header[11] = 'E';
-
-    // fmt sub-chunk
-    header[12] = 'f'; header[13] = 'm'; header[14] = 't'; header[15] = ' ';
-    header[16] = 16; // SubChunk1Size is 16
-    header[17] = 0;
-    header[18] = 0;
-    header[19] = 0;
-    header[20] = 1; // PCM = 1
-    header[21] = 0;
-    header[22] = WAV_CHANNELS;
-    header[23] = 0;
-    
-    // Sample rate
-    header[24] = (WAV_SAMPLE_RATE & 0xFF);
-    header[25] = ((WAV_SAMPLE_RATE >> 8) & 0xFF);
-    header[26] = ((WAV_SAMPLE_RATE >> 16) & 0xFF);
-    header[27] = ((WAV_SAMPLE_RATE >> 24) & 0xFF);
-    
-    // Byte rate
-    unsigned long byteRate = WAV_SAMPLE_RATE * WAV_CHANNELS * (WAV_BITS_PER_SAMPLE / 8);
-    header[28] = (byteRate & 0xFF);
-    header[29] = ((byteRate >> 8) & 0xFF);
-    header[30] = ((byteRate >> 16) & 0xFF);
-    header[31] = ((byteRate >> 24) & 0xFF);
-    
-    // Block align
-    header[32] = WAV_CHANNELS * (WAV_BITS_PER_SAMPLE / 8);
-    header[33] = 0;
-    
-    // Bits per sample
-    header[34] = WAV_BITS_PER_SAMPLE;
-    header[35] = 0;
+    return String(AUDIO_FOLDER) + "/audio_" + String(millis()) + RECORDING_EXTENSION;
+}
 
-    // data sub-chunk
-    header[36] = 'd'; header[37] = 'a'; header[38] = 't'; header[39] = 'a';
-    header[40] = (length & 0xFF);
-    header[41] = ((length >> 8) & 0xFF);
-    header[42] = ((length >> 16) & 0xFF);
-    header[43] = ((length >> 24) & 0xFF);
+bool Application::startRecording() {
+    m_current_audio_file = getTimestampFilename();
+    if (!m_recorder->start(m_current_audio_file.c_str(), WAV_SAMPLE_RATE, RECORDING_LOSSLESS)) {
+        Serial.println("Failed to create new audio file");
+        m_current_audio_file = "";
+        return false;
+    }
+    return true;
+}
 
-    file->write(header, sizeof(header));
+void Application::saveAudioToSD(const int16_t* samples, size_t length) {
+    // this just copies the samples - the recorder's task does the writing
+    m_recorder->write(samples, length * sizeof(int16_t));
 }
 
-bool Application::saveAudioToSD(const int16_t* samples, size_t length) {
-    if (!m_sd_initialized) {
-        return false;
+void Application::stopRecording() {
+    if (!m_recorder->is_recording()) {
+        return;
     }
+    m_recorder->stop();
+    if (m_recorder->dropped_bytes() > 0) {
+        Serial.printf("SD card too slow - dropped %u bytes of the recording\n", m_recorder->dropped_bytes());
+    }
+    // the file is closed now - journal it before anything else so it survives a full queue or a power cut
+    // and let the upload task know it's there
+    m_journal->add(m_current_audio_file.c_str());
+    queueUpload(m_current_audio_file);
+    m_current_audio_file = "";
+}
 
-    // If we don't have a current file, create one
-    if (m_current_audio_file.length() == 0) {
-        m_current_audio_file = getTimestampFilename();
-        File file = SD.open(m_current_audio_file.c_str(), FILE_WRITE);
-        if (!file) {
-            Serial.println("Failed to create new audio file");
-            m_current_audio_file = "";
-            return false;
+void Application::recordReceivedAudio(const int16_t* samples, int count) {
+    // stick with the sender we're recording while they're still talking, otherwise record whoever spoke
+    // last - streams stay active for a while after their sender stops so being active isn't enough
+    int stream = -1;
+    for (int i = 0; i < MIXER_MAX_STREAMS && m_recording_received; i++) {
+        if (m_mixer->is_active(i) && memcmp(m_mixer->address(i), m_received_address, sizeof(m_received_address)) == 0 &&
+            millis() - m_mixer->last_seen(i) < RECORDING_SENDER_IDLE_MS) {
+            stream = i;
         }
-        writeWAVHeader(&file, length);
-        file.close();
     }
-
-    // Append the samples to the current file
-    File file = SD.open(m_current_audio_file.c_str(), FILE_APPEND);
-    if (!file) {
-        Serial.println("Failed to open audio file for appending");
-        return false;
+    if (stream < 0) {
+        stream = m_mixer->latest_stream();
     }
+    if (stream < 0) {
+        stopRecordingReceived();
+        return;
+    }
+    // start a new segment when someone new starts talking - it's named after them and when they started
+    const uint8_t* address = m_mixer->address(stream);
+    if (!m_recording_received || memcmp(address, m_received_address, sizeof(m_received_address)) != 0) {
+        stopRecordingReceived();
+        char name[32];
+        snprintf(name, sizeof(name), "/rx_%02x%02x%02x%02x%02x%02x_%lu",
+                 address[0], address[1], address[2], address[3], address[4], address[5], millis());
+        String path = String(AUDIO_FOLDER) + name + RECORDING_EXTENSION;
+        if (!m_recorder->start(path.c_str(), SAMPLE_RATE, RECORDING_LOSSLESS)) {
+            return;
+        }
+        memcpy(m_received_address, address, sizeof(m_received_address));
+        m_recording_received = true;
+    }
+    // the output buffer scales samples down for the speaker - put them back to full scale
+    int16_t scaled[128];
+    while (count > 0) {
+        int block = count < 128 ? count : 128;
+        for (int i = 0; i < block; i++) {
+            int32_t sample = samples[i] * 8;
+            scaled[i] = sample > INT16_MAX ? INT16_MAX : (sample < INT16_MIN ? INT16_MIN : sample);
+        }
+        m_recorder->write(scaled, block * sizeof(int16_t));
+        samples += block;
+        count -= block;
+    }
+}
 
-    size_t written = file.write((const uint8_t*)samples, length * sizeof(int16_t));
-    file.close();
-
-    return written == length * sizeof(int16_t);
+void Application::stopRecordingReceived() {
+    if (m_recording_received) {
+        // don't wait for the card - the writer task will close the file
+        m_recorder->stop(false);
+        m_recording_received = false;
+    }
 }
 
 bool Application::initWiFi() {
@@ -332,152 +434,245 @@ bool Application::initWiFi() {
     return m_wifi_connected;
 }
 
-String Application::base64Encode(const uint8_t* data, size_t length) {
-    const char* base64_chars = 
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz"
-        "0123456789+/";
-
-    String encoded;
-    encoded.reserve(((length + 2) / 3) * 4);
-
-    for (size_t i = 0; i < length; i += 3) {
-        uint32_t octet_a = i < length ? data[i] : 0;
-        uint32_t octet_b = i + 1 < length ? data[i + 1] : 0;
-        uint32_t octet_c = i + 2 < length ? data[i + 2] : 0;
-
-        uint32_t triple = (octet_a << 16) + (octet_b << 8) + octet_c;
-
-        encoded += base64_chars[(triple >> 18) & 0x3F];
-        encoded += base64_chars[(triple >> 12) & 0x3F];
-        encoded += base64_chars[(triple >> 6) & 0x3F];
-        encoded += base64_chars[triple & 0x3F];
-    }
+// The request is the prompt and the audio as inline data - the base64 encoded audio goes between these
+static String geminiRequestPrefix(const char* mimeType) {
+    return String("{\"contents\":[{\"parts\":["
+                  "{\"text\":\"Por favor, transcreva esse áudio em texto.\"},"
+                  "{\"inlineData\":{\"mimeType\":\"") + mimeType + "\",\"data\":\"";
+}
+static const char* GEMINI_REQUEST_SUFFIX = "\"}}]}]}";
 
-    switch (length % 3) {
-        case 1:
-            encoded[encoded.length() - 2] = '=';
-            encoded[encoded.length() - 1] = '=';
-            break;
-        case 2:
-            encoded[encoded.length() - 1] = '=';
-            break;
+// keep the connection for the next request only if the whole response was read - otherwise close it
+static void finishRequest(HttpConnection& connection, int httpCode) {
+    if (httpCode > 0) {
+        connection.end();
+    } else {
+        connection.abort();
     }
-
-    return encoded;
 }
 
-String Application::readWAVFile(const char* filepath) {
-    if (!m_sd_initialized) {
-        Serial.println("SD card not initialized");
+String Application::transcribeAudio(const char* filepath) {
+    if (!m_wifi_connected) {
+        Serial.println("WiFi not connected");
         return "";
     }
-    
+
     File audioFile = SD.open(filepath);
     if (!audioFile) {
         Serial.println("Failed to open audio file for reading");
         return "";
     }
-    
-    size_t fileSize = audioFile.size();
-    if (fileSize > MAX_AUDIO_SIZE) {
+    if (audioFile.size() > MAX_AUDIO_SIZE) {
         Serial.println("Audio file too large");
         audioFile.close();
         return "";
     }
-    
-    // Alocar buffer para o arquivo inteiro (incluindo cabeçalho WAV)
-    uint8_t* buffer = (uint8_t*)malloc(fileSize);
-    if (!buffer) {
-        Serial.println("Failed to allocate memory for audio data");
+
+    String url = String(GEMINI_API_URL) + "?key=" + String(GEMINI_API_KEY);
+    HttpConnection& connection = m_connections->connection(url);
+    if (!connection.begin(url)) {
+        Serial.println("Couldn't connect to Gemini");
         audioFile.close();
         return "";
     }
+    HTTPClient& http = connection.http();
+    http.addHeader("Content-Type", "application/json");
+
+    // the audio is base64 encoded straight from the SD card as it is sent so we never hold more than a chunk of it in memory
+    FileRequestStream body(geminiRequestPrefix(RECORDING_MIME_TYPE), audioFile, true, GEMINI_REQUEST_SUFFIX);
+
+    int httpCode = http.sendRequest("POST", &body, body.size());
+    String transcription;
     
-    size_t bytesRead = audioFile.read(buffer, fileSize);
-    if (bytesRead != fileSize) {
-        Serial.println("Failed to read complete file");
-        free(buffer);
-        audioFile.close();
-        return "";
+    if (httpCode == HTTP_CODE_OK) {
+        // pick the text out of the response as it arrives rather than holding all of it
+        JsonTextExtractor extractor("candidates.0.content.parts.*.text");
+        if (http.writeToStream(&extractor) < 0) {
+            httpCode = -1;
+        }
+        if (extractor.finished()) {
+            transcription = extractor.text();
+        } else {
+            Serial.println("Couldn't read the transcription from the response");
+        }
+    } else if (httpCode > 0) {
+        // read the error so it isn't taken for the answer to the next request
+        Serial.println("Gemini error: " + http.getString());
+    } else {
+        Serial.printf("HTTP request failed, error: %s\n", http.errorToString(httpCode).c_str());
     }
-    
-    String base64Audio = base64Encode(buffer, bytesRead);
-    
-    free(buffer);
+    finishRequest(connection, httpCode);
     audioFile.close();
+    return transcription;
+}
+
+void Application::processAudioFile(const char* filepath) {
+    if (!m_sd_initialized || !m_wifi_connected) return;
     
-    if (base64Audio.length() == 0) {
-        Serial.println("Failed to encode audio to base64");
-        return "";
+    m_last_transcription = transcribeAudio(filepath);
+    Serial.println("Transcription: " + m_last_transcription);
+}
+
+// short recordings are worth holding back so they can be transcribed together
+static bool isShortRecording(const char* filepath) {
+    File file = SD.open(filepath);
+    if (!file) {
+        return false;
+    }
+    bool isShort = file.size() <= TRANSCRIPTION_BATCH_MAX_CLIP_BYTES;
+    file.close();
+    return isShort;
+}
+
+// The answer to a batch has a line per recording starting with its number - "2: ..." or "Áudio 2: ..."
+static void splitTranscripts(const String& text, String* transcripts, int count) {
+    int current = -1;
+    int start = 0;
+    while (start < (int)text.length()) {
+        int end = text.indexOf('\n', start);
+        if (end < 0) {
+            end = text.length();
+        }
+        String line = text.substring(start, end);
+        start = end + 1;
+        line.trim();
+        int colon = line.indexOf(':');
+        int number = 0;
+        if (colon > 0 && colon <= 12) {
+            int digit = 0;
+            while (digit < colon && !isdigit(line[digit])) {
+                digit++;
+            }
+            number = line.substring(digit, colon).toInt();
+        }
+        if (number >= 1 && number <= count) {
+            current = number - 1;
+            line = line.substring(colon + 1);
+            line.trim();
+        }
+        // anything before the first numbered line isn't a transcription
+        if (current < 0 || line.length() == 0) {
+            continue;
+        }
+        if (transcripts[current].length() > 0) {
+            transcripts[current] += "\n";
+        }
+        transcripts[current] += line;
     }
-    
-    return base64Audio;
 }
 
-String Application::transcribeAudio(const String& audioBase64) {
+void Application::transcribeBatch(UploadEntry** batch, int count, String* transcripts) {
     if (!m_wifi_connected) {
         Serial.println("WiFi not connected");
-        return "";
+        return;
     }
-    
-    HTTPClient http;
+
+    // each recording is its own inline data part after a numbered label - the files have to outlive the body
+    File audioFiles[TRANSCRIPTION_BATCH_MAX];
+    FileRequestStream body(true, GEMINI_REQUEST_SUFFIX);
+    for (int i = 0; i < count; i++) {
+        audioFiles[i] = SD.open(batch[i]->path);
+        if (!audioFiles[i]) {
+            Serial.printf("Failed to open %s for reading\n", batch[i]->path);
+            return;
+        }
+        String prefix;
+        if (i == 0) {
+            prefix = String("{\"contents\":[{\"parts\":["
+                            "{\"text\":\"Por favor, transcreva cada um dos ") + count + " áudios abaixo em texto. "
+                     "Responda com uma linha por áudio, na mesma ordem, começando com o número do áudio e dois pontos, "
+                     "por exemplo 1: texto.\"},";
+        } else {
+            prefix = "\"}},";
+        }
+        prefix += String("{\"text\":\"Áudio ") + (i + 1) + ":\"},"
+                  "{\"inlineData\":{\"mimeType\":\"" RECORDING_MIME_TYPE "\",\"data\":\"";
+        body.add_file(prefix, audioFiles[i]);
+    }
+
     String url = String(GEMINI_API_URL) + "?key=" + String(GEMINI_API_KEY);
-    http.begin(url);
+    HttpConnection& connection = m_connections->connection(url);
+    if (!connection.begin(url)) {
+        Serial.println("Couldn't connect to Gemini");
+        for (int i = 0; i < count; i++) {
+            audioFiles[i].close();
+        }
+        return;
+    }
+    HTTPClient& http = connection.http();
     http.addHeader("Content-Type", "application/json");
-    
-    // Criar o JSON para a API do Gemini
-    DynamicJsonDocument doc(MAX_JSON_SIZE);
-    JsonArray contents = doc.createNestedArray("contents");
-    JsonObject content = contents.createNestedObject();
-    JsonArray parts = content.createNestedArray("parts");
-    
-    // Adicionar o texto do prompt
-    JsonObject textPart = parts.createNestedObject();
-    textPart["text"] = "Por favor, transcreva esse áudio em texto.";
-    
-    // Adicionar o áudio
-    JsonObject audioPart = parts.createNestedObject();
-    JsonObject inlineData = audioPart.createNestedObject("inlineData");
-    inlineData["mimeType"] = "audio/wav";
-    inlineData["data"] = audioBase64;
-    
-    String jsonString;
-    serializeJson(doc, jsonString);
-    
-    int httpCode = http.POST(jsonString);
-    String transcription;
-    
+
+    int httpCode = http.sendRequest("POST", &body, body.size());
     if (httpCode == HTTP_CODE_OK) {
-        String response = http.getString();
-        
-        DynamicJsonDocument responseDoc(4096);
-        deserializeJson(responseDoc, response);
-        
-        transcription = responseDoc["candidates"][0]["content"]["parts"][0]["text"].as<String>();
+        JsonTextExtractor extractor("candidates.0.content.parts.*.text");
+        if (http.writeToStream(&extractor) < 0) {
+            httpCode = -1;
+        }
+        if (extractor.finished()) {
+            splitTranscripts(extractor.text(), transcripts, count);
+        } else {
+            Serial.println("Couldn't read the transcriptions from the response");
+        }
+    } else if (httpCode > 0) {
+        Serial.println("Gemini error: " + http.getString());
     } else {
         Serial.printf("HTTP request failed, error: %s\n", http.errorToString(httpCode).c_str());
     }
-    
-    http.end();
-    return transcription;
+    finishRequest(connection, httpCode);
+    for (int i = 0; i < count; i++) {
+        audioFiles[i].close();
+    }
 }
 
-void Application::processAudioFile(const char* filepath) {
-    if (!m_sd_initialized || !m_wifi_connected) return;
-    
-    String audioBase64 = readWAVFile(filepath);
-    if (audioBase64.length() > 0) {
-        m_last_transcription = transcribeAudio(audioBase64);
-        Serial.println("Transcription: " + m_last_transcription);
+// transcribes the recording - along with any other short ones that are waiting if it's short too
+bool Application::transcribeRecordings(UploadEntry* entry) {
+    UploadEntry* batch[TRANSCRIPTION_BATCH_MAX];
+    int count = 0;
+    if (isShortRecording(entry->path)) {
+        batch[count++] = entry;
+        UploadEntry* waiting[TRANSCRIPTION_BATCH_MAX];
+        int found = m_journal->collect(UPLOAD_TRANSCRIBED, waiting, TRANSCRIPTION_BATCH_MAX);
+        for (int i = 0; i < found && count < TRANSCRIPTION_BATCH_MAX; i++) {
+            if (waiting[i] != entry && isShortRecording(waiting[i]->path)) {
+                batch[count++] = waiting[i];
+            }
+        }
     }
+    if (count > 1) {
+        Serial.printf("Transcribing %d recordings in one request\n", count);
+        String transcripts[TRANSCRIPTION_BATCH_MAX];
+        transcribeBatch(batch, count, transcripts);
+        for (int i = 0; i < count; i++) {
+            // the ones that didn't come back are transcribed on their own when they come round - the rest
+            // don't need to wait out their own window any more
+            if (transcripts[i].length() > 0 && m_journal->save_transcript(batch[i], transcripts[i])) {
+                m_journal->mark(batch[i], UPLOAD_TRANSCRIBED);
+                m_journal->defer(batch[i], 0);
+            }
+        }
+        if (entry->state & UPLOAD_TRANSCRIBED) {
+            m_last_transcription = transcripts[0];
+            Serial.println("Transcription: " + m_last_transcription);
+            return true;
+        }
+    }
+
+    processAudioFile(entry->path);
+    if (m_last_transcription.length() == 0) {
+        return false;
+    }
+    // hang on to it in case sending it fails
+    if (!m_journal->save_transcript(entry, m_last_transcription)) {
+        return false;
+    }
+    m_journal->mark(entry, UPLOAD_TRANSCRIBED);
+    return true;
 }
 
 bool Application::initTelegramBot()
 {
     m_client.setInsecure(); // Required for HTTPS but skips certificate verification
     m_bot = new UniversalTelegramBot(BOT_TOKEN, m_client);
-    m_last_bot_check = 0;
     return true;
 }
 
@@ -497,22 +692,41 @@ bool Application::sendAudioFileToTelegram(const char* filepath)
     String fileName = String(filepath);
     fileName = fileName.substring(fileName.lastIndexOf('/') + 1);
 
-    HTTPClient http;
     String url = "https://api.telegram.org/bot" + String(BOT_TOKEN) + "/sendAudio";
-
-    http.begin(url);
-    
-    // Use URLEncoded form instead of multipart for simplicity
-    String data = "chat_id=" + String(CHAT_ID);
-    data += "&caption=" + String("Audio file: ") + fileName;
-    data += "&audio=" + String("attach://audio.wav");
-    
-    http.addHeader("Content-Type", "application/x-www-form-urlencoded");
-    
-    // Send the request
-    int httpCode = http.sendRequest("POST", data);
-    String response = http.getString();
-    http.end();
+    HttpConnection& connection = m_connections->connection(url);
+    if (!connection.begin(url)) {
+        Serial.println("Couldn't connect to Telegram");
+        audioFile.close();
+        return false;
+    }
+    HTTPClient& http = connection.http();
+    http.addHeader("Content-Type", "multipart/form-data; boundary=" TELEGRAM_BOUNDARY);
+
+    // The form fields go in front of the file and the closing boundary after it - the file itself
+    // is sent straight from the SD card a chunk at a time so we never hold it in memory
+    String prefix = "--" TELEGRAM_BOUNDARY "\r\n"
+                    "Content-Disposition: form-data; name=\"chat_id\"\r\n\r\n";
+    prefix += String(CHAT_ID) + "\r\n";
+    prefix += "--" TELEGRAM_BOUNDARY "\r\n"
+              "Content-Disposition: form-data; name=\"caption\"\r\n\r\n"
+              "Audio file: ";
+    prefix += fileName + "\r\n";
+    prefix += "--" TELEGRAM_BOUNDARY "\r\n"
+              "Content-Disposition: form-data; name=\"audio\"; filename=\"";
+    prefix += fileName + "\"\r\n";
+    prefix += "Content-Type: " RECORDING_MIME_TYPE "\r\n\r\n";
+    String suffix = "\r\n--" TELEGRAM_BOUNDARY "--\r\n";
+    FileRequestStream body(prefix, audioFile, false, suffix);
+
+    int httpCode = http.sendRequest("POST", &body, body.size());
+    if (body.failed()) {
+        Serial.println("Audio file ended before it was fully sent");
+    }
+    String response;
+    if (httpCode > 0) {
+        response = http.getString();
+    }
+    finishRequest(connection, httpCode);
     audioFile.close();
 
     if (httpCode == HTTP_CODE_OK) {
@@ -533,10 +747,14 @@ bool Application::sendMessageToTelegram(const String& message)
         return false;
     }
 
-    HTTPClient http;
     String url = "https://api.telegram.org/bot" + String(BOT_TOKEN) + "/sendMessage";
-    
-    http.begin(url);
+    // this normally goes out on the connection the audio was just sent on
+    HttpConnection& connection = m_connections->connection(url);
+    if (!connection.begin(url)) {
+        Serial.println("Couldn't connect to Telegram");
+        return false;
+    }
+    HTTPClient& http = connection.http();
     http.addHeader("Content-Type", "application/x-www-form-urlencoded");
     
     String data = "chat_id=" + String(CHAT_ID);
@@ -544,8 +762,11 @@ bool Application::sendMessageToTelegram(const String& message)
     data += "&parse_mode=HTML";
     
     int httpCode = http.POST(data);
-    String response = http.getString();
-    http.end();
+    String response;
+    if (httpCode > 0) {
+        response = http.getString();
+    }
+    finishRequest(connection, httpCode);
 
     if (httpCode == HTTP_CODE_OK) {
         Serial.println("Message sent to Telegram successfully");
@@ -557,37 +778,197 @@ bool Application::sendMessageToTelegram(const String& message)
     }
 }
 
-void Application::handleCurrentAudioFile()
+void Application::queueUpload(const String& filepath, bool live)
+{
+    if (!m_upload_queue || filepath.length() == 0) {
+        return;
+    }
+    UploadRequest request;
+    request.live = live;
+    strlcpy(request.path, filepath.c_str(), sizeof(request.path));
+    // never wait here - we're on the audio task
+    if (xQueueSend(m_upload_queue, &request, 0) != pdTRUE) {
+        if (live) {
+            Serial.printf("Upload queue full - not transcribing %s live\n", request.path);
+            m_live->cancel();
+        } else {
+            Serial.printf("Upload queue full - %s will be picked up from the journal\n", request.path);
+        }
+    }
+}
+
+void Application::transcribeLive(const char* filepath)
+{
+    String url = String(GEMINI_API_URL) + "?key=" + String(GEMINI_API_KEY);
+    HttpConnection& connection = m_connections->connection(url);
+    JsonTextExtractor extractor("candidates.0.content.parts.*.text");
+    // this sends the audio as it's recorded and returns once the button is released and we have the answer
+    int httpCode = m_live->send(connection, url, geminiRequestPrefix(RECORDING_MIME_TYPE), GEMINI_REQUEST_SUFFIX, &extractor);
+    if (httpCode == HTTP_CODE_OK && extractor.finished() && extractor.text().length() > 0) {
+        Serial.printf("Live transcription ready %u ms after release\n", m_live->latency_ms());
+        // keep it until the recording is finished and comes round to be uploaded
+        m_live_path = filepath;
+        m_live_transcription = extractor.text();
+    } else {
+        Serial.printf("Live transcription failed (%d) - transcribing from the SD card instead\n", httpCode);
+    }
+}
+
+bool Application::processRecording(UploadEntry* entry)
 {
-    if (m_current_audio_file.length() > 0) {
-        Serial.printf("Processing audio file: %s\n", m_current_audio_file.c_str());
-        
+    const char* filepath = entry->path;
+    Serial.printf("Processing audio file: %s\n", filepath);
+
+    // pick up from wherever we got to last time
+    if (!(entry->state & UPLOAD_TELEGRAM_SENT)) {
         // First, send the audio file to Telegram
-        if (sendAudioFileToTelegram(m_current_audio_file.c_str())) {
-            // Then process it with Gemini API
-            processAudioFile(m_current_audio_file.c_str());
-            
-            // If we got a transcription, send it to Telegram
-            if (m_last_transcription.length() > 0) {
-                String message = "<b>📝 Transcription:</b>\n\n" + m_last_transcription;
-                sendMessageToTelegram(message);
+        if (!sendAudioFileToTelegram(filepath)) {
+            return false;
+        }
+        m_journal->mark(entry, UPLOAD_TELEGRAM_SENT);
+    }
+    if (!(entry->state & UPLOAD_TRANSCRIBED)) {
+        // the audio is out - a short one waits for the next few recordings so they can share its transcription request
+        unsigned long waited = millis() - entry->added_at;
+        if (waited < TRANSCRIPTION_BATCH_WINDOW_MS && isShortRecording(filepath)) {
+            m_journal->defer(entry, TRANSCRIPTION_BATCH_WINDOW_MS - waited);
+            return true;
+        }
+        // Then process it with Gemini API
+        if (!transcribeRecordings(entry)) {
+            return false;
+        }
+    } else {
+        m_last_transcription = m_journal->load_transcript(entry);
+    }
+    if (!(entry->state & UPLOAD_TRANSCRIPT_SENT)) {
+        // Finally send the transcription to Telegram
+        String message = "<b>📝 Transcription:</b>\n\n" + m_last_transcription;
+        if (!sendMessageToTelegram(message)) {
+            return false;
+        }
+        m_journal->mark(entry, UPLOAD_TRANSCRIPT_SENT);
+    }
+    m_journal->complete(entry);
+    return true;
+}
+
+void Application::printConnectionStats()
+{
+    for (int i = 0; i < m_connections->count(); i++)
+    {
+        HttpConnection& connection = m_connections->get(i);
+        if (connection.requests() > 0)
+        {
+            Serial.printf("%s: %u requests, %u handshakes averaging %u ms, requests averaging %u ms, longest %u ms\n",
+                          connection.host().c_str(), connection.requests(), connection.handshakes(),
+                          connection.average_handshake_ms(), connection.average_request_ms(), connection.max_request_ms());
+        }
+    }
+}
+
+// a recording straight from the recorder - trimmed and split into parts which are uploaded one by one
+void Application::addRecording(UploadEntry* entry)
+{
+    // the entry goes once the parts have taken its place
+    char filepath[UPLOAD_JOURNAL_MAX_PATH];
+    strlcpy(filepath, entry->path, sizeof(filepath));
+    if (m_trimmer)
+    {
+        // a live transcription is of the whole recording so it can be trimmed but not split
+        bool live = m_live_transcription.length() > 0 && m_live_path == filepath;
+        char paths[TRIM_MAX_SEGMENTS][SD_RECORDER_MAX_PATH];
+        int count = m_trimmer->process(filepath, !live, paths);
+        if (count == 0)
+        {
+            Serial.printf("%s is all silence - not uploading it\n", filepath);
+            m_journal->complete(entry);
+            return;
+        }
+        if (count > 0)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                addUpload(paths[i]);
+            }
+            // unless it was left where it was
+            if (!(entry->state & UPLOAD_TRIMMED))
+            {
+                m_journal->complete(entry);
             }
+            return;
+        }
+        // it couldn't be trimmed so send it as it is
+    }
+    addUpload(filepath);
+}
+
+void Application::addUpload(const char* filepath)
+{
+    UploadEntry* added = m_journal->add(filepath, UPLOAD_TRIMMED);
+    // it might have been transcribed while it was being recorded
+    if (added && m_live_transcription.length() > 0 && m_live_path == filepath)
+    {
+        if (m_journal->save_transcript(added, m_live_transcription))
+        {
+            m_journal->mark(added, UPLOAD_TRANSCRIBED);
         }
-        
-        m_current_audio_file = ""; // Clear current file
+        m_live_transcription = "";
     }
 }
 
-void Application::checkAndProcessNewAudioFile()
+// upload task - does all the network I/O for finished recordings
+void Application::uploadLoop()
 {
-    handleCurrentAudioFile(); // Process any pending file first
+    m_journal->begin();
+    UploadRequest request;
+    while (true)
+    {
+        m_connections->close_idle();
+        unsigned long wait_ms = 0;
+        UploadEntry* entry = m_journal->next(&wait_ms);
+        if (entry && wait_ms == 0)
+        {
+            if (entry->state == 0)
+            {
+                // nothing has been done with it yet
+                addRecording(entry);
+                continue;
+            }
+            if (!processRecording(entry))
+            {
+                m_journal->retry(entry);
+            }
+            printConnectionStats();
+        }
+        // pick up new recordings - waking up when the next retry is due or to close idle connections
+        TickType_t wait = entry ? pdMS_TO_TICKS(wait_ms) : portMAX_DELAY;
+        if (m_connections->has_open() && wait > pdMS_TO_TICKS(HTTP_IDLE_TIMEOUT_MS))
+        {
+            wait = pdMS_TO_TICKS(HTTP_IDLE_TIMEOUT_MS);
+        }
+        if (xQueueReceive(m_upload_queue, &request, wait) == pdTRUE)
+        {
+            // finished recordings are already in the journal so there's nothing more to do than wake up
+            if (request.live)
+            {
+                transcribeLive(request.path);
+            }
+        }
+    }
 }
 
 Application::~Application()
 {
     delete m_bot;
-    delete m_output_buffer;
+    delete m_mixer;
+    delete m_recorder;
+    delete m_journal;
+    delete m_connections;
+    delete m_live;
+    delete m_trimmer;
     delete m_input;
+    delete m_vad;
     delete m_output;
     delete m_transport;
     delete m_indicator_led;
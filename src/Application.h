@@ -5,62 +5,104 @@
 #include "SPI.h"
 #include <WiFi.h>
 #include <HTTPClient.h>
-#include <ArduinoJson.h>
 #include <WiFiClientSecure.h>
 #include <UniversalTelegramBot.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 
 using fs::File;  // Resolvendo ambiguidade do tipo File
 
 class Output;
 class I2SSampler;
+class VoiceActivityDetector;
 class Transport;
-class OutputBuffer;
+class StreamMixer;
 class IndicatorLed;
+class SdRecorder;
+class UploadJournal;
+class HttpConnectionManager;
+class LiveUpload;
+class RecordingTrimmer;
+struct UploadEntry;
 
 class Application
 {
 private:
     Output *m_output;
     I2SSampler *m_input;
+    VoiceActivityDetector *m_vad;
     Transport *m_transport;
     IndicatorLed *m_indicator_led;
-    OutputBuffer *m_output_buffer;
+    StreamMixer *m_mixer;
+    SdRecorder *m_recorder;
     bool m_sd_initialized;
     bool m_wifi_connected;
     String m_last_transcription;
     String m_current_audio_file;
+    // are we recording what we're hearing and who from?
+    bool m_recording_received = false;
+    uint8_t m_received_address[6];
     
     // Telegram bot components
     WiFiClientSecure m_client;
     UniversalTelegramBot* m_bot;
-    unsigned long m_last_bot_check;
-    const unsigned long m_bot_check_interval = 1000; // Check every second
+
+    // finished recordings waiting for the upload task - the audio loop never touches the network
+    QueueHandle_t m_upload_queue = NULL;
+    // what's left to upload - kept on the SD card so it survives failures and reboots
+    UploadJournal *m_journal;
+    // kept-alive connections to Telegram and Gemini - also owned by the upload task
+    HttpConnectionManager *m_connections;
+    // sends the recording to Gemini while the button is still held - NULL if that's turned off
+    LiveUpload *m_live;
+    // the transcription that came back and which recording it belongs to
+    String m_live_path;
+    String m_live_transcription;
+    // takes the silence out of finished recordings before they're uploaded - NULL if that's turned off
+    RecordingTrimmer *m_trimmer;
+
+    // longest the audio loop has gone between blocks of samples
+    unsigned long m_last_block_us = 0;
+    unsigned long m_max_loop_stall_us = 0;
     
     // SD Card functions
     bool initSDCard();
     void createAudioDirectory();
-    void writeWAVHeader(File* file, size_t length);
-    bool saveAudioToSD(const int16_t* samples, size_t length);
+    bool startRecording();
+    void saveAudioToSD(const int16_t* samples, size_t length);
+    void stopRecording();
+    void recordReceivedAudio(const int16_t* samples, int count);
+    void stopRecordingReceived();
     String getTimestampFilename();
 
     // Transcription functions
     bool initWiFi();
-    String readWAVFile(const char* filepath);
-    String transcribeAudio(const String& audioBase64);
-    String base64Encode(const uint8_t* data, size_t length);
+    String transcribeAudio(const char* filepath);
     void processAudioFile(const char* filepath);
+    bool transcribeRecordings(UploadEntry* entry);
+    void transcribeBatch(UploadEntry** batch, int count, String* transcripts);
     
     // Telegram functions
     bool initTelegramBot();
     bool sendAudioFileToTelegram(const char* filepath);
     bool sendMessageToTelegram(const String& message);
-    void checkAndProcessNewAudioFile();
-    void handleCurrentAudioFile();
+
+    // Upload functions
+    void queueUpload(const String& filepath, bool live = false);
+    void transcribeLive(const char* filepath);
+    void addRecording(UploadEntry* entry);
+    void addUpload(const char* filepath);
+    bool processRecording(UploadEntry* entry);
+    void printConnectionStats();
+
+    void resetLoopStall();
+    void trackLoopStall();
 
 public:
     Application();
     ~Application();
     void begin();
     void loop();
+    void uploadLoop();
     String getLastTranscription() { return m_last_transcription; }
 };
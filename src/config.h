@@ -18,7 +18,7 @@
 #define WAV_CHANNELS 1
 
 // API Settings
-#define MAX_AUDIO_SIZE (1024 * 1024)  // 1MB
+#define MAX_AUDIO_SIZE (14 * 1024 * 1024)  // 14MB - Gemini takes up to 20MB of inline data once it's base64 encoded
 #define MAX_JSON_SIZE 16384
 #define GEMINI_API_URL "https://generativelanguage.googleapis.com/v1/models/gemini-pro:generateContent"
 
@@ -27,9 +27,29 @@
 
 // Gemini API Settings
 #define GEMINI_API_URL "https://generativelanguage.googleapis.com/v1/models/gemini-pro:generateContent"
-#define MAX_AUDIO_SIZE 1024 * 1024  // 1MB maximum for audio file
+#define MAX_AUDIO_SIZE (14 * 1024 * 1024)  // 14MB maximum for audio file
 #define MAX_JSON_SIZE 16384         // 16KB for JSON responses
 
+// Telegram Settings
+// separates the parts of the multipart upload - must not appear anywhere in the audio file
+#define TELEGRAM_BOUNDARY "----WalkieTalkieAudioBoundary7MA4YWxkTrZu0gW"
+
+// Upload Settings
+// finished recordings that can wait for the upload task before new ones are skipped
+#define UPLOAD_QUEUE_LENGTH 8
+// recordings still to be uploaded and how far each one got
+#define UPLOAD_JOURNAL_FILE "/uploads.log"
+// send the audio to Gemini while the button is held so the transcription is ready soon after it's released -
+// it goes as WAV so this only works when recording to WAV
+#define USE_LIVE_TRANSCRIPTION
+// a short recording's audio goes straight out but its transcription waits this long for others to share the request
+#define TRANSCRIPTION_BATCH_WINDOW_MS 3000
+// most recordings in one request and the biggest that get batched - about 5 seconds of WAV
+#define TRANSCRIPTION_BATCH_MAX 4
+#define TRANSCRIPTION_BATCH_MAX_CLIP_BYTES (5 * WAV_SAMPLE_RATE * 2)
+// cut the silence off the ends of each recording and split long ones at long pauses before uploading them
+#define USE_RECORDING_TRIMMING
+
 // SD Card Settings
 #define SD_CS_PIN GPIO_NUM_15
 #define SD_MOSI_PIN GPIO_NUM_23
@@ -41,6 +61,22 @@
 #define WAV_SAMPLE_RATE 16000
 #define WAV_BITS_PER_SAMPLE 16
 #define WAV_CHANNELS 1
+// Record to FLAC instead of WAV - lossless, but roughly half the size on the card and to upload
+// #define USE_LOSSLESS_RECORDING
+#ifdef USE_LOSSLESS_RECORDING
+#define RECORDING_LOSSLESS true
+#define RECORDING_EXTENSION ".flac"
+#define RECORDING_MIME_TYPE "audio/flac"
+#else
+#define RECORDING_LOSSLESS false
+#define RECORDING_EXTENSION ".wav"
+#define RECORDING_MIME_TYPE "audio/wav"
+#endif
+// a power cut loses at most this much of the recording being made - lower means more writes to the card
+#define RECORDING_MAX_LOSS_MS 1000
+// a recording of received audio sticks with its sender until we've not heard from them for this long, then
+// a new one is started for whoever is talking
+#define RECORDING_SENDER_IDLE_MS 250
 
 // are you using an I2S microphone - comment this if you want to use an analog mic and ADC input
 // #define USE_I2S_MIC_INPUT
@@ -85,6 +121,18 @@
 #define TRANSPORT_HEADER_SIZE 0
 extern uint8_t transport_header[TRANSPORT_HEADER_SIZE];
 
+// How many samples to put in each transport packet - smaller packets mean lower latency but more packets on air
+// 160 samples is 10ms at 16kHz, about 55ms mouth-to-ear on a good link - 320 halves the packet rate but adds 16ms
+#define TRANSPORT_FRAME_SIZE 160
+
+// Send an XOR parity frame after this many audio frames so a receiver can rebuild any single lost frame in the group.
+// 4 costs 25% extra airtime, 8 costs 12.5% - set to 0 to turn parity frames off
+#define TRANSPORT_FEC_GROUP_SIZE 5
+
+// Stop sending audio while nobody is talking and just send the occasional comfort noise frame instead - saves airtime
+// on a shared channel. Comment this out to send every sample while the transmit button is pushed
+#define USE_VOICE_ACTIVITY_DETECTION
+
 
 // i2s config for using the internal ADC
 extern i2s_config_t i2s_adc_config;
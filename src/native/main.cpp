@@ -0,0 +1,229 @@
+// Runs the audio pipeline on the host - one device talks into a WAV file, another plays what it hears
+// into a WAV file, and we report how much CPU each block of audio took. Build with `pio run -e native`.
+// The tests build the rest of src with their own mains so this is left out of them.
+#ifndef PIO_UNIT_TESTING
+#include <Arduino.h>
+#include <SD.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "NativeDevice.h"
+#include "I2SMEMSSampler.h"
+#include "VoiceActivityDetector.h"
+#include "I2SOutput.h"
+#include "UdpTransport.h"
+#include "OutputBuffer.h"
+#include "JitterBuffer.h"
+#include "StreamMixer.h"
+#include "SdRecorder.h"
+#include "config.h"
+
+// samples the application loops work on at a time
+#define BLOCK_SIZE 128
+// keep listening for a bit after the talker has finished so the end comes out of the jitter buffer
+#define LISTEN_TAIL_MS 500
+
+// how long each block took to process, not counting waiting for I2S
+class BlockTimes
+{
+private:
+  std::vector<unsigned long> m_times;
+
+public:
+  void add(unsigned long us) { m_times.push_back(us); }
+  void print(const char *name)
+  {
+    if (m_times.empty())
+    {
+      return;
+    }
+    std::vector<unsigned long> sorted(m_times);
+    std::sort(sorted.begin(), sorted.end());
+    unsigned long total = 0;
+    for (unsigned long time : sorted)
+    {
+      total += time;
+    }
+    // this is how long we've got before the next block arrives
+    float budget = 1000000.0f * BLOCK_SIZE / SAMPLE_RATE;
+    float mean = (float)total / sorted.size();
+    Serial.printf("%s: %u blocks, mean %.1f us (%.2f%% of the %.0f us budget), p99 %lu us, max %lu us\n",
+                  name, (unsigned)sorted.size(), mean, 100.0f * mean / budget, budget,
+                  sorted[sorted.size() * 99 / 100], sorted.back());
+  }
+};
+
+// a few seconds of voice-like bursts with pauses in between for when we're not given anything to say
+static bool make_test_input(const char *path)
+{
+  FILE *file = fopen(path, "wb");
+  if (!file)
+  {
+    Serial.printf("Failed to create %s\n", path);
+    return false;
+  }
+  const int bursts = 3;
+  const int burst_samples = SAMPLE_RATE * 6 / 5;
+  const int pause_samples = SAMPLE_RATE * 4 / 5;
+  uint8_t header[WAV_HEADER_SIZE];
+  SdRecorder::make_wav_header(header, SAMPLE_RATE, bursts * (burst_samples + pause_samples) * sizeof(int16_t));
+  fwrite(header, 1, sizeof(header), file);
+  uint32_t noise = 1;
+  for (int burst = 0; burst < bursts; burst++)
+  {
+    for (int i = 0; i < burst_samples + pause_samples; i++)
+    {
+      float t = (float)i / SAMPLE_RATE;
+      noise = noise * 1664525 + 1013904223;
+      float sample = ((int32_t)noise >> 24) * 2.0f;
+      if (i < burst_samples)
+      {
+        // a 140Hz voice with a few harmonics and four syllables a second
+        float voice = 0;
+        for (int harmonic = 1; harmonic <= 5; harmonic++)
+        {
+          voice += sinf(2 * M_PI * 140 * harmonic * t) / harmonic;
+        }
+        sample += 6000 * voice * (0.6f - 0.4f * cosf(2 * M_PI * 4 * t));
+      }
+      int16_t value = sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample);
+      fwrite(&value, sizeof(value), 1, file);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static long peak_rss_kb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+int main(int argc, char **argv)
+{
+  const char *input_path = argc > 1 ? argv[1] : "native_input.wav";
+  const char *output_path = argc > 2 ? argv[2] : "native_output.wav";
+  if (argc <= 1 && !make_test_input(input_path))
+  {
+    return 1;
+  }
+
+  // the talker sends what's in the input file
+  NativeDevice talker("talker");
+  talker.select();
+  talker.set_i2s_input(I2S_NUM_0, input_path);
+  SD.begin(SD_CS_PIN);
+  SD.mkdir(AUDIO_FOLDER);
+  SdRecorder *recorder = new SdRecorder(SD, talker.sd_path("").c_str());
+  recorder->begin();
+  StreamMixer *talker_mixer = new StreamMixer(200 * 16, SAMPLE_RATE);
+  I2SSampler *input = new I2SMEMSSampler(I2S_NUM_0, i2s_mic_pins, i2s_mic_Config, BLOCK_SIZE);
+  VoiceActivityDetector *vad = new VoiceActivityDetector();
+  Transport *talker_transport = new UdpTransport(talker_mixer);
+  talker_transport->set_header(TRANSPORT_HEADER_SIZE, transport_header);
+  talker_transport->set_frame_size(TRANSPORT_FRAME_SIZE);
+  talker_transport->set_fec_group_size(TRANSPORT_FEC_GROUP_SIZE);
+  talker_transport->begin();
+
+  // the listener plays everything it hears into the output file
+  NativeDevice listener("listener");
+  listener.select();
+  listener.set_i2s_output(I2S_NUM_0, output_path);
+  StreamMixer *mixer = new StreamMixer(200 * 16, SAMPLE_RATE);
+  Output *output = new I2SOutput(I2S_NUM_0, i2s_speaker_pins);
+  Transport *listener_transport = new UdpTransport(mixer);
+  listener_transport->set_header(TRANSPORT_HEADER_SIZE, transport_header);
+  listener_transport->set_frame_size(TRANSPORT_FRAME_SIZE);
+  listener_transport->set_fec_group_size(TRANSPORT_FEC_GROUP_SIZE);
+  listener_transport->begin();
+  output->start(SAMPLE_RATE);
+  mixer->flush();
+  NativeDevice::deselect();
+
+  BlockTimes talker_times;
+  BlockTimes listener_times;
+  std::atomic<bool> talking(true);
+
+  // the same as the transmit half of Application::loop
+  std::thread talk([&]()
+                   {
+                     talker.select();
+                     int16_t samples[BLOCK_SIZE];
+                     input->start();
+                     vad->reset();
+                     recorder->start(AUDIO_FOLDER "/talker" RECORDING_EXTENSION, WAV_SAMPLE_RATE, RECORDING_LOSSLESS);
+                     while (!talker.i2s_input_finished(I2S_NUM_0))
+                     {
+                       int samples_read = input->read(samples, BLOCK_SIZE);
+                       unsigned long start = micros();
+                       if (samples_read > 0)
+                       {
+                         recorder->write(samples, samples_read * sizeof(int16_t));
+                         if (!vad->is_speech(samples, samples_read))
+                         {
+                           talker_transport->add_silence(samples_read, vad->noise_level());
+                         }
+                         else
+                         {
+                           talker_transport->add_samples(samples, samples_read);
+                         }
+                       }
+                       talker_times.add(micros() - start);
+                     }
+                     talker_transport->flush();
+                     recorder->stop();
+                     input->stop();
+                     talking = false;
+                   });
+
+  // and the receive half
+  std::thread listen([&]()
+                     {
+                       listener.select();
+                       int16_t samples[BLOCK_SIZE];
+                       unsigned long finished = 0;
+                       while (talking || millis() - finished < LISTEN_TAIL_MS)
+                       {
+                         if (talking)
+                         {
+                           finished = millis();
+                         }
+                         unsigned long start = micros();
+                         mixer->remove_samples(samples, BLOCK_SIZE);
+                         listener_times.add(micros() - start);
+                         output->write(samples, BLOCK_SIZE);
+                       }
+                       output->stop();
+                     });
+
+  talk.join();
+  listen.join();
+
+  Serial.printf("Talker dropped %llu input samples, sent %d fewer bytes with discontinuous transmission\n",
+                (unsigned long long)talker.i2s_input_dropped(I2S_NUM_0), talker_transport->dtx_saved_bytes());
+  talker_times.print("Transmit");
+  listener_times.print("Receive");
+  Serial.printf("Recovered %u frames, dropped %u packets, ignored %u senders\n",
+                listener_transport->fec_recovered(), listener_transport->receive_dropped(), mixer->rejected());
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    if (mixer->is_active(i))
+    {
+      OutputBuffer *output_buffer = mixer->output_buffer(i);
+      JitterBuffer *jitter_buffer = output_buffer->jitter_buffer();
+      Serial.printf("Received %u frames, lost %u, late %u, duplicate %u, jitter %d samples, target depth %d samples, underruns %u\n",
+                    jitter_buffer->received(), jitter_buffer->lost(), jitter_buffer->late(), jitter_buffer->duplicate(),
+                    jitter_buffer->jitter(), output_buffer->target_depth(), output_buffer->underruns());
+    }
+  }
+  Serial.printf("Peak memory %ld KB\n", peak_rss_kb());
+  listener.finish_i2s(I2S_NUM_0);
+  Serial.printf("Wrote what the listener heard to %s\n", output_path);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,396 @@
+// Plays the same talker through a set of simulated bad channels and scores what the listener hears -
+// mouth-to-ear latency, underruns and a segmental SNR. Everything follows from the seed so two runs
+// with the same seed print exactly the same numbers. Build with `pio run -e native_sim`.
+//
+//   program [seed] [scenario]
+#include <Arduino.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "NativeDevice.h"
+#include "Output.h"
+#include "VoiceActivityDetector.h"
+#include "OutputBuffer.h"
+#include "JitterBuffer.h"
+#include "StreamMixer.h"
+#include "RadioChannel.h"
+#include "SimTransport.h"
+#include "config.h"
+
+// samples the application loops work on at a time
+#define BLOCK_SIZE 128
+#define BLOCK_US (1000000 * BLOCK_SIZE / SAMPLE_RATE)
+// what's left in I2SOutput's DMA buffers when a block is written - the speaker plays it this much later
+#define OUTPUT_DMA_SAMPLES (OUTPUT_DMA_BUFFER_COUNT * OUTPUT_DMA_BUFFER_LENGTH)
+// ESP-NOW's biggest frame
+#define SIM_PACKET_SIZE 250
+// how long the talker talks for and how long we keep listening after they stop
+#define TALK_MS 12000
+#define TAIL_MS 1500
+// windows of the talker's speech we compare with what the listener played
+#define SCORE_WINDOW 640
+#define SCORE_HOP 320
+// longest delay we look for, the quietest window that counts as speech and how alike a window
+// has to be to count as heard
+#define SCORE_MAX_LAG (SAMPLE_RATE * 3 / 4)
+#define SCORE_MIN_RMS 500
+#define SCORE_MIN_CORRELATION 0.7f
+// per window SNR limits - the usual range for segmental SNR
+#define SCORE_MAX_SNR 35.0f
+
+struct Scenario
+{
+  const char *name;
+  RadioChannelConfig channel;
+  // other walkie-talkies on the channel talking to their own group the whole time
+  int interferers;
+};
+
+// a tiny generator for the test signals so they're the same everywhere
+class Random
+{
+private:
+  uint32_t m_state;
+
+public:
+  Random(uint32_t seed) : m_state(seed * 2654435761u + 1) {}
+  uint32_t next()
+  {
+    m_state = m_state * 1664525 + 1013904223;
+    return m_state;
+  }
+  // -1 to 1
+  float uniform() { return (int32_t)next() * (1.0f / 2147483648.0f); }
+};
+
+// voice-like talk spurts with pauses in between - a wandering pitch plus breath noise so no
+// two windows look alike, which the latency measurement depends on
+static std::vector<int16_t> make_speech(uint32_t seed)
+{
+  Random random(seed);
+  std::vector<int16_t> samples(SAMPLE_RATE * TALK_MS / 1000);
+  size_t i = 0;
+  float phase = 0;
+  float pitch = 140;
+  float noise = 0;
+  while (i < samples.size())
+  {
+    size_t talk = SAMPLE_RATE * (1000 + random.next() % 1500) / 1000;
+    size_t pause = SAMPLE_RATE * (300 + random.next() % 900) / 1000;
+    for (size_t j = 0; j < talk + pause && i < samples.size(); j++, i++)
+    {
+      float sample = 50 * random.uniform();
+      if (j < talk)
+      {
+        pitch += random.uniform() * 2;
+        pitch = pitch < 90 ? 90 : (pitch > 200 ? 200 : pitch);
+        phase += 2 * M_PI * pitch / SAMPLE_RATE;
+        float voice = 0;
+        for (int harmonic = 1; harmonic <= 6; harmonic++)
+        {
+          voice += sinf(harmonic * phase) / harmonic;
+        }
+        noise = 0.7f * noise + 0.3f * random.uniform();
+        // syllables about four times a second
+        float t = (float)j / SAMPLE_RATE;
+        float envelope = 0.55f - 0.45f * cosf(2 * M_PI * 4 * t);
+        sample += envelope * (3000 * voice + 9000 * noise);
+      }
+      samples[i] = sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample);
+    }
+  }
+  return samples;
+}
+
+struct Result
+{
+  std::vector<int16_t> heard;
+  uint32_t underruns = 0;
+  uint32_t received = 0;
+  uint32_t lost = 0;
+  uint32_t late = 0;
+  uint32_t duplicate = 0;
+  uint32_t recovered = 0;
+};
+
+static Result run(const Scenario &scenario, const std::vector<int16_t> &speech, RadioChannel &channel)
+{
+  const uint8_t group_header[] = {0x57};
+  const uint8_t other_header[] = {0x58};
+  uint8_t address[PACKET_ADDRESS_SIZE] = {0x02, 0, 0, 0, 0, 1};
+
+  // the talker and the listener are in the same group
+  StreamMixer talker_mixer(200 * 16, SAMPLE_RATE);
+  SimTransport talker(&talker_mixer, &channel, SIM_PACKET_SIZE, address);
+  address[5]++;
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  SimTransport listener(&mixer, &channel, SIM_PACKET_SIZE, address);
+  std::vector<SimTransport *> transports = {&talker, &listener};
+  // everyone else just uses up airtime
+  std::vector<StreamMixer *> other_mixers;
+  for (int i = 0; i < scenario.interferers; i++)
+  {
+    address[5]++;
+    other_mixers.push_back(new StreamMixer(200 * 16, SAMPLE_RATE));
+    transports.push_back(new SimTransport(other_mixers.back(), &channel, SIM_PACKET_SIZE, address));
+  }
+  for (size_t i = 0; i < transports.size(); i++)
+  {
+    transports[i]->set_header(sizeof(group_header), i < 2 ? group_header : other_header);
+    transports[i]->set_frame_size(TRANSPORT_FRAME_SIZE);
+    transports[i]->set_fec_group_size(TRANSPORT_FEC_GROUP_SIZE);
+    transports[i]->begin();
+  }
+
+  VoiceActivityDetector vad;
+  Random noise(scenario.channel.seed);
+  int16_t samples[BLOCK_SIZE];
+  int talk_blocks = speech.size() / BLOCK_SIZE;
+  int blocks = talk_blocks + 1 + TAIL_MS * 1000 / BLOCK_US;
+  Result result;
+  result.heard.resize(blocks * BLOCK_SIZE);
+  for (int block = 0; block < blocks; block++)
+  {
+    uint64_t now = (uint64_t)block * BLOCK_US;
+    // everything that arrived since the last block - the receive side sees the real arrival times
+    while (channel.next_delivery() <= now)
+    {
+      native_set_clock(channel.next_delivery());
+      channel.deliver_next(now);
+    }
+    native_set_clock(now);
+    channel.set_time(now);
+    // what the receive task does when it's waiting for packets
+    listener.poll();
+    // take turns at going first so the talker doesn't always get on air before everyone else
+    int senders = 1 + scenario.interferers;
+    for (int turn = 0; turn < senders; turn++)
+    {
+      int sender = (block + turn) % senders;
+      if (sender > 0)
+      {
+        for (int j = 0; j < BLOCK_SIZE; j++)
+        {
+          samples[j] = 4000 * noise.uniform();
+        }
+        transports[sender + 1]->add_samples(samples, BLOCK_SIZE);
+        continue;
+      }
+      // the block captured over the last 8ms is ready
+      if (block < 1 || block > talk_blocks)
+      {
+        continue;
+      }
+      const int16_t *captured = &speech[(block - 1) * BLOCK_SIZE];
+      if (block == 1)
+      {
+        vad.reset();
+      }
+      if (vad.is_speech(captured, BLOCK_SIZE))
+      {
+        talker.add_samples(captured, BLOCK_SIZE);
+      }
+      else
+      {
+        talker.add_silence(BLOCK_SIZE, vad.noise_level());
+      }
+      if (block == talk_blocks)
+      {
+        talker.flush();
+      }
+    }
+    mixer.remove_samples(&result.heard[block * BLOCK_SIZE], BLOCK_SIZE);
+  }
+
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    if (mixer.is_active(i))
+    {
+      OutputBuffer *output_buffer = mixer.output_buffer(i);
+      JitterBuffer *jitter_buffer = output_buffer->jitter_buffer();
+      result.underruns += output_buffer->underruns();
+      result.received += jitter_buffer->received();
+      result.lost += jitter_buffer->lost();
+      result.late += jitter_buffer->late();
+      result.duplicate += jitter_buffer->duplicate();
+    }
+  }
+  result.recovered = listener.fec_recovered();
+  for (size_t i = 2; i < transports.size(); i++)
+  {
+    delete transports[i];
+  }
+  for (StreamMixer *other_mixer : other_mixers)
+  {
+    delete other_mixer;
+  }
+  return result;
+}
+
+// normalised correlation of a window of speech with what was heard lag samples later, every step samples
+static float correlation(const std::vector<int16_t> &speech, const std::vector<int16_t> &heard, size_t start, size_t lag, int step)
+{
+  double xy = 0, xx = 0, yy = 0;
+  for (size_t i = start; i < start + SCORE_WINDOW; i += step)
+  {
+    double x = speech[i];
+    double y = heard[i + lag];
+    xy += x * y;
+    xx += x * x;
+    yy += y * y;
+  }
+  return xx > 0 && yy > 0 ? xy / sqrt(xx * yy) : 0;
+}
+
+static float percentile(std::vector<float> &values, int percent)
+{
+  return values[(values.size() - 1) * percent / 100];
+}
+
+static void score(const Scenario &scenario, const std::vector<int16_t> &speech, const Result &result, RadioChannel &channel)
+{
+  std::vector<float> latencies;
+  double snr_total = 0;
+  int windows = 0;
+  for (size_t start = 0; start + SCORE_WINDOW <= speech.size(); start += SCORE_HOP)
+  {
+    double energy = 0;
+    for (size_t i = start; i < start + SCORE_WINDOW; i++)
+    {
+      energy += (double)speech[i] * speech[i];
+    }
+    if (sqrt(energy / SCORE_WINDOW) < SCORE_MIN_RMS || start + SCORE_WINDOW + SCORE_MAX_LAG > result.heard.size())
+    {
+      continue;
+    }
+    // look for it every 4th sample then close in on the best match
+    size_t best_lag = 0;
+    float best = -1;
+    for (size_t lag = 0; lag < SCORE_MAX_LAG; lag += 4)
+    {
+      float value = correlation(speech, result.heard, start, lag, 4);
+      if (value > best)
+      {
+        best = value;
+        best_lag = lag;
+      }
+    }
+    size_t from = best_lag > 4 ? best_lag - 4 : 0;
+    best = -1;
+    for (size_t lag = from; lag <= from + 8; lag++)
+    {
+      float value = correlation(speech, result.heard, start, lag, 1);
+      if (value > best)
+      {
+        best = value;
+        best_lag = lag;
+      }
+    }
+    // with the best gain the error is what the correlation doesn't explain
+    float snr = best > 0 ? -10 * log10f(std::max(1.0f - best * best, 1e-6f)) : 0;
+    snr_total += std::min(snr, SCORE_MAX_SNR);
+    windows++;
+    if (best >= SCORE_MIN_CORRELATION)
+    {
+      latencies.push_back(1000.0f * (best_lag + OUTPUT_DMA_SAMPLES) / SAMPLE_RATE);
+    }
+  }
+  // a fingerprint of everything the listener played - any change to the pipeline shows up here
+  uint32_t checksum = 2166136261u;
+  for (int16_t sample : result.heard)
+  {
+    checksum = (checksum ^ (uint16_t)sample) * 16777619u;
+  }
+
+  Serial.printf("%s: sent %u frames, %u dropped waiting for air, %u lost, %u reordered, %u duplicated, channel %.0f%% busy\n",
+                scenario.name, channel.sent(), channel.congestion_drops(), channel.lost(), channel.reordered(),
+                channel.duplicated(), 100 * channel.utilisation());
+  Serial.printf("  received %u frames, lost %u, late %u, duplicate %u, recovered %u, underruns %u\n",
+                result.received, result.lost, result.late, result.duplicate, result.recovered, result.underruns);
+  if (!latencies.empty())
+  {
+    std::sort(latencies.begin(), latencies.end());
+    Serial.printf("  mouth-to-ear ms: min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+                  latencies.front(), percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), latencies.back());
+  }
+  Serial.printf("  segmental SNR %.1f dB, %.1f%% of speech heard, checksum %08x\n",
+                windows ? snr_total / windows : 0, windows ? 100.0f * latencies.size() / windows : 0, checksum);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;
+  const char *only = argc > 2 ? argv[2] : NULL;
+
+  std::vector<Scenario> scenarios;
+  Scenario scenario;
+  scenario.interferers = 0;
+  scenario.channel.seed = seed;
+  scenario.name = "clean";
+  scenario.channel.jitter_us = 500;
+  scenarios.push_back(scenario);
+
+  scenario.name = "random_loss";
+  scenario.channel.loss_good = 0.05f;
+  scenarios.push_back(scenario);
+
+  // about the same average loss but in bursts of around five frames
+  scenario.name = "burst_loss";
+  scenario.channel.loss_good = 0;
+  scenario.channel.good_to_bad = 0.012f;
+  scenario.channel.bad_to_good = 0.2f;
+  scenario.channel.loss_bad = 0.85f;
+  scenarios.push_back(scenario);
+
+  scenario.name = "jitter";
+  scenario.channel = RadioChannelConfig();
+  scenario.channel.seed = seed;
+  scenario.channel.jitter_us = 15000;
+  scenarios.push_back(scenario);
+
+  scenario.name = "reorder_duplicate";
+  scenario.channel.jitter_us = 2000;
+  scenario.channel.reorder = 0.05f;
+  scenario.channel.duplicate = 0.03f;
+  scenarios.push_back(scenario);
+
+  scenario.name = "busy_channel";
+  scenario.channel = RadioChannelConfig();
+  scenario.channel.seed = seed;
+  scenario.channel.jitter_us = 1000;
+  scenario.interferers = 6;
+  scenarios.push_back(scenario);
+
+  scenario.name = "saturated_channel";
+  scenario.channel.bitrate = 500000;
+  scenario.interferers = 8;
+  scenarios.push_back(scenario);
+
+  scenario.name = "field";
+  scenario.channel = RadioChannelConfig();
+  scenario.channel.seed = seed;
+  scenario.channel.jitter_us = 8000;
+  scenario.channel.good_to_bad = 0.01f;
+  scenario.channel.bad_to_good = 0.25f;
+  scenario.channel.loss_bad = 0.7f;
+  scenario.channel.loss_good = 0.01f;
+  scenario.channel.reorder = 0.02f;
+  scenario.channel.duplicate = 0.01f;
+  scenario.interferers = 3;
+  scenarios.push_back(scenario);
+
+  std::vector<int16_t> speech = make_speech(seed);
+  Serial.printf("Seed %u, %d ms frames, FEC group %d\n", seed, TRANSPORT_FRAME_SIZE * 1000 / SAMPLE_RATE, TRANSPORT_FEC_GROUP_SIZE);
+  for (const Scenario &scenario : scenarios)
+  {
+    if (only && strcmp(only, scenario.name) != 0)
+    {
+      continue;
+    }
+    RadioChannel channel(scenario.channel);
+    Result result = run(scenario, speech, channel);
+    score(scenario, speech, result, channel);
+  }
+  return 0;
+}
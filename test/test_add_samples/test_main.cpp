@@ -0,0 +1,123 @@
+// Compares handing the transport a block of samples at a time with handing it one sample at a
+// time - run with `pio test -e native -f test_add_samples`
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "Transport.h"
+#include "StreamMixer.h"
+
+#define SAMPLE_RATE 16000
+#define FRAME_SIZE 160
+// what the application loop reads from the microphone in one go
+#define BLOCK_SIZE 128
+#define BENCHMARK_SECONDS 60
+#define PACKET_SIZE 250
+
+static const uint8_t header[] = {0x57};
+
+// counts the packets and checksums what's in them
+class CountingTransport : public Transport
+{
+protected:
+  void send(const uint8_t *data, int length) override
+  {
+    packets++;
+    bytes += length;
+    for (int i = 0; i < length; i++)
+    {
+      checksum = checksum * 31 + data[i];
+    }
+  }
+
+public:
+  int packets = 0;
+  int bytes = 0;
+  uint32_t checksum = 0;
+
+  CountingTransport(StreamMixer *mixer) : Transport(mixer, PACKET_SIZE)
+  {
+    set_header(sizeof(header), header);
+    set_frame_size(FRAME_SIZE);
+  }
+  bool begin() override { return true; }
+};
+
+static void make_voice(std::vector<int16_t> &samples)
+{
+  uint32_t noise = 1;
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    float t = (float)i / SAMPLE_RATE;
+    noise = noise * 1664525 + 1013904223;
+    samples[i] = 8000 * sinf(2 * M_PI * 140 * t) + ((int32_t)noise >> 22);
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_block_and_sample_paths_match()
+{
+  std::vector<int16_t> samples(SAMPLE_RATE);
+  make_voice(samples);
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  CountingTransport by_block(&mixer);
+  CountingTransport by_sample(&mixer);
+  for (size_t i = 0; i + BLOCK_SIZE <= samples.size(); i += BLOCK_SIZE)
+  {
+    by_block.add_samples(&samples[i], BLOCK_SIZE);
+    for (int j = 0; j < BLOCK_SIZE; j++)
+    {
+      by_sample.add_sample(samples[i + j]);
+    }
+  }
+  // packets only go out at frame edges whichever way the samples come in
+  TEST_ASSERT_EQUAL(samples.size() / FRAME_SIZE, by_block.packets);
+  TEST_ASSERT_EQUAL(by_sample.packets, by_block.packets);
+  TEST_ASSERT_EQUAL(by_sample.bytes, by_block.bytes);
+  TEST_ASSERT_EQUAL_HEX32(by_sample.checksum, by_block.checksum);
+}
+
+void test_benchmark()
+{
+  std::vector<int16_t> samples(SAMPLE_RATE * BENCHMARK_SECONDS);
+  make_voice(samples);
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  CountingTransport by_block(&mixer);
+  CountingTransport by_sample(&mixer);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i + BLOCK_SIZE <= samples.size(); i += BLOCK_SIZE)
+  {
+    by_block.add_samples(&samples[i], BLOCK_SIZE);
+  }
+  auto block_end = std::chrono::steady_clock::now();
+  for (size_t i = 0; i + BLOCK_SIZE <= samples.size(); i += BLOCK_SIZE)
+  {
+    for (int j = 0; j < BLOCK_SIZE; j++)
+    {
+      by_sample.add_sample(samples[i + j]);
+    }
+  }
+  auto sample_end = std::chrono::steady_clock::now();
+
+  double block_ns = std::chrono::duration<double, std::nano>(block_end - start).count() / samples.size();
+  double sample_ns = std::chrono::duration<double, std::nano>(sample_end - block_end).count() / samples.size();
+  char message[120];
+  snprintf(message, sizeof(message), "blocks of %d: %.2f ns per sample, one at a time: %.2f ns per sample (%.1fx)",
+           BLOCK_SIZE, block_ns, sample_ns, sample_ns / block_ns);
+  TEST_MESSAGE(message);
+  // both have to be nowhere near real time - the checksums stop the work being optimised away
+  TEST_ASSERT_EQUAL_HEX32(by_sample.checksum, by_block.checksum);
+  TEST_ASSERT_LESS_THAN(1000000000.0 / SAMPLE_RATE / 100, block_ns);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_block_and_sample_paths_match);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
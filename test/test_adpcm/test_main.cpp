@@ -0,0 +1,153 @@
+// IMA-ADPCM round trips and encode/decode throughput - run with `pio test -e native -f test_adpcm`
+#include <Arduino.h>
+#include <unity.h>
+#include "AdpcmCodec.h"
+
+#define SAMPLE_RATE 16000
+// one second of audio
+#define SAMPLE_COUNT 16000
+// the samples in a full ESP-NOW packet
+#define PACKET_SAMPLES 320
+#define BENCHMARK_SECONDS 20
+
+static int16_t input[SAMPLE_COUNT];
+static int16_t output[SAMPLE_COUNT];
+static uint8_t packets[SAMPLE_COUNT / PACKET_SAMPLES][ADPCM_STATE_SIZE + PACKET_SAMPLES / 2];
+
+void setUp()
+{
+  // a 140Hz voice with a few harmonics and a little noise
+  uint32_t noise = 1;
+  for (int i = 0; i < SAMPLE_COUNT; i++)
+  {
+    float t = (float)i / SAMPLE_RATE;
+    float voice = 0;
+    for (int harmonic = 1; harmonic <= 5; harmonic++)
+    {
+      voice += sinf(2 * M_PI * 140 * harmonic * t) / harmonic;
+    }
+    noise = noise * 1664525 + 1013904223;
+    input[i] = 8000 * voice + ((int32_t)noise >> 24);
+  }
+}
+
+void tearDown() {}
+
+// encode everything into packets the way Transport does - state first then two codes to a byte
+static void encode_packets(AdpcmEncoder &encoder)
+{
+  for (int packet = 0; packet < SAMPLE_COUNT / PACKET_SAMPLES; packet++)
+  {
+    encoder.write_state(packets[packet]);
+    uint8_t *codes = packets[packet] + ADPCM_STATE_SIZE;
+    const int16_t *samples = input + packet * PACKET_SAMPLES;
+    for (int i = 0; i < PACKET_SAMPLES; i += 2)
+    {
+      uint8_t low = encoder.encode(samples[i]);
+      uint8_t high = encoder.encode(samples[i + 1]);
+      codes[i / 2] = low | (high << 4);
+    }
+  }
+}
+
+static int decode_packets(AdpcmDecoder &decoder)
+{
+  int count = 0;
+  for (int packet = 0; packet < SAMPLE_COUNT / PACKET_SAMPLES; packet++)
+  {
+    count += decoder.decode(packets[packet], sizeof(packets[packet]), output + count, SAMPLE_COUNT - count);
+  }
+  return count;
+}
+
+static float snr_db(const int16_t *reference, const int16_t *decoded, int count)
+{
+  double signal = 0;
+  double error = 0;
+  for (int i = 0; i < count; i++)
+  {
+    signal += (double)reference[i] * reference[i];
+    error += (double)(reference[i] - decoded[i]) * (reference[i] - decoded[i]);
+  }
+  return 10 * log10(signal / (error + 1));
+}
+
+void test_round_trip()
+{
+  AdpcmEncoder encoder;
+  AdpcmDecoder decoder;
+  encode_packets(encoder);
+  TEST_ASSERT_EQUAL(SAMPLE_COUNT, decode_packets(decoder));
+  // skip the first few ms while the step size adapts
+  float snr = snr_db(input + 160, output + 160, SAMPLE_COUNT - 160);
+  char message[64];
+  snprintf(message, sizeof(message), "SNR %.1f dB", snr);
+  TEST_MESSAGE(message);
+  // the old 8 bit truncation managed about 48dB on a full scale signal and much less on quiet speech
+  TEST_ASSERT_GREATER_THAN(25, (int)snr);
+}
+
+void test_lost_packet_does_not_affect_the_next()
+{
+  AdpcmEncoder encoder;
+  AdpcmDecoder decoder;
+  encode_packets(encoder);
+  int16_t in_order[PACKET_SAMPLES];
+  int16_t on_its_own[PACKET_SAMPLES];
+  decoder.decode(packets[3], sizeof(packets[3]), output, PACKET_SAMPLES);
+  decoder.decode(packets[4], sizeof(packets[4]), in_order, PACKET_SAMPLES);
+  // decode packet 4 without having seen any of the ones before it
+  AdpcmDecoder fresh;
+  TEST_ASSERT_EQUAL(PACKET_SAMPLES, fresh.decode(packets[4], sizeof(packets[4]), on_its_own, PACKET_SAMPLES));
+  TEST_ASSERT_EQUAL_INT16_ARRAY(in_order, on_its_own, PACKET_SAMPLES);
+}
+
+void test_odd_count()
+{
+  AdpcmEncoder encoder;
+  AdpcmDecoder decoder;
+  uint8_t packet[ADPCM_STATE_SIZE + 2];
+  encoder.write_state(packet, ADPCM_FLAG_ODD_COUNT);
+  packet[ADPCM_STATE_SIZE] = encoder.encode(1000) | (encoder.encode(2000) << 4);
+  packet[ADPCM_STATE_SIZE + 1] = encoder.encode(3000);
+  int16_t samples[4];
+  TEST_ASSERT_EQUAL(3, decoder.decode(packet, sizeof(packet), samples, 4));
+  // too short to hold any samples
+  TEST_ASSERT_EQUAL(0, decoder.decode(packet, ADPCM_STATE_SIZE, samples, 4));
+}
+
+void test_benchmark()
+{
+  AdpcmEncoder encoder;
+  AdpcmDecoder decoder;
+  unsigned long start = micros();
+  for (int i = 0; i < BENCHMARK_SECONDS; i++)
+  {
+    encode_packets(encoder);
+  }
+  unsigned long encode_us = micros() - start;
+  start = micros();
+  for (int i = 0; i < BENCHMARK_SECONDS; i++)
+  {
+    decode_packets(decoder);
+  }
+  unsigned long decode_us = micros() - start;
+  char message[128];
+  float samples = (float)BENCHMARK_SECONDS * SAMPLE_COUNT;
+  snprintf(message, sizeof(message), "encode %.1f Msamples/s (%.2f ns/sample), decode %.1f Msamples/s (%.2f ns/sample)",
+           samples / encode_us, 1000.0f * encode_us / samples, samples / decode_us, 1000.0f * decode_us / samples);
+  TEST_MESSAGE(message);
+  // anything close to real time on a PC would be hopeless on the ESP32
+  TEST_ASSERT_LESS_THAN(BENCHMARK_SECONDS * 1000000UL / 100, encode_us);
+  TEST_ASSERT_LESS_THAN(BENCHMARK_SECONDS * 1000000UL / 100, decode_us);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_lost_packet_does_not_affect_the_next);
+  RUN_TEST(test_odd_count);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
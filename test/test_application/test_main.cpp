@@ -0,0 +1,392 @@
+// Runs the real Application on a host device - the button is a pin the test presses, the microphone reads a
+// WAV file and Telegram and Gemini are local stand-ins - then checks what gets uploaded for a recording,
+// that short ones go to Telegram straight away and share a transcription request but only once they've been
+// trimmed, and how long after the button is released everything goes - run with
+// `pio test -e native -f test_application`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "NativeDevice.h"
+#include "NativeHttpServer.h"
+#include "SdRecorder.h"
+#include "RecordingTrimmer.h"
+#include "Application.h"
+#include "config.h"
+
+#define TELEGRAM_HOST "api.telegram.org"
+#define GEMINI_HOST "generativelanguage.googleapis.com"
+#define INPUT_PATH "application_input.wav"
+// what the microphone hears from the first press on - a phrase with silence either side, then talking
+#define INPUT_SECONDS 60
+#define PHRASE_START_MS 400
+#define PHRASE_END_MS 2000
+#define TALKING_FROM_MS 4000
+// what it hears from the press it's swapped in for - a phrase and nothing else
+#define PAUSE_INPUT_PATH "application_pause_input.wav"
+#define PAUSE_INPUT_SECONDS 10
+#define PAUSE_PHRASE_START_MS 1000
+#define PAUSE_PHRASE_END_MS 2000
+#define TRANSCRIPT "Copiado, câmbio."
+#define BATCH_TRANSCRIPT "Mensagem"
+// how long to wait for the uploads to finish
+#define UPLOAD_TIMEOUT_MS 15000
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+// a request and when it finished arriving
+struct Arrival
+{
+  NativeHttpServer::Request request;
+  TimePoint at;
+};
+
+static NativeDevice *device;
+static NativeHttpServer *server;
+static Application *application;
+static std::mutex arrivals_lock;
+static std::vector<Arrival> arrivals;
+// Gemini turns down requests streamed while recording so recordings are transcribed from the card
+static std::atomic<bool> refuse_live(false);
+// how long Gemini takes to answer a request streamed while recording
+static std::atomic<uint32_t> live_answer_ms(0);
+
+static uint32_t random_seed = 1;
+
+static int16_t random_sample(int level)
+{
+  random_seed = random_seed * 1664525 + 1013904223;
+  return (int32_t)(int16_t)(random_seed >> 16) * level / 32768;
+}
+
+// syllables of a 140Hz voice over quiet background noise - a phrase and then talking from talking_from_ms on
+static void make_input(const char *path, uint32_t seconds, uint32_t phrase_start_ms, uint32_t phrase_end_ms, uint32_t talking_from_ms)
+{
+  uint32_t samples = seconds * SAMPLE_RATE;
+  std::vector<int16_t> audio(samples);
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    uint32_t ms = i / (SAMPLE_RATE / 1000);
+    bool talking = (ms >= phrase_start_ms && ms < phrase_end_ms) || ms >= talking_from_ms;
+    // 200ms syllables with 64ms gaps
+    bool voiced = talking && (ms - (ms < talking_from_ms ? phrase_start_ms : talking_from_ms)) % 264 < 200;
+    float t = (float)i / SAMPLE_RATE;
+    float voice = sinf(2 * M_PI * 140 * t) + 0.5f * sinf(2 * M_PI * 280 * t) + 0.25f * sinf(2 * M_PI * 420 * t);
+    audio[i] = (voiced ? 3000 * voice : 0) + random_sample(80);
+  }
+  FILE *file = fopen(path, "wb");
+  uint8_t header[WAV_HEADER_SIZE];
+  SdRecorder::make_wav_header(header, SAMPLE_RATE, samples * sizeof(int16_t));
+  fwrite(header, 1, sizeof(header), file);
+  fwrite(audio.data(), sizeof(int16_t), samples, file);
+  fclose(file);
+}
+
+static NativeHttpServer::Response answer(const NativeHttpServer::Request &request)
+{
+  {
+    std::lock_guard<std::mutex> guard(arrivals_lock);
+    arrivals.push_back(Arrival{request, std::chrono::steady_clock::now()});
+  }
+  NativeHttpServer::Response response;
+  if (request.path.find("/sendAudio") != std::string::npos || request.path.find("/sendMessage") != std::string::npos)
+  {
+    response.body = "{\"ok\":true,\"result\":{\"message_id\":1}}";
+  }
+  else if (request.chunked && refuse_live)
+  {
+    response.status = 503;
+    response.body = "{\"error\":{\"code\":503,\"message\":\"The model is overloaded.\"}}";
+  }
+  else
+  {
+    if (request.chunked)
+    {
+      response.delay_ms = live_answer_ms;
+    }
+    // a line per recording when there's more than one
+    int recordings = 0;
+    for (size_t found = request.body.find("inlineData"); found != std::string::npos; found = request.body.find("inlineData", found + 1))
+    {
+      recordings++;
+    }
+    std::string text = TRANSCRIPT;
+    if (recordings > 1)
+    {
+      text = "";
+      for (int i = 1; i <= recordings; i++)
+      {
+        text += std::to_string(i) + ": " BATCH_TRANSCRIPT " " + std::to_string(i) + "\\n";
+      }
+    }
+    response.body = "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"" + text + "\"}],\"role\":\"model\"}}]}";
+  }
+  return response;
+}
+
+// requests for a path that have arrived since the first - 0 for all of them
+static std::vector<Arrival> requests_for(const char *path, size_t first = 0)
+{
+  std::lock_guard<std::mutex> guard(arrivals_lock);
+  std::vector<Arrival> found;
+  for (size_t i = first; i < arrivals.size(); i++)
+  {
+    if (arrivals[i].request.path.find(path) != std::string::npos)
+    {
+      found.push_back(arrivals[i]);
+    }
+  }
+  return found;
+}
+
+static size_t arrival_count()
+{
+  std::lock_guard<std::mutex> guard(arrivals_lock);
+  return arrivals.size();
+}
+
+static bool wait_for(const char *path, size_t count, size_t first)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(UPLOAD_TIMEOUT_MS);
+  while (requests_for(path, first).size() < count)
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+// the upload task finishes off the entry just after the last request
+static bool wait_for_empty_journal()
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(UPLOAD_TIMEOUT_MS);
+  while (std::chrono::steady_clock::now() < deadline)
+  {
+    File journal = SD.open(UPLOAD_JOURNAL_FILE);
+    size_t size = journal ? journal.size() : 0;
+    journal.close();
+    if (size == 0)
+    {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+// the application listens for at least a second before it looks at the button again
+static void listen()
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+}
+
+// hold the button down - returns when it was let go
+static TimePoint press(uint32_t ms)
+{
+  device->set_pin(GPIO_TRANSMIT_BUTTON, HIGH);
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  device->set_pin(GPIO_TRANSMIT_BUTTON, LOW);
+  return std::chrono::steady_clock::now();
+}
+
+static uint32_t ms_between(TimePoint from, TimePoint to)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+}
+
+// the audio file out of a sendAudio form
+static std::string form_file(const std::string &body)
+{
+  size_t start = body.find("\r\n\r\n", body.find("filename=\""));
+  size_t end = body.rfind("\r\n--" TELEGRAM_BOUNDARY "--");
+  if (start == std::string::npos || end == std::string::npos || end < start + 4)
+  {
+    return "";
+  }
+  return body.substr(start + 4, end - start - 4);
+}
+
+// how much audio there is in a sendAudio request's WAV file
+static uint32_t audio_length_ms(const Arrival &arrival)
+{
+  std::string file = form_file(arrival.request.body);
+  TEST_ASSERT_GREATER_THAN(WAV_HEADER_SIZE, file.size());
+  TEST_ASSERT_EQUAL(0, memcmp(file.data(), "RIFF", 4));
+  uint32_t data_size = (uint8_t)file[40] | ((uint8_t)file[41] << 8) | ((uint8_t)file[42] << 16) | ((uint32_t)(uint8_t)file[43] << 24);
+  TEST_ASSERT_EQUAL(file.size() - WAV_HEADER_SIZE, data_size);
+  return data_size / sizeof(int16_t) / (SAMPLE_RATE / 1000);
+}
+
+// the transcription requests made from the card rather than while recording
+static std::vector<Arrival> batch_requests(size_t first)
+{
+  std::vector<Arrival> batches;
+  for (const Arrival &arrival : requests_for("generateContent", first))
+  {
+    if (!arrival.request.chunked)
+    {
+      batches.push_back(arrival);
+    }
+  }
+  return batches;
+}
+
+void setUp()
+{
+  listen();
+}
+
+void tearDown() {}
+
+void test_recording_is_uploaded()
+{
+  size_t first = arrival_count();
+  TimePoint released = press(3000);
+  TEST_ASSERT_TRUE(wait_for("/sendMessage", 1, first));
+  uint32_t message_ms = ms_between(released, requests_for("/sendMessage", first)[0].at);
+
+  // transcribed while it was recorded...
+  std::vector<Arrival> gemini = requests_for("generateContent", first);
+  TEST_ASSERT_EQUAL(1, gemini.size());
+  TEST_ASSERT_TRUE(gemini[0].request.chunked);
+  // ...then the trimmed recording and the transcription sent to Telegram
+  std::vector<Arrival> audio = requests_for("/sendAudio", first);
+  TEST_ASSERT_EQUAL(1, audio.size());
+  uint32_t audio_ms = ms_between(released, audio[0].at);
+  uint32_t kept_ms = audio_length_ms(audio[0]);
+  // the phrase with the lead in and the detector's hangover - the silence around it is gone
+  TEST_ASSERT_GREATER_OR_EQUAL(PHRASE_END_MS - PHRASE_START_MS, kept_ms);
+  TEST_ASSERT_LESS_THAN(PHRASE_END_MS - PHRASE_START_MS + TRIM_LEAD_IN_MS + 400, kept_ms);
+  std::vector<Arrival> messages = requests_for("/sendMessage", first);
+  TEST_ASSERT_EQUAL(1, messages.size());
+  TEST_ASSERT_TRUE(messages[0].request.body.find(TRANSCRIPT) != std::string::npos);
+  // and once it's done the journal has nothing left in it
+  TEST_ASSERT_TRUE(wait_for_empty_journal());
+
+  char message[160];
+  snprintf(message, sizeof(message), "3 s press: %u ms of audio sent to Telegram %u ms after release, transcription %u ms after release",
+           kept_ms, audio_ms, message_ms);
+  TEST_MESSAGE(message);
+  // the transcription was ready when the button was let go
+  TEST_ASSERT_LESS_THAN(1000, message_ms);
+}
+
+void test_short_recordings_share_a_transcription()
+{
+  // the audio of each goes to Telegram as soon as it's recorded and the transcriptions wait for the next
+  // one to share the request to Gemini
+  refuse_live = true;
+  size_t first = arrival_count();
+  TimePoint released[2];
+  released[0] = press(1000);
+  listen();
+  released[1] = press(1000);
+  TEST_ASSERT_TRUE(wait_for("/sendMessage", 2, first));
+  TEST_ASSERT_TRUE(wait_for_empty_journal());
+  refuse_live = false;
+
+  std::vector<Arrival> audio = requests_for("/sendAudio", first);
+  TEST_ASSERT_EQUAL(2, audio.size());
+  uint32_t audio_ms[2];
+  for (int i = 0; i < 2; i++)
+  {
+    audio_ms[i] = ms_between(released[i], audio[i].at);
+    TEST_ASSERT_LESS_THAN(1000, audio_ms[i]);
+  }
+  // the first recording's audio didn't wait for the second
+  TEST_ASSERT_TRUE(audio[0].at < released[1]);
+
+  std::vector<Arrival> batches = batch_requests(first);
+  TEST_ASSERT_EQUAL(1, batches.size());
+  TEST_ASSERT_TRUE(batches[0].request.body.find("\"Áudio 2:\"") != std::string::npos);
+  uint32_t batch_ms = ms_between(released[0], batches[0].at);
+  TEST_ASSERT_GREATER_OR_EQUAL(TRANSCRIPTION_BATCH_WINDOW_MS, batch_ms);
+
+  std::vector<Arrival> messages = requests_for("/sendMessage", first);
+  TEST_ASSERT_EQUAL(2, messages.size());
+  TEST_ASSERT_TRUE(messages[0].request.body.find(BATCH_TRANSCRIPT " 1") != std::string::npos);
+  TEST_ASSERT_TRUE(messages[1].request.body.find(BATCH_TRANSCRIPT " 2") != std::string::npos);
+  uint32_t message_ms[2] = {ms_between(released[0], messages[0].at), ms_between(released[1], messages[1].at)};
+  // both went as soon as the shared request came back
+  TEST_ASSERT_LESS_THAN(batch_ms + 500, message_ms[0]);
+  TEST_ASSERT_LESS_THAN(ms_between(released[1], batches[0].at) + 500, message_ms[1]);
+
+  char message[200];
+  snprintf(message, sizeof(message), "two 1 s presses: audio sent %u and %u ms after release, one transcription request %u ms after the first "
+                                     "release, transcriptions sent %u and %u ms after release",
+           audio_ms[0], audio_ms[1], batch_ms, message_ms[0], message_ms[1]);
+  TEST_MESSAGE(message);
+}
+
+void test_untrimmed_recording_is_not_batched()
+{
+  // the first recording is transcribed from the card once its window is up - but the upload task is busy
+  // transcribing the second live until after that, so when the first comes round the second is in the
+  // journal straight from the recorder and has to be trimmed before it goes anywhere
+  size_t first = arrival_count();
+  refuse_live = true;
+  press(1000);
+  // the second has silence either side of its phrase - the input doesn't come back so this goes last
+  device->set_i2s_input(I2S_NUM_0, PAUSE_INPUT_PATH);
+  listen();
+  refuse_live = false;
+  live_answer_ms = 300;
+  press(TRANSCRIPTION_BATCH_WINDOW_MS);
+  TEST_ASSERT_TRUE(wait_for("/sendMessage", 2, first));
+  TEST_ASSERT_TRUE(wait_for_empty_journal());
+  live_answer_ms = 0;
+
+  // the first was transcribed on its own and the second kept its live transcription
+  std::vector<Arrival> batches = batch_requests(first);
+  TEST_ASSERT_EQUAL(1, batches.size());
+  TEST_ASSERT_TRUE(batches[0].request.body.find("\"Áudio 2:\"") == std::string::npos);
+  std::vector<Arrival> messages = requests_for("/sendMessage", first);
+  TEST_ASSERT_EQUAL(2, messages.size());
+  for (const Arrival &message : messages)
+  {
+    TEST_ASSERT_TRUE(message.request.body.find(TRANSCRIPT) != std::string::npos);
+  }
+  // and the second went to Telegram trimmed down to its phrase
+  std::vector<Arrival> audio = requests_for("/sendAudio", first);
+  TEST_ASSERT_EQUAL(2, audio.size());
+  uint32_t kept_ms = audio_length_ms(audio[1]);
+  TEST_ASSERT_GREATER_OR_EQUAL(PAUSE_PHRASE_END_MS - PAUSE_PHRASE_START_MS, kept_ms);
+  TEST_ASSERT_LESS_THAN(PAUSE_PHRASE_END_MS - PAUSE_PHRASE_START_MS + TRIM_LEAD_IN_MS + 400, kept_ms);
+
+  char message[160];
+  snprintf(message, sizeof(message), "%u ms press released while the last one was due: %u ms of audio sent to Telegram",
+           TRANSCRIPTION_BATCH_WINDOW_MS, kept_ms);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv)
+{
+  make_input(INPUT_PATH, INPUT_SECONDS, PHRASE_START_MS, PHRASE_END_MS, TALKING_FROM_MS);
+  make_input(PAUSE_INPUT_PATH, PAUSE_INPUT_SECONDS, PAUSE_PHRASE_START_MS, PAUSE_PHRASE_END_MS, UINT32_MAX);
+  device = new NativeDevice("application");
+  device->select();
+  // start from an empty card so nothing is left over in the journal from the last run
+  std::filesystem::remove_all(device->sd_path(""));
+  device->set_i2s_input(I2S_NUM_0, INPUT_PATH);
+  server = new NativeHttpServer(answer);
+  server->set_keep_bodies(true);
+  server->route(TELEGRAM_HOST);
+  server->route(GEMINI_HOST);
+  // the application's tasks carry on until the end of the run
+  application = new Application();
+  application->begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_recording_is_uploaded);
+  RUN_TEST(test_short_recordings_share_a_transcription);
+  RUN_TEST(test_untrimmed_recording_is_not_batched);
+  return UNITY_END();
+}
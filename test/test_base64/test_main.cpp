@@ -0,0 +1,220 @@
+// Checks the block base64 encoder and its incremental mode against a simple reference on random data
+// split at random points, then measures how fast they go next to the String based encoder they
+// replaced - run with `pio test -e native -f test_base64`
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Base64.h"
+
+#define FUZZ_RUNS 20000
+#define FUZZ_MAX_LENGTH 300
+#define BENCHMARK_SIZE (1024 * 1024)
+#define BENCHMARK_RUNS 50
+// what FileRequestStream reads from the card at a time
+#define FILE_CHUNK_SIZE 382
+
+static uint32_t random_seed = 1;
+
+static uint32_t random_number()
+{
+  random_seed = random_seed * 1664525 + 1013904223;
+  return random_seed >> 8;
+}
+
+// six bits at a time off the front of the data - nothing like the block encoder so they can't share a bug
+static std::string reference_encode(const std::vector<uint8_t> &data)
+{
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  uint32_t bits = 0;
+  int bit_count = 0;
+  for (uint8_t byte : data)
+  {
+    bits = (bits << 8) | byte;
+    bit_count += 8;
+    while (bit_count >= 6)
+    {
+      bit_count -= 6;
+      encoded += alphabet[(bits >> bit_count) & 0x3f];
+    }
+  }
+  if (bit_count > 0)
+  {
+    encoded += alphabet[(bits << (6 - bit_count)) & 0x3f];
+  }
+  while (encoded.size() % 4)
+  {
+    encoded += '=';
+  }
+  return encoded;
+}
+
+// the encoder this replaced - a character at a time onto a String
+static String string_encode(const uint8_t *data, size_t length)
+{
+  const char *base64_chars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+      "abcdefghijklmnopqrstuvwxyz"
+      "0123456789+/";
+
+  String encoded;
+  encoded.reserve(((length + 2) / 3) * 4);
+
+  for (size_t i = 0; i < length; i += 3)
+  {
+    uint32_t octet_a = i < length ? data[i] : 0;
+    uint32_t octet_b = i + 1 < length ? data[i + 1] : 0;
+    uint32_t octet_c = i + 2 < length ? data[i + 2] : 0;
+
+    uint32_t triple = (octet_a << 16) + (octet_b << 8) + octet_c;
+
+    encoded += base64_chars[(triple >> 18) & 0x3F];
+    encoded += base64_chars[(triple >> 12) & 0x3F];
+    encoded += base64_chars[(triple >> 6) & 0x3F];
+    encoded += base64_chars[triple & 0x3F];
+  }
+
+  switch (length % 3)
+  {
+  case 1:
+    encoded[encoded.length() - 2] = '=';
+    encoded[encoded.length() - 1] = '=';
+    break;
+  case 2:
+    encoded[encoded.length() - 1] = '=';
+    break;
+  }
+
+  return encoded;
+}
+
+static std::vector<uint8_t> random_data(size_t length)
+{
+  std::vector<uint8_t> data(length);
+  for (uint8_t &byte : data)
+  {
+    byte = random_number();
+  }
+  return data;
+}
+
+void setUp()
+{
+  random_seed = 1;
+}
+
+void tearDown() {}
+
+void test_known_values()
+{
+  // RFC 4648 section 10
+  const char *inputs[] = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+  const char *outputs[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+  for (int i = 0; i < 7; i++)
+  {
+    char encoded[16];
+    size_t length = base64_encode((const uint8_t *)inputs[i], strlen(inputs[i]), encoded);
+    TEST_ASSERT_EQUAL(strlen(outputs[i]), length);
+    TEST_ASSERT_EQUAL(base64_encoded_length(strlen(inputs[i])), length);
+    encoded[length] = 0;
+    TEST_ASSERT_EQUAL_STRING(outputs[i], encoded);
+  }
+}
+
+void test_matches_reference()
+{
+  std::vector<char> encoded(base64_encoded_length(FUZZ_MAX_LENGTH) + 4);
+  for (int run = 0; run < FUZZ_RUNS; run++)
+  {
+    std::vector<uint8_t> data = random_data(random_number() % (FUZZ_MAX_LENGTH + 1));
+    // a guard after the end to catch writing too far
+    encoded[base64_encoded_length(data.size())] = '#';
+    size_t length = base64_encode(data.data(), data.size(), encoded.data());
+    TEST_ASSERT_EQUAL(base64_encoded_length(data.size()), length);
+    TEST_ASSERT_EQUAL('#', encoded[length]);
+    TEST_ASSERT_TRUE(reference_encode(data) == std::string(encoded.data(), length));
+  }
+}
+
+void test_incremental_matches_reference()
+{
+  // the same data in pieces of any size gives the same result as all at once
+  std::vector<char> encoded(base64_encoded_length(FUZZ_MAX_LENGTH) + 4);
+  Base64Encoder encoder;
+  for (int run = 0; run < FUZZ_RUNS; run++)
+  {
+    std::vector<uint8_t> data = random_data(random_number() % (FUZZ_MAX_LENGTH + 1));
+    size_t length = 0;
+    size_t position = 0;
+    while (position < data.size())
+    {
+      // mostly short pieces so the carried over bytes get a good workout
+      size_t piece = random_number() % (random_number() % 4 == 0 ? 64 : 5);
+      piece = std::min(piece, data.size() - position);
+      size_t written = encoder.update(&data[position], piece, &encoded[length]);
+      TEST_ASSERT_LESS_OR_EQUAL(Base64Encoder::max_output(piece), written);
+      length += written;
+      position += piece;
+    }
+    length += encoder.finish(&encoded[length]);
+    TEST_ASSERT_TRUE(reference_encode(data) == std::string(encoded.data(), length));
+  }
+}
+
+void test_benchmark()
+{
+  std::vector<uint8_t> data = random_data(BENCHMARK_SIZE);
+  std::vector<char> encoded(base64_encoded_length(BENCHMARK_SIZE));
+  size_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int run = 0; run < BENCHMARK_RUNS; run++)
+  {
+    checksum += base64_encode(data.data(), data.size(), encoded.data());
+    checksum += encoded[run];
+  }
+  auto block_end = std::chrono::steady_clock::now();
+  // the way the request body uses it - a card read's worth at a time into a small buffer
+  Base64Encoder encoder;
+  char chunk[Base64Encoder::max_output(FILE_CHUNK_SIZE) + 4];
+  for (int run = 0; run < BENCHMARK_RUNS; run++)
+  {
+    for (size_t position = 0; position < data.size(); position += FILE_CHUNK_SIZE)
+    {
+      checksum += encoder.update(&data[position], std::min<size_t>(FILE_CHUNK_SIZE, data.size() - position), chunk);
+    }
+    checksum += encoder.finish(chunk) + chunk[0];
+  }
+  auto incremental_end = std::chrono::steady_clock::now();
+  String old_encoded;
+  for (int run = 0; run < BENCHMARK_RUNS; run++)
+  {
+    old_encoded = string_encode(data.data(), data.size());
+    checksum += old_encoded[run];
+  }
+  auto string_end = std::chrono::steady_clock::now();
+  TEST_ASSERT_TRUE(std::string(encoded.data(), encoded.size()) == old_encoded.c_str());
+
+  double megabytes = (double)BENCHMARK_SIZE * BENCHMARK_RUNS / (1024 * 1024);
+  double block_rate = megabytes / std::chrono::duration<double>(block_end - start).count();
+  double incremental_rate = megabytes / std::chrono::duration<double>(incremental_end - block_end).count();
+  double string_rate = megabytes / std::chrono::duration<double>(string_end - incremental_end).count();
+  char message[200];
+  snprintf(message, sizeof(message), "block: %.0f MB/s, incremental in %d byte pieces: %.0f MB/s, String: %.0f MB/s (%.1fx) [%zu]",
+           block_rate, FILE_CHUNK_SIZE, incremental_rate, string_rate, block_rate / string_rate, checksum);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(string_rate, block_rate);
+  TEST_ASSERT_GREATER_THAN(string_rate, incremental_rate);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_known_values);
+  RUN_TEST(test_matches_reference);
+  RUN_TEST(test_incremental_matches_reference);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,188 @@
+// Sends the requests a few recordings make - audio and transcript to Telegram, audio to Gemini - to a local
+// stand-in that takes as long as a TLS handshake to answer on each new connection, and checks how many
+// handshakes there were, what they cost and that connections are opened again when they have to be - run
+// with `pio test -e native -f test_connection_reuse`
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include "NativeDevice.h"
+#include "NativeHttpServer.h"
+#include "HttpConnections.h"
+
+#define TELEGRAM_HOST "api.telegram.org"
+#define GEMINI_HOST "generativelanguage.googleapis.com"
+#define OTHER_HOST "example.com"
+#define SEND_AUDIO_URL "https://" TELEGRAM_HOST "/bottest/sendAudio"
+#define SEND_MESSAGE_URL "https://" TELEGRAM_HOST "/bottest/sendMessage"
+#define GEMINI_URL "https://" GEMINI_HOST "/v1beta/models/gemini-1.5-flash:generateContent?key=test"
+#define OTHER_URL "https://" OTHER_HOST "/"
+// roughly what a handshake takes an ESP32
+#define HANDSHAKE_MS 200
+#define RECORDINGS 3
+
+static NativeDevice *device;
+static NativeHttpServer *server;
+static bool close_after_response = false;
+
+static int post(HttpConnectionManager &connections, const char *url)
+{
+  HttpConnection &connection = connections.connection(url);
+  if (!connection.begin(url))
+  {
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  HTTPClient &http = connection.http();
+  int code = http.POST("chat_id=1&text=hello");
+  if (code > 0)
+  {
+    TEST_ASSERT_EQUAL_STRING("{\"ok\":true}", http.getString().c_str());
+    connection.end();
+  }
+  else
+  {
+    connection.abort();
+  }
+  return code;
+}
+
+// what processRecording sends for each recording
+static void upload_recordings(HttpConnectionManager &connections, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_AUDIO_URL));
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, GEMINI_URL));
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_MESSAGE_URL));
+  }
+}
+
+static uint32_t elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void setUp()
+{
+  close_after_response = false;
+}
+
+void tearDown() {}
+
+void test_one_handshake_per_host()
+{
+  int connections_before = server->connections();
+  HttpConnectionManager connections;
+  auto start = std::chrono::steady_clock::now();
+  upload_recordings(connections, RECORDINGS);
+  uint32_t reused_ms = elapsed_ms(start);
+  TEST_ASSERT_EQUAL(2, server->connections() - connections_before);
+  HttpConnection &telegram = connections.connection(SEND_MESSAGE_URL);
+  HttpConnection &gemini = connections.connection(GEMINI_URL);
+  TEST_ASSERT_EQUAL(2 * RECORDINGS, telegram.requests());
+  TEST_ASSERT_EQUAL(1, telegram.handshakes());
+  TEST_ASSERT_EQUAL(RECORDINGS, gemini.requests());
+  TEST_ASSERT_EQUAL(1, gemini.handshakes());
+  // the stand-in's handshake is in the first request rather than the connect but it's only paid once
+  TEST_ASSERT_GREATER_OR_EQUAL(HANDSHAKE_MS, telegram.max_request_ms());
+  // and from then on requests go straight out
+  start = std::chrono::steady_clock::now();
+  upload_recordings(connections, 1);
+  uint32_t later_ms = elapsed_ms(start) / 3;
+  TEST_ASSERT_EQUAL(2, server->connections() - connections_before);
+  TEST_ASSERT_LESS_THAN(HANDSHAKE_MS / 4, later_ms);
+
+  // the way it was - a new connection for every request
+  connections_before = server->connections();
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < RECORDINGS; i++)
+  {
+    HttpConnectionManager fresh[3];
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(fresh[0], SEND_AUDIO_URL));
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(fresh[1], GEMINI_URL));
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(fresh[2], SEND_MESSAGE_URL));
+  }
+  uint32_t fresh_ms = elapsed_ms(start);
+  int fresh_handshakes = server->connections() - connections_before;
+  TEST_ASSERT_EQUAL(3 * RECORDINGS, fresh_handshakes);
+
+  char message[160];
+  snprintf(message, sizeof(message), "%d recordings: kept alive 2 handshakes in %u ms, new connections %d handshakes in %u ms, later requests %u ms",
+           RECORDINGS, reused_ms, fresh_handshakes, fresh_ms, later_ms);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(fresh_ms, reused_ms);
+}
+
+void test_reconnects_when_server_closes()
+{
+  HttpConnectionManager connections;
+  close_after_response = true;
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_AUDIO_URL));
+  close_after_response = false;
+  HttpConnection &telegram = connections.connection(SEND_MESSAGE_URL);
+  TEST_ASSERT_FALSE(telegram.is_open());
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_MESSAGE_URL));
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_MESSAGE_URL));
+  TEST_ASSERT_EQUAL(2, telegram.handshakes());
+  TEST_ASSERT_TRUE(telegram.is_open());
+}
+
+void test_new_host_takes_the_oldest_connection()
+{
+  HttpConnectionManager connections;
+  // connections are aged in milliseconds and requests here take less than that
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_AUDIO_URL));
+  delay(2);
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, GEMINI_URL));
+  delay(2);
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_MESSAGE_URL));
+  delay(2);
+  // Gemini was used longest ago
+  HttpConnection &other = connections.connection(OTHER_URL);
+  TEST_ASSERT_EQUAL_STRING(OTHER_HOST, other.host().c_str());
+  TEST_ASSERT_FALSE(other.is_open());
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, OTHER_URL));
+  TEST_ASSERT_TRUE(connections.connection(SEND_MESSAGE_URL).is_open());
+  TEST_ASSERT_EQUAL(1, connections.connection(SEND_MESSAGE_URL).handshakes());
+}
+
+void test_idle_connections_are_closed()
+{
+  // this stops the clock for the rest of the run so it goes last
+  native_set_clock(native_micros());
+  HttpConnectionManager connections;
+  upload_recordings(connections, 1);
+  connections.close_idle();
+  TEST_ASSERT_TRUE(connections.has_open());
+  native_set_clock(native_micros() + (HTTP_IDLE_TIMEOUT_MS + 1) * 1000ull);
+  connections.close_idle();
+  TEST_ASSERT_FALSE(connections.has_open());
+  // and the next request opens a new one
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, post(connections, SEND_MESSAGE_URL));
+  TEST_ASSERT_EQUAL(2, connections.connection(SEND_MESSAGE_URL).handshakes());
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("connection_reuse");
+  device->select();
+  server = new NativeHttpServer([](const NativeHttpServer::Request &request)
+                                {
+                                  NativeHttpServer::Response response;
+                                  response.body = "{\"ok\":true}";
+                                  response.close = close_after_response;
+                                  return response;
+                                });
+  server->set_handshake_ms(HANDSHAKE_MS);
+  server->route(TELEGRAM_HOST);
+  server->route(GEMINI_HOST);
+  server->route(OTHER_HOST);
+  UNITY_BEGIN();
+  RUN_TEST(test_one_handshake_per_host);
+  RUN_TEST(test_reconnects_when_server_closes);
+  RUN_TEST(test_new_host_takes_the_oldest_connection);
+  RUN_TEST(test_idle_connections_are_closed);
+  int result = UNITY_END();
+  delete server;
+  return result;
+}
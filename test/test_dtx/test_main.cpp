@@ -0,0 +1,293 @@
+// Runs talk spurts and background noise through the voice activity detector and the transport the way
+// the transmit loop does, checks no speech is clipped, how much airtime is saved and that the receiver
+// fills the pauses with comfort noise - run with `pio test -e native -f test_dtx`
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "NativeDevice.h"
+#include "VoiceActivityDetector.h"
+#include "Transport.h"
+#include "StreamMixer.h"
+#include "OutputBuffer.h"
+
+#define SAMPLE_RATE 16000
+#define FRAME_SIZE 160
+#define GROUP_SIZE 5
+// what the transmit loop reads from the microphone in one go
+#define BLOCK_SIZE 128
+#define BLOCK_US (1000000 * BLOCK_SIZE / SAMPLE_RATE)
+#define PACKET_SIZE 250
+// background noise RMS level
+#define NOISE_LEVEL 300
+// a second of talking then two of listening
+#define TALK_BLOCKS (SAMPLE_RATE / BLOCK_SIZE)
+#define PAUSE_BLOCKS (2 * SAMPLE_RATE / BLOCK_SIZE)
+#define SPURTS 5
+#define BENCHMARK_BLOCKS 1000000
+
+static const uint8_t header[] = {0x57};
+static const uint8_t address[PACKET_ADDRESS_SIZE] = {0x02, 0, 0, 0, 0, 1};
+
+// keeps everything it sends so it can be counted and handed to a listener
+class LoopbackTransport : public Transport
+{
+protected:
+  void send(const uint8_t *data, int length) override
+  {
+    sent.push_back(std::vector<uint8_t>(data, data + length));
+    bytes += length;
+  }
+
+public:
+  std::vector<std::vector<uint8_t>> sent;
+  int bytes = 0;
+
+  LoopbackTransport(StreamMixer *mixer) : Transport(mixer, PACKET_SIZE)
+  {
+    set_header(sizeof(header), header);
+    set_frame_size(FRAME_SIZE);
+    set_fec_group_size(GROUP_SIZE);
+  }
+  bool begin() override { return true; }
+  void deliver(const std::vector<uint8_t> &packet) { receive_packet(address, packet.data(), packet.size()); }
+};
+
+static uint32_t noise_seed = 1;
+
+// uniform noise at the background level
+static int16_t noise()
+{
+  noise_seed = noise_seed * 1664525 + 1013904223;
+  return (int32_t)(int16_t)(noise_seed >> 16) * NOISE_LEVEL * 7 / 4 / 32768;
+}
+
+// a voiced sound over the background noise that dies away over the last fifth of the spurt like the end of a word
+static void make_speech(int16_t *samples, int block)
+{
+  for (int i = 0; i < BLOCK_SIZE; i++)
+  {
+    int n = block * BLOCK_SIZE + i;
+    float level = 8000;
+    if (block > TALK_BLOCKS * 4 / 5)
+    {
+      level *= expf(-(float)(n - TALK_BLOCKS * 4 / 5 * BLOCK_SIZE) / 400);
+    }
+    samples[i] = level * sinf(2 * M_PI * 140 * n / SAMPLE_RATE) + noise();
+  }
+}
+
+static void make_pause(int16_t *samples)
+{
+  for (int i = 0; i < BLOCK_SIZE; i++)
+  {
+    samples[i] = noise();
+  }
+}
+
+static float rms(const int16_t *samples, int count)
+{
+  double sum = 0;
+  for (int i = 0; i < count; i++)
+  {
+    sum += (double)samples[i] * samples[i];
+  }
+  return sqrt(sum / count);
+}
+
+void setUp()
+{
+  noise_seed = 1;
+  native_set_clock(0);
+}
+
+void tearDown() {}
+
+void test_speech_is_sent()
+{
+  VoiceActivityDetector vad;
+  int16_t samples[BLOCK_SIZE];
+  // settle on the background level first
+  for (int i = 0; i < PAUSE_BLOCKS; i++)
+  {
+    make_pause(samples);
+    vad.is_speech(samples, BLOCK_SIZE);
+  }
+  TEST_ASSERT_FALSE(vad.is_speech(samples, BLOCK_SIZE));
+  TEST_ASSERT_INT_WITHIN(NOISE_LEVEL / 4, NOISE_LEVEL, vad.noise_level());
+  // every block with a word in it goes out, right down to where it fades into the background
+  for (int i = 0; i < TALK_BLOCKS; i++)
+  {
+    make_speech(samples, i);
+    TEST_ASSERT_TRUE(vad.is_speech(samples, BLOCK_SIZE));
+  }
+  // after the last loud block we keep going for the hangover then stop
+  make_speech(samples, 0);
+  vad.is_speech(samples, BLOCK_SIZE);
+  int hangover = 0;
+  for (; hangover < PAUSE_BLOCKS; hangover++)
+  {
+    make_pause(samples);
+    if (!vad.is_speech(samples, BLOCK_SIZE))
+    {
+      break;
+    }
+  }
+  TEST_ASSERT_EQUAL(VAD_HANGOVER_BLOCKS - 1, hangover);
+}
+
+void test_fricative_is_sent()
+{
+  VoiceActivityDetector vad;
+  int16_t samples[BLOCK_SIZE];
+  for (int i = 0; i < PAUSE_BLOCKS; i++)
+  {
+    make_pause(samples);
+    vad.is_speech(samples, BLOCK_SIZE);
+  }
+  // a quiet hiss - not loud enough to count on its energy alone, but it crosses zero on nearly every sample
+  for (int i = 0; i < BLOCK_SIZE; i++)
+  {
+    samples[i] = (i & 1 ? 1 : -1) * NOISE_LEVEL * 3 / 2 + noise() / 4;
+  }
+  TEST_ASSERT_TRUE(vad.is_speech(samples, BLOCK_SIZE));
+}
+
+void test_pauses_save_airtime()
+{
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  LoopbackTransport with_dtx(&mixer);
+  LoopbackTransport without_dtx(&mixer);
+  VoiceActivityDetector vad;
+  int16_t samples[BLOCK_SIZE];
+  int suppressed_blocks = 0;
+  for (int spurt = 0; spurt < SPURTS; spurt++)
+  {
+    for (int i = 0; i < TALK_BLOCKS + PAUSE_BLOCKS; i++)
+    {
+      if (i < TALK_BLOCKS)
+      {
+        make_speech(samples, i);
+      }
+      else
+      {
+        make_pause(samples);
+      }
+      without_dtx.add_samples(samples, BLOCK_SIZE);
+      if (!vad.is_speech(samples, BLOCK_SIZE))
+      {
+        with_dtx.add_silence(BLOCK_SIZE, vad.noise_level());
+        suppressed_blocks++;
+        continue;
+      }
+      with_dtx.add_samples(samples, BLOCK_SIZE);
+    }
+  }
+  with_dtx.flush();
+  without_dtx.flush();
+  char message[160];
+  snprintf(message, sizeof(message), "%d of %d blocks suppressed - %d bytes sent instead of %d (%.0f%% saved), counter says %d",
+           suppressed_blocks, SPURTS * (TALK_BLOCKS + PAUSE_BLOCKS), with_dtx.bytes, without_dtx.bytes,
+           100.0 * (without_dtx.bytes - with_dtx.bytes) / without_dtx.bytes, with_dtx.dtx_saved_bytes());
+  TEST_MESSAGE(message);
+  // nearly all of the pauses less the hangovers
+  TEST_ASSERT_GREATER_THAN(SPURTS * (PAUSE_BLOCKS - VAD_HANGOVER_BLOCKS) * 9 / 10, suppressed_blocks);
+  TEST_ASSERT_LESS_OR_EQUAL(SPURTS * PAUSE_BLOCKS, suppressed_blocks);
+  // the counter is an estimate - it doesn't know how the partly filled packets at the ends of words fall
+  int saved = without_dtx.bytes - with_dtx.bytes;
+  TEST_ASSERT_INT_WITHIN(saved / 20, saved, with_dtx.dtx_saved_bytes());
+}
+
+void test_receiver_plays_comfort_noise()
+{
+  StreamMixer sender_mixer(200 * 16, SAMPLE_RATE);
+  LoopbackTransport talker(&sender_mixer);
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  LoopbackTransport listener(&mixer);
+  VoiceActivityDetector vad;
+  int16_t samples[BLOCK_SIZE];
+  int16_t played[BLOCK_SIZE];
+  std::vector<float> pause_levels;
+  for (int i = 0; i < TALK_BLOCKS + PAUSE_BLOCKS; i++)
+  {
+    native_set_clock((uint64_t)i * BLOCK_US);
+    if (i < TALK_BLOCKS)
+    {
+      make_speech(samples, i);
+    }
+    else
+    {
+      make_pause(samples);
+    }
+    if (vad.is_speech(samples, BLOCK_SIZE))
+    {
+      talker.add_samples(samples, BLOCK_SIZE);
+    }
+    else
+    {
+      talker.add_silence(BLOCK_SIZE, vad.noise_level());
+    }
+    // straight across to the listener and play a block
+    for (const std::vector<uint8_t> &packet : talker.sent)
+    {
+      listener.deliver(packet);
+    }
+    talker.sent.clear();
+    listener.poll();
+    mixer.remove_samples(played, BLOCK_SIZE);
+    // well after the hangover and the buffered audio have played out
+    if (i > TALK_BLOCKS + 2 * VAD_HANGOVER_BLOCKS)
+    {
+      pause_levels.push_back(rms(played, BLOCK_SIZE));
+    }
+  }
+  // the pause sounds like the sender's background rather than dead air - output is scaled down by 8
+  float level = 0;
+  for (float block_level : pause_levels)
+  {
+    level += block_level / pause_levels.size();
+  }
+  TEST_ASSERT_FLOAT_WITHIN(NOISE_LEVEL / 8 / 4, NOISE_LEVEL / 8, level);
+  // and running dry in a pause isn't an underrun
+  TEST_ASSERT_EQUAL(0, mixer.output_buffer(0)->underruns());
+}
+
+void test_benchmark()
+{
+  // what the detector costs the transmit loop for each block it reads
+  VoiceActivityDetector vad;
+  std::vector<int16_t> samples((TALK_BLOCKS + PAUSE_BLOCKS) * BLOCK_SIZE);
+  for (int i = 0; i < TALK_BLOCKS + PAUSE_BLOCKS; i++)
+  {
+    if (i < TALK_BLOCKS)
+    {
+      make_speech(&samples[i * BLOCK_SIZE], i);
+    }
+    else
+    {
+      make_pause(&samples[i * BLOCK_SIZE]);
+    }
+  }
+  int speech_blocks = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_BLOCKS; i++)
+  {
+    speech_blocks += vad.is_speech(&samples[(i % (TALK_BLOCKS + PAUSE_BLOCKS)) * BLOCK_SIZE], BLOCK_SIZE);
+  }
+  double block_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCHMARK_BLOCKS;
+  char message[120];
+  snprintf(message, sizeof(message), "%.0f ns per %d sample block [%d]", block_ns, BLOCK_SIZE, speech_blocks);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(1000000000.0 * BLOCK_SIZE / SAMPLE_RATE / 100, block_ns);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_speech_is_sent);
+  RUN_TEST(test_fricative_is_sent);
+  RUN_TEST(test_pauses_save_airtime);
+  RUN_TEST(test_receiver_plays_comfort_noise);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
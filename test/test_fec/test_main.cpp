@@ -0,0 +1,230 @@
+// Checks the parity frames rebuild lost frames, but only lost ones, and that the end of a
+// transmission waits for the last group's parity - run with `pio test -e native -f test_fec`
+#include <Arduino.h>
+#include <unity.h>
+#include <vector>
+#include "NativeDevice.h"
+#include "Transport.h"
+#include "OutputBuffer.h"
+#include "JitterBuffer.h"
+#include "StreamMixer.h"
+
+#define SAMPLE_RATE 16000
+#define FRAME_SIZE 160
+#define GROUP_SIZE 5
+#define FRAME_US (1000000 * FRAME_SIZE / SAMPLE_RATE)
+// like ESP-NOW
+#define PACKET_SIZE 250
+
+static const uint8_t header[] = {0x57};
+static const uint8_t address[PACKET_ADDRESS_SIZE] = {0x02, 0, 0, 0, 0, 1};
+
+// keeps everything it sends so the test can deliver it however it likes
+class LoopbackTransport : public Transport
+{
+protected:
+  void send(const uint8_t *data, int length) override
+  {
+    sent.push_back(std::vector<uint8_t>(data, data + length));
+  }
+
+public:
+  std::vector<std::vector<uint8_t>> sent;
+
+  LoopbackTransport(StreamMixer *mixer) : Transport(mixer, PACKET_SIZE)
+  {
+    set_header(sizeof(header), header);
+    set_frame_size(FRAME_SIZE);
+    set_fec_group_size(GROUP_SIZE);
+  }
+  bool begin() override { return true; }
+  void deliver(const std::vector<uint8_t> &packet) { receive_packet(address, packet.data(), packet.size()); }
+};
+
+static bool is_parity(const std::vector<uint8_t> &packet)
+{
+  return packet[sizeof(header)] == FRAME_TYPE_PARITY;
+}
+
+static uint16_t sequence(const std::vector<uint8_t> &packet)
+{
+  uint16_t sequence;
+  memcpy(&sequence, packet.data() + sizeof(header) + 2, sizeof(uint16_t));
+  return sequence;
+}
+
+// a transmission of frame_count frames followed by the end of transmission and the last parity
+static std::vector<std::vector<uint8_t>> make_transmission(int frame_count)
+{
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  LoopbackTransport talker(&mixer);
+  int16_t samples[FRAME_SIZE];
+  for (int frame = 0; frame < frame_count; frame++)
+  {
+    for (int i = 0; i < FRAME_SIZE; i++)
+    {
+      samples[i] = 4000 * sinf(2 * M_PI * 200 * (frame * FRAME_SIZE + i) / SAMPLE_RATE);
+    }
+    talker.add_samples(samples, FRAME_SIZE);
+  }
+  talker.flush();
+  return talker.sent;
+}
+
+// hands the packets to a listener one frame time apart
+struct Listener
+{
+  StreamMixer mixer;
+  LoopbackTransport transport;
+  uint64_t now = 0;
+
+  Listener() : mixer(200 * 16, SAMPLE_RATE), transport(&mixer) {}
+  void deliver(const std::vector<uint8_t> &packet)
+  {
+    now += FRAME_US;
+    native_set_clock(now);
+    transport.deliver(packet);
+    transport.poll();
+  }
+  void wait(uint64_t us)
+  {
+    now += us;
+    native_set_clock(now);
+    transport.poll();
+  }
+  JitterBuffer *jitter_buffer() { return mixer.output_buffer(0)->jitter_buffer(); }
+};
+
+void setUp() {}
+
+void tearDown() {}
+
+// the listener only finds out the group size from the first parity frame so these all lose a
+// frame from a later group
+void test_lost_frame_is_rebuilt()
+{
+  std::vector<std::vector<uint8_t>> packets = make_transmission(12);
+  Listener listener;
+  for (const std::vector<uint8_t> &packet : packets)
+  {
+    if (is_parity(packet) || sequence(packet) != 7)
+    {
+      listener.deliver(packet);
+    }
+  }
+  TEST_ASSERT_EQUAL(1, listener.jitter_buffer()->recovered());
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->lost());
+  TEST_ASSERT_EQUAL(1, listener.transport.fec_recovered());
+}
+
+void test_late_frame_is_not_rebuilt()
+{
+  std::vector<std::vector<uint8_t>> packets = make_transmission(12);
+  Listener listener;
+  // frame 7 turns up just after its group's parity - while the jitter buffer is still waiting for it
+  std::vector<uint8_t> held;
+  for (const std::vector<uint8_t> &packet : packets)
+  {
+    if (!is_parity(packet) && sequence(packet) == 7)
+    {
+      held = packet;
+      continue;
+    }
+    listener.deliver(packet);
+    if (is_parity(packet) && !held.empty())
+    {
+      listener.deliver(held);
+      held.clear();
+    }
+  }
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->recovered());
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->duplicate());
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->lost());
+  TEST_ASSERT_EQUAL(12, listener.jitter_buffer()->received());
+}
+
+void test_end_waits_for_last_parity()
+{
+  // the last group is frames 10, 11 and the empty end of transmission frame
+  std::vector<std::vector<uint8_t>> packets = make_transmission(11);
+  TEST_ASSERT_TRUE(is_parity(packets.back()));
+  Listener listener;
+  for (size_t i = 0; i + 1 < packets.size(); i++)
+  {
+    if (is_parity(packets[i]) || sequence(packets[i]) != 10)
+    {
+      listener.deliver(packets[i]);
+    }
+  }
+  // we've had the end of the transmission but frame 10 is still missing
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->lost());
+  listener.deliver(packets.back());
+  TEST_ASSERT_EQUAL(1, listener.jitter_buffer()->recovered());
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->lost());
+}
+
+void test_end_gives_up_without_last_parity()
+{
+  std::vector<std::vector<uint8_t>> packets = make_transmission(11);
+  Listener listener;
+  for (size_t i = 0; i + 1 < packets.size(); i++)
+  {
+    if (is_parity(packets[i]) || sequence(packets[i]) != 10)
+    {
+      listener.deliver(packets[i]);
+    }
+  }
+  listener.wait(FRAME_US);
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->lost());
+  // long enough for the whole group to have arrived
+  listener.wait(GROUP_SIZE * FRAME_US);
+  TEST_ASSERT_EQUAL(1, listener.jitter_buffer()->lost());
+  TEST_ASSERT_EQUAL(0, listener.jitter_buffer()->recovered());
+}
+
+void test_parity_fits_in_a_packet()
+{
+  // frames as big as the packet allows
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  LoopbackTransport talker(&mixer);
+  talker.set_frame_size(JITTER_BUFFER_MAX_FRAME_SAMPLES);
+  int16_t samples[JITTER_BUFFER_MAX_FRAME_SAMPLES] = {};
+  for (int i = 0; i < 4 * GROUP_SIZE; i++)
+  {
+    talker.add_samples(samples, JITTER_BUFFER_MAX_FRAME_SAMPLES);
+  }
+  talker.flush();
+  int parity_frames = 0;
+  for (const std::vector<uint8_t> &packet : talker.sent)
+  {
+    TEST_ASSERT_LESS_OR_EQUAL(PACKET_SIZE, packet.size());
+    parity_frames += is_parity(packet);
+  }
+  TEST_ASSERT_GREATER_THAN(0, parity_frames);
+}
+
+void test_silence_sends_parity()
+{
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  LoopbackTransport talker(&mixer);
+  int16_t samples[FRAME_SIZE] = {};
+  talker.add_samples(samples, FRAME_SIZE);
+  talker.add_samples(samples, FRAME_SIZE / 2);
+  talker.add_silence(FRAME_SIZE, 100);
+  // the part filled frame, its parity and a comfort noise frame - nothing left waiting for the next word
+  TEST_ASSERT_EQUAL(4, talker.sent.size());
+  TEST_ASSERT_TRUE(is_parity(talker.sent[2]));
+  TEST_ASSERT_EQUAL(2, talker.sent[2][sizeof(header) + 1]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_lost_frame_is_rebuilt);
+  RUN_TEST(test_late_frame_is_not_rebuilt);
+  RUN_TEST(test_end_waits_for_last_parity);
+  RUN_TEST(test_end_gives_up_without_last_parity);
+  RUN_TEST(test_parity_fits_in_a_packet);
+  RUN_TEST(test_silence_sends_parity);
+  return UNITY_END();
+}
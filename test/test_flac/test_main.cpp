@@ -0,0 +1,167 @@
+// Encodes tones, noise and speech-like audio, checks they decode back exactly, how much smaller they come out
+// and how long a block takes to encode next to the time it takes to record - run with
+// `pio test -e native -f test_flac`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <chrono>
+#include <vector>
+#include "NativeDevice.h"
+#include "FlacCodec.h"
+
+#define SAMPLE_RATE 16000
+#define SECONDS 10
+#define BENCHMARK_BLOCKS 2000
+
+static NativeDevice *device;
+static uint32_t random_seed = 1;
+
+static int16_t random_sample(int level)
+{
+  random_seed = random_seed * 1664525 + 1013904223;
+  return (int32_t)(int16_t)(random_seed >> 16) * level / 32768;
+}
+
+// a voiced sound with a couple of harmonics that comes and goes like words, over background noise
+static std::vector<int16_t> make_speech(uint32_t samples)
+{
+  std::vector<int16_t> data(samples);
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    float t = (float)i / SAMPLE_RATE;
+    float envelope = 0.5f + 0.5f * sinf(2 * M_PI * 1.5f * t);
+    float voice = sinf(2 * M_PI * 140 * t) + 0.5f * sinf(2 * M_PI * 280 * t) + 0.25f * sinf(2 * M_PI * 420 * t);
+    data[i] = 6000 * envelope * voice + random_sample(64);
+  }
+  return data;
+}
+
+// encode the lot into a file the way the recorder does, returning its size
+static size_t encode(const char *path, const std::vector<int16_t> &samples)
+{
+  FlacEncoder *encoder = new FlacEncoder();
+  std::vector<uint8_t> frame(FLAC_MAX_FRAME_SIZE);
+  File file = SD.open(path, FILE_WRITE);
+  uint8_t header[FLAC_HEADER_SIZE];
+  FlacEncoder::write_header(header, SAMPLE_RATE, samples.size(), 0, 0);
+  file.write(header, FLAC_HEADER_SIZE);
+  size_t size = FLAC_HEADER_SIZE;
+  for (size_t position = 0; position < samples.size(); position += FLAC_BLOCK_SIZE)
+  {
+    int count = samples.size() - position < FLAC_BLOCK_SIZE ? samples.size() - position : FLAC_BLOCK_SIZE;
+    int length = encoder->encode(&samples[position], count, frame.data());
+    TEST_ASSERT_LESS_OR_EQUAL(FLAC_MAX_FRAME_SIZE, length);
+    file.write(frame.data(), length);
+    size += length;
+  }
+  file.close();
+  delete encoder;
+  return size;
+}
+
+// encode, decode and compare - returns how big the file came out as a percentage of 16 bit PCM
+static int round_trip(const char *path, const std::vector<int16_t> &samples)
+{
+  size_t size = encode(path, samples);
+  File file = SD.open(path);
+  FlacDecoder decoder(file);
+  TEST_ASSERT_TRUE(decoder.begin());
+  TEST_ASSERT_EQUAL(SAMPLE_RATE, decoder.sample_rate());
+  TEST_ASSERT_EQUAL(samples.size(), decoder.total_samples());
+  // in odd sized reads so they don't line up with the frames
+  std::vector<int16_t> decoded;
+  int16_t buffer[1000];
+  int read;
+  while ((read = decoder.read(buffer, 1000)) > 0)
+  {
+    decoded.insert(decoded.end(), buffer, buffer + read);
+  }
+  file.close();
+  TEST_ASSERT_EQUAL(samples.size(), decoded.size());
+  TEST_ASSERT_EQUAL_INT16_ARRAY(samples.data(), decoded.data(), samples.size());
+  return 100 * size / (samples.size() * sizeof(int16_t));
+}
+
+void setUp()
+{
+  random_seed = 1;
+}
+
+void tearDown() {}
+
+void test_silence()
+{
+  // every residual is 0 so it comes down to the Rice code's stop bit - a bit a sample
+  std::vector<int16_t> samples(SECONDS * SAMPLE_RATE, 0);
+  TEST_ASSERT_LESS_OR_EQUAL(100 / 16 + 1, round_trip("/silence.flac", samples));
+}
+
+void test_full_scale()
+{
+  // a square wave from one end of the range to the other and a block that isn't a whole frame
+  std::vector<int16_t> samples(3 * FLAC_BLOCK_SIZE + 123);
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    samples[i] = (i / 20) & 1 ? INT16_MAX : INT16_MIN;
+  }
+  round_trip("/full_scale.flac", samples);
+}
+
+void test_noise_stays_within_bounds()
+{
+  // white noise can't be predicted so it shouldn't grow much past PCM
+  std::vector<int16_t> samples(SECONDS * SAMPLE_RATE);
+  for (int16_t &sample : samples)
+  {
+    sample = random_sample(32768);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(101, round_trip("/noise.flac", samples));
+}
+
+void test_speech_halves()
+{
+  int percent = round_trip("/speech.flac", make_speech(SECONDS * SAMPLE_RATE));
+  char message[80];
+  snprintf(message, sizeof(message), "speech comes out at %d%% of PCM", percent);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL(55, percent);
+}
+
+void test_benchmark()
+{
+  // what encoding costs the recorder for every block it writes
+  std::vector<int16_t> samples = make_speech(SECONDS * SAMPLE_RATE);
+  FlacEncoder *encoder = new FlacEncoder();
+  std::vector<uint8_t> frame(FLAC_MAX_FRAME_SIZE);
+  int blocks = samples.size() / FLAC_BLOCK_SIZE;
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCHMARK_BLOCKS; i++)
+  {
+    bytes += encoder->encode(&samples[(i % blocks) * FLAC_BLOCK_SIZE], FLAC_BLOCK_SIZE, frame.data());
+  }
+  double block_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / BENCHMARK_BLOCKS;
+  delete encoder;
+  double budget_us = 1000000.0 * FLAC_BLOCK_SIZE / SAMPLE_RATE;
+  char message[160];
+  snprintf(message, sizeof(message), "%.0f us per %d sample block - %.2f%% of the %.0f us it takes to record, %.1f MB/s [%zu]",
+           block_us, FLAC_BLOCK_SIZE, 100 * block_us / budget_us, budget_us,
+           FLAC_BLOCK_SIZE * sizeof(int16_t) / block_us, bytes);
+  TEST_MESSAGE(message);
+  // the ESP32 is a good deal slower than the host so leave it plenty of room
+  TEST_ASSERT_LESS_THAN(budget_us / 100, block_us);
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("flac");
+  device->select();
+  SD.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_silence);
+  RUN_TEST(test_full_scale);
+  RUN_TEST(test_noise_stays_within_bounds);
+  RUN_TEST(test_speech_halves);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,197 @@
+// Sends recordings to a local stand-in for Gemini the way transcribeAudio does - the JSON around the
+// audio base64 encoded straight off the SD card - and checks what arrives, that the transcription comes
+// back out and that the memory used doesn't grow with the length of the recording - run with
+// `pio test -e native -f test_gemini_upload`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <malloc.h>
+#include <atomic>
+#include <string>
+#include "NativeDevice.h"
+#include "NativeHttpServer.h"
+#include "HttpConnections.h"
+#include "FileRequestStream.h"
+#include "JsonTextExtractor.h"
+
+#define GEMINI_HOST "generativelanguage.googleapis.com"
+#define GEMINI_URL "https://" GEMINI_HOST "/v1beta/models/gemini-1.5-flash:generateContent?key=test"
+#define REQUEST_PREFIX "{\"contents\":[{\"parts\":[{\"text\":\"Transcribe\"},{\"inlineData\":{\"mimeType\":\"audio/wav\",\"data\":\""
+#define REQUEST_SUFFIX "\"}}]}]}"
+#define TRANSCRIPTION "ol\\u00e1 mundo"
+#define RESPONSE "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"" TRANSCRIPTION "\"}],\"role\":\"model\"}}]}"
+
+static NativeDevice *device;
+static NativeHttpServer *server;
+static std::atomic<size_t> peak_heap;
+
+static size_t heap_in_use()
+{
+  return mallinfo2().uordblks;
+}
+
+// what the audio should look like when it arrives
+static std::string base64(const std::string &data)
+{
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  for (size_t i = 0; i < data.size(); i += 3)
+  {
+    uint32_t group = (uint8_t)data[i] << 16;
+    group |= i + 1 < data.size() ? (uint8_t)data[i + 1] << 8 : 0;
+    group |= i + 2 < data.size() ? (uint8_t)data[i + 2] : 0;
+    encoded += alphabet[group >> 18];
+    encoded += alphabet[(group >> 12) & 0x3f];
+    encoded += i + 1 < data.size() ? alphabet[(group >> 6) & 0x3f] : '=';
+    encoded += i + 2 < data.size() ? alphabet[group & 0x3f] : '=';
+  }
+  return encoded;
+}
+
+static std::string make_recording(const char *path, size_t size)
+{
+  std::string data(size, 0);
+  for (size_t i = 0; i < size; i++)
+  {
+    data[i] = (i * 7919) ^ (i >> 5);
+  }
+  File file = SD.open(path, FILE_WRITE);
+  file.write((const uint8_t *)data.data(), data.size());
+  file.close();
+  return data;
+}
+
+// transcribeAudio without the Application around it - returns the HTTP code and the transcription
+static int transcribe(HttpConnectionManager &connections, const char *path, String &transcription)
+{
+  File file = SD.open(path);
+  HttpConnection &connection = connections.connection(GEMINI_URL);
+  TEST_ASSERT_TRUE(connection.begin(GEMINI_URL));
+  HTTPClient &http = connection.http();
+  http.addHeader("Content-Type", "application/json");
+  FileRequestStream body(REQUEST_PREFIX, file, true, REQUEST_SUFFIX);
+  int code = http.sendRequest("POST", &body, body.size());
+  if (code == HTTP_CODE_OK)
+  {
+    JsonTextExtractor extractor("candidates.0.content.parts.*.text");
+    http.writeToStream(&extractor);
+    if (extractor.finished())
+    {
+      transcription = extractor.text();
+    }
+  }
+  connection.end();
+  file.close();
+  return code;
+}
+
+void setUp()
+{
+  server->set_keep_bodies(true);
+  server->set_on_body(nullptr);
+}
+
+void tearDown() {}
+
+void test_request_body()
+{
+  HttpConnectionManager connections;
+  // every length of tail the base64 can end with, a chunk boundary either side and a few seconds of audio
+  const size_t sizes[] = {0, 1, 2, 3, 383, 384, 385, 4096, 100001};
+  for (size_t size : sizes)
+  {
+    std::string data = make_recording("/audio.wav", size);
+    String transcription;
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, transcribe(connections, "/audio.wav", transcription));
+    TEST_ASSERT_EQUAL_STRING("olá mundo", transcription.c_str());
+    NativeHttpServer::Request request = server->received().back();
+    std::string expected = REQUEST_PREFIX + base64(data) + REQUEST_SUFFIX;
+    TEST_ASSERT_EQUAL_STRING("POST", request.method.c_str());
+    TEST_ASSERT_EQUAL_STRING("/v1beta/models/gemini-1.5-flash:generateContent?key=test", request.path.c_str());
+    TEST_ASSERT_EQUAL_STRING("application/json", request.headers["content-type"].c_str());
+    // the length was known up front
+    TEST_ASSERT_FALSE(request.chunked);
+    TEST_ASSERT_EQUAL(expected.size(), strtoul(request.headers["content-length"].c_str(), NULL, 10));
+    TEST_ASSERT_TRUE(expected == request.body);
+  }
+  // all on the one connection
+  TEST_ASSERT_EQUAL(1, connections.get(0).handshakes());
+}
+
+void test_file_cut_short()
+{
+  // the file loses its end after the Content-Length has been worked out - the request has to fail
+  // rather than leave the server waiting for the rest
+  HttpConnectionManager connections;
+  make_recording("/short.wav", 50000);
+  File file = SD.open("/short.wav");
+  HttpConnection &connection = connections.connection(GEMINI_URL);
+  TEST_ASSERT_TRUE(connection.begin(GEMINI_URL));
+  HTTPClient &http = connection.http();
+  FileRequestStream body(REQUEST_PREFIX, file, true, REQUEST_SUFFIX);
+  make_recording("/short.wav", 10000);
+  int requests = server->requests();
+  TEST_ASSERT_EQUAL(HTTPC_ERROR_SEND_PAYLOAD_FAILED, http.sendRequest("POST", &body, body.size()));
+  TEST_ASSERT_TRUE(body.failed());
+  connection.abort();
+  file.close();
+  TEST_ASSERT_FALSE(connection.is_open());
+  TEST_ASSERT_EQUAL(requests, server->requests());
+}
+
+// the most the heap grows by while a recording of size bytes is sent
+static size_t peak_heap_for(size_t size)
+{
+  make_recording("/long.wav", size);
+  HttpConnectionManager connections;
+  String transcription;
+  // open the connection first so it isn't counted
+  transcribe(connections, "/long.wav", transcription);
+  size_t baseline = heap_in_use();
+  peak_heap = baseline;
+  server->set_keep_bodies(false);
+  server->set_on_body([](const NativeHttpServer::Request &request, size_t received)
+                      {
+                        size_t in_use = heap_in_use();
+                        if (in_use > peak_heap)
+                        {
+                          peak_heap = in_use;
+                        }
+                      });
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, transcribe(connections, "/long.wav", transcription));
+  server->set_on_body(nullptr);
+  return peak_heap - baseline;
+}
+
+void test_memory_does_not_grow_with_length()
+{
+  size_t short_peak = peak_heap_for(100 * 1024);
+  size_t long_peak = peak_heap_for(4 * 1024 * 1024);
+  char message[120];
+  snprintf(message, sizeof(message), "heap used while sending: %zu bytes for 100 KB, %zu bytes for 4 MB", short_peak, long_peak);
+  TEST_MESSAGE(message);
+  // the old way needed more than the whole recording twice over
+  TEST_ASSERT_LESS_THAN(16 * 1024, long_peak);
+  TEST_ASSERT_LESS_THAN(short_peak + 4 * 1024, long_peak);
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("gemini_upload");
+  device->select();
+  SD.begin();
+  server = new NativeHttpServer([](const NativeHttpServer::Request &request)
+                                {
+                                  NativeHttpServer::Response response;
+                                  response.body = RESPONSE;
+                                  return response;
+                                });
+  server->route(GEMINI_HOST);
+  UNITY_BEGIN();
+  RUN_TEST(test_request_body);
+  RUN_TEST(test_file_cut_short);
+  RUN_TEST(test_memory_does_not_grow_with_length);
+  int result = UNITY_END();
+  delete server;
+  return result;
+}
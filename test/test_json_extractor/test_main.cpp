@@ -0,0 +1,230 @@
+// Feeds Gemini responses to the JSON text extractor in pieces the way HTTPClient::writeToStream does and
+// checks the transcription that comes out, then measures the most heap it needs next to holding the whole
+// response the way the getString and 4 KB JSON document did - run with `pio test -e native -f test_json_extractor`
+#include <Arduino.h>
+#include <unity.h>
+#include <malloc.h>
+#include <chrono>
+#include <string>
+#include "JsonTextExtractor.h"
+
+#define TEXT_PATH "candidates.0.content.parts.*.text"
+// the document transcribeAudio used to parse the response into
+#define OLD_DOCUMENT_SIZE 4096
+// what HTTPClient reads off the connection at a time
+#define TCP_BUFFER_SIZE 1460
+
+// Gemini pretty prints its responses - this is one with everything it sends around the text
+static const char *SHORT_RESPONSE = R"({
+  "candidates": [
+    {
+      "content": {
+        "parts": [
+          {
+            "text": "Copiado, câmbio.\n"
+          }
+        ],
+        "role": "model"
+      },
+      "finishReason": "STOP",
+      "avgLogprobs": -0.0123,
+      "safetyRatings": [
+        { "category": "HARM_CATEGORY_HATE_SPEECH", "probability": "NEGLIGIBLE" },
+        { "category": "HARM_CATEGORY_DANGEROUS_CONTENT", "probability": "NEGLIGIBLE" },
+        { "category": "HARM_CATEGORY_HARASSMENT", "probability": "NEGLIGIBLE" },
+        { "category": "HARM_CATEGORY_SEXUALLY_EXPLICIT", "probability": "NEGLIGIBLE" }
+      ]
+    }
+  ],
+  "usageMetadata": {
+    "promptTokenCount": 112,
+    "candidatesTokenCount": 6,
+    "totalTokenCount": 118,
+    "promptTokensDetails": [ { "modality": "AUDIO", "tokenCount": 104 }, { "modality": "TEXT", "tokenCount": 8 } ]
+  },
+  "modelVersion": "gemini-1.5-flash"
+})";
+
+// text split over parts with escapes, a second candidate and a text key somewhere else that mustn't be picked up
+static const char *MIXED_RESPONSE = R"({"candidates":[{"content":{"parts":[{"text":"Ele disse \"ok\" — "},)"
+                                    R"({"inlineData":{"mimeType":"text/plain","data":"aWdub3Jl"}},{"text":"tudo certo 📝\ttab\\"}],)"
+                                    R"("role":"model"},"finishReason":"STOP","citationMetadata":{"text":"not this"}},)"
+                                    R"({"content":{"parts":[{"text":"second candidate"}]}}],"text":"nor this"})";
+static const char *MIXED_TEXT = "Ele disse \"ok\" — tudo certo 📝\ttab\\";
+
+static uint32_t random_seed = 1;
+
+static uint32_t random_number()
+{
+  random_seed = random_seed * 1664525 + 1013904223;
+  return random_seed >> 8;
+}
+
+static size_t heap_in_use()
+{
+  return mallinfo2().uordblks;
+}
+
+// a batch answer of about length bytes - one numbered line per recording
+static std::string long_transcript(size_t length)
+{
+  std::string text;
+  for (int line = 1; text.size() < length; line++)
+  {
+    text += std::to_string(line) + ": Unidade " + std::to_string(line * 7 % 13) +
+            " na posição, aguardando instruções. Câmbio \"copiado\".\n";
+  }
+  return text;
+}
+
+static std::string json_escape(const std::string &text)
+{
+  std::string escaped;
+  for (char c : text)
+  {
+    switch (c)
+    {
+    case '"':
+      escaped += "\\\"";
+      break;
+    case '\\':
+      escaped += "\\\\";
+      break;
+    case '\n':
+      escaped += "\\n";
+      break;
+    default:
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+static std::string response_for(const std::string &text)
+{
+  return "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"" + json_escape(text) +
+         "\"}],\"role\":\"model\"},\"finishReason\":\"STOP\"}],"
+         "\"usageMetadata\":{\"promptTokenCount\":4000,\"totalTokenCount\":9000}}";
+}
+
+// hand the response over in random sized pieces - returns the most the heap grew by
+static size_t extract(JsonTextExtractor &extractor, const std::string &response, size_t max_piece)
+{
+  size_t baseline = heap_in_use();
+  size_t peak = baseline;
+  size_t position = 0;
+  while (position < response.size())
+  {
+    size_t piece = std::min<size_t>(1 + random_number() % max_piece, response.size() - position);
+    TEST_ASSERT_EQUAL(piece, extractor.write((const uint8_t *)&response[position], piece));
+    position += piece;
+    peak = std::max(peak, heap_in_use());
+  }
+  extractor.text();
+  peak = std::max(peak, heap_in_use());
+  return peak - baseline;
+}
+
+void setUp()
+{
+  random_seed = 1;
+}
+
+void tearDown() {}
+
+void test_sample_responses()
+{
+  // a byte at a time and bigger pieces give the same answer
+  const size_t pieces[] = {1, 7, TCP_BUFFER_SIZE};
+  for (size_t max_piece : pieces)
+  {
+    JsonTextExtractor short_extractor(TEXT_PATH);
+    extract(short_extractor, SHORT_RESPONSE, max_piece);
+    TEST_ASSERT_TRUE(short_extractor.finished());
+    TEST_ASSERT_EQUAL_STRING("Copiado, câmbio.\n", short_extractor.text().c_str());
+
+    JsonTextExtractor mixed_extractor(TEXT_PATH);
+    extract(mixed_extractor, MIXED_RESPONSE, max_piece);
+    TEST_ASSERT_TRUE(mixed_extractor.finished());
+    TEST_ASSERT_EQUAL_STRING(MIXED_TEXT, mixed_extractor.text().c_str());
+  }
+}
+
+void test_long_transcript()
+{
+  // far more than fitted in the old document
+  std::string text = long_transcript(64 * 1024);
+  JsonTextExtractor extractor(TEXT_PATH);
+  extract(extractor, response_for(text), TCP_BUFFER_SIZE);
+  TEST_ASSERT_TRUE(extractor.finished());
+  TEST_ASSERT_EQUAL(text.size(), extractor.text().length());
+  TEST_ASSERT_TRUE(text == extractor.text().c_str());
+}
+
+void test_cut_short()
+{
+  std::string response = SHORT_RESPONSE;
+  JsonTextExtractor extractor(TEXT_PATH);
+  extract(extractor, response.substr(0, response.size() / 2), TCP_BUFFER_SIZE);
+  TEST_ASSERT_FALSE(extractor.finished());
+  TEST_ASSERT_FALSE(extractor.failed());
+
+  JsonTextExtractor broken(TEXT_PATH);
+  extract(broken, "{\"candidates\":[}", TCP_BUFFER_SIZE);
+  TEST_ASSERT_TRUE(broken.failed());
+  TEST_ASSERT_FALSE(broken.finished());
+}
+
+void test_heap_benchmark()
+{
+  const size_t lengths[] = {100, 4 * 1024, 64 * 1024};
+  for (size_t length : lengths)
+  {
+    std::string text = long_transcript(length);
+    std::string response = response_for(text);
+
+    JsonTextExtractor *extractor = new JsonTextExtractor(TEXT_PATH);
+    auto start = std::chrono::steady_clock::now();
+    size_t extractor_peak = extract(*extractor, response, TCP_BUFFER_SIZE);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TEST_ASSERT_TRUE(extractor->finished());
+    delete extractor;
+
+    // the old way - getString reserved the Content-Length and read the whole response into it, it was
+    // parsed into the document and the text copied out of that
+    size_t baseline = heap_in_use();
+    String *whole = new String();
+    whole->reserve(response.size());
+    size_t position = 0;
+    while (position < response.size())
+    {
+      size_t piece = std::min<size_t>(TCP_BUFFER_SIZE, response.size() - position);
+      whole->concat(&response[position], piece);
+      position += piece;
+    }
+    String *transcription = new String(text.c_str());
+    size_t old_peak = heap_in_use() - baseline + OLD_DOCUMENT_SIZE;
+    delete transcription;
+    delete whole;
+
+    char message[200];
+    snprintf(message, sizeof(message), "%zu byte transcript in a %zu byte response: heap grew by %zu bytes (%.0f%% of the text) "
+                                       "against %zu holding the response, %.0f MB/s",
+             text.size(), response.size(), extractor_peak, 100.0 * extractor_peak / text.size(), old_peak,
+             response.size() / seconds / (1024 * 1024));
+    TEST_MESSAGE(message);
+    // nothing but the text with room for the String to grow into
+    TEST_ASSERT_LESS_THAN(text.size() * 2 + 256, extractor_peak);
+    TEST_ASSERT_LESS_THAN(old_peak, extractor_peak);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_sample_responses);
+  RUN_TEST(test_long_transcript);
+  RUN_TEST(test_cut_short);
+  RUN_TEST(test_heap_benchmark);
+  return UNITY_END();
+}
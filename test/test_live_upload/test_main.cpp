@@ -0,0 +1,180 @@
+// Records into a live upload in real time while the upload side sends it to a local stand-in for Gemini
+// over a link not much faster than the audio, then measures how long after the button is released the
+// transcription arrives - next to sending the whole recording after the release the way it used to be -
+// and checks the body that arrived - run with `pio test -e native -f test_live_upload`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "NativeDevice.h"
+#include "NativeHttpServer.h"
+#include "HttpConnections.h"
+#include "FileRequestStream.h"
+#include "JsonTextExtractor.h"
+#include "LiveUpload.h"
+#include "SdRecorder.h"
+
+#define SAMPLE_RATE 16000
+// what the transmit loop reads from the microphone in one go
+#define BLOCK_SIZE 128
+#define RECORDING_SECONDS 4
+#define GEMINI_HOST "generativelanguage.googleapis.com"
+#define GEMINI_URL "https://" GEMINI_HOST "/v1beta/models/gemini-1.5-flash:generateContent?key=test"
+#define REQUEST_PREFIX "{\"contents\":[{\"parts\":[{\"text\":\"Transcribe\"},{\"inlineData\":{\"mimeType\":\"audio/wav\",\"data\":\""
+#define REQUEST_SUFFIX "\"}}]}]}"
+#define RESPONSE "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"copiado\"}],\"role\":\"model\"}}]}"
+// base64 16kHz audio is about 43 KB/s - a link with a little room to spare
+#define LINK_BYTES_PER_SECOND 64000
+// how long the model takes to answer once it has the audio
+#define MODEL_MS 300
+// the transcription should be ready this long after the release on top of the model's time
+#define LATENCY_TARGET_MS 1000
+
+static NativeDevice *device;
+static NativeHttpServer *server;
+
+static int16_t sample(uint32_t i)
+{
+  return 8000 * sinf(2 * M_PI * 300 * i / SAMPLE_RATE) + (int16_t)(i * 7919) / 256;
+}
+
+static std::string base64(const std::string &data)
+{
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  for (size_t i = 0; i < data.size(); i += 3)
+  {
+    uint32_t group = (uint8_t)data[i] << 16;
+    group |= i + 1 < data.size() ? (uint8_t)data[i + 1] << 8 : 0;
+    group |= i + 2 < data.size() ? (uint8_t)data[i + 2] : 0;
+    encoded += alphabet[group >> 18];
+    encoded += alphabet[(group >> 12) & 0x3f];
+    encoded += i + 1 < data.size() ? alphabet[(group >> 6) & 0x3f] : '=';
+    encoded += i + 2 < data.size() ? alphabet[group & 0x3f] : '=';
+  }
+  return encoded;
+}
+
+// the microphone - a block at a time at the rate it's captured, returns the audio as it should arrive
+static std::string record(LiveUpload &live, uint32_t samples)
+{
+  std::string audio;
+  int16_t block[BLOCK_SIZE];
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t position = 0; position < samples; position += BLOCK_SIZE)
+  {
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+      block[i] = sample(position + i);
+    }
+    live.write(block, BLOCK_SIZE);
+    audio.append((const char *)block, sizeof(block));
+    std::this_thread::sleep_until(start + std::chrono::microseconds(1000000ull * (position + BLOCK_SIZE) / SAMPLE_RATE));
+  }
+  live.stop();
+  return audio;
+}
+
+void setUp()
+{
+  server->set_bytes_per_second(LINK_BYTES_PER_SECOND);
+}
+
+void tearDown() {}
+
+void test_release_to_transcript_latency()
+{
+  HttpConnectionManager connections;
+  LiveUpload *live = new LiveUpload(SAMPLE_RATE);
+  TEST_ASSERT_TRUE(live->start());
+  JsonTextExtractor extractor("candidates.0.content.parts.*.text");
+  int status = 0;
+  std::thread upload([&]()
+                     { status = live->send(connections.connection(GEMINI_URL), GEMINI_URL, REQUEST_PREFIX, REQUEST_SUFFIX, &extractor); });
+  std::string audio = record(*live, RECORDING_SECONDS * SAMPLE_RATE);
+  upload.join();
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, status);
+  TEST_ASSERT_TRUE(extractor.finished());
+  TEST_ASSERT_EQUAL_STRING("copiado", extractor.text().c_str());
+  uint32_t live_ms = live->latency_ms();
+
+  // the body is the WAV - with a header that runs to the end - sent as it was recorded
+  NativeHttpServer::Request request = server->received().back();
+  TEST_ASSERT_TRUE(request.chunked);
+  uint8_t header[WAV_HEADER_SIZE];
+  SdRecorder::make_wav_header(header, SAMPLE_RATE, UINT32_MAX - (WAV_HEADER_SIZE - 8));
+  std::string expected = REQUEST_PREFIX + base64(std::string((const char *)header, sizeof(header)) + audio) + REQUEST_SUFFIX;
+  TEST_ASSERT_TRUE(expected == request.body);
+
+  // the way it was - the whole recording sent from the card once the button is released
+  File file = SD.open("/recording.wav", FILE_WRITE);
+  SdRecorder::make_wav_header(header, SAMPLE_RATE, audio.size());
+  file.write(header, sizeof(header));
+  file.write((const uint8_t *)audio.data(), audio.size());
+  file.close();
+  auto released = std::chrono::steady_clock::now();
+  file = SD.open("/recording.wav");
+  HttpConnection &connection = connections.connection(GEMINI_URL);
+  TEST_ASSERT_TRUE(connection.begin(GEMINI_URL));
+  FileRequestStream body(REQUEST_PREFIX, file, true, REQUEST_SUFFIX);
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, connection.http().sendRequest("POST", &body, body.size()));
+  JsonTextExtractor after("candidates.0.content.parts.*.text");
+  connection.http().writeToStream(&after);
+  connection.end();
+  file.close();
+  uint32_t after_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - released).count();
+  TEST_ASSERT_EQUAL_STRING("copiado", after.text().c_str());
+
+  char message[160];
+  snprintf(message, sizeof(message), "%d s recording, model takes %d ms: transcript %u ms after release live, %u ms sent after release",
+           RECORDING_SECONDS, MODEL_MS, live_ms, after_ms);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(MODEL_MS + LATENCY_TARGET_MS, live_ms);
+  TEST_ASSERT_LESS_THAN(after_ms, live_ms);
+  delete live;
+}
+
+void test_abandoned_when_upload_task_is_busy()
+{
+  // nobody reads the audio for over a second so the session is given up and the recording is sent from the card
+  HttpConnectionManager connections;
+  LiveUpload *live = new LiveUpload(SAMPLE_RATE);
+  TEST_ASSERT_TRUE(live->start());
+  int16_t block[BLOCK_SIZE] = {};
+  for (int i = 0; i < LIVE_UPLOAD_BUFFER_SAMPLES / BLOCK_SIZE + 1; i++)
+  {
+    live->write(block, BLOCK_SIZE);
+  }
+  live->stop();
+  int requests = server->requests();
+  JsonTextExtractor extractor("candidates.0.content.parts.*.text");
+  TEST_ASSERT_EQUAL(-1, live->send(connections.connection(GEMINI_URL), GEMINI_URL, REQUEST_PREFIX, REQUEST_SUFFIX, &extractor));
+  TEST_ASSERT_EQUAL(requests, server->requests());
+  // and the next one can go
+  TEST_ASSERT_TRUE(live->start());
+  live->cancel();
+  delete live;
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("live_upload");
+  device->select();
+  SD.begin();
+  server = new NativeHttpServer([](const NativeHttpServer::Request &request)
+                                {
+                                  NativeHttpServer::Response response;
+                                  response.body = RESPONSE;
+                                  response.delay_ms = MODEL_MS;
+                                  return response;
+                                });
+  server->route(GEMINI_HOST);
+  UNITY_BEGIN();
+  RUN_TEST(test_release_to_transcript_latency);
+  RUN_TEST(test_abandoned_when_upload_task_is_busy);
+  int result = UNITY_END();
+  delete server;
+  return result;
+}
@@ -0,0 +1,190 @@
+// Checks each sender gets a stream of its own, that the mix adds up without wrapping, that idle streams are
+// let go and which sender spoke last, then measures what each extra stream costs to mix - run with
+// `pio test -e native -f test_mixer`
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include "NativeDevice.h"
+#include "StreamMixer.h"
+#include "OutputBuffer.h"
+
+#define SAMPLE_RATE 16000
+#define MAX_SAMPLES_TO_BUFFER (200 * 16)
+#define FRAME_SIZE 160
+#define BLOCK_SIZE 128
+#define BENCHMARK_BLOCKS 200000
+
+static uint8_t addresses[MIXER_MAX_STREAMS + 1][MIXER_ADDRESS_SIZE];
+
+static void fill(int16_t *samples, int count, int16_t value)
+{
+  for (int i = 0; i < count; i++)
+  {
+    samples[i] = value;
+  }
+}
+
+// claim a stream for the sender and give it enough audio to start playing
+static int talk(StreamMixer &mixer, int sender, int16_t value)
+{
+  bool is_new;
+  int stream = mixer.claim_stream(addresses[sender], is_new);
+  if (stream < 0)
+  {
+    return stream;
+  }
+  OutputBuffer *output_buffer = mixer.output_buffer(stream);
+  output_buffer->set_target_depth(FRAME_SIZE);
+  int16_t frame[FRAME_SIZE];
+  fill(frame, FRAME_SIZE, value);
+  for (int i = 0; i < 4; i++)
+  {
+    output_buffer->add_samples(frame, FRAME_SIZE);
+  }
+  return stream;
+}
+
+void setUp()
+{
+  native_set_clock(0);
+  for (int i = 0; i <= MIXER_MAX_STREAMS; i++)
+  {
+    memset(addresses[i], 0, MIXER_ADDRESS_SIZE);
+    addresses[i][0] = 0x02;
+    addresses[i][5] = i + 1;
+  }
+}
+
+void tearDown() {}
+
+void test_senders_get_their_own_streams()
+{
+  StreamMixer mixer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  int first = talk(mixer, 0, 1000 << 3);
+  int second = talk(mixer, 1, 2000 << 3);
+  TEST_ASSERT_NOT_EQUAL(first, second);
+  // the same sender again goes to the same stream
+  bool is_new;
+  TEST_ASSERT_EQUAL(first, mixer.claim_stream(addresses[0], is_new));
+  TEST_ASSERT_FALSE(is_new);
+  int16_t block[BLOCK_SIZE];
+  mixer.remove_samples(block, BLOCK_SIZE);
+  TEST_ASSERT_EQUAL(3000, block[0]);
+  TEST_ASSERT_EQUAL(3000, block[BLOCK_SIZE - 1]);
+}
+
+void test_too_many_senders()
+{
+  StreamMixer mixer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    TEST_ASSERT_GREATER_OR_EQUAL(0, talk(mixer, i, 100));
+  }
+  TEST_ASSERT_EQUAL(-1, talk(mixer, MIXER_MAX_STREAMS, 100));
+  TEST_ASSERT_EQUAL(1, mixer.rejected());
+}
+
+void test_loudest_mix_does_not_wrap()
+{
+  // streams are scaled down by 8 so even all of them at full scale add up without wrapping round
+  StreamMixer mixer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  StreamMixer negative_mixer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    talk(mixer, i, INT16_MAX);
+    talk(negative_mixer, i, INT16_MIN);
+  }
+  int16_t block[BLOCK_SIZE];
+  mixer.remove_samples(block, BLOCK_SIZE);
+  TEST_ASSERT_EQUAL(MIXER_MAX_STREAMS * (INT16_MAX >> 3), block[0]);
+  negative_mixer.remove_samples(block, BLOCK_SIZE);
+  TEST_ASSERT_EQUAL(MIXER_MAX_STREAMS * (INT16_MIN >> 3), block[0]);
+}
+
+void test_idle_streams_are_let_go()
+{
+  StreamMixer mixer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    talk(mixer, i, 100);
+  }
+  int16_t block[BLOCK_SIZE];
+  native_set_clock((MIXER_STREAM_TIMEOUT_MS + 1) * 1000ull);
+  mixer.remove_samples(block, BLOCK_SIZE);
+  for (int i = 0; i < MIXER_MAX_STREAMS; i++)
+  {
+    TEST_ASSERT_FALSE(mixer.is_active(i));
+  }
+  // so a new sender gets in
+  TEST_ASSERT_GREATER_OR_EQUAL(0, talk(mixer, MIXER_MAX_STREAMS, 100));
+}
+
+void test_latest_stream_is_who_spoke_last()
+{
+  StreamMixer mixer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  TEST_ASSERT_EQUAL(-1, mixer.latest_stream());
+  int first = talk(mixer, 0, 100);
+  native_set_clock(500000);
+  int second = talk(mixer, 1, 100);
+  TEST_ASSERT_EQUAL(second, mixer.latest_stream());
+  // the first sender is still active but the second is who we heard last until the first speaks again
+  TEST_ASSERT_TRUE(mixer.is_active(first));
+  TEST_ASSERT_EQUAL(500, mixer.last_seen(second));
+  native_set_clock(600000);
+  talk(mixer, 0, 100);
+  TEST_ASSERT_EQUAL(first, mixer.latest_stream());
+}
+
+void test_benchmark()
+{
+  char message[120];
+  double previous_ns = 0;
+  for (int streams = 0; streams <= MIXER_MAX_STREAMS; streams++)
+  {
+    StreamMixer mixer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+    int16_t frame[FRAME_SIZE];
+    fill(frame, FRAME_SIZE, 1000);
+    for (int i = 0; i < streams; i++)
+    {
+      talk(mixer, i, 1000);
+    }
+    int16_t block[BLOCK_SIZE];
+    int64_t checksum = 0;
+    double total_ns = 0;
+    for (int i = 0; i < BENCHMARK_BLOCKS; i++)
+    {
+      // keep every stream topped up the way the receive task would - 4 frames for every 5 blocks
+      if (i % 5 < 4)
+      {
+        for (int j = 0; j < streams; j++)
+        {
+          mixer.output_buffer(j)->add_samples(frame, FRAME_SIZE);
+        }
+      }
+      // and only time the mixing
+      auto start = std::chrono::steady_clock::now();
+      mixer.remove_samples(block, BLOCK_SIZE);
+      total_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      checksum += block[i % BLOCK_SIZE];
+    }
+    double mix_ns = total_ns / BENCHMARK_BLOCKS;
+    snprintf(message, sizeof(message), "%d streams: %.0f ns per %d sample block (+%.0f ns) [%lld]",
+             streams, mix_ns, BLOCK_SIZE, mix_ns - previous_ns, (long long)checksum);
+    TEST_MESSAGE(message);
+    previous_ns = mix_ns;
+  }
+  // a block has to be mixed in well under the time it takes to play
+  TEST_ASSERT_LESS_THAN(1000000000.0 * BLOCK_SIZE / SAMPLE_RATE / 100, previous_ns);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_senders_get_their_own_streams);
+  RUN_TEST(test_too_many_senders);
+  RUN_TEST(test_loudest_mix_does_not_wrap);
+  RUN_TEST(test_idle_streams_are_let_go);
+  RUN_TEST(test_latest_stream_is_who_spoke_last);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
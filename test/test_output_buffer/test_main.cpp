@@ -0,0 +1,271 @@
+// Runs the output buffer's producer and consumer on separate threads, checks reset and flush are
+// left to the consumer and compares it with the semaphore buffer it replaced - run with
+// `pio test -e native -f test_output_buffer`
+#include <Arduino.h>
+#include <unity.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "OutputBuffer.h"
+
+#define SAMPLE_RATE 16000
+#define MAX_SAMPLES_TO_BUFFER (200 * 16)
+#define FRAME_SIZE 160
+#define BLOCK_SIZE 128
+// samples pushed through by the concurrency test and the benchmark
+#define CONCURRENT_SAMPLES (16 * 1024 * 1024)
+#define BENCHMARK_SAMPLES (16 * 1024 * 1024)
+
+// the output buffer as it was before it went lock free - one semaphore for both sides and a
+// modulo for every sample
+class SemaphoreOutputBuffer
+{
+private:
+  int m_number_samples_to_buffer;
+  int m_read_head;
+  int m_write_head;
+  int m_available_samples;
+  int m_buffer_size;
+  bool m_buffering;
+  uint8_t *m_buffer;
+  SemaphoreHandle_t m_semaphore;
+
+public:
+  SemaphoreOutputBuffer(int number_samples_to_buffer) : m_number_samples_to_buffer(number_samples_to_buffer)
+  {
+    m_semaphore = xSemaphoreCreateBinary();
+    xSemaphoreGive(m_semaphore);
+    m_read_head = 0;
+    m_write_head = 0;
+    m_available_samples = 0;
+    m_buffering = true;
+    m_buffer_size = 3 * number_samples_to_buffer;
+    m_buffer = (uint8_t *)malloc(m_buffer_size);
+    memset(m_buffer, 0, m_buffer_size);
+  }
+
+  ~SemaphoreOutputBuffer()
+  {
+    free(m_buffer);
+  }
+
+  void add_samples(const uint8_t *samples, int count)
+  {
+    xSemaphoreTake(m_semaphore, portMAX_DELAY);
+    if (m_available_samples + count <= m_buffer_size)
+    {
+      for (int i = 0; i < count; i++)
+      {
+        m_buffer[m_write_head] = samples[i];
+        m_write_head = (m_write_head + 1) % m_buffer_size;
+      }
+      m_available_samples += count;
+    }
+    xSemaphoreGive(m_semaphore);
+  }
+
+  void remove_samples(int16_t *samples, int count)
+  {
+    xSemaphoreTake(m_semaphore, portMAX_DELAY);
+    for (int i = 0; i < count; i++)
+    {
+      samples[i] = 0;
+      if (m_available_samples == 0 && !m_buffering)
+      {
+        m_buffering = true;
+      }
+      if (m_buffering && m_available_samples < m_number_samples_to_buffer)
+      {
+        samples[i] = 0;
+      }
+      else
+      {
+        m_buffering = false;
+        int16_t sample = m_buffer[m_read_head];
+        samples[i] = (sample - 128) << 5;
+        m_read_head = (m_read_head + 1) % m_buffer_size;
+        m_available_samples--;
+      }
+    }
+    xSemaphoreGive(m_semaphore);
+  }
+};
+
+// what comes out for sample number i once the buffer has scaled it down
+static int16_t expected(uint32_t i)
+{
+  return (int16_t)(i << 3) >> 3;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_producer_and_consumer_threads()
+{
+  OutputBuffer output_buffer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  // how far each side has got - they keep within the buffer's size of each other so nothing is
+  // dropped or made up, but otherwise they run flat out against each other
+  std::atomic<uint32_t> written(0);
+  std::atomic<uint32_t> read(0);
+  std::thread producer([&]()
+                       {
+                         int16_t frame[FRAME_SIZE];
+                         for (uint32_t position = 0; position < CONCURRENT_SAMPLES; position += FRAME_SIZE)
+                         {
+                           while (position + FRAME_SIZE - read.load() > 2 * MAX_SAMPLES_TO_BUFFER)
+                           {
+                             std::this_thread::yield();
+                           }
+                           for (int i = 0; i < FRAME_SIZE; i++)
+                           {
+                             frame[i] = (position + i) << 3;
+                           }
+                           output_buffer.add_samples(frame, FRAME_SIZE);
+                           written.store(position + FRAME_SIZE);
+                         } });
+  int16_t block[BLOCK_SIZE];
+  uint32_t errors = 0;
+  for (uint32_t position = 0; position + BLOCK_SIZE <= CONCURRENT_SAMPLES - FRAME_SIZE; position += BLOCK_SIZE)
+  {
+    // wait until the first read will find enough buffered to start playing and after that for a whole block
+    uint32_t needed = position + BLOCK_SIZE + (position == 0 ? MAX_SAMPLES_TO_BUFFER : 0);
+    while (written.load() < needed)
+    {
+      std::this_thread::yield();
+    }
+    output_buffer.remove_samples(block, BLOCK_SIZE);
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+      errors += block[i] != expected(position + i);
+    }
+    read.store(position + BLOCK_SIZE);
+  }
+  producer.join();
+  TEST_ASSERT_EQUAL(0, errors);
+  TEST_ASSERT_EQUAL(0, output_buffer.underruns());
+}
+
+void test_flush_is_done_by_the_consumer()
+{
+  OutputBuffer output_buffer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  output_buffer.set_target_depth(FRAME_SIZE);
+  int16_t frame[FRAME_SIZE];
+  for (int i = 0; i < FRAME_SIZE; i++)
+  {
+    frame[i] = 1000 << 3;
+  }
+  output_buffer.add_samples(frame, FRAME_SIZE);
+  // from somewhere other than the playback loop - nothing changes until the consumer next reads
+  std::thread([&]()
+              { output_buffer.flush(); })
+      .join();
+  int16_t block[BLOCK_SIZE];
+  output_buffer.remove_samples(block, BLOCK_SIZE);
+  for (int i = 0; i < BLOCK_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL(0, block[i]);
+  }
+  // and it starts playing again from what's written next
+  for (int i = 0; i < FRAME_SIZE; i++)
+  {
+    frame[i] = 2000 << 3;
+  }
+  output_buffer.add_samples(frame, FRAME_SIZE);
+  output_buffer.remove_samples(block, BLOCK_SIZE);
+  TEST_ASSERT_EQUAL(2000, block[BLOCK_SIZE - 1]);
+  TEST_ASSERT_EQUAL(0, output_buffer.underruns());
+}
+
+void test_reset_keeps_the_new_stream()
+{
+  OutputBuffer output_buffer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  int16_t frame[FRAME_SIZE];
+  for (int i = 0; i < FRAME_SIZE; i++)
+  {
+    frame[i] = 1000 << 3;
+  }
+  output_buffer.add_samples(frame, FRAME_SIZE);
+  // a new sender takes the stream over and gets audio in before the consumer comes round
+  output_buffer.reset();
+  output_buffer.set_target_depth(FRAME_SIZE);
+  for (int i = 0; i < FRAME_SIZE; i++)
+  {
+    frame[i] = 2000 << 3;
+  }
+  output_buffer.add_samples(frame, FRAME_SIZE);
+  int16_t block[BLOCK_SIZE];
+  output_buffer.remove_samples(block, BLOCK_SIZE);
+  for (int i = 0; i < BLOCK_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL(2000, block[i]);
+  }
+}
+
+void test_benchmark()
+{
+  // the same traffic through both - a frame in then a block out, kept topped up so neither ever runs dry
+  OutputBuffer output_buffer(MAX_SAMPLES_TO_BUFFER, SAMPLE_RATE);
+  SemaphoreOutputBuffer semaphore_buffer(MAX_SAMPLES_TO_BUFFER);
+  int16_t frame[FRAME_SIZE];
+  uint8_t frame8[FRAME_SIZE];
+  for (int i = 0; i < FRAME_SIZE; i++)
+  {
+    frame[i] = 1000 * sinf(2 * M_PI * i / FRAME_SIZE);
+    frame8[i] = 128 + (frame[i] >> 8);
+  }
+  int16_t block[BLOCK_SIZE];
+  int64_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i * FRAME_SIZE < MAX_SAMPLES_TO_BUFFER + BLOCK_SIZE; i++)
+  {
+    output_buffer.add_samples(frame, FRAME_SIZE);
+  }
+  for (uint32_t position = 0; position < BENCHMARK_SAMPLES; position += BLOCK_SIZE)
+  {
+    if (position % FRAME_SIZE < BLOCK_SIZE)
+    {
+      output_buffer.add_samples(frame, FRAME_SIZE);
+    }
+    output_buffer.remove_samples(block, BLOCK_SIZE);
+    checksum += block[position % BLOCK_SIZE];
+  }
+  auto lock_free_end = std::chrono::steady_clock::now();
+  for (int i = 0; i * FRAME_SIZE < MAX_SAMPLES_TO_BUFFER + BLOCK_SIZE; i++)
+  {
+    semaphore_buffer.add_samples(frame8, FRAME_SIZE);
+  }
+  for (uint32_t position = 0; position < BENCHMARK_SAMPLES; position += BLOCK_SIZE)
+  {
+    if (position % FRAME_SIZE < BLOCK_SIZE)
+    {
+      semaphore_buffer.add_samples(frame8, FRAME_SIZE);
+    }
+    semaphore_buffer.remove_samples(block, BLOCK_SIZE);
+    checksum += block[position % BLOCK_SIZE];
+  }
+  auto semaphore_end = std::chrono::steady_clock::now();
+
+  double lock_free_ns = std::chrono::duration<double, std::nano>(lock_free_end - start).count() / BENCHMARK_SAMPLES;
+  double semaphore_ns = std::chrono::duration<double, std::nano>(semaphore_end - lock_free_end).count() / BENCHMARK_SAMPLES;
+  char message[160];
+  snprintf(message, sizeof(message), "lock free: %.2f ns per sample, semaphore: %.2f ns per sample (%.1fx) [%lld]",
+           lock_free_ns, semaphore_ns, semaphore_ns / lock_free_ns, (long long)checksum);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(0, output_buffer.underruns());
+  TEST_ASSERT_LESS_THAN(semaphore_ns, lock_free_ns);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_producer_and_consumer_threads);
+  RUN_TEST(test_flush_is_done_by_the_consumer);
+  RUN_TEST(test_reset_keeps_the_new_stream);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,214 @@
+// Drops frames at a range of rates on their way into an OutputBuffer and reports the underruns and
+// how continuous the playback was - run with `pio test -e native -f test_packet_loss`
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "NativeDevice.h"
+#include "OutputBuffer.h"
+
+#define SAMPLE_RATE 16000
+// 10ms frames from the sender and 8ms blocks pulled by the playback loop
+#define FRAME_SIZE 160
+#define BLOCK_SIZE 128
+#define FRAME_US (1000000 * FRAME_SIZE / SAMPLE_RATE)
+#define BLOCK_US (1000000 * BLOCK_SIZE / SAMPLE_RATE)
+#define TALK_SECONDS 10
+// the rates we try - change these to look at other rates
+static const float LOSS_RATES[] = {0, 0.01f, 0.05f, 0.1f, 0.2f};
+
+struct LossResult
+{
+  uint32_t lost;
+  uint32_t underruns;
+  uint32_t gap_samples;
+  // sample to sample jumps far bigger than anything in the signal
+  int clicks;
+  // blocks of silence while the sender was talking
+  int silent_blocks;
+};
+
+static uint32_t random_state;
+
+static float random_uniform()
+{
+  random_state = random_state * 1664525 + 1013904223;
+  return (random_state >> 8) * (1.0f / 16777216.0f);
+}
+
+// a 140Hz voice with a few harmonics
+static void make_voice(std::vector<int16_t> &samples)
+{
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    float t = (float)i / SAMPLE_RATE;
+    float voice = 0;
+    for (int harmonic = 1; harmonic <= 5; harmonic++)
+    {
+      voice += sinf(2 * M_PI * 140 * harmonic * t) / harmonic;
+    }
+    samples[i] = 8000 * voice;
+  }
+}
+
+static LossResult play(const std::vector<int16_t> &voice, float loss_rate, uint32_t seed)
+{
+  random_state = seed;
+  OutputBuffer output_buffer(200 * 16, SAMPLE_RATE);
+  int frames = voice.size() / FRAME_SIZE;
+  // frames turn up 2-4ms after they're sent
+  std::vector<uint64_t> arrivals(frames);
+  for (int i = 0; i < frames; i++)
+  {
+    arrivals[i] = (uint64_t)(i + 1) * FRAME_US + 2000 + (uint64_t)(2000 * random_uniform());
+  }
+  int max_step = 0;
+  for (size_t i = 1; i < voice.size(); i++)
+  {
+    max_step = std::max(max_step, abs((voice[i] >> 3) - (voice[i - 1] >> 3)));
+  }
+
+  LossResult result = {};
+  int next_frame = 0;
+  int16_t previous = 0;
+  bool playing = false;
+  int16_t samples[BLOCK_SIZE];
+  // stop before the sender does so running out at the end doesn't count
+  uint64_t end_us = (uint64_t)(frames - 5) * FRAME_US;
+  for (uint64_t now = BLOCK_US; now < end_us; now += BLOCK_US)
+  {
+    while (next_frame < frames && arrivals[next_frame] <= now)
+    {
+      native_set_clock(arrivals[next_frame]);
+      if (next_frame == 0 || random_uniform() >= loss_rate)
+      {
+        output_buffer.add_frame(next_frame, next_frame * FRAME_SIZE, &voice[next_frame * FRAME_SIZE], FRAME_SIZE, next_frame == 0, false);
+      }
+      next_frame++;
+    }
+    native_set_clock(now);
+    output_buffer.remove_samples(samples, BLOCK_SIZE);
+    int energy = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+      energy |= samples[i];
+      if (playing && abs(samples[i] - previous) > 2 * max_step)
+      {
+        result.clicks++;
+      }
+      previous = samples[i];
+    }
+    // count from when playback first starts
+    if (energy)
+    {
+      playing = true;
+    }
+    else if (playing)
+    {
+      result.silent_blocks++;
+    }
+  }
+  result.lost = output_buffer.jitter_buffer()->lost();
+  result.underruns = output_buffer.underruns();
+  result.gap_samples = output_buffer.gap_samples();
+  return result;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_loss_rates()
+{
+  std::vector<int16_t> voice(SAMPLE_RATE * TALK_SECONDS);
+  make_voice(voice);
+  // the jitter buffer can run dry once while it's starting up whether or not anything is lost
+  uint32_t startup_underruns = play(voice, 0, 1).underruns;
+  for (float loss_rate : LOSS_RATES)
+  {
+    LossResult result = play(voice, loss_rate, 1);
+    char message[160];
+    snprintf(message, sizeof(message), "%2.0f%% loss: %u frames lost, %u samples concealed, %u underruns, %d clicks, %d silent blocks",
+             loss_rate * 100, result.lost, result.gap_samples, result.underruns, result.clicks, result.silent_blocks);
+    TEST_MESSAGE(message);
+    // every lost frame is filled in where it was so playback never goes quiet - playback can run dry
+    // waiting for a lost frame before it's given up on but no more than once for each one
+    TEST_ASSERT_EQUAL(result.lost * FRAME_SIZE, result.gap_samples);
+    TEST_ASSERT_LESS_OR_EQUAL(startup_underruns + result.lost, result.underruns);
+    TEST_ASSERT_EQUAL(0, result.silent_blocks);
+    // the made up audio is faded in and out so the joins don't click
+    TEST_ASSERT_LESS_OR_EQUAL(result.lost, result.clicks);
+  }
+}
+
+void test_single_lost_frame_is_filled_exactly()
+{
+  std::vector<int16_t> voice(FRAME_SIZE * 10);
+  make_voice(voice);
+  OutputBuffer output_buffer(200 * 16, SAMPLE_RATE);
+  for (int i = 0; i < 10; i++)
+  {
+    native_set_clock((uint64_t)i * FRAME_US);
+    if (i != 4)
+    {
+      output_buffer.add_frame(i, i * FRAME_SIZE, &voice[i * FRAME_SIZE], FRAME_SIZE, i == 0, i == 9);
+    }
+  }
+  TEST_ASSERT_EQUAL(1, output_buffer.jitter_buffer()->lost());
+  TEST_ASSERT_EQUAL(FRAME_SIZE, output_buffer.gap_samples());
+  // everything after the gap is where it should be
+  std::vector<int16_t> played(FRAME_SIZE * 10);
+  output_buffer.remove_samples(played.data(), played.size());
+  for (int i = 6 * FRAME_SIZE; i < 10 * FRAME_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL(voice[i] >> 3, played[i]);
+  }
+  TEST_ASSERT_EQUAL(0, output_buffer.underruns());
+}
+
+void test_silence_is_not_filled()
+{
+  // the sender skipped 200ms of silence between these frames - that's not a lost frame
+  std::vector<int16_t> voice(FRAME_SIZE * 3);
+  make_voice(voice);
+  OutputBuffer output_buffer(200 * 16, SAMPLE_RATE);
+  output_buffer.add_frame(0, 0, &voice[0], FRAME_SIZE, true, false);
+  output_buffer.add_frame(1, 3200 + FRAME_SIZE, &voice[FRAME_SIZE], FRAME_SIZE, false, false);
+  output_buffer.add_frame(2, 3200 + 2 * FRAME_SIZE, &voice[2 * FRAME_SIZE], FRAME_SIZE, false, true);
+  TEST_ASSERT_EQUAL(0, output_buffer.jitter_buffer()->lost());
+  TEST_ASSERT_EQUAL(0, output_buffer.gap_samples());
+}
+
+void test_pitch_search_cost()
+{
+  // each loss event costs one pitch search - time a few thousand of them (the clock in micros()
+  // is the simulated one here)
+  std::vector<int16_t> voice(SAMPLE_RATE);
+  make_voice(voice);
+  PacketLossConcealer concealer;
+  int16_t samples[BLOCK_SIZE];
+  const int events = 2000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < events; i++)
+  {
+    concealer.push(&voice[(i * 97) % (SAMPLE_RATE - PLC_HISTORY_SIZE)], PLC_HISTORY_SIZE);
+    concealer.conceal(samples, BLOCK_SIZE);
+    concealer.resume(samples, BLOCK_SIZE);
+  }
+  long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  char message[64];
+  snprintf(message, sizeof(message), "%.1f us per loss event", (float)elapsed / events);
+  TEST_MESSAGE(message);
+  // a small fraction of the 8ms block on a PC
+  TEST_ASSERT_LESS_THAN(200L * events, elapsed);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_loss_rates);
+  RUN_TEST(test_single_lost_frame_is_filled_exactly);
+  RUN_TEST(test_silence_is_not_filled);
+  RUN_TEST(test_pitch_search_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,250 @@
+// Cuts the power part way through recordings and cuts finished recordings off at random points, then
+// checks what's left still reads back as the start of the recording and that no more than the loss
+// budget went missing - run with `pio test -e native -f test_power_cut`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "NativeDevice.h"
+#include "SdRecorder.h"
+#include "FlacCodec.h"
+
+#define SAMPLE_RATE 16000
+// what the transmit loop reads from the microphone in one go
+#define BLOCK_SIZE 128
+// recordings are captured this many times faster than real time
+#define SPEED_UP 16
+#define BLOCK_US (1000000 * BLOCK_SIZE / SAMPLE_RATE / SPEED_UP)
+#define RECORDING_SAMPLES (8 * SAMPLE_RATE)
+#define POWER_CUTS 12
+#define TRUNCATIONS 50
+
+static NativeDevice *device;
+// the writer task never stops so there's one recorder for all the tests
+static SdRecorder *recorder;
+static uint32_t random_seed = 1;
+
+static uint32_t random_number()
+{
+  random_seed = random_seed * 1664525 + 1013904223;
+  return random_seed >> 8;
+}
+
+// something between a tone and noise so the FLAC frames vary in size
+static int16_t sample(uint32_t i)
+{
+  return 6000 * sinf(2 * M_PI * 220 * i / SAMPLE_RATE) + (int16_t)(i * 7919) / 64;
+}
+
+static std::vector<uint8_t> read_file(const char *path)
+{
+  std::vector<uint8_t> data;
+  FILE *file = fopen(device->sd_path(path).c_str(), "rb");
+  if (file)
+  {
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+      data.insert(data.end(), buffer, buffer + read);
+    }
+    fclose(file);
+  }
+  return data;
+}
+
+static void write_file(const char *path, const uint8_t *data, size_t length)
+{
+  FILE *file = fopen(device->sd_path(path).c_str(), "wb");
+  fwrite(data, 1, length, file);
+  fclose(file);
+}
+
+// read back the samples the way the trimmer does - up to the size in the header for WAV, frame by frame
+// for FLAC - and check they're the start of what was recorded. Returns how many there were or -1
+static int recovered_samples(const std::vector<uint8_t> &data, bool lossless)
+{
+  if (!lossless)
+  {
+    if (data.size() < WAV_HEADER_SIZE || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0)
+    {
+      return -1;
+    }
+    uint32_t data_size;
+    memcpy(&data_size, data.data() + 40, sizeof(uint32_t));
+    uint32_t riff_size;
+    memcpy(&riff_size, data.data() + 4, sizeof(uint32_t));
+    if (riff_size != data_size + WAV_HEADER_SIZE - 8)
+    {
+      return -1;
+    }
+    uint32_t available = data.size() - WAV_HEADER_SIZE;
+    uint32_t count = (data_size < available ? data_size : available) / sizeof(int16_t);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      int16_t value;
+      memcpy(&value, data.data() + WAV_HEADER_SIZE + i * sizeof(int16_t), sizeof(int16_t));
+      if (value != sample(i))
+      {
+        return -1;
+      }
+    }
+    return count;
+  }
+  write_file("/cut.flac", data.data(), data.size());
+  File file = SD.open("/cut.flac");
+  FlacDecoder decoder(file);
+  if (!decoder.begin() || decoder.sample_rate() != SAMPLE_RATE)
+  {
+    return -1;
+  }
+  std::vector<int16_t> samples(FLAC_BLOCK_SIZE);
+  uint32_t count = 0;
+  int read;
+  while ((read = decoder.read(samples.data(), FLAC_BLOCK_SIZE)) > 0)
+  {
+    for (int i = 0; i < read; i++)
+    {
+      if (samples[i] != sample(count + i))
+      {
+        return -1;
+      }
+    }
+    count += read;
+  }
+  file.close();
+  return count;
+}
+
+// record in real time, only faster, copying the file off the card at power_cut_at samples as if the
+// power went then - returns how many samples were lost
+static int record_with_power_cut(const char *path, bool lossless, uint32_t power_cut_at)
+{
+  TEST_ASSERT_TRUE(recorder->start(path, SAMPLE_RATE, lossless));
+  int16_t block[BLOCK_SIZE];
+  std::vector<uint8_t> left;
+  auto next = std::chrono::steady_clock::now();
+  for (uint32_t position = 0; position < RECORDING_SAMPLES; position += BLOCK_SIZE)
+  {
+    if (position >= power_cut_at && left.empty())
+    {
+      left = read_file(path);
+    }
+    std::this_thread::sleep_until(next);
+    next += std::chrono::microseconds(BLOCK_US);
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+      block[i] = sample(position + i);
+    }
+    recorder->write(block, sizeof(block));
+  }
+  recorder->stop();
+  TEST_ASSERT_EQUAL(0, recorder->dropped_bytes());
+  int recovered = recovered_samples(left, lossless);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, recovered);
+  // power_cut_at is a block boundary so that's how much had been captured
+  return power_cut_at - recovered;
+}
+
+static void check_power_cuts(bool lossless)
+{
+  random_seed = 1;
+  int worst = 0;
+  uint64_t total = 0;
+  for (int i = 0; i < POWER_CUTS; i++)
+  {
+    // anywhere after the first second, on a block boundary
+    uint32_t power_cut_at = (SAMPLE_RATE + random_number() % (RECORDING_SAMPLES - 2 * SAMPLE_RATE)) / BLOCK_SIZE * BLOCK_SIZE;
+    int lost = record_with_power_cut(lossless ? "/power.flac" : "/power.wav", lossless, power_cut_at);
+    worst = lost > worst ? lost : worst;
+    total += lost;
+  }
+  char message[120];
+  snprintf(message, sizeof(message), "%s: lost %.0f ms on average, %.0f ms at worst with a %u ms budget",
+           lossless ? "FLAC" : "WAV", 1000.0 * total / POWER_CUTS / SAMPLE_RATE, 1000.0 * worst / SAMPLE_RATE,
+           SD_RECORDER_MAX_LOSS_MS);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL(SAMPLE_RATE * SD_RECORDER_MAX_LOSS_MS / 1000, worst);
+}
+
+static void check_truncations(bool lossless)
+{
+  const char *path = lossless ? "/whole.flac" : "/whole.wav";
+  TEST_ASSERT_TRUE(recorder->start(path, SAMPLE_RATE, lossless));
+  std::vector<int16_t> samples(RECORDING_SAMPLES);
+  for (uint32_t i = 0; i < RECORDING_SAMPLES; i++)
+  {
+    samples[i] = sample(i);
+  }
+  // a block at a time so the writer keeps up
+  for (uint32_t position = 0; position < RECORDING_SAMPLES; position += FLAC_BLOCK_SIZE)
+  {
+    uint32_t count = RECORDING_SAMPLES - position < FLAC_BLOCK_SIZE ? RECORDING_SAMPLES - position : FLAC_BLOCK_SIZE;
+    recorder->write(&samples[position], count * sizeof(int16_t));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  recorder->stop();
+  std::vector<uint8_t> whole = read_file(path);
+  TEST_ASSERT_EQUAL(RECORDING_SAMPLES, recovered_samples(whole, lossless));
+  random_seed = 2;
+  int header_size = lossless ? FLAC_HEADER_SIZE : WAV_HEADER_SIZE;
+  for (int i = 0; i < TRUNCATIONS; i++)
+  {
+    size_t length = header_size + random_number() % (whole.size() - header_size);
+    std::vector<uint8_t> cut(whole.begin(), whole.begin() + length);
+    int recovered = recovered_samples(cut, lossless);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, recovered);
+    // everything up to the cut - for FLAC less the frame it went through, and it's never under half the size
+    int expected = (length - header_size) / sizeof(int16_t);
+    if (lossless)
+    {
+      TEST_ASSERT_LESS_OR_EQUAL(expected * 2, recovered);
+      TEST_ASSERT_EQUAL(0, recovered % FLAC_BLOCK_SIZE);
+    }
+    else
+    {
+      TEST_ASSERT_EQUAL(expected, recovered);
+    }
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_power_cut_wav()
+{
+  check_power_cuts(false);
+}
+
+void test_power_cut_flac()
+{
+  check_power_cuts(true);
+}
+
+void test_truncated_wav()
+{
+  check_truncations(false);
+}
+
+void test_truncated_flac()
+{
+  check_truncations(true);
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("power_cut");
+  device->select();
+  SD.begin();
+  recorder = new SdRecorder(SD, device->sd_path("").c_str());
+  recorder->begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_power_cut_wav);
+  RUN_TEST(test_power_cut_flac);
+  RUN_TEST(test_truncated_wav);
+  RUN_TEST(test_truncated_flac);
+  return UNITY_END();
+}
@@ -0,0 +1,175 @@
+// Pushes packets at the transport the way the network callbacks do and measures how many a second
+// the receive task keeps up with - run with `pio test -e native -f test_receive_rate`
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "Transport.h"
+#include "StreamMixer.h"
+#include "OutputBuffer.h"
+#include "JitterBuffer.h"
+
+#define SAMPLE_RATE 16000
+#define FRAME_SIZE 160
+#define GROUP_SIZE 5
+#define PACKET_SIZE 250
+// a minute of talking
+#define FRAME_COUNT (60 * SAMPLE_RATE / FRAME_SIZE)
+// what a busy ESP-NOW channel can deliver - 10 times the rate a single talker sends at
+#define PACED_RATE 1000
+
+static const uint8_t header[] = {0x57};
+static const uint8_t address[PACKET_ADDRESS_SIZE] = {0x02, 0, 0, 0, 0, 1};
+
+class TestTransport : public Transport
+{
+protected:
+  void send(const uint8_t *data, int length) override
+  {
+    sent.push_back(std::vector<uint8_t>(data, data + length));
+  }
+
+public:
+  std::vector<std::vector<uint8_t>> sent;
+
+  TestTransport(StreamMixer *mixer) : Transport(mixer, PACKET_SIZE)
+  {
+    set_header(sizeof(header), header);
+    set_frame_size(FRAME_SIZE);
+    set_fec_group_size(GROUP_SIZE);
+  }
+  bool begin() override
+  {
+    start_receive_task();
+    return true;
+  }
+  // what the network callbacks do - returns false if the packet was dropped
+  bool push(const std::vector<uint8_t> &packet) { return m_packet_pool->push(address, packet.data(), packet.size()); }
+};
+
+static std::vector<std::vector<uint8_t>> packets;
+static int audio_packets = 0;
+
+static void make_packets()
+{
+  StreamMixer mixer(200 * 16, SAMPLE_RATE);
+  TestTransport talker(&mixer);
+  int16_t samples[FRAME_SIZE];
+  for (int frame = 0; frame < FRAME_COUNT; frame++)
+  {
+    for (int i = 0; i < FRAME_SIZE; i++)
+    {
+      samples[i] = 4000 * sinf(2 * M_PI * 200 * (frame * FRAME_SIZE + i) / SAMPLE_RATE);
+    }
+    talker.add_samples(samples, FRAME_SIZE);
+  }
+  packets = talker.sent;
+  for (const std::vector<uint8_t> &packet : packets)
+  {
+    audio_packets += packet[sizeof(header)] == FRAME_TYPE_AUDIO;
+  }
+}
+
+// the receive task never stops so whatever it uses has to be around for good
+static TestTransport *make_listener(StreamMixer *&mixer)
+{
+  mixer = new StreamMixer(200 * 16, SAMPLE_RATE);
+  TestTransport *listener = new TestTransport(mixer);
+  listener->begin();
+  return listener;
+}
+
+// wait for the receive task to get through everything we've pushed
+static bool wait_for(JitterBuffer *jitter_buffer, int count)
+{
+  for (int i = 0; i < 10000 && (int)jitter_buffer->received() < count; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return (int)jitter_buffer->received() == count;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_callback_cost()
+{
+  StreamMixer *mixer;
+  TestTransport *listener = make_listener(mixer);
+  // time each push on its own - this is all the network stack's task has to do
+  double total_ns = 0;
+  double worst_ns = 0;
+  for (const std::vector<uint8_t> &packet : packets)
+  {
+    auto start = std::chrono::steady_clock::now();
+    bool accepted = listener->push(packet);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    total_ns += ns;
+    worst_ns = ns > worst_ns ? ns : worst_ns;
+    // the pool is full - let the receive task catch up the way a real network's gaps would
+    if (!accepted)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  char message[120];
+  snprintf(message, sizeof(message), "push: mean %.0f ns, worst %.0f ns", total_ns / packets.size(), worst_ns);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(5000, total_ns / packets.size());
+}
+
+void test_max_sustained_rate()
+{
+  StreamMixer *mixer;
+  TestTransport *listener = make_listener(mixer);
+  // push as fast as the receive task takes them - a full pool means it's behind so wait for a free buffer
+  auto start = std::chrono::steady_clock::now();
+  for (const std::vector<uint8_t> &packet : packets)
+  {
+    while (!listener->push(packet))
+    {
+      std::this_thread::yield();
+    }
+  }
+  JitterBuffer *jitter_buffer = mixer->output_buffer(0)->jitter_buffer();
+  TEST_ASSERT_TRUE(wait_for(jitter_buffer, audio_packets));
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double rate = packets.size() / seconds;
+  char message[120];
+  snprintf(message, sizeof(message), "%u packets in %.3f s - %.0f packets a second", (unsigned)packets.size(), seconds, rate);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(0, jitter_buffer->lost());
+  TEST_ASSERT_GREATER_THAN(10 * PACED_RATE, rate);
+}
+
+void test_paced_rate_drops_nothing()
+{
+  StreamMixer *mixer;
+  TestTransport *listener = make_listener(mixer);
+  // a second's worth at the paced rate
+  int count = PACED_RATE < (int)packets.size() ? PACED_RATE : packets.size();
+  auto next = std::chrono::steady_clock::now();
+  int expected_audio = 0;
+  for (int i = 0; i < count; i++)
+  {
+    std::this_thread::sleep_until(next);
+    next += std::chrono::microseconds(1000000 / PACED_RATE);
+    listener->push(packets[i]);
+    expected_audio += packets[i][sizeof(header)] == FRAME_TYPE_AUDIO;
+  }
+  JitterBuffer *jitter_buffer = mixer->output_buffer(0)->jitter_buffer();
+  TEST_ASSERT_TRUE(wait_for(jitter_buffer, expected_audio));
+  TEST_ASSERT_EQUAL(0, listener->receive_dropped());
+}
+
+int main(int argc, char **argv)
+{
+  make_packets();
+  UNITY_BEGIN();
+  RUN_TEST(test_callback_cost);
+  RUN_TEST(test_max_sustained_rate);
+  RUN_TEST(test_paced_rate_drops_nothing);
+  return UNITY_END();
+}
@@ -0,0 +1,226 @@
+// Records through a simulated slow SD card and checks the capture side never waits for it, that the
+// writes land on block boundaries and that every file comes out whole - run with
+// `pio test -e native -f test_sd_recorder`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "NativeDevice.h"
+#include "SdRecorder.h"
+
+#define SAMPLE_RATE 16000
+// what the transmit loop reads from the microphone in one go
+#define BLOCK_SIZE 128
+#define BLOCK_US (1000000 * BLOCK_SIZE / SAMPLE_RATE)
+// the tests that don't time anything record faster than real time
+#define SPEED_UP 16
+#define SECTOR_SIZE 512
+
+static NativeDevice *device;
+// the writer task never stops so there's one recorder for all the tests
+static SdRecorder *recorder;
+
+static int16_t sample(uint32_t i)
+{
+  return (i * 7919) ^ (i >> 3);
+}
+
+// what we expect to find in the file - the samples in order after a correct header
+static void check_recording(const char *path, uint32_t samples)
+{
+  FILE *file = fopen(device->sd_path(path).c_str(), "rb");
+  TEST_ASSERT_NOT_NULL(file);
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  // trimmed back to the end of the audio
+  TEST_ASSERT_EQUAL(WAV_HEADER_SIZE + samples * sizeof(int16_t), size);
+  uint8_t header[WAV_HEADER_SIZE];
+  uint8_t expected_header[WAV_HEADER_SIZE];
+  TEST_ASSERT_EQUAL(WAV_HEADER_SIZE, fread(header, 1, WAV_HEADER_SIZE, file));
+  SdRecorder::make_wav_header(expected_header, SAMPLE_RATE, samples * sizeof(int16_t));
+  TEST_ASSERT_EQUAL_MEMORY(expected_header, header, WAV_HEADER_SIZE);
+  std::vector<int16_t> data(samples);
+  TEST_ASSERT_EQUAL(samples, fread(data.data(), sizeof(int16_t), samples, file));
+  uint32_t errors = 0;
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    errors += data[i] != sample(i);
+  }
+  TEST_ASSERT_EQUAL(0, errors);
+  fclose(file);
+}
+
+struct Capture
+{
+  double mean_us;
+  double worst_us;
+};
+
+// feeds the recorder a block at a time the way the transmit loop does, speed_up times faster than real
+// time, and times every write
+static Capture capture(uint32_t samples, int block_size = BLOCK_SIZE, int speed_up = 1)
+{
+  int16_t block[SAMPLE_RATE];
+  double total_us = 0;
+  double worst_us = 0;
+  int blocks = 0;
+  auto next = std::chrono::steady_clock::now();
+  for (uint32_t position = 0; position < samples; position += block_size)
+  {
+    std::this_thread::sleep_until(next);
+    next += std::chrono::microseconds(1000000ll * block_size / SAMPLE_RATE / speed_up);
+    int count = samples - position < (uint32_t)block_size ? samples - position : block_size;
+    for (int i = 0; i < count; i++)
+    {
+      block[i] = sample(position + i);
+    }
+    auto start = std::chrono::steady_clock::now();
+    recorder->write(block, count * sizeof(int16_t));
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    total_us += us;
+    worst_us = us > worst_us ? us : worst_us;
+    blocks++;
+  }
+  return Capture{total_us / blocks, worst_us};
+}
+
+static void set_card(uint32_t write_us, uint32_t us_per_kb, int stall_every, uint32_t stall_us)
+{
+  NativeDevice::SdCard &card = device->sd_card();
+  card.write_us = write_us;
+  card.us_per_kb = us_per_kb;
+  card.stall_every = stall_every;
+  card.stall_us = stall_us;
+  card.writes = 0;
+  card.unaligned_writes = 0;
+  card.extends = 0;
+}
+
+void setUp()
+{
+  set_card(0, 0, 0, 0);
+}
+
+void tearDown() {}
+
+void test_recording_is_whole()
+{
+  // an odd length so the last block is part filled
+  uint32_t samples = 3 * SAMPLE_RATE + 1234;
+  TEST_ASSERT_TRUE(recorder->start("/whole.wav", SAMPLE_RATE));
+  // in uneven pieces
+  capture(samples, 333, SPEED_UP);
+  recorder->stop();
+  TEST_ASSERT_EQUAL(0, recorder->dropped_bytes());
+  check_recording("/whole.wav", samples);
+}
+
+void test_writes_fill_whole_blocks()
+{
+  uint32_t samples = 10 * SAMPLE_RATE;
+  TEST_ASSERT_TRUE(recorder->start("/aligned.wav", SAMPLE_RATE));
+  capture(samples, BLOCK_SIZE, SPEED_UP);
+  recorder->stop();
+  TEST_ASSERT_EQUAL(0, recorder->dropped_bytes());
+  check_recording("/aligned.wav", samples);
+  NativeDevice::SdCard &card = device->sd_card();
+  char message[120];
+  snprintf(message, sizeof(message), "%u writes, %u starting part way into a sector, the file grew %u times",
+           card.writes.load(), card.unaligned_writes.load(), card.extends.load());
+  TEST_MESSAGE(message);
+  // only the first block, which shares its sector with the header
+  TEST_ASSERT_EQUAL(1, card.unaligned_writes);
+  // once for the header then an extent at a time rather than every block
+  uint32_t size = WAV_HEADER_SIZE + samples * sizeof(int16_t);
+  TEST_ASSERT_EQUAL(1 + (size + SD_RECORDER_EXTENT_SIZE - 1) / SD_RECORDER_EXTENT_SIZE, card.extends);
+}
+
+void test_slow_card_never_stalls_capture()
+{
+  // 3 ms a write plus 0.5 ms a KB, and every 16th write the card goes away for 300 ms to erase
+  set_card(3000, 500, 16, 300000);
+  uint32_t samples = 5 * SAMPLE_RATE;
+  TEST_ASSERT_TRUE(recorder->start("/slow.wav", SAMPLE_RATE));
+  Capture result = capture(samples);
+  auto stop_start = std::chrono::steady_clock::now();
+  recorder->stop();
+  double stop_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stop_start).count();
+  char message[160];
+  snprintf(message, sizeof(message), "capture write: mean %.1f us, worst %.1f us (%d us budget), %u card writes, stop took %.0f ms",
+           result.mean_us, result.worst_us, BLOCK_US, device->sd_card().writes.load(), stop_ms);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(0, recorder->dropped_bytes());
+  TEST_ASSERT_LESS_THAN(BLOCK_US / 10, result.worst_us);
+  check_recording("/slow.wav", samples);
+}
+
+void test_card_too_slow_drops_without_stalling()
+{
+  // longer than all the blocks put together can cover
+  set_card(3000, 500, 4, 2000000);
+  uint32_t samples = 3 * SAMPLE_RATE;
+  TEST_ASSERT_TRUE(recorder->start("/stalled.wav", SAMPLE_RATE));
+  Capture result = capture(samples);
+  recorder->stop();
+  char message[120];
+  snprintf(message, sizeof(message), "capture write: worst %.1f us, dropped %u bytes", result.worst_us, recorder->dropped_bytes());
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(0, recorder->dropped_bytes());
+  TEST_ASSERT_LESS_THAN(BLOCK_US / 10, result.worst_us);
+  // what did make it is still a valid file
+  TEST_ASSERT_EQUAL(samples * sizeof(int16_t) - recorder->dropped_bytes(), recorder->bytes_written());
+}
+
+void test_stop_without_waiting()
+{
+  // recordings started and stopped faster than the card can keep up with
+  set_card(20000, 0, 0, 0);
+  const int recordings = 8;
+  uint32_t samples = SAMPLE_RATE / 4;
+  std::vector<int16_t> data(samples);
+  for (uint32_t i = 0; i < samples; i++)
+  {
+    data[i] = sample(i);
+  }
+  char path[32];
+  for (int i = 0; i < recordings; i++)
+  {
+    snprintf(path, sizeof(path), "/quick%d.wav", i);
+    TEST_ASSERT_TRUE(recorder->start(path, SAMPLE_RATE));
+    recorder->write(data.data(), samples * sizeof(int16_t));
+    recorder->stop(false);
+  }
+  // waiting for the last one waits for all of them
+  recorder->stop();
+  // the recorder had no free blocks for some of them, but every one that was opened was closed properly
+  int recorded = 0;
+  for (int i = 0; i < recordings; i++)
+  {
+    snprintf(path, sizeof(path), "/quick%d.wav", i);
+    if (SD.exists(path))
+    {
+      check_recording(path, samples);
+      recorded++;
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(0, recorded);
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("recorder");
+  device->select();
+  SD.begin();
+  recorder = new SdRecorder(SD, device->sd_path("").c_str());
+  recorder->begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_recording_is_whole);
+  RUN_TEST(test_writes_fill_whole_blocks);
+  RUN_TEST(test_slow_card_never_stalls_capture);
+  RUN_TEST(test_card_too_slow_drops_without_stalling);
+  RUN_TEST(test_stop_without_waiting);
+  return UNITY_END();
+}
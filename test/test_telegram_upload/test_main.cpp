@@ -0,0 +1,244 @@
+// Sends recordings to a local stand-in for Telegram the way sendAudioFileToTelegram does - a multipart
+// form with the WAV file streamed off the SD card - and checks what arrives, what happens when the
+// connection can't be made or the server says no, and how long an upload takes and how much memory it
+// needs per MB - run with `pio test -e native -f test_telegram_upload`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <malloc.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include "NativeDevice.h"
+#include "NativeHttpServer.h"
+#include "HttpConnections.h"
+#include "FileRequestStream.h"
+
+#define TELEGRAM_HOST "api.telegram.org"
+#define TELEGRAM_URL "https://" TELEGRAM_HOST "/bottest/sendAudio"
+#define UNREACHABLE_HOST "unreachable.example.com"
+#define BOUNDARY "----ESP32AudioBoundary"
+#define CHAT_ID "1234"
+#define RESPONSE "{\"ok\":true,\"result\":{\"message_id\":1}}"
+#define ERROR_RESPONSE "{\"ok\":false,\"error_code\":400,\"description\":\"Bad Request: chat not found\"}"
+
+static NativeDevice *device;
+static NativeHttpServer *server;
+static std::atomic<size_t> peak_heap;
+static std::atomic<bool> refuse;
+
+static size_t heap_in_use()
+{
+  return mallinfo2().uordblks;
+}
+
+static std::string make_recording(const char *path, size_t size)
+{
+  std::string data(size, 0);
+  for (size_t i = 0; i < size; i++)
+  {
+    data[i] = (i * 7919) ^ (i >> 5);
+  }
+  File file = SD.open(path, FILE_WRITE);
+  file.write((const uint8_t *)data.data(), data.size());
+  file.close();
+  return data;
+}
+
+static String form_prefix(const String &file_name)
+{
+  return "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"chat_id\"\r\n\r\n" CHAT_ID "\r\n"
+         "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"caption\"\r\n\r\n"
+         "Audio file: " + file_name + "\r\n"
+         "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"audio\"; filename=\"" + file_name + "\"\r\n"
+         "Content-Type: audio/wav\r\n\r\n";
+}
+
+static const char *FORM_SUFFIX = "\r\n--" BOUNDARY "--\r\n";
+
+// sendAudioFileToTelegram without the Application around it - returns the HTTP code and the response
+static int send_audio(HttpConnectionManager &connections, const char *url, const char *path, String &response)
+{
+  File file = SD.open(path);
+  HttpConnection &connection = connections.connection(url);
+  if (!connection.begin(url))
+  {
+    file.close();
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  HTTPClient &http = connection.http();
+  http.addHeader("Content-Type", "multipart/form-data; boundary=" BOUNDARY);
+  FileRequestStream body(form_prefix(String(path).substring(1)), file, false, FORM_SUFFIX);
+  int code = http.sendRequest("POST", &body, body.size());
+  if (code > 0)
+  {
+    response = http.getString();
+    connection.end();
+  }
+  else
+  {
+    connection.abort();
+  }
+  file.close();
+  return code;
+}
+
+void setUp()
+{
+  server->set_keep_bodies(true);
+  server->set_on_body(nullptr);
+  refuse = false;
+}
+
+void tearDown() {}
+
+void test_multipart_body()
+{
+  HttpConnectionManager connections;
+  // empty, a TCP buffer's worth either side and a few seconds of audio
+  const size_t sizes[] = {0, 1, 1459, 1460, 1461, 100001};
+  for (size_t size : sizes)
+  {
+    std::string data = make_recording("/audio.wav", size);
+    String response;
+    TEST_ASSERT_EQUAL(HTTP_CODE_OK, send_audio(connections, TELEGRAM_URL, "/audio.wav", response));
+    TEST_ASSERT_EQUAL_STRING(RESPONSE, response.c_str());
+    NativeHttpServer::Request request = server->received().back();
+    std::string expected = std::string(form_prefix("audio.wav").c_str()) + data + FORM_SUFFIX;
+    TEST_ASSERT_EQUAL_STRING("POST", request.method.c_str());
+    TEST_ASSERT_EQUAL_STRING("/bottest/sendAudio", request.path.c_str());
+    TEST_ASSERT_EQUAL_STRING("multipart/form-data; boundary=" BOUNDARY, request.headers["content-type"].c_str());
+    TEST_ASSERT_FALSE(request.chunked);
+    TEST_ASSERT_EQUAL(expected.size(), strtoul(request.headers["content-length"].c_str(), NULL, 10));
+    TEST_ASSERT_TRUE(expected == request.body);
+  }
+  TEST_ASSERT_EQUAL(1, connections.get(0).handshakes());
+}
+
+void test_connect_failure()
+{
+  // nothing is listening there - begin has to say so rather than hand back a client that isn't connected
+  HttpConnectionManager connections;
+  make_recording("/audio.wav", 1000);
+  HttpConnection &connection = connections.connection("https://" UNREACHABLE_HOST "/bottest/sendAudio");
+  TEST_ASSERT_FALSE(connection.begin("https://" UNREACHABLE_HOST "/bottest/sendAudio"));
+  TEST_ASSERT_FALSE(connection.is_open());
+  TEST_ASSERT_EQUAL(0, connection.handshakes());
+}
+
+void test_error_response_is_read()
+{
+  // the error's body is read so the next request on the connection gets its own answer
+  HttpConnectionManager connections;
+  make_recording("/audio.wav", 5000);
+  String response;
+  refuse = true;
+  TEST_ASSERT_EQUAL(400, send_audio(connections, TELEGRAM_URL, "/audio.wav", response));
+  TEST_ASSERT_EQUAL_STRING(ERROR_RESPONSE, response.c_str());
+  refuse = false;
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, send_audio(connections, TELEGRAM_URL, "/audio.wav", response));
+  TEST_ASSERT_EQUAL_STRING(RESPONSE, response.c_str());
+  TEST_ASSERT_EQUAL(1, connections.get(0).handshakes());
+}
+
+void test_file_cut_short()
+{
+  // the file is shorter than the Content-Length by the time it's read - the connection is closed
+  // rather than left with the server waiting for the rest of the body
+  HttpConnectionManager connections;
+  make_recording("/short.wav", 50000);
+  File file = SD.open("/short.wav");
+  HttpConnection &connection = connections.connection(TELEGRAM_URL);
+  TEST_ASSERT_TRUE(connection.begin(TELEGRAM_URL));
+  FileRequestStream body(form_prefix("short.wav"), file, false, FORM_SUFFIX);
+  make_recording("/short.wav", 10000);
+  TEST_ASSERT_EQUAL(HTTPC_ERROR_SEND_PAYLOAD_FAILED, connection.http().sendRequest("POST", &body, body.size()));
+  connection.abort();
+  file.close();
+  TEST_ASSERT_FALSE(connection.is_open());
+  // and the next one starts again on a new connection
+  make_recording("/audio.wav", 1000);
+  String response;
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, send_audio(connections, TELEGRAM_URL, "/audio.wav", response));
+  TEST_ASSERT_EQUAL(2, connection.handshakes());
+}
+
+// sends a recording of size bytes - returns how long it took and the most the heap grew by
+static void measure_upload(size_t size, uint32_t &elapsed_ms, size_t &peak)
+{
+  make_recording("/long.wav", size);
+  HttpConnectionManager connections;
+  String response;
+  // open the connection first so it isn't counted
+  send_audio(connections, TELEGRAM_URL, "/long.wav", response);
+  size_t baseline = heap_in_use();
+  peak_heap = baseline;
+  server->set_keep_bodies(false);
+  server->set_on_body([](const NativeHttpServer::Request &request, size_t received)
+                      {
+                        size_t in_use = heap_in_use();
+                        if (in_use > peak_heap)
+                        {
+                          peak_heap = in_use;
+                        }
+                      });
+  auto start = std::chrono::steady_clock::now();
+  TEST_ASSERT_EQUAL(HTTP_CODE_OK, send_audio(connections, TELEGRAM_URL, "/long.wav", response));
+  elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  server->set_on_body(nullptr);
+  peak = peak_heap - baseline;
+}
+
+void test_time_and_heap_per_mb()
+{
+  const size_t megabytes[] = {1, 4, 16};
+  size_t peaks[3];
+  for (int i = 0; i < 3; i++)
+  {
+    uint32_t elapsed_ms;
+    measure_upload(megabytes[i] * 1024 * 1024, elapsed_ms, peaks[i]);
+    char message[120];
+    snprintf(message, sizeof(message), "%zu MB: %u ms (%u ms per MB), heap grew by %zu bytes (%zu bytes per MB)",
+             megabytes[i], elapsed_ms, elapsed_ms / (uint32_t)megabytes[i], peaks[i], peaks[i] / megabytes[i]);
+    TEST_MESSAGE(message);
+  }
+  // a chunk buffer and the form around the file - the same however long the recording
+  TEST_ASSERT_LESS_THAN(16 * 1024, peaks[2]);
+  TEST_ASSERT_LESS_THAN(peaks[0] + 4 * 1024, peaks[2]);
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("telegram_upload");
+  device->select();
+  SD.begin();
+  server = new NativeHttpServer([](const NativeHttpServer::Request &request)
+                                {
+                                  NativeHttpServer::Response response;
+                                  if (refuse)
+                                  {
+                                    response.status = 400;
+                                    response.body = ERROR_RESPONSE;
+                                  }
+                                  else
+                                  {
+                                    response.body = RESPONSE;
+                                  }
+                                  return response;
+                                });
+  server->route(TELEGRAM_HOST);
+  // nothing listens on port 1
+  native_route_host(UNREACHABLE_HOST, 1);
+  UNITY_BEGIN();
+  RUN_TEST(test_multipart_body);
+  RUN_TEST(test_connect_failure);
+  RUN_TEST(test_error_response_is_read);
+  RUN_TEST(test_file_cut_short);
+  RUN_TEST(test_time_and_heap_per_mb);
+  int result = UNITY_END();
+  delete server;
+  return result;
+}
@@ -0,0 +1,271 @@
+// Trims a corpus of recordings with speech in known places - phrases over background noise with short and
+// long pauses, speech right up to the ends and none at all - and checks each part starts and ends where it
+// should and holds exactly the audio from there, in WAV and FLAC, and reports what each one saves - run with
+// `pio test -e native -f test_trim_corpus`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "NativeDevice.h"
+#include "FlacCodec.h"
+#include "RecordingTrimmer.h"
+#include "VoiceActivityDetector.h"
+
+#define SAMPLE_RATE 16000
+#define SAMPLES_PER_MS (SAMPLE_RATE / 1000)
+// the detector's blocks in ms - the corpus puts speech on block boundaries so the trim points are exact
+#define BLOCK_MS (TRIM_VAD_BLOCK_SIZE / SAMPLES_PER_MS)
+// the last speech block is followed by this much hangover
+#define HANGOVER_MS ((VAD_HANGOVER_BLOCKS - 1) * BLOCK_MS)
+// words are syllables of 25 blocks with 8 quiet blocks between them so the noise floor stays down
+#define SYLLABLE_BLOCKS 25
+#define GAP_BLOCKS 8
+#define MAX_PHRASES 4
+
+static_assert(TRIM_LEAD_IN_MS == 200 && HANGOVER_MS == 232, "the trim points below are worked out for these");
+
+struct Span
+{
+  uint32_t start_ms;
+  uint32_t end_ms;
+};
+
+struct Recording
+{
+  const char *name;
+  uint32_t length_ms;
+  bool split;
+  int phrase_count;
+  Span phrases[MAX_PHRASES];
+  // what should be left - a phrase starts TRIM_LEAD_IN_MS early and ends HANGOVER_MS late
+  int part_count;
+  Span parts[MAX_PHRASES];
+};
+
+static const Recording corpus[] = {
+    {"one phrase", 4000, true, 1, {{1000, 2504}}, 1, {{800, 2736}}},
+    {"short pauses stay in", 6000, true, 3, {{800, 2000}, {2600, 3600}, {4200, 5000}}, 1, {{600, 5232}}},
+    // the pause is over TRIM_SPLIT_PAUSE_MS but not once the hangover has had its share
+    {"1.6 s pause after 12 s", 16000, true, 2, {{400, 12400}, {14000, 15200}}, 1, {{200, 15432}}},
+    {"2 s pause after 12 s", 20000, true, 2, {{400, 12400}, {14400, 19000}}, 2, {{200, 12632}, {14200, 19232}}},
+    {"2 s pause after 5 s", 14000, true, 2, {{400, 5400}, {7400, 12400}}, 1, {{200, 12632}}},
+    {"2 s pause not split", 20000, false, 2, {{400, 12400}, {14400, 19000}}, 1, {{200, 19232}}},
+    {"speech from the start", 5000, true, 1, {{0, 3000}}, 1, {{0, 3232}}},
+    {"speech to the end", 3000, true, 1, {{1000, 3000}}, 1, {{800, 3000}}},
+};
+
+static NativeDevice *device;
+static uint32_t random_seed = 1;
+
+static int16_t random_sample(int level)
+{
+  random_seed = random_seed * 1664525 + 1013904223;
+  return (int32_t)(int16_t)(random_seed >> 16) * level / 32768;
+}
+
+// background noise well under the detector's floor with voiced syllables where the phrases are
+static std::vector<int16_t> make_audio(const Recording &recording)
+{
+  std::vector<int16_t> audio(recording.length_ms * SAMPLES_PER_MS);
+  for (uint32_t i = 0; i < audio.size(); i++)
+  {
+    audio[i] = random_sample(80);
+  }
+  for (int p = 0; p < recording.phrase_count; p++)
+  {
+    uint32_t first_block = recording.phrases[p].start_ms / BLOCK_MS;
+    uint32_t end_block = recording.phrases[p].end_ms / BLOCK_MS;
+    for (uint32_t block = first_block; block < end_block; block++)
+    {
+      // the last block is always voiced so the phrase ends where it says
+      if ((block - first_block) % (SYLLABLE_BLOCKS + GAP_BLOCKS) >= SYLLABLE_BLOCKS && block != end_block - 1)
+      {
+        continue;
+      }
+      for (uint32_t i = block * TRIM_VAD_BLOCK_SIZE; i < (block + 1) * TRIM_VAD_BLOCK_SIZE; i++)
+      {
+        float t = (float)i / SAMPLE_RATE;
+        float voice = sinf(2 * M_PI * 140 * t) + 0.5f * sinf(2 * M_PI * 280 * t) + 0.25f * sinf(2 * M_PI * 420 * t);
+        audio[i] += 3000 * voice;
+      }
+    }
+  }
+  return audio;
+}
+
+static void write_wav(const char *path, const std::vector<int16_t> &audio)
+{
+  File file = SD.open(path, FILE_WRITE);
+  uint8_t header[WAV_HEADER_SIZE];
+  SdRecorder::make_wav_header(header, SAMPLE_RATE, audio.size() * sizeof(int16_t));
+  file.write(header, sizeof(header));
+  file.write((const uint8_t *)audio.data(), audio.size() * sizeof(int16_t));
+  file.close();
+}
+
+static void write_flac(const char *path, const std::vector<int16_t> &audio)
+{
+  FlacEncoder *encoder = new FlacEncoder();
+  std::vector<uint8_t> frame(FLAC_MAX_FRAME_SIZE);
+  File file = SD.open(path, FILE_WRITE);
+  uint8_t header[FLAC_HEADER_SIZE];
+  FlacEncoder::write_header(header, SAMPLE_RATE, audio.size(), 0, 0);
+  file.write(header, FLAC_HEADER_SIZE);
+  for (size_t position = 0; position < audio.size(); position += FLAC_BLOCK_SIZE)
+  {
+    int count = audio.size() - position < FLAC_BLOCK_SIZE ? audio.size() - position : FLAC_BLOCK_SIZE;
+    file.write(frame.data(), encoder->encode(&audio[position], count, frame.data()));
+  }
+  file.close();
+  delete encoder;
+}
+
+static std::vector<int16_t> read_wav(const char *path)
+{
+  File file = SD.open(path);
+  TEST_ASSERT_TRUE(file);
+  uint8_t header[WAV_HEADER_SIZE];
+  TEST_ASSERT_EQUAL(WAV_HEADER_SIZE, file.read(header, sizeof(header)));
+  uint32_t data_size = header[40] | (header[41] << 8) | (header[42] << 16) | ((uint32_t)header[43] << 24);
+  TEST_ASSERT_EQUAL(file.size() - WAV_HEADER_SIZE, data_size);
+  std::vector<int16_t> audio(data_size / sizeof(int16_t));
+  TEST_ASSERT_EQUAL(data_size, file.read((uint8_t *)audio.data(), data_size));
+  file.close();
+  return audio;
+}
+
+static std::vector<int16_t> read_flac(const char *path)
+{
+  File file = SD.open(path);
+  TEST_ASSERT_TRUE(file);
+  FlacDecoder *decoder = new FlacDecoder(file);
+  TEST_ASSERT_TRUE(decoder->begin());
+  TEST_ASSERT_EQUAL(SAMPLE_RATE, decoder->sample_rate());
+  std::vector<int16_t> audio(decoder->total_samples());
+  TEST_ASSERT_EQUAL(audio.size(), decoder->read(audio.data(), audio.size()));
+  int16_t extra;
+  TEST_ASSERT_EQUAL(0, decoder->read(&extra, 1));
+  delete decoder;
+  file.close();
+  return audio;
+}
+
+static size_t file_size(const char *path)
+{
+  File file = SD.open(path);
+  size_t size = file.size();
+  file.close();
+  return size;
+}
+
+// trim one recording from the corpus and check every part against where it should have come from
+static void check_recording(const Recording &recording, bool lossless)
+{
+  std::vector<int16_t> audio = make_audio(recording);
+  const char *path = lossless ? "/corpus.flac" : "/corpus.wav";
+  if (lossless)
+  {
+    write_flac(path, audio);
+  }
+  else
+  {
+    write_wav(path, audio);
+  }
+  size_t original_size = file_size(path);
+
+  RecordingTrimmer trimmer(SD);
+  char paths[TRIM_MAX_SEGMENTS][SD_RECORDER_MAX_PATH];
+  int parts = trimmer.process(path, recording.split, paths);
+  TEST_ASSERT_EQUAL_MESSAGE(recording.part_count, parts, recording.name);
+
+  char points[120] = "";
+  size_t trimmed_size = 0;
+  for (int i = 0; i < parts; i++)
+  {
+    TEST_ASSERT_FALSE_MESSAGE(parts == 1 && strcmp(paths[0], path) != 0, recording.name);
+    std::vector<int16_t> part = lossless ? read_flac(paths[i]) : read_wav(paths[i]);
+    uint32_t start = recording.parts[i].start_ms * SAMPLES_PER_MS;
+    uint32_t end = recording.parts[i].end_ms * SAMPLES_PER_MS;
+    TEST_ASSERT_EQUAL_MESSAGE(end - start, part.size(), recording.name);
+    TEST_ASSERT_TRUE_MESSAGE(std::equal(part.begin(), part.end(), audio.begin() + start), recording.name);
+    trimmed_size += file_size(paths[i]);
+    snprintf(points + strlen(points), sizeof(points) - strlen(points), " %u-%u", recording.parts[i].start_ms, recording.parts[i].end_ms);
+    SD.remove(paths[i]);
+  }
+  if (parts > 1)
+  {
+    TEST_ASSERT_FALSE_MESSAGE(SD.exists(path), recording.name);
+  }
+
+  char message[200];
+  snprintf(message, sizeof(message), "%s %s: %u ms kept as%s ms, %zu bytes down to %zu",
+           recording.name, lossless ? "FLAC" : "WAV", recording.length_ms, points, original_size, trimmed_size);
+  TEST_MESSAGE(message);
+}
+
+void setUp()
+{
+  random_seed = 1;
+}
+
+void tearDown() {}
+
+void test_wav_trim_points()
+{
+  for (const Recording &recording : corpus)
+  {
+    check_recording(recording, false);
+  }
+}
+
+void test_flac_trim_points()
+{
+  // re-encoded rather than copied so the parts have to decode to the same samples
+  for (const Recording &recording : corpus)
+  {
+    check_recording(recording, true);
+  }
+}
+
+void test_speech_throughout_is_left_alone()
+{
+  // there's less than TRIM_MIN_SAVING_MS to take off so the file isn't touched
+  Recording recording = {"speech throughout", 5000, true, 1, {{96, 4904}}};
+  std::vector<int16_t> audio = make_audio(recording);
+  write_wav("/throughout.wav", audio);
+  RecordingTrimmer trimmer(SD);
+  char paths[TRIM_MAX_SEGMENTS][SD_RECORDER_MAX_PATH];
+  TEST_ASSERT_EQUAL(1, trimmer.process("/throughout.wav", true, paths));
+  TEST_ASSERT_EQUAL_STRING("/throughout.wav", paths[0]);
+  std::vector<int16_t> kept = read_wav("/throughout.wav");
+  TEST_ASSERT_EQUAL(audio.size(), kept.size());
+  TEST_ASSERT_EQUAL_INT16_ARRAY(audio.data(), kept.data(), audio.size());
+  SD.remove("/throughout.wav");
+}
+
+void test_silence()
+{
+  // nothing but background noise - the caller throws it away
+  Recording recording = {"silence", 3000, true, 0};
+  write_wav("/silence.wav", make_audio(recording));
+  RecordingTrimmer trimmer(SD);
+  char paths[TRIM_MAX_SEGMENTS][SD_RECORDER_MAX_PATH];
+  TEST_ASSERT_EQUAL(0, trimmer.process("/silence.wav", true, paths));
+  TEST_ASSERT_TRUE(SD.exists("/silence.wav"));
+  SD.remove("/silence.wav");
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("trim_corpus");
+  device->select();
+  SD.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_wav_trim_points);
+  RUN_TEST(test_flac_trim_points);
+  RUN_TEST(test_speech_throughout_is_left_alone);
+  RUN_TEST(test_silence);
+  return UNITY_END();
+}
@@ -0,0 +1,257 @@
+// Journals recordings the way the recorder and the upload task do - recordings added from one thread while
+// another works through them - and checks what comes back after a reboot, that recordings we give up on
+// are kept along with their transcriptions and how long adding one takes - run with
+// `pio test -e native -f test_upload_journal`
+#include <Arduino.h>
+#include <unity.h>
+#include <SD.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "NativeDevice.h"
+#include "UploadJournal.h"
+
+#define JOURNAL_PATH "/uploads.log"
+#define CONCURRENT_RECORDINGS 200
+
+static NativeDevice *device;
+
+static std::string read_journal()
+{
+  std::string contents;
+  File file = SD.open(JOURNAL_PATH);
+  if (file)
+  {
+    uint8_t buffer[256];
+    int read;
+    while ((read = file.read(buffer, sizeof(buffer))) > 0)
+    {
+      contents.append((const char *)buffer, read);
+    }
+    file.close();
+  }
+  return contents;
+}
+
+static void make_recording(const char *path)
+{
+  File file = SD.open(path, FILE_WRITE);
+  file.write((const uint8_t *)"RIFF", 4);
+  file.close();
+}
+
+// give up on an entry the way the upload task would after it keeps failing
+static void fail(UploadJournal &journal, UploadEntry *entry)
+{
+  for (int i = 1; i < UPLOAD_MAX_ATTEMPTS; i++)
+  {
+    TEST_ASSERT_TRUE(journal.retry(entry));
+  }
+  TEST_ASSERT_FALSE(journal.retry(entry));
+}
+
+void setUp()
+{
+  SD.remove(JOURNAL_PATH);
+}
+
+void tearDown() {}
+
+void test_recording_survives_reboot()
+{
+  make_recording("/a.wav");
+  make_recording("/b.wav");
+  {
+    UploadJournal journal(SD, JOURNAL_PATH);
+    journal.begin();
+    // straight from the recorder and a part the trimmer has made
+    journal.add("/a.wav");
+    UploadEntry *b = journal.add("/b.wav", UPLOAD_TRIMMED);
+    journal.mark(b, UPLOAD_TELEGRAM_SENT);
+  }
+  UploadJournal journal(SD, JOURNAL_PATH);
+  journal.begin();
+  TEST_ASSERT_EQUAL(2, journal.pending());
+  // the one straight from the recorder comes round first to be trimmed...
+  unsigned long wait_ms;
+  UploadEntry *recorded = journal.next(&wait_ms);
+  TEST_ASSERT_EQUAL_STRING("/a.wav", recorded->path);
+  TEST_ASSERT_EQUAL(0, recorded->state);
+  // ...and isn't handed out with the trimmed ones until it has been
+  UploadEntry *entries[2];
+  TEST_ASSERT_EQUAL(1, journal.collect(UPLOAD_TRANSCRIBED, entries, 2));
+  TEST_ASSERT_EQUAL_STRING("/b.wav", entries[0]->path);
+  TEST_ASSERT_EQUAL(UPLOAD_TRIMMED | UPLOAD_TELEGRAM_SENT, entries[0]->state);
+}
+
+void test_trimmed_in_place()
+{
+  // adding a trimmed recording that's already there marks it trimmed rather than adding it twice
+  make_recording("/a.wav");
+  UploadJournal journal(SD, JOURNAL_PATH);
+  journal.begin();
+  UploadEntry *recorded = journal.add("/a.wav");
+  TEST_ASSERT_TRUE(recorded == journal.add("/a.wav", UPLOAD_TRIMMED));
+  TEST_ASSERT_EQUAL(1, journal.pending());
+  TEST_ASSERT_EQUAL(UPLOAD_TRIMMED, recorded->state);
+  TEST_ASSERT_EQUAL_STRING("A /a.wav\nS 8 /a.wav\n", read_journal().c_str());
+}
+
+void test_giving_up_keeps_the_recording()
+{
+  make_recording("/a.wav");
+  {
+    UploadJournal journal(SD, JOURNAL_PATH);
+    journal.begin();
+    UploadEntry *entry = journal.add("/a.wav", UPLOAD_TRIMMED);
+    journal.mark(entry, UPLOAD_TELEGRAM_SENT);
+    TEST_ASSERT_TRUE(journal.save_transcript(entry, "olá mundo"));
+    journal.mark(entry, UPLOAD_TRANSCRIBED);
+    fail(journal, entry);
+    // it's not handed out again but it's still there with its transcription
+    unsigned long wait_ms;
+    TEST_ASSERT_NULL(journal.next(&wait_ms));
+    UploadEntry *entries[1];
+    TEST_ASSERT_EQUAL(0, journal.collect(UPLOAD_TRANSCRIPT_SENT, entries, 1));
+    TEST_ASSERT_EQUAL(1, journal.pending());
+    TEST_ASSERT_EQUAL(1, journal.failed());
+    TEST_ASSERT_EQUAL_STRING("olá mundo", journal.load_transcript(entry).c_str());
+    TEST_ASSERT_EQUAL(std::string::npos, read_journal().find("D "));
+  }
+  // and gets another go after a reboot
+  UploadJournal journal(SD, JOURNAL_PATH);
+  journal.begin();
+  TEST_ASSERT_EQUAL(0, journal.failed());
+  unsigned long wait_ms;
+  UploadEntry *entry = journal.next(&wait_ms);
+  TEST_ASSERT_NOT_NULL(entry);
+  TEST_ASSERT_EQUAL(UPLOAD_TRIMMED | UPLOAD_TELEGRAM_SENT | UPLOAD_TRANSCRIBED, entry->state);
+  TEST_ASSERT_EQUAL_STRING("olá mundo", journal.load_transcript(entry).c_str());
+  journal.complete(entry);
+  TEST_ASSERT_FALSE(SD.exists("/a.wav.txt"));
+}
+
+void test_failed_make_way_when_full()
+{
+  UploadJournal journal(SD, JOURNAL_PATH);
+  journal.begin();
+  UploadEntry *failed = NULL;
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+  {
+    char path[32];
+    snprintf(path, sizeof(path), "/full_%d.wav", i);
+    make_recording(path);
+    UploadEntry *entry = journal.add(path, UPLOAD_TRIMMED);
+    TEST_ASSERT_NOT_NULL(entry);
+    if (i == 3)
+    {
+      journal.save_transcript(entry, "kept");
+      journal.mark(entry, UPLOAD_TRANSCRIBED);
+      failed = entry;
+    }
+  }
+  TEST_ASSERT_NULL(journal.add("/one_too_many.wav"));
+  fail(journal, failed);
+  UploadEntry *added = journal.add("/one_too_many.wav");
+  TEST_ASSERT_TRUE(added == failed);
+  TEST_ASSERT_EQUAL_STRING("/one_too_many.wav", added->path);
+  TEST_ASSERT_EQUAL(UPLOAD_JOURNAL_MAX_ENTRIES, journal.pending());
+  TEST_ASSERT_EQUAL(0, journal.failed());
+  // the journal forgets it but the files stay on the card
+  TEST_ASSERT_TRUE(SD.exists("/full_3.wav"));
+  TEST_ASSERT_TRUE(SD.exists("/full_3.wav.txt"));
+  for (int i = 0; i < UPLOAD_JOURNAL_MAX_ENTRIES; i++)
+  {
+    unsigned long wait_ms;
+    journal.complete(journal.next(&wait_ms));
+  }
+  SD.remove("/full_3.wav.txt");
+}
+
+void test_journal_starts_again_with_only_failures_left()
+{
+  make_recording("/a.wav");
+  make_recording("/b.wav");
+  UploadJournal journal(SD, JOURNAL_PATH);
+  journal.begin();
+  UploadEntry *a = journal.add("/a.wav", UPLOAD_TRIMMED);
+  UploadEntry *b = journal.add("/b.wav", UPLOAD_TRIMMED);
+  fail(journal, a);
+  journal.mark(b, UPLOAD_TELEGRAM_SENT);
+  journal.complete(b);
+  // just what's needed to bring back the failed one
+  TEST_ASSERT_EQUAL_STRING("A /a.wav\nS 88 /a.wav\n", read_journal().c_str());
+}
+
+void test_adding_while_uploading()
+{
+  // the recorder adds recordings while the upload task works through them - everything added is uploaded
+  // once and the journal is empty at the end
+  UploadJournal journal(SD, JOURNAL_PATH);
+  journal.begin();
+  std::chrono::nanoseconds add_time(0);
+  std::chrono::nanoseconds worst_add(0);
+  std::thread recorder([&]()
+                       {
+                         for (int i = 0; i < CONCURRENT_RECORDINGS; i++)
+                         {
+                           char path[32];
+                           snprintf(path, sizeof(path), "/rec_%d.wav", i);
+                           make_recording(path);
+                           auto start = std::chrono::steady_clock::now();
+                           while (!journal.add(path))
+                           {
+                             // full - wait for the upload task to catch up
+                             std::this_thread::sleep_for(std::chrono::microseconds(100));
+                             start = std::chrono::steady_clock::now();
+                           }
+                           auto elapsed = std::chrono::steady_clock::now() - start;
+                           add_time += elapsed;
+                           worst_add = std::max<std::chrono::nanoseconds>(worst_add, elapsed);
+                           std::this_thread::sleep_for(std::chrono::microseconds(50));
+                         }
+                       });
+  int uploaded = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (uploaded < CONCURRENT_RECORDINGS && std::chrono::steady_clock::now() < deadline)
+  {
+    unsigned long wait_ms;
+    UploadEntry *entry = journal.next(&wait_ms);
+    if (!entry)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    TEST_ASSERT_EQUAL(0, entry->state);
+    journal.mark(entry, UPLOAD_TRIMMED | UPLOAD_TELEGRAM_SENT);
+    journal.mark(entry, UPLOAD_TRANSCRIBED);
+    journal.mark(entry, UPLOAD_TRANSCRIPT_SENT);
+    journal.complete(entry);
+    uploaded++;
+  }
+  recorder.join();
+  TEST_ASSERT_EQUAL(CONCURRENT_RECORDINGS, uploaded);
+  TEST_ASSERT_EQUAL(0, journal.pending());
+  UploadJournal rebooted(SD, JOURNAL_PATH);
+  rebooted.begin();
+  TEST_ASSERT_EQUAL(0, rebooted.pending());
+  char message[100];
+  snprintf(message, sizeof(message), "adding a recording took %lld us on average, %lld us at worst",
+           (long long)(add_time.count() / CONCURRENT_RECORDINGS / 1000), (long long)(worst_add.count() / 1000));
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv)
+{
+  device = new NativeDevice("upload_journal");
+  device->select();
+  SD.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_recording_survives_reboot);
+  RUN_TEST(test_trimmed_in_place);
+  RUN_TEST(test_giving_up_keeps_the_recording);
+  RUN_TEST(test_failed_make_way_when_full);
+  RUN_TEST(test_journal_starts_again_with_only_failures_left);
+  RUN_TEST(test_adding_while_uploading);
+  return UNITY_END();
+}